@@ -0,0 +1,565 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "header.h"
+
+/*
+ * Object archives (--archive). An archive bundles the .ob, .ent and .ext files of many assembled sources
+ * (the members) in one file, with an index of every entry symbol, so the member that defines a symbol is
+ * found without opening (or reading) the other members. The archive is mapped to memory and used in place:
+ *
+ *      header          the magic "MZA1", the number of members, of symbols and of index slots and the size
+ *                      of the strings, as 4 bytes little endian numbers
+ *      members         the offset of the name in the strings, and the offset and the length of the .ob, the
+ *                      .ent and the .ext files in the archive, 7 numbers
+ *      index           a hash table of the entry symbols (FNV-1a, linear probing, the number of slots is a power
+ *                      of 2 and at least twice the number of symbols): the offset of the name + 1 (0 for an empty
+ *                      slot), the member and the address, 3 numbers
+ *      strings         the names, null terminated
+ *      contents        the files of the members, as they were
+ *
+ * A symbol is an entry of one member only, so looking it up gives one answer, whatever the order of the
+ * members. Resolving the externs of a program pulls in the members that define them, and then the members
+ * that their own externs need, and nothing else.
+ */
+
+#define ARCHIVE_MAGIC "MZA1"
+#define ARCHIVE_HEADER_SIZE 20
+#define MEMBER_SIZE 28
+#define SLOT_SIZE 12
+
+/* a member while the archive is created */
+typedef struct{
+    char *name; /* the name without the directory, points into the base name */
+    char *files[MEMBER_FILES]; /* the contents of the .ob, .ent and .ext files, NULL if there is none */
+    long lengths[MEMBER_FILES];
+} new_member_t;
+
+/* an entry symbol while the archive is created */
+typedef struct{
+    long name; /* the offset of the name in the strings */
+    long member;
+    int address;
+} new_symbol_t;
+
+static const char *member_extensions[MEMBER_FILES] = {".ob", ".ent", ".ext"};
+
+/**
+ * Read a 4 bytes little endian number.
+ */
+static long get_le32(const unsigned char *p){
+    return (long) p[0] | (long) p[1] << 8 | (long) p[2] << 16 | (long) p[3] << 24;
+}
+
+/**
+ * Write a 4 bytes little endian number.
+ */
+static void put_le32(long num, FILE *fp){
+    fputc((int) (num & 0xFF), fp);
+    fputc((int) ((num >> 8) & 0xFF), fp);
+    fputc((int) ((num >> 16) & 0xFF), fp);
+    fputc((int) ((num >> 24) & 0xFF), fp);
+}
+
+/**
+ * Hash a symbol name (FNV-1a).
+ *
+ * @param char*     name - The name.
+ *
+ * @return unsigned long - The hash, 32 bits.
+ */
+unsigned long symbol_hash(const char *name){
+    unsigned long hash = 2166136261UL;
+
+    while ( *name ) {
+        hash = ((hash ^ (unsigned char) *name++) * 16777619UL) & 0xFFFFFFFFUL;
+    }
+
+    return hash;
+}
+
+/**
+ * Add a name to the strings of a new archive.
+ *
+ * @param char**    strings - The strings.
+ * @param int*      size - The size of the strings.
+ * @param int*      capacity - The capacity of the strings.
+ * @param char*     name - The name to add.
+ *
+ * @return long - The offset of the name, -1 on memory error.
+ */
+static long add_string(char **strings, int *size, int *capacity, const char *name){
+    int offset = *size, length = (int) strlen(name) + 1;
+
+    if ( !ensure_capacity((void **) strings, capacity, *size + length, sizeof(char)) ) {
+        return -1;
+    }
+    memcpy(*strings + offset, name, (size_t) length);
+    *size += length;
+
+    return offset;
+}
+
+/**
+ * Read the files of a member, and add its entry symbols.
+ *
+ * @param new_member_t*     member - The member, its name is set.
+ * @param char*             base_name - The file name without extension.
+ * @param long              index - The index of the member.
+ * @param new_symbol_t**    symbols - The symbols of the archive.
+ * @param int*              symbols_size - The number of symbols.
+ * @param int*              symbols_capacity - The capacity of the symbols.
+ * @param char**            strings - The strings of the archive.
+ * @param int*              strings_size - The size of the strings.
+ * @param int*              strings_capacity - The capacity of the strings.
+ *
+ * @return int - 1 if everything went OK, 0 otherwise (an error is printed).
+ */
+static int read_member(new_member_t *member, char *base_name, long index, new_symbol_t **symbols, int *symbols_size,
+                       int *symbols_capacity, char **strings, int *strings_size, int *strings_capacity){
+    char name[LINE_MAX], *file_name, *line, *end;
+    int i, address;
+
+    if ( !(file_name = malloc(strlen(base_name) + 5)) ) {
+        fprintf(stderr, "Cannot allocate memory.\n");
+        return 0;
+    }
+    for ( i = 0; i < MEMBER_FILES; i++ ) {
+        sprintf(file_name, "%s%s", base_name, member_extensions[i]);
+        member->files[i] = read_whole_file(file_name, &member->lengths[i]);
+        if ( i == MEMBER_OB && !member->files[i] ) {
+            fprintf(stderr, "Cannot open file: %s\n", file_name);
+            free(file_name);
+            return 0;
+        }
+    }
+    free(file_name);
+
+    for ( line = member->files[MEMBER_ENT]; line && *line; line = *end ? end + 1 : end ) {
+        end = line + strcspn(line, "\n");
+        if ( end - line >= LINE_MAX || !read_symbol_line(line, name, &address) ) {
+            continue;
+        }
+        if ( !ensure_capacity((void **) symbols, symbols_capacity, *symbols_size + 1, sizeof(new_symbol_t))
+             || ((*symbols)[*symbols_size].name = add_string(strings, strings_size, strings_capacity, name)) < 0 ) {
+            fprintf(stderr, "Cannot allocate memory.\n");
+            return 0;
+        }
+        (*symbols)[*symbols_size].member = index;
+        (*symbols)[(*symbols_size)++].address = address;
+    }
+
+    return 1;
+}
+
+/**
+ * Create an archive of assembled sources.
+ *
+ * @param char*     archive_name - The name of the archive file.
+ * @param int       count - The number of sources.
+ * @param char**    base_names - The file names without extension, NAME.ob should exist.
+ *
+ * @return int - 0 if everything went OK, 1 otherwise.
+ */
+int archive_create(char *archive_name, int count, char *base_names[]){
+    new_member_t *members;
+    new_symbol_t *symbols = NULL;
+    long *slots = NULL, offset, name_offset;
+    char *strings = NULL, *name;
+    int symbols_size = 0, symbols_capacity = 0, strings_size = 0, strings_capacity = 0, ok = 1;
+    long slots_size, slot, i, j;
+    FILE *fp;
+
+    if ( !(members = calloc((size_t) count + 1, sizeof(new_member_t))) ) {
+        fprintf(stderr, "Cannot allocate memory.\n");
+        return 1;
+    }
+
+    /* the member names come first in the strings, then the symbols */
+    for ( i = 0; ok && i < count; i++ ) {
+        members[i].name = strrchr(base_names[i], '/') ? strrchr(base_names[i], '/') + 1 : base_names[i];
+        for ( j = 0; j < i; j++ ) {
+            if ( strcmp(members[i].name, members[j].name) == 0 ) {
+                fprintf(stderr, "The archive has two members named %s\n", members[i].name);
+                ok = 0;
+            }
+        }
+        if ( ok && add_string(&strings, &strings_size, &strings_capacity, members[i].name) < 0 ) {
+            fprintf(stderr, "Cannot allocate memory.\n");
+            ok = 0;
+        }
+    }
+    for ( i = 0; ok && i < count; i++ ) {
+        ok = read_member(&members[i], base_names[i], i, &symbols, &symbols_size, &symbols_capacity,
+                         &strings, &strings_size, &strings_capacity);
+    }
+
+    /* the index, a symbol defined twice is an error */
+    for ( slots_size = 2; slots_size < 2L * symbols_size; slots_size *= 2 );
+    if ( ok && !(slots = malloc((size_t) slots_size * sizeof(long))) ) {
+        fprintf(stderr, "Cannot allocate memory.\n");
+        ok = 0;
+    }
+    for ( slot = 0; ok && slot < slots_size; slot++ ) {
+        slots[slot] = -1;
+    }
+    for ( i = 0; ok && i < symbols_size; i++ ) {
+        name = strings + symbols[i].name;
+        for ( slot = (long) (symbol_hash(name) & (unsigned long) (slots_size - 1)); slots[slot] != -1;
+              slot = (slot + 1) & (slots_size - 1) ) {
+            if ( strcmp(strings + symbols[slots[slot]].name, name) == 0 ) {
+                fprintf(stderr, "Symbol %s is an entry of both %s and %s\n", name,
+                        members[symbols[slots[slot]].member].name, members[symbols[i].member].name);
+                ok = 0;
+                break;
+            }
+        }
+        slots[slot] = i;
+    }
+
+    if ( ok && (ok = (fp = open_output(archive_name, "", &name)) != NULL) ) {
+        fwrite(ARCHIVE_MAGIC, 1, 4, fp);
+        put_le32(count, fp);
+        put_le32(symbols_size, fp);
+        put_le32(slots_size, fp);
+        put_le32(strings_size, fp);
+
+        offset = ARCHIVE_HEADER_SIZE + count * MEMBER_SIZE + slots_size * SLOT_SIZE + strings_size;
+        for ( i = 0, name_offset = 0; i < count; i++ ) {
+            put_le32(name_offset, fp);
+            name_offset += (long) strlen(members[i].name) + 1;
+            for ( j = 0; j < MEMBER_FILES; j++ ) {
+                put_le32(members[i].files[j] ? offset : 0, fp);
+                put_le32(members[i].files[j] ? members[i].lengths[j] : 0, fp);
+                offset += members[i].files[j] ? members[i].lengths[j] : 0;
+            }
+        }
+        for ( slot = 0; slot < slots_size; slot++ ) {
+            put_le32(slots[slot] == -1 ? 0 : symbols[slots[slot]].name + 1, fp);
+            put_le32(slots[slot] == -1 ? 0 : symbols[slots[slot]].member, fp);
+            put_le32(slots[slot] == -1 ? 0 : symbols[slots[slot]].address, fp);
+        }
+        fwrite(strings, 1, (size_t) strings_size, fp);
+        for ( i = 0; i < count; i++ ) {
+            for ( j = 0; j < MEMBER_FILES; j++ ) {
+                if ( members[i].files[j] ) {
+                    fwrite(members[i].files[j], 1, (size_t) members[i].lengths[j], fp);
+                }
+            }
+        }
+        ok = close_output(fp, name, !ferror(fp));
+        free(name);
+    }
+
+    for ( i = 0; i < count; i++ ) {
+        for ( j = 0; j < MEMBER_FILES; j++ ) {
+            free(members[i].files[j]);
+        }
+    }
+    free(members);
+    free(symbols);
+    free(slots);
+    free(strings);
+
+    return !ok;
+}
+
+/**
+ * Map an archive to memory and check its tables.
+ *
+ * @param archive_t*    ar - Will hold the archive at the end.
+ * @param char*         archive_name - The name of the archive file.
+ *
+ * @return int - 1 if everything went OK, 0 if the file isn't a valid archive (an error is printed).
+ */
+int archive_open(archive_t *ar, const char *archive_name){
+    const unsigned char *p, *member;
+    long i, j, needed;
+    int ok;
+
+    memset(ar, 0, sizeof(archive_t));
+    if ( !(ar->contents = (const unsigned char *) map_file(archive_name, &ar->length)) ) {
+        fprintf(stderr, "Cannot open file: %s\n", archive_name);
+        return 0;
+    }
+
+    p = ar->contents;
+    ok = ar->length >= ARCHIVE_HEADER_SIZE && memcmp(p, ARCHIVE_MAGIC, 4) == 0;
+    if ( ok ) {
+        ar->members = get_le32(p + 4);
+        ar->symbols = get_le32(p + 8);
+        ar->slots = get_le32(p + 12);
+        ar->strings_size = get_le32(p + 16);
+        needed = ARCHIVE_HEADER_SIZE + ar->members * MEMBER_SIZE + ar->slots * SLOT_SIZE + ar->strings_size;
+        ok = ar->members >= 0 && ar->symbols >= 0 && ar->slots > 0 && (ar->slots & (ar->slots - 1)) == 0
+             && ar->strings_size > 0 && needed <= ar->length && p[needed - 1] == '\0';
+    }
+    if ( ok ) {
+        ar->member_table = p + ARCHIVE_HEADER_SIZE;
+        ar->index = ar->member_table + ar->members * MEMBER_SIZE;
+        ar->strings = ar->index + ar->slots * SLOT_SIZE;
+    }
+
+    /* every name and every file should be in the archive, so a lookup needs no more checks */
+    for ( i = 0; ok && i < ar->members; i++ ) {
+        member = ar->member_table + i * MEMBER_SIZE;
+        ok = get_le32(member) < ar->strings_size;
+        for ( j = 0; ok && j < MEMBER_FILES; j++ ) {
+            ok = get_le32(member + 4 + 8 * j) >= 0 && get_le32(member + 8 + 8 * j) >= 0
+                 && get_le32(member + 4 + 8 * j) + get_le32(member + 8 + 8 * j) <= ar->length;
+        }
+    }
+    for ( i = 0; ok && i < ar->slots; i++ ) {
+        ok = get_le32(ar->index + i * SLOT_SIZE) <= ar->strings_size && get_le32(ar->index + i * SLOT_SIZE + 4) < ar->members;
+    }
+
+    if ( !ok ) {
+        fprintf(stderr, "Not a valid archive: %s\n", archive_name);
+        archive_close(ar);
+    }
+
+    return ok;
+}
+
+/**
+ * Unmap an archive.
+ *
+ * @param archive_t*    ar - The archive.
+ */
+void archive_close(archive_t *ar){
+    if ( ar->contents ) {
+        unmap_file((const char *) ar->contents, ar->length);
+    }
+    memset(ar, 0, sizeof(archive_t));
+}
+
+/**
+ * Find the member that defines an entry symbol, by the index.
+ *
+ * @param archive_t*    ar - The archive.
+ * @param char*         symbol - The name of the symbol.
+ * @param int*          address - Will hold the address of the symbol in the member at the end, when it's found.
+ *
+ * @return long - The index of the member, -1 if no member defines the symbol.
+ */
+long archive_find(archive_t *ar, const char *symbol, int *address){
+    const unsigned char *slot;
+    long i, name;
+
+    for ( i = (long) (symbol_hash(symbol) & (unsigned long) (ar->slots - 1)); ; i = (i + 1) & (ar->slots - 1) ) {
+        slot = ar->index + i * SLOT_SIZE;
+        if ( (name = get_le32(slot)) == 0 ) {
+            return -1;
+        }
+        if ( strcmp((const char *) ar->strings + name - 1, symbol) == 0 ) {
+            *address = (int) get_le32(slot + 8);
+            return get_le32(slot + 4);
+        }
+    }
+}
+
+/**
+ * Get the name of a member.
+ *
+ * @param archive_t*    ar - The archive.
+ * @param long          member - The index of the member.
+ *
+ * @return char* - The name, points into the archive.
+ */
+const char *archive_member_name(archive_t *ar, long member){
+    return (const char *) ar->strings + get_le32(ar->member_table + member * MEMBER_SIZE);
+}
+
+/**
+ * Get a file of a member.
+ *
+ * @param archive_t*    ar - The archive.
+ * @param long          member - The index of the member.
+ * @param int           file - MEMBER_OB, MEMBER_ENT or MEMBER_EXT.
+ * @param long*         length - Will hold the length of the file at the end.
+ *
+ * @return char* - The contents of the file (not null terminated), points into the archive. NULL if the member
+ *                 has no such file.
+ */
+const char *archive_member_file(archive_t *ar, long member, int file, long *length){
+    const unsigned char *p = ar->member_table + member * MEMBER_SIZE + 4 + 8 * file;
+
+    *length = get_le32(p + 4);
+
+    return get_le32(p) ? (const char *) ar->contents + get_le32(p) : NULL;
+}
+
+/**
+ * Print the members of an archive, and the entry symbols of each one.
+ *
+ * @param archive_t*    ar - The archive.
+ */
+static void archive_list(archive_t *ar){
+    symbol_reader_t reader;
+    const char *p;
+    long i, length;
+
+    for ( i = 0; i < ar->members; i++ ) {
+        printf("%s\n", archive_member_name(ar, i));
+        p = archive_member_file(ar, i, MEMBER_ENT, &length);
+        for ( symbol_reader_init(&reader, p, length); symbol_reader_next(&reader); ) {
+            printf("    %-30s%d\n", reader.name, reader.address);
+        }
+    }
+}
+
+/**
+ * Write the files of members of an archive to the current directory.
+ *
+ * @param archive_t*    ar - The archive.
+ * @param int           count - The number of members to extract, 0 for all of them.
+ * @param char**        names - The names of the members.
+ *
+ * @return int - 0 if everything went OK, 1 otherwise.
+ */
+static int archive_extract(archive_t *ar, int count, char *names[]){
+    const char *contents;
+    char *name;
+    long i, length;
+    int j, k, found, ok = 1;
+    FILE *fp;
+
+    for ( k = 0; ok && k < (count ? count : 1); k++ ) {
+        for ( found = 0, i = 0; ok && i < ar->members; i++ ) {
+            if ( count && strcmp(names[k], archive_member_name(ar, i)) != 0 ) {
+                continue;
+            }
+            found = 1;
+            for ( j = 0; ok && j < MEMBER_FILES; j++ ) {
+                if ( (contents = archive_member_file(ar, i, j, &length))
+                     && (ok = (fp = open_output((char *) archive_member_name(ar, i), (char *) member_extensions[j], &name)) != NULL) ) {
+                    fwrite(contents, 1, (size_t) length, fp);
+                    ok = close_output(fp, name, !ferror(fp));
+                    free(name);
+                }
+            }
+        }
+        if ( count && !found ) {
+            fprintf(stderr, "No member named %s\n", names[k]);
+            ok = 0;
+        }
+    }
+
+    return !ok;
+}
+
+/**
+ * Find the members of an archive that a program needs: the members that define its externs, and then the members
+ * that their externs need. Every member that is pulled in is printed with the symbol that pulled it.
+ *
+ * @param archive_t*    ar - The archive.
+ * @param char*         base_name - The program, without extension, its externs are read from NAME.ext.
+ *
+ * @return int - 0 if every extern was resolved, 1 otherwise.
+ */
+static int archive_resolve(archive_t *ar, char *base_name){
+    symbol_reader_t reader;
+    char *file_name, *contents;
+    const char *p;
+    long *queue, member, length, head, tail = 0;
+    name_table_t undefined;
+    char *pulled;
+    int address, ok = 1;
+
+    file_name = malloc(strlen(base_name) + 5);
+    queue = malloc(((size_t) ar->members + 1) * sizeof(long));
+    pulled = calloc((size_t) ar->members + 1, sizeof(char));
+    if ( !file_name || !queue || !pulled ) {
+        free(file_name);
+        free(queue);
+        free(pulled);
+        fprintf(stderr, "Cannot allocate memory.\n");
+        return 1;
+    }
+    sprintf(file_name, "%s.ext", base_name);
+    contents = read_whole_file(file_name, &length); /* a program without externs needs nothing */
+    name_table_init(&undefined);
+
+    /* the program is the first in the queue (-1), a member is pulled in once, the first time it's needed */
+    for ( head = -1; head < tail; head++ ) {
+        if ( head < 0 ) {
+            p = contents;
+            length = contents ? length : 0;
+        } else {
+            p = archive_member_file(ar, queue[head], MEMBER_EXT, &length);
+        }
+        for ( symbol_reader_init(&reader, p, length); symbol_reader_next(&reader); ) {
+            if ( (member = archive_find(ar, reader.name, &address)) == -1 ) {
+                if ( name_table_find(&undefined, reader.name) == -1 ) {
+                    fprintf(stderr, "Undefined symbol: %s (used by %s)\n", reader.name, head < 0 ? base_name : archive_member_name(ar, queue[head]));
+                    name_table_insert(&undefined, reader.name);
+                    ok = 0;
+                }
+                continue;
+            }
+            if ( !pulled[member] ) {
+                pulled[member] = 1;
+                queue[tail++] = member;
+                printf("%-30s%s\n", archive_member_name(ar, member), reader.name);
+            }
+        }
+    }
+
+    name_table_free(&undefined);
+    free(contents);
+    free(queue);
+    free(pulled);
+    free(file_name);
+
+    return !ok;
+}
+
+/**
+ * Run an archive command (--archive):
+ *
+ *      create ARCHIVE file1 file2 ...      bundle the .ob, .ent and .ext files of the sources
+ *      list ARCHIVE                        print the members and their entry symbols
+ *      extract ARCHIVE [member ...]        write the files of the members (all of them by default)
+ *      resolve ARCHIVE NAME                print the members that the externs of NAME need
+ *
+ * @param int       argc - The number of arguments after --archive.
+ * @param char**    argv - The arguments after --archive.
+ *
+ * @return int - 0 if everything went OK, 1 otherwise.
+ */
+int archive_command(int argc, char *argv[]){
+    archive_t ar;
+    int status;
+
+    if ( argc < 2 || (strcmp(argv[0], "create") != 0 && strcmp(argv[0], "list") != 0
+                      && strcmp(argv[0], "extract") != 0 && strcmp(argv[0], "resolve") != 0) ) {
+        fprintf(stderr, "Usage: --archive create|list|extract|resolve ARCHIVE ...\n");
+        return 1;
+    }
+    if ( strcmp(argv[0], "create") == 0 ) {
+        if ( argc < 3 ) {
+            fprintf(stderr, "Missing file names after %s\n", argv[1]);
+            return 1;
+        }
+        return archive_create(argv[1], argc - 2, argv + 2);
+    }
+    if ( strcmp(argv[0], "resolve") == 0 && argc != 3 ) {
+        fprintf(stderr, "Missing file name after %s\n", argv[1]);
+        return 1;
+    }
+
+    if ( !archive_open(&ar, argv[1]) ) {
+        return 1;
+    }
+    status = 0;
+    if ( strcmp(argv[0], "list") == 0 ) {
+        archive_list(&ar);
+    } else if ( strcmp(argv[0], "extract") == 0 ) {
+        status = archive_extract(&ar, argc - 2, argv + 2);
+    } else {
+        status = archive_resolve(&ar, argv[2]);
+    }
+    archive_close(&ar);
+
+    return status;
+}
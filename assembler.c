@@ -0,0 +1,817 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "header.h"
+
+/*
+ * The assembler itself. Everything that belongs to a single source is held by an assembler context (assembler_t),
+ * so any number of sources can be assembled in the same process, one after the other or at the same time.
+ */
+
+/**
+ * Empty the tables of the assembled source. Their memory is kept for the next source, so a context that
+ * assembles many sources stops allocating once its tables are big enough (a spilled segment is freed, see
+ * spill.c).
+ *
+ * @param assembler_t*  as - The assembler context.
+ */
+static void clear_tables(assembler_t *as){
+    if ( segment_spilled_bytes(&as->spilled, as->code_seg) ) {
+        segment_free(&as->spilled, as->code_seg);
+        as->code_seg = NULL;
+        as->code_capacity = 0;
+    }
+    if ( segment_spilled_bytes(&as->spilled, as->data_seg) ) {
+        segment_free(&as->spilled, as->data_seg);
+        as->data_seg = NULL;
+        as->data_capacity = 0;
+    }
+    free_signs_names(as->table_signs, as->table_signs_size);
+    free_table_names(as->ent, as->ent_size);
+    free_table_names(as->ext, as->ext_size);
+
+    as->table_signs_size = as->dc = as->ic = as->ent_size = as->ext_size = 0;
+    as->fixups_size = 0;
+}
+
+/**
+ * Free the tables of the assembled source and reset their sizes.
+ *
+ * @param assembler_t*  as - The assembler context.
+ */
+static void free_tables(assembler_t *as){
+    clear_tables(as);
+    free(as->code_seg);
+    free(as->data_seg);
+    free(as->table_signs);
+    free(as->ent);
+    free(as->ext);
+    spill_table_free(&as->spilled);
+
+    as->table_signs = NULL;
+    as->data_seg = as->code_seg = NULL;
+    as->ent = as->ext = NULL;
+    as->table_signs_capacity = as->data_capacity = as->code_capacity = as->ent_capacity = as->ext_capacity = 0;
+}
+
+/**
+ * Check if the first scan should record the instructions, for the passes that run at its end.
+ *
+ * @param assembler_t*  as - The assembler context.
+ *
+ * @return int - 1 if the instructions are recorded, 0 otherwise.
+ */
+static int records_instructions(assembler_t *as){
+    return as->settings.optimize || as->settings.gc;
+}
+
+/**
+ * Initialize an assembler context with the default settings, before it's used for the first time.
+ *
+ * @param assembler_t*  as - The context to initialize.
+ */
+void assembler_init(assembler_t *as){
+    memset(&as->settings, 0, sizeof(settings_t));
+    as->settings.diag_format = DIAG_TEXT;
+    as->settings.batch = NULL;
+    as->settings.load_base = -1;
+    diag_init(&as->diag);
+    preprocessor_init(&as->pp);
+    constant_table_init(&as->constants);
+    instruction_list_init(&as->instructions);
+    name_table_init(&as->entries);
+    string_pool_init(&as->pool);
+    line_table_init(&as->lines);
+    as->incremental = 0;
+    as->gc_code_words = as->gc_data_words = 0;
+
+    as->fixups = NULL;
+    as->fixups_size = as->fixups_capacity = 0;
+    as->table_signs = NULL;
+    as->data_seg = as->code_seg = NULL;
+    spill_table_init(&as->spilled);
+    as->ent = as->ext = NULL;
+    as->table_signs_size = as->dc = as->ic = as->ent_size = as->ext_size = 0;
+    as->table_signs_capacity = as->data_capacity = as->code_capacity = as->ent_capacity = as->ext_capacity = 0;
+}
+
+/**
+ * Free everything the context holds. The context (and its settings) could be used again for another source afterwards.
+ *
+ * @param assembler_t*  as - The context to free.
+ */
+void assembler_free(assembler_t *as){
+    free_tables(as);
+    diag_free(&as->diag);
+    preprocessor_free(&as->pp);
+    constant_table_free(&as->constants);
+    instruction_list_free(&as->instructions);
+    name_table_free(&as->entries);
+    string_pool_free(&as->pool);
+    line_table_free(&as->lines);
+    free(as->fixups);
+    as->fixups = NULL;
+    as->fixups_capacity = 0;
+}
+
+/**
+ * First assembler scan.
+ *
+ * @param assembler_t*  as - The assembler context.
+ * @param FILE*         fp - The file to scan from.
+ *
+ * @return int 0 if everything went OK, 1 otherwise.
+ */
+int first_scan(assembler_t *as, FILE *fp){
+    int matrix_size, i, local_error;
+    int line_counter = 0; /* line number */
+	int error = 0; /* 1 if we found an error */
+	char line[LINE_MAX], temp[LINE_MAX], label[LINE_MAX], oper[LINE_MAX], arg1[LINE_MAX], arg2[LINE_MAX];
+	int length; /* length of current word */
+	int valid; /* save the result of the isvalid */
+	int pos; /* the position on the current line*/
+	int is_label; /* 1 if we have label on the current line */
+    int register_arg_flag; /* indicates the first argument was a register */
+    int insert_status; /* whether a sign insert to the table successfully */
+    int too_big; /* 1 if a number doesn't fit in a word */
+    int pooled; /* the address of a string that is already in the string pool */
+    int label_pos, oper_pos, word_pos; /* the positions of the label, the operation and the last word we read, for the diagnostics */
+	as->ic = INITIAL_IC; as->dc = 0;
+
+	while ( read_line(as, fp, line, &line_counter) ) { /* get line, after the macros were expanded */
+        if ( diag_limit_reached(&as->diag) ) { /* too many errors, don't bother to scan the rest */
+            break;
+        }
+
+		pos = local_error = 0;
+        register_arg_flag = 0; /* not register yet */
+		is_label = 0; /* not label yet */
+
+		skip_white_space(line, &pos); /* skip to the first word */
+        label_pos = oper_pos = pos;
+		length = get_new_word(line, temp, &pos); /* get the first word */
+
+		if ( length == 0 ) /* if it's mark or empty line */
+            continue;
+
+		/* ------------ LABEL HANDLING --------------- */
+		if ( temp[length-1] == ':' ){	/* if we read label */
+			temp[length-1] = '\0'; /* "delete" the : by putting \0 there */
+			strcpy(label,temp);
+			if ( ! check_word(label, LABEL) ) { /* check if it's valid label */
+				diag_report(&as->diag, line_counter, label_pos + 1, DIAG_INVALID_LABEL, 1, "invalid label: '%s'", label);
+				error = 1;
+				continue;
+			}
+			is_label = 1; /* mark there is a label */
+			skip_white_space(line, &pos); /* skip to the next word */
+            oper_pos = pos;
+			get_new_word(line, oper, &pos); /* read the operation */
+		}
+		else {    /* we read the operation immediately */
+            strcpy(oper, temp);
+        }
+
+		/* ------------ CHECK OPERATION --------------- */
+		if ( ( valid = check_word(oper, OPERATION)) == -1 ){ /* check if the word is invalid */
+			diag_report(&as->diag, line_counter, oper_pos + 1, DIAG_INVALID_OPERATION, 1, "invalid operation: %s", oper);
+			error = 1;
+			continue;
+		}
+
+        /* ------------ ENTRY HANDLING --------------- */
+        if ( valid == ENTRY ) {
+            /*
+             * If the word was .entry, we don't have anything to do right now,
+             * we will handle this case in the second scan. Only the garbage collection needs to know the entries.
+             */
+            skip_white_space(line, &pos);
+            get_new_word(line, arg1, &pos);
+            if ( as->settings.gc && name_table_find(&as->entries, arg1) == -1 && name_table_insert(&as->entries, arg1) < 0 ) {
+                diag_report(&as->diag, line_counter, 0, DIAG_MEMORY, 1, "Cannot allocate memory for the entries");
+                error = 1;
+            }
+            continue;
+        }
+
+        /* ------------ DEFINE HANDLING --------------- */
+        if ( valid == DEFINE ) {
+            if ( is_label ) {
+                diag_report(&as->diag, line_counter, label_pos + 1, DIAG_INVALID_LABEL, 1, "A .define line can't have a label");
+                error = 1;
+                continue;
+            }
+            if ( !parse_define(as, line, pos, line_counter) ) {
+                error = 1;
+            }
+            continue;
+        }
+
+		/* ------------ DATA HANDLING --------------- */
+		if ( valid == DATA ) { /* the operation we read was .data */
+
+			if ( is_label == 1 ) { /* we have a label on this line, insert it to our table of signs */
+                if ( (insert_status = insert_sign(&as->table_signs, &as->table_signs_size, &as->table_signs_capacity, label, as->dc, 0, 0)) != 1 ) {
+                    if ( insert_status == -1 ) {
+                        diag_report(&as->diag, line_counter, label_pos + 1, DIAG_DUPLICATE_SIGN, 1, "The sign %s declared more then once", label);
+                    }
+                    error = 1;
+                    continue;
+                }
+            }
+
+			skip_white_space(line, &pos);
+            word_pos = pos;
+			length = get_new_word(line, arg1, &pos); /* get the next word (of data) */
+			while ( length > 0 ) { /* while we read a word */
+				int num;
+				word_t op_num;
+				if ( !fold_data_value(as, arg1, line_counter, word_pos + 1, &num) ) { /* if it's invalid number (or expression) */
+					error = 1;
+                    local_error = 1;
+					break;
+				}
+                too_big = 0;
+				op_num = trans_to_word(num, &too_big); /* change it to word_type */
+                if ( too_big ) {
+                    diag_report(&as->diag, line_counter, word_pos + 1, DIAG_NUMBER_TOO_BIG, 1, "Number's size is bigger than the word size (%d bits).", WORD_MAX);
+                    error = 1;
+                }
+				if ( !code_insert(&as->spilled, &as->data_seg, &as->dc, &as->data_capacity, op_num) ) { /* add the data word to the data table */
+					error = 1;
+                    local_error = 1;
+					break;
+				}
+				skip_white_space(line, &pos);
+                word_pos = pos;
+				length = get_new_word(line, arg1, &pos); /* get the next word (of data) */
+			}
+
+            if ( local_error ) continue;
+
+			skip_white_space(line, &pos);
+			if ( line[pos] != '\n' && line[pos] != '\0' ) { /* if the last char wasn't \n and wasn't \0 */
+				diag_report(&as->diag, line_counter, pos + 1, DIAG_INVALID_LIST, 1, "Invalid list number");
+				error = 1;
+			}
+			continue;
+		}
+
+		/* ------------ STRING HANDLING --------------- */
+		if ( valid == STRING ) { /* the word was .string */
+			if ( is_label ) { /* we have a label on this line, insert it to our table of signs */
+                if ( (insert_status = insert_sign(&as->table_signs, &as->table_signs_size, &as->table_signs_capacity, label, as->dc, 0, 0)) != 1 ) {
+                    if (insert_status == -1) {
+                        diag_report(&as->diag, line_counter, label_pos + 1, DIAG_DUPLICATE_SIGN, 1, "The sign %s declared more then once", label);
+                    }
+                    error = 1;
+                    break;
+                }
+            }
+			skip_white_space(line, &pos);
+            word_pos = pos;
+			length = get_entry_string(line, arg1, &pos);	/* get the string */
+			if ( length < 0 ) {
+				diag_report(&as->diag, line_counter, word_pos + 1, DIAG_INVALID_STRING, 1, "String should start and end with \"");
+				error = 1;
+                continue;
+			}
+            /* a labeled string that was already written shares its words, only its label is added */
+            if ( as->settings.pool_strings && is_label && (pooled = string_pool_find(&as->pool, arg1)) != -1 ) {
+                as->table_signs[as->table_signs_size - 1].address = pooled;
+                as->table_signs[as->table_signs_size - 1].alias = 1;
+                length = 0; /* nothing to write */
+            } else if ( as->settings.pool_strings && !string_pool_add(&as->pool, arg1, as->dc) ) {
+                diag_report(&as->diag, line_counter, 0, DIAG_MEMORY, 1, "Cannot allocate memory for the string pool");
+                error = 1;
+                continue;
+            }
+			for ( i = 0; i < length; i++ ) { /* for each char on the string (include \0) */
+				int num = arg1[i];
+                word_t op_num;
+
+                too_big = 0;
+				op_num = trans_to_word(num, &too_big); /* change it to word_type */
+                if ( too_big ) {
+                    diag_report(&as->diag, line_counter, word_pos + 1, DIAG_NUMBER_TOO_BIG, 1, "Number's size is bigger than the word size (%d bits).", WORD_MAX);
+                    error = 1;
+                }
+
+				if ( !code_insert(&as->spilled, &as->data_seg, &as->dc, &as->data_capacity, op_num) ) { /* add this sign to data table */
+					error = 1;
+                    continue;
+				}
+			}
+			skip_white_space(line, &pos);
+            word_pos = pos;
+			length = get_new_word(line, arg1, &pos);
+			if ( length > 0 ) { /* if there was another word after the string */
+				diag_report(&as->diag, line_counter, word_pos + 1, DIAG_EXTRA_OPERAND, 1, ".string should have one argument");
+				error = 1;
+			}
+			continue;
+		}
+
+        /* ------------ MATRIX HANDLING --------------- */
+        if ( valid == MAT ) { /* the word was .mat */
+
+            if ( is_label == 1 ) { /* we have a label on this line, insert it to our table of signs */
+                if ( (insert_status = insert_sign(&as->table_signs, &as->table_signs_size, &as->table_signs_capacity, label, as->dc, 0, 0)) != 1 ) {
+                    if ( insert_status == -1 ) {
+                        diag_report(&as->diag, line_counter, label_pos + 1, DIAG_DUPLICATE_SIGN, 1, "The sign %s declared more then once", label);
+                    }
+                    error = 1;
+                    continue;
+                }
+            }
+
+            skip_white_space(line, &pos);
+            word_pos = pos;
+            get_new_word(line, arg1, &pos); /* get matrix rows/columns count */
+            matrix_size = calculate_matrix_size(arg1);
+            if ( matrix_size < 1 ) {
+                diag_report(&as->diag, line_counter, word_pos + 1, DIAG_INVALID_MATRIX_SIZE, 1, "Matrix rows and columns must be natural numbers.");
+                error = 1;
+                continue;
+            }
+
+            skip_white_space(line, &pos);
+            word_pos = pos;
+            length = get_new_word(line, arg2, &pos);
+            i = 0; /* this will tell us how many numbers there are at the end */
+            while ( length > 0 ) { /* while we read a word */
+                int num;
+                word_t op_num;
+                if ( !fold_data_value(as, arg2, line_counter, word_pos + 1, &num) ) { /* if it's invalid number (or expression) */
+                    error = 1;
+                    local_error = 1;
+                    break;
+                }
+                too_big = 0;
+                op_num = trans_to_word(num, &too_big); /* change it to word_type */
+                if ( too_big ) {
+                    diag_report(&as->diag, line_counter, word_pos + 1, DIAG_NUMBER_TOO_BIG, 1, "Number's size is bigger than the word size (%d bits).", WORD_MAX);
+                    error = 1;
+                }
+                if ( !code_insert(&as->spilled, &as->data_seg, &as->dc, &as->data_capacity, op_num) ) { /* add the data number to the data table */
+                    error = 1;
+                    local_error = 1;
+                    break;
+                }
+                skip_white_space(line, &pos);
+                word_pos = pos;
+                length = get_new_word(line, arg2, &pos); /* get the next number */
+                i++;
+            }
+
+            if ( local_error ) continue;
+
+            skip_white_space(line, &pos);
+            if ( (line[pos] != '\n' &&  line[pos] != '\0') || i > matrix_size ) { /* if the last char wasn't \n or \0, or if there are more number than matrix size */
+                diag_report(&as->diag, line_counter, pos + 1, DIAG_INVALID_MATRIX_LIST, 1, "Error trying to assign list number to the matrix, the list is invalid.");
+                error = 1;
+            }
+            continue;
+        }
+
+		/* ------------ EXTERN HANDLING --------------- */
+		if ( valid == EXTERN ) { /*the word was .extern */
+			skip_white_space(line, &pos);
+            word_pos = pos;
+            get_new_word(line, arg1, &pos);
+			if ( (insert_status = insert_sign(&as->table_signs, &as->table_signs_size, &as->table_signs_capacity, arg1, 0, 1, 2)) != 1 ){  /* add the label to the signs table */
+				if ( insert_status == -1 ) {
+                    diag_report(&as->diag, line_counter, word_pos + 1, DIAG_DUPLICATE_SIGN, 1, "The sign %s declared more then once", arg1);
+                }
+                error = 1;
+                continue;
+			}
+			skip_white_space(line, &pos);
+            word_pos = pos;
+			length = get_new_word(line, arg1, &pos);
+			if ( length > 0 ){ /* if there was another word after the extern */
+				diag_report(&as->diag, line_counter, word_pos + 1, DIAG_EXTRA_OPERAND, 1, ".extern should have one argument");
+				error = 1;
+			}
+			continue;
+		}
+		/* ------------ OPERATION HANDLING --------------- */
+        /* the word was an operation */
+        if ( is_label == 1 ) { /* we have a label on this line */
+            if ( (insert_status = insert_sign(&as->table_signs, &as->table_signs_size, &as->table_signs_capacity, label, as->ic, 0, 1)) != 1 ) {
+                if ( insert_status == -1 ) {
+                    diag_report(&as->diag, line_counter, label_pos + 1, DIAG_DUPLICATE_SIGN, 1, "The sign %s declared more then once", label);
+                }
+                error = 1;
+                continue;
+            }
+        }
+        if ( records_instructions(as) && !instruction_add(&as->instructions, as->ic, valid, is_label) ) {
+            diag_report(&as->diag, line_counter, 0, DIAG_MEMORY, 1, "Cannot allocate memory for the instruction list");
+            error = 1;
+            continue;
+        }
+        as->ic++; /* we surely have a new word for the operation */
+        skip_white_space(line, &pos);
+
+		/* ------------ ARG1 HANDLING --------------- */
+        word_pos = pos;
+		get_new_word(line, arg1, &pos);
+        if ( strlen(arg1) == 0 ) { /*if we don't have arguments */
+            continue;
+        }
+
+		if ( (valid = check_word(arg1, ARGUMENT)) == -1 ) { /* if the argument1 is invalid*/
+			diag_report(&as->diag, line_counter, word_pos + 1, DIAG_INVALID_ARGUMENT, 1, "invalid argument: '%s'", arg1);
+			error = 1;
+			continue;
+		}
+        if ( records_instructions(as) && !instruction_set_operand(&as->instructions, FIRST_ARG, arg1, valid) ) {
+            diag_report(&as->diag, line_counter, 0, DIAG_MEMORY, 1, "Cannot allocate memory for the instruction list");
+            error = 1;
+            continue;
+        }
+        switch ( valid ) {
+            case DIRECT: case IMMEDIATE:
+                as->ic++; /* we should have new word for the label's address (or specified number) */
+                break;
+            case MATRIX_ACCESS:
+                as->ic += 2; /* we need two more spaces - one for the address of the matrix, and second for the relevant row/column */
+                break;
+            default: /* DIRECT_REGISTER */
+                as->ic++;
+                register_arg_flag = 1;
+        }
+		skip_white_space(line, &pos);
+
+		/* ------------ ARG2 HANDLING --------------- */
+        word_pos = pos;
+		get_new_word(line, arg2, &pos);
+        if ( strlen(arg2) == 0 ) { /* if we have only one argument */
+            continue;
+        }
+
+		if ( (valid = check_word(arg2, ARGUMENT)) == -1 ) { /*/if the argument2 is invalid*/
+			diag_report(&as->diag, line_counter, word_pos + 1, DIAG_INVALID_ARGUMENT, 1, "invalid argument: '%s'", arg2);
+			error=1;
+			continue;
+		}
+        if ( records_instructions(as) && !instruction_set_operand(&as->instructions, SECOND_ARG, arg2, valid) ) {
+            diag_report(&as->diag, line_counter, 0, DIAG_MEMORY, 1, "Cannot allocate memory for the instruction list");
+            error = 1;
+            continue;
+        }
+        switch ( valid ) {
+            case DIRECT: case IMMEDIATE:
+                as->ic++; /* we should have new word for the label's address (or specified number) */
+                break;
+            case MATRIX_ACCESS:
+                as->ic += 2; /* we need two more spaces - one for the address of the matrix, and second for the relevant row/column */
+                break;
+            default : /* DIRECT_REGISTER */
+                if ( !register_arg_flag ) { /* if arg1 was a register, we don't need to increase ic as they share a common word */
+                    as->ic++;
+                }
+        }
+
+		/* ------------ EXCEPTION ARGS  --------------- */
+		skip_white_space(line, &pos);
+		if ( (line[pos] != '\n') && (line[pos] != '\0') ){ /*if after the 2 arguments we have more */
+			diag_report(&as->diag, line_counter, pos + 1, DIAG_TOO_MANY_OPERANDS, 1, "too much parameters");
+			error = 1;
+            continue;
+		}
+	}
+
+    /* all the constants are known now, fix the data words that used them before they were defined */
+    if ( resolve_fixups(as) ) {
+        error = 1;
+    }
+
+    /* remove the unreachable code and data, and the instructions that have no effect, before the data is placed after the code */
+    if ( records_instructions(as) && !error && as->diag.errors == 0 ) {
+        if ( as->settings.gc && !collect_garbage(as) ) {
+            diag_report(&as->diag, 0, 0, DIAG_MEMORY, 1, "Cannot allocate memory for the garbage collection");
+            error = 1;
+        }
+        if ( as->settings.optimize ) {
+            peephole_optimize(as);
+        }
+        if ( remove_instructions(as) < 0 ) {
+            diag_report(&as->diag, 0, 0, DIAG_MEMORY, 1, "Cannot allocate memory for the optimizer");
+            error = 1;
+        }
+    }
+
+	/* update the table of signs so the data will be placed after to code segment */
+	signs_table_update(as->table_signs, as->table_signs_size, as->ic);
+
+    if ( as->diag.errors > 0 ) { /* errors of the macro stage */
+        error = 1;
+    }
+
+	return error;
+}
+
+
+/**
+ * Encode a single line in the second scan: an instruction is added to the code segment, and the label of
+ * an .entry to the entry table. The other lines were done by the first scan.
+ *
+ * @param assembler_t*  as - The assembler context.
+ * @param char*         line - The line, after the macros were expanded.
+ * @param int           line_counter - The line number.
+ * @param int*          instruction - The index of the instruction in the instruction list, moved past the line's instruction.
+ *
+ * @return int - LINE_ENCODED if an instruction was encoded, LINE_SKIPPED for any other line, LINE_ERROR if the line
+ *               has errors, LINE_FATAL if the line has errors and the scan should stop.
+ */
+int encode_line(assembler_t *as, char *line, int line_counter, int *instruction){
+    char temp[LINE_MAX];	/* temp array to save each word */
+    char oper[LINE_MAX], arg1[LINE_MAX], arg2[LINE_MAX];
+    int length; /* length of current word */
+    int pos; /* the position on the current line */
+    int arg1_exists;
+    int arg2_exists;
+    int address;
+    int arg1_amethod;
+    int arg2_amethod;
+    int src_operand_amethod;
+    int dest_operand_amethod;
+    int arg1_pos, arg2_pos; /* the positions of the arguments, for the diagnostics */
+    int status = LINE_SKIPPED;
+
+    word_t current_code; /* current code */
+
+    pos = arg1_exists = arg2_exists =  arg1_amethod = arg2_amethod = 0;
+    current_code.oper = current_code.amethod_src_operand = current_code.amethod_dest_operand = current_code.memory = 0;
+
+    /* reset the arguments */
+    arg1[0] = '\0';
+    arg2[0] = '\0';
+
+    skip_white_space(line, &pos); /* skip to the first word */
+    length = get_new_word(line, temp, &pos); /* get the first word */
+
+    if ( length == 0 ) {/* if it's mark or empty line */
+        return LINE_SKIPPED;
+    }
+
+    /* ------------ LABEL HANDLING --------------- */
+    if (temp[length-1]==':'){	/* we read label */
+        skip_white_space(line, &pos);
+        get_new_word(line, oper, &pos); /* read the operation */
+    } else {    /* we read the operation immediately */
+        strcpy(oper, temp);
+    }
+
+    /* ------------ CHECK OPERATION --------------- */
+    address = check_word(oper, OPERATION);
+
+    /* do nothing in these cases */
+    if ( address == DATA || address == STRING || address == MAT || address == EXTERN || address == DEFINE ) {
+        return LINE_SKIPPED;
+    }
+
+
+    /* ------------ ENTRY HANDLING --------------- */
+    if ( address == ENTRY ) {
+        skip_white_space(line, &pos);
+        arg1_pos = pos;
+        get_new_word(line, arg1, &pos);
+        if ( ! update_ent_table(&as->ent, &as->ent_size, &as->ent_capacity, arg1, as->table_signs, as->table_signs_size) ) { /* update the ent table */
+            diag_report(&as->diag, line_counter, arg1_pos + 1, DIAG_INVALID_ENTRY, 1, "Error trying to add value %s to the entry table.", arg1);
+            return LINE_ERROR;
+        }
+        arg2_pos = pos;
+        length = get_new_word(line, arg2, &pos);
+        if ( length > 0 ) { /* if there was another word after the entry */
+            diag_report(&as->diag, line_counter, arg2_pos + 1, DIAG_EXTRA_OPERAND, 1, ".entry should have one argument");
+            return LINE_ERROR;
+        }
+        return LINE_SKIPPED;
+    }
+
+    /* ------------ OPERATION HANDLING --------------- */
+    address = check_word(oper, OPERATION);
+
+    if ( records_instructions(as) && as->instructions.items[(*instruction)++].removed ) { /* removed by the optimizer or the garbage collection */
+        return LINE_SKIPPED;
+    }
+
+    current_code.oper = (unsigned) address;
+    current_code.memory = 0;
+
+    /* get arg1 */
+    skip_white_space(line, &pos);
+    arg1_pos = pos;
+    get_new_word(line, arg1, &pos);
+
+    /* get arg2 */
+    skip_white_space(line, &pos);
+    arg2_pos = pos;
+    get_new_word(line, arg2, &pos);
+
+    /* check what we have */
+    if ( strlen(arg1) > 0 ) {
+        arg1_exists = 1;
+        arg1_amethod = (unsigned) check_word(arg1, ARGUMENT);
+
+        if ( strlen(arg2) > 0 ) { /* check for arg2 either */
+            arg2_exists = 1;
+            arg2_amethod = (unsigned) check_word(arg2, ARGUMENT);
+        }
+    }
+
+    if ( arg1_exists && !is_label_defined(arg1, arg1_amethod, as->table_signs, as->table_signs_size) ) {
+        diag_report(&as->diag, line_counter, arg1_pos + 1, DIAG_UNDEFINED_LABEL, 0, "Undefined label: %s", arg1);
+    }
+    if ( arg2_exists && !is_label_defined(arg2, arg2_amethod, as->table_signs, as->table_signs_size) ) {
+        diag_report(&as->diag, line_counter, arg2_pos + 1, DIAG_UNDEFINED_LABEL, 0, "Undefined label: %s", arg2);
+    }
+
+    /* fold the constant expressions of the immediate operands to numbers */
+    if ( (arg1_exists && arg1_amethod == IMMEDIATE && !fold_immediate(as, arg1, line_counter, arg1_pos + 1))
+         || (arg2_exists && arg2_amethod == IMMEDIATE && !fold_immediate(as, arg2, line_counter, arg2_pos + 1)) ) {
+        return LINE_ERROR;
+    }
+
+    /* if we have two arguments, the first one is going to be the source operand */
+    if ( arg1_exists && arg2_exists ) {
+        current_code.amethod_src_operand = (unsigned) arg1_amethod;
+        current_code.amethod_dest_operand = (unsigned) arg2_amethod;
+        src_operand_amethod = arg1_amethod;
+        dest_operand_amethod = arg2_amethod;
+    }
+    /* if we have one argument, he is going to be destination operand */
+    else if ( arg1_exists &&  !arg2_exists ) {
+        current_code.amethod_dest_operand = (unsigned) arg1_amethod;
+        src_operand_amethod = NO_ARG;
+        dest_operand_amethod = arg1_amethod;
+    }
+    else { /* both not exists */
+        src_operand_amethod = dest_operand_amethod = NO_ARG;
+    }
+
+    /* check if the addressing method fits the operation */
+    if ( ! is_address_valid(address, src_operand_amethod, dest_operand_amethod) ) {
+        diag_report(&as->diag, line_counter, arg1_pos + 1, DIAG_INVALID_ADDRESSING, 1, "invalid address");
+        return LINE_ERROR;
+    }
+
+    /* encode the operation */
+    if ( ! code_insert(&as->spilled, &as->code_seg, &as->ic, &as->code_capacity, current_code) ) {
+        diag_report(&as->diag, line_counter, 0, DIAG_MEMORY, 1, "Failed to insert code.");
+        return LINE_ERROR;
+    }
+    status = LINE_ENCODED;
+
+    /* encode the arguments */
+    if ( arg1_exists ) {
+        encode_argument(arg1, arg1_amethod, arg2, FIRST_ARG, &as->spilled, &as->code_seg, &as->ic, &as->code_capacity, as->table_signs, as->table_signs_size, &as->ext, &as->ext_size, &as->ext_capacity);
+    } else { /* if the destination operand is't exists, it must be the last word in the line */
+        return status;
+    }
+
+    if ( arg2_exists ) {
+        encode_argument(arg2, arg2_amethod, arg1, SECOND_ARG, &as->spilled, &as->code_seg, &as->ic, &as->code_capacity, as->table_signs, as->table_signs_size, &as->ext, &as->ext_size, &as->ext_capacity);
+    } else {
+        return status; /* no need to check for exception args if arg2 isn't exists */
+    }
+
+
+    /* ------------ EXCEPTION ARGS  --------------- */
+    skip_white_space(line, &pos);
+    if ( line[pos] != '\n' && line[pos] != '\0' ) { /*if after the 2 arguments we have more */
+        diag_report(&as->diag, line_counter, pos + 1, DIAG_TOO_MANY_OPERANDS, 1, "Too much parameters");
+        return LINE_FATAL;
+    }
+
+    return status;
+}
+
+
+/**
+ * Second assembler scan.
+ *
+ * @param assembler_t*  as - The assembler context.
+ * @param FILE*         fp - The file to scan from.
+ *
+ * @return int 0 if everything went OK, 1 otherwise.
+ */
+int second_scan(assembler_t *as, FILE *fp){
+    int line_counter = 0; /* line number */
+    int error = 0; /* errors indicator */
+    char line[LINE_MAX];	/* the line */
+    int instruction = 0; /* the index of the instruction in the instruction list */
+    int address; /* the address of the instruction on the line */
+    int status;
+
+    rewind(fp);
+    preprocessor_rewind(&as->pp);
+    as->ic = 0;
+
+
+    while ( read_line(as, fp, line, &line_counter) ) { /* get line, after the macros were expanded */
+        if ( diag_limit_reached(&as->diag) ) { /* too many errors, don't bother to scan the rest */
+            break;
+        }
+
+        address = INITIAL_IC + as->ic;
+        status = encode_line(as, line, line_counter, &instruction);
+
+        /* the line of the instruction, for the debug information and the incremental assembly */
+        if ( status != LINE_SKIPPED && status != LINE_ERROR && (as->settings.debug_info || as->incremental)
+             && !line_table_add(&as->lines, address, line_counter) ) {
+            diag_report(&as->diag, line_counter, 0, DIAG_MEMORY, 1, "Cannot allocate memory for the line table.");
+            status = LINE_ERROR;
+        }
+
+        if ( status == LINE_ERROR || status == LINE_FATAL ) {
+            error = 1;
+        }
+        if ( status == LINE_FATAL ) {
+            break;
+        }
+    }
+
+    return error;
+}
+
+
+/**
+ * Assemble a source: run the first and the second scan over it.
+ * The code and data segments, the entry and the extern tables are left in the context,
+ * and so are the diagnostics, until they are flushed.
+ *
+ * @param assembler_t*  as - The assembler context, the tables it holds from a previous source are freed first.
+ * @param FILE*         fp - The source to assemble, could be a file or an in-memory stream.
+ *
+ * @return int - 0 if everything went OK, 1 if the source has errors.
+ */
+int assembler_run(assembler_t *as, FILE *fp){
+    clear_tables(as);
+    diag_clear(&as->diag);
+    preprocessor_reset(&as->pp);
+    name_table_clear(&as->constants.names);
+    instruction_list_clear(&as->instructions);
+    name_table_clear(&as->entries);
+    string_pool_clear(&as->pool);
+    line_table_clear(&as->lines);
+    as->gc_code_words = as->gc_data_words = 0;
+    as->diag.max_errors = as->settings.max_errors;
+    as->spilled.budget = as->settings.mem_limit;
+
+    if ( first_scan(as, fp) == 1 || second_scan(as, fp) == 1 ) {  /* if there was a problem on one of the scans */
+        clear_tables(as);
+        return 1;
+    }
+
+    return 0;
+}
+
+/**
+ * Assemble a source that is already in memory.
+ *
+ * @param assembler_t*  as - The assembler context.
+ * @param char*         source - The source text, doesn't have to be null terminated.
+ * @param size_t        length - The length of the source.
+ *
+ * @return int - 0 if everything went OK, 1 if the source has errors, 2 if the source couldn't be opened.
+ */
+int assemble_buffer(assembler_t *as, const char *source, size_t length){
+    FILE *fp;
+    int status;
+
+    if ( length == 0 ) { /* an empty buffer can't be opened as a stream, but it also has nothing to assemble */
+        clear_tables(as);
+        diag_clear(&as->diag);
+        return 0;
+    }
+
+    if ( !(fp = fmemopen((void *) source, length, "r")) ) {
+        diag_report(&as->diag, 0, 0, DIAG_MEMORY, 1, "Cannot open the source buffer.");
+        return 2;
+    }
+
+    status = assembler_run(as, fp);
+    fclose(fp);
+
+    return status;
+}
+
+/**
+ * Get a view of the assembled segments. The view points into the context, nothing is copied,
+ * so it's valid until the context is freed or used for another source.
+ *
+ * @param assembler_t*      as - The assembler context.
+ * @param segments_view*    view - Will hold the view at the end.
+ */
+void assembler_segments(assembler_t *as, segments_view *view){
+    view->code = as->code_seg;
+    view->code_size = as->ic;
+    view->data = as->data_seg;
+    view->data_size = as->dc;
+    view->base = INITIAL_IC;
+}
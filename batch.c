@@ -0,0 +1,637 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "header.h"
+
+/*
+ * The batch simulator (--batch=FILE). Every line of FILE is the input of an instance of the program (the
+ * numbers red reads), and the program is run once for every line. BATCH_WIDTH instances (lanes) run
+ * together, in lockstep: the state is kept as structure of arrays, a word of the memory or a register
+ * is an array of BATCH_WIDTH values, so a single micro op is run for all the lanes by a short loop over
+ * the arrays, which the compiler turns into SIMD code.
+ *
+ * The lanes run the same code, but they could be at different addresses after a bne. The lanes at the
+ * lowest address run first (the others are masked), so the lanes that took a shorter path wait for the
+ * others and go on together from where the paths meet. When less than a quarter of the running lanes
+ * run together over a window of groups, the lanes are too far apart to gain from the lockstep, and each
+ * of them goes on alone on the simulator. A lane that writes to its code goes on alone too, since the code isn't shared anymore.
+ *
+ * The output is a line for every instance: the numbers prn wrote, and the runtime error if there was one.
+ */
+
+#define BATCH_WIDTH 64
+#define DIVERGENCE_WINDOW 64 /* groups of lanes, if less than a quarter of the running lanes run together over them, the lockstep stops */
+
+/* the state of BATCH_WIDTH instances, by word and then by lane */
+typedef struct{
+    int memory[MEMORY_SIZE][BATCH_WIDTH];
+    int registers[NUM_OF_REGISTERS][BATCH_WIDTH];
+    int stack[STACK_SIZE][BATCH_WIDTH];
+    int zero[BATCH_WIDTH];
+    int sp[BATCH_WIDTH];
+    int pc[BATCH_WIDTH];
+    int status[BATCH_WIDTH];
+    int alone[BATCH_WIDTH]; /* 1 for the lanes that go on on the simulator */
+    int mask[BATCH_WIDTH]; /* 1 for the lanes of the group that runs now */
+    long steps[BATCH_WIDTH];
+    const char *error[BATCH_WIDTH];
+    value_list_t *input[BATCH_WIDTH];
+    int input_position[BATCH_WIDTH];
+    value_list_t *output[BATCH_WIDTH];
+    int lanes; /* the lanes in use */
+    machine_t *code; /* the program as it was loaded, decodes the blocks for all the lanes */
+} batch_t;
+
+/**
+ * Get the address of a matrix access for a lane.
+ */
+static int matrix_address(batch_t *b, operand_t *operand, int lane){
+    return (operand->value + b->registers[operand->row][lane] + b->registers[operand->column][lane]) & (MEMORY_SIZE - 1);
+}
+
+/**
+ * Read an operand for all the lanes.
+ *
+ * @param batch_t*      b - The batch.
+ * @param operand_t*    operand - The operand.
+ * @param int*          values - Will hold the value of every lane at the end.
+ */
+static void load_operand(batch_t *b, operand_t *operand, int *values){
+    int lane;
+
+    switch ( operand->method ) {
+        case IMMEDIATE:
+            for ( lane = 0; lane < BATCH_WIDTH; lane++ ) {
+                values[lane] = operand->value & WORD_MASK;
+            }
+            break;
+        case MATRIX_ACCESS:
+            for ( lane = 0; lane < BATCH_WIDTH; lane++ ) {
+                values[lane] = b->memory[matrix_address(b, operand, lane)][lane];
+            }
+            break;
+        case DIRECT:
+            memcpy(values, b->memory[operand->value], sizeof(int) * BATCH_WIDTH);
+            break;
+        default: /* DIRECT_REGISTER */
+            memcpy(values, b->registers[operand->value], sizeof(int) * BATCH_WIDTH);
+    }
+}
+
+/**
+ * Take a lane out of the current block: its instructions after "remaining" weren't run.
+ *
+ * @param batch_t*  b - The batch.
+ * @param int*      mask - The lanes that run the block.
+ * @param int       lane - The lane.
+ * @param int       pc - The address it stopped at.
+ * @param int       remaining - The instructions of the block it won't run.
+ */
+static void leave_block(batch_t *b, int *mask, int lane, int pc, int remaining){
+    b->pc[lane] = pc;
+    b->steps[lane] -= remaining;
+    mask[lane] = 0;
+}
+
+/**
+ * Stop a lane with a runtime error, the instruction that failed is counted as a step like on the simulator.
+ *
+ * @param batch_t*      b - The batch.
+ * @param int*          mask - The lanes that run the block.
+ * @param int           lane - The lane.
+ * @param micro_op_t*   op - The micro op that failed.
+ * @param char*         error - The error message.
+ * @param int           remaining - The instructions of the block after this one.
+ */
+static void lane_error(batch_t *b, int *mask, int lane, micro_op_t *op, const char *error, int remaining){
+    b->status[lane] = MACHINE_ERROR;
+    b->error[lane] = error;
+    leave_block(b, mask, lane, op->address, remaining);
+}
+
+/**
+ * Write a value to the destination operand of the masked lanes. A lane that writes to its code goes on
+ * alone, from the next instruction.
+ *
+ * @param batch_t*      b - The batch.
+ * @param int*          mask - The lanes that run the block, -1 for a lane that runs it and 0 for the others.
+ * @param micro_op_t*   op - The micro op, its destination is a register or a memory word.
+ * @param int*          values - The value of every lane.
+ * @param int           remaining - The instructions of the block after this one.
+ */
+static void store_operand(batch_t *b, int *mask, micro_op_t *op, int *values, int remaining){
+    operand_t *operand = &op->dest;
+    int lane, address, *row;
+
+    if ( operand->method == MATRIX_ACCESS ) {
+        for ( lane = 0; lane < BATCH_WIDTH; lane++ ) {
+            if ( mask[lane] ) {
+                address = matrix_address(b, operand, lane);
+                b->memory[address][lane] = values[lane] & WORD_MASK;
+                if ( b->code->is_code[address] ) {
+                    b->alone[lane] = 1;
+                    leave_block(b, mask, lane, op->next, remaining);
+                }
+            }
+        }
+        return;
+    }
+
+    row = operand->method == DIRECT ? b->memory[operand->value] : b->registers[operand->value];
+    for ( lane = 0; lane < BATCH_WIDTH; lane++ ) {
+        row[lane] = (row[lane] & ~mask[lane]) | (values[lane] & WORD_MASK & mask[lane]);
+    }
+    if ( operand->method == DIRECT && b->code->is_code[operand->value] ) {
+        for ( lane = 0; lane < BATCH_WIDTH; lane++ ) {
+            if ( mask[lane] ) {
+                b->alone[lane] = 1;
+                leave_block(b, mask, lane, op->next, remaining);
+            }
+        }
+    }
+}
+
+/**
+ * Set the program counter of the masked lanes to the target of a jmp, bne or jsr.
+ *
+ * @param batch_t*      b - The batch.
+ * @param int*          mask - The lanes that run the block.
+ * @param operand_t*    operand - The destination operand.
+ * @param int*          taken - 1 for the lanes that jump, the others go on to the next instruction.
+ */
+static void jump(batch_t *b, int *mask, operand_t *operand, int *taken){
+    int lane, target;
+
+    for ( lane = 0; lane < BATCH_WIDTH; lane++ ) {
+        if ( !mask[lane] || !taken[lane] ) {
+            continue;
+        }
+        if ( operand->method == DIRECT_REGISTER ) {
+            target = b->registers[operand->value][lane] & (MEMORY_SIZE - 1);
+        } else if ( operand->method == MATRIX_ACCESS ) {
+            target = matrix_address(b, operand, lane);
+        } else {
+            target = operand->value;
+        }
+        b->pc[lane] = target;
+    }
+}
+
+/**
+ * Run a micro op for the masked lanes.
+ *
+ * @param batch_t*      b - The batch.
+ * @param int*          mask - The lanes that run the block, -1 for a lane that runs it and 0 for the others.
+ * @param micro_op_t*   op - The micro op.
+ * @param int           remaining - The instructions of the block after this one.
+ */
+static void run_op(batch_t *b, int *mask, micro_op_t *op, int remaining){
+    int src[BATCH_WIDTH], dest[BATCH_WIDTH], lane;
+
+    switch ( op->oper ) {
+        case MOV:
+            load_operand(b, &op->src, dest);
+            store_operand(b, mask, op, dest, remaining);
+            break;
+        case CMP:
+            load_operand(b, &op->src, src);
+            load_operand(b, &op->dest, dest);
+            for ( lane = 0; lane < BATCH_WIDTH; lane++ ) {
+                b->zero[lane] = (b->zero[lane] & ~mask[lane]) | ((src[lane] == dest[lane]) & mask[lane]);
+            }
+            break;
+        case ADD:
+        case SUB:
+            load_operand(b, &op->src, src);
+            load_operand(b, &op->dest, dest);
+            if ( op->oper == SUB ) {
+                for ( lane = 0; lane < BATCH_WIDTH; lane++ ) {
+                    src[lane] = -src[lane];
+                }
+            }
+            for ( lane = 0; lane < BATCH_WIDTH; lane++ ) {
+                dest[lane] += src[lane];
+            }
+            store_operand(b, mask, op, dest, remaining);
+            break;
+        case NOT:
+        case INC:
+        case DEC:
+            load_operand(b, &op->dest, dest);
+            if ( op->oper == NOT ) {
+                for ( lane = 0; lane < BATCH_WIDTH; lane++ ) {
+                    dest[lane] = ~dest[lane];
+                }
+            } else {
+                for ( lane = 0; lane < BATCH_WIDTH; lane++ ) {
+                    dest[lane] += op->oper == INC ? 1 : -1;
+                }
+            }
+            store_operand(b, mask, op, dest, remaining);
+            break;
+        case CLR:
+            memset(dest, 0, sizeof(dest));
+            store_operand(b, mask, op, dest, remaining);
+            break;
+        case LEA:
+            for ( lane = 0; lane < BATCH_WIDTH; lane++ ) {
+                dest[lane] = op->src.method == MATRIX_ACCESS ? matrix_address(b, &op->src, lane) : op->src.value;
+            }
+            store_operand(b, mask, op, dest, remaining);
+            break;
+        case JMP:
+        case BNE:
+            for ( lane = 0; lane < BATCH_WIDTH; lane++ ) {
+                dest[lane] = op->oper == JMP || !b->zero[lane];
+            }
+            jump(b, mask, &op->dest, dest);
+            break;
+        case RED:
+            memset(dest, 0, sizeof(dest));
+            for ( lane = 0; lane < BATCH_WIDTH; lane++ ) {
+                if ( mask[lane] ) {
+                    if ( b->input_position[lane] == b->input[lane]->size ) {
+                        lane_error(b, mask, lane, op, "no more input for red", remaining);
+                    } else {
+                        dest[lane] = b->input[lane]->values[b->input_position[lane]++];
+                    }
+                }
+            }
+            store_operand(b, mask, op, dest, remaining);
+            break;
+        case PRN:
+            load_operand(b, &op->dest, dest);
+            for ( lane = 0; lane < BATCH_WIDTH; lane++ ) {
+                if ( mask[lane] && !value_list_add(b->output[lane], dest[lane] >= 1 << (WORD_MAX - 1) ? dest[lane] - (1 << WORD_MAX) : dest[lane]) ) {
+                    lane_error(b, mask, lane, op, "cannot allocate memory", remaining);
+                }
+            }
+            break;
+        case JSR:
+            for ( lane = 0; lane < BATCH_WIDTH; lane++ ) {
+                if ( mask[lane] ) {
+                    if ( b->sp[lane] == STACK_SIZE ) {
+                        lane_error(b, mask, lane, op, "stack overflow", remaining);
+                    } else {
+                        b->stack[b->sp[lane]++][lane] = op->next;
+                    }
+                }
+                dest[lane] = 1;
+            }
+            jump(b, mask, &op->dest, dest);
+            break;
+        case RTS:
+            for ( lane = 0; lane < BATCH_WIDTH; lane++ ) {
+                if ( mask[lane] ) {
+                    if ( b->sp[lane] == 0 ) {
+                        lane_error(b, mask, lane, op, "rts with an empty stack", remaining);
+                    } else {
+                        b->pc[lane] = b->stack[--b->sp[lane]][lane];
+                    }
+                }
+            }
+            break;
+        default: /* STOP */
+            for ( lane = 0; lane < BATCH_WIDTH; lane++ ) {
+                if ( mask[lane] ) {
+                    b->status[lane] = MACHINE_HALTED;
+                    b->pc[lane] = op->address;
+                }
+            }
+    }
+}
+
+/**
+ * Run (a part of) a block for the lanes of the group: count the steps of the whole part first, and
+ * correct them for a lane that leaves in the middle.
+ *
+ * @param batch_t*      b - The batch, its mask is the lanes of the group.
+ * @param micro_op_t*   ops - The micro ops.
+ * @param int           count - The number of micro ops to run.
+ */
+static void run_block(batch_t *b, micro_op_t *ops, int count){
+    int mask[BATCH_WIDTH], lane, i;
+
+    for ( lane = 0; lane < BATCH_WIDTH; lane++ ) {
+        mask[lane] = -b->mask[lane];
+        b->steps[lane] += b->mask[lane] * count;
+        b->pc[lane] = b->mask[lane] ? ops[count - 1].next : b->pc[lane];
+    }
+
+    for ( i = 0; i < count; i++ ) {
+        run_op(b, mask, &ops[i], count - i - 1);
+    }
+
+    for ( lane = 0; lane < BATCH_WIDTH; lane++ ) {
+        if ( mask[lane] && b->status[lane] == MACHINE_RUNNING && b->pc[lane] >= MEMORY_SIZE ) {
+            b->status[lane] = MACHINE_ERROR;
+            b->error[lane] = "the program counter is out of the memory";
+        }
+    }
+}
+
+/**
+ * Decode the block at an address for all the lanes. A lane whose words of the block aren't the words
+ * of the loaded program (it wrote to them before they were decoded) goes on alone.
+ *
+ * @param batch_t*  b - The batch.
+ * @param int       pc - The address.
+ *
+ * @return int - 1 if the block was decoded, 0 if it's not valid code.
+ */
+static int decode_lanes_block(batch_t *b, int pc){
+    micro_op_t *last;
+    int address, lane;
+
+    if ( b->code->blocks[pc].count ) {
+        return 1;
+    }
+    if ( !decode_block(b->code, pc) ) {
+        b->code->status = MACHINE_RUNNING; /* the lanes that run it get the error */
+        return 0;
+    }
+
+    last = b->code->ops + b->code->blocks[pc].first + b->code->blocks[pc].count - 1;
+    for ( address = pc; address < last->next; address++ ) {
+        for ( lane = 0; lane < b->lanes; lane++ ) {
+            if ( b->memory[address][lane] != b->code->memory[address] ) {
+                b->alone[lane] = 1;
+            }
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * Run a lane alone on the simulator, from where it is.
+ *
+ * @param batch_t*      b - The batch.
+ * @param int           lane - The lane.
+ * @param machine_t*    m - A machine to run it on, initialized with the program.
+ * @param long          max_steps - Stop after this many instructions, 0 for no limit.
+ */
+static void run_alone(batch_t *b, int lane, machine_t *m, long max_steps){
+    int i;
+
+    for ( i = 0; i < MEMORY_SIZE; i++ ) {
+        m->memory[i] = b->memory[i][lane];
+    }
+    for ( i = 0; i < NUM_OF_REGISTERS; i++ ) {
+        m->registers[i] = b->registers[i][lane];
+    }
+    for ( i = 0; i < b->sp[lane]; i++ ) {
+        m->stack[i] = b->stack[i][lane];
+    }
+    m->sp = b->sp[lane];
+    m->zero = b->zero[lane];
+    m->pc = b->pc[lane];
+    m->steps = b->steps[lane];
+    m->status = MACHINE_RUNNING;
+    m->input = b->input[lane];
+    m->input_position = b->input_position[lane];
+    m->output = b->output[lane];
+    machine_flush(m);
+
+    machine_run(m, max_steps);
+
+    b->status[lane] = m->status;
+    b->error[lane] = m->error;
+    b->pc[lane] = m->pc;
+    b->steps[lane] = m->steps;
+}
+
+/**
+ * Run the lanes of a batch until they all stop.
+ *
+ * @param batch_t*      b - The batch, loaded.
+ * @param machine_t*    m - A machine to run the lanes that go on alone, initialized with the program.
+ * @param long          max_steps - Stop every lane after this many instructions, 0 for no limit.
+ */
+static void run_batch(batch_t *b, machine_t *m, long max_steps){
+    long work = 0, slots = 0; /* lane steps that were run, and that could have been run, in the current window */
+    int lane, pc, together, running, groups = 0, count;
+
+    for ( ;; ) {
+        /* the lanes at the lowest address run */
+        for ( pc = MEMORY_SIZE, running = 0, lane = 0; lane < b->lanes; lane++ ) {
+            if ( b->status[lane] == MACHINE_RUNNING && !b->alone[lane] ) {
+                if ( max_steps && b->steps[lane] >= max_steps ) {
+                    b->status[lane] = MACHINE_STEP_LIMIT;
+                    continue;
+                }
+                running++;
+                pc = b->pc[lane] < pc ? b->pc[lane] : pc;
+            }
+        }
+        if ( running == 0 ) {
+            break;
+        }
+
+        if ( !decode_lanes_block(b, pc) ) {
+            for ( lane = 0; lane < b->lanes; lane++ ) {
+                if ( b->status[lane] == MACHINE_RUNNING && !b->alone[lane] && b->pc[lane] == pc ) {
+                    b->status[lane] = MACHINE_ERROR;
+                    b->error[lane] = b->code->error;
+                }
+            }
+            continue;
+        }
+
+        /* the block, or as much of it as the lane closest to the step limit could run */
+        count = b->code->blocks[pc].count;
+        for ( together = 0, lane = 0; lane < BATCH_WIDTH; lane++ ) {
+            b->mask[lane] = lane < b->lanes && b->status[lane] == MACHINE_RUNNING && !b->alone[lane] && b->pc[lane] == pc;
+            together += b->mask[lane];
+            if ( b->mask[lane] && max_steps && max_steps - b->steps[lane] < count ) {
+                count = (int) (max_steps - b->steps[lane]);
+            }
+        }
+        if ( together > 0 ) {
+            run_block(b, b->code->ops + b->code->blocks[pc].first, count);
+        }
+
+        /* too far apart for the lockstep to pay, every lane goes on alone */
+        work += (long) together * count;
+        slots += (long) running * count;
+        if ( ++groups == DIVERGENCE_WINDOW ) {
+            if ( work * 4 < slots ) {
+                for ( lane = 0; lane < b->lanes; lane++ ) {
+                    b->alone[lane] = 1;
+                }
+                break;
+            }
+            groups = 0;
+            work = slots = 0;
+        }
+    }
+
+    for ( lane = 0; lane < b->lanes; lane++ ) {
+        if ( b->alone[lane] && b->status[lane] == MACHINE_RUNNING ) {
+            run_alone(b, lane, m, max_steps);
+        }
+    }
+}
+
+/**
+ * Load up to BATCH_WIDTH instances of the program to a batch.
+ *
+ * @param batch_t*          b - The batch.
+ * @param image_t*          image - The program.
+ * @param value_list_t*     inputs - The input of every instance.
+ * @param value_list_t*     outputs - The output of every instance.
+ * @param int               lanes - The number of instances.
+ */
+static void load_batch(batch_t *b, image_t *image, value_list_t *inputs, value_list_t *outputs, int lanes){
+    int i, lane;
+
+    memset(b->memory, 0, sizeof(b->memory));
+    memset(b->registers, 0, sizeof(b->registers));
+    for ( i = 0; i < image->code_size + image->data_size; i++ ) {
+        for ( lane = 0; lane < BATCH_WIDTH; lane++ ) {
+            b->memory[image->base + i][lane] = image->words[i] & WORD_MASK;
+        }
+    }
+
+    b->lanes = lanes;
+    for ( lane = 0; lane < BATCH_WIDTH; lane++ ) {
+        b->zero[lane] = b->sp[lane] = b->alone[lane] = b->mask[lane] = 0;
+        b->pc[lane] = image->base;
+        b->steps[lane] = 0;
+        b->status[lane] = lane < lanes ? MACHINE_RUNNING : MACHINE_HALTED;
+        b->error[lane] = NULL;
+        b->input[lane] = lane < lanes ? &inputs[lane] : NULL;
+        b->output[lane] = lane < lanes ? &outputs[lane] : NULL;
+        b->input_position[lane] = 0;
+    }
+}
+
+/**
+ * Free the lists of values.
+ */
+static void free_value_lists(value_list_t *lists, int count){
+    int i;
+
+    for ( i = 0; lists && i < count; i++ ) {
+        free(lists[i].values);
+    }
+    free(lists);
+}
+
+/**
+ * Read the inputs of the instances: a line of numbers for every instance, empty lines are skipped.
+ *
+ * @param char*             file_name - The file.
+ * @param value_list_t**    inputs - Will point to the (allocated) inputs at the end.
+ *
+ * @return int - The number of instances, -1 if the file couldn't be read or isn't valid.
+ */
+static int read_inputs(char *file_name, value_list_t **inputs){
+    char *contents, *line, *end, *p, *number_end;
+    long length, value;
+    int count = 0, capacity = 0, line_no = 0, ok = 1;
+
+    *inputs = NULL;
+    if ( !(contents = read_whole_file(file_name, &length)) ) {
+        fprintf(stderr, "Cannot open file: %s\n", file_name);
+        return -1;
+    }
+
+    for ( line = contents; ok && *line; line = *end ? end + 1 : end ) {
+        end = line + strcspn(line, "\n");
+        line_no++;
+        for ( p = line; p < end && strchr(" \t\r,", *p); p++ )
+            ;
+        if ( p == end ) {
+            continue;
+        }
+
+        if ( !(ok = ensure_capacity((void **) inputs, &capacity, count + 1, sizeof(value_list_t))) ) {
+            fprintf(stderr, "Cannot allocate memory.\n");
+            break;
+        }
+        memset(&(*inputs)[count], 0, sizeof(value_list_t));
+        (*inputs)[count].values = NULL;
+        count++;
+
+        while ( ok && p < end ) {
+            value = strtol(p, &number_end, 10);
+            if ( number_end == p ) {
+                fprintf(stderr, "%s:%d: Invalid number in the input.\n", file_name, line_no);
+                ok = 0;
+            } else if ( !(ok = value_list_add(&(*inputs)[count - 1], (int) value)) ) {
+                fprintf(stderr, "Cannot allocate memory.\n");
+            }
+            for ( p = number_end; p < end && strchr(" \t\r,", *p); p++ )
+                ;
+        }
+    }
+    free(contents);
+
+    if ( !ok ) {
+        free_value_lists(*inputs, count);
+        *inputs = NULL;
+        return -1;
+    }
+
+    return count;
+}
+
+/**
+ * Run a program once for every line of the batch file, and write a line of output for every instance.
+ *
+ * @param image_t*      image - The program.
+ * @param settings_t*   options - The settings (batch, max_steps).
+ *
+ * @return int - 0 if every instance stopped with stop, 1 otherwise.
+ */
+int batch_simulate(image_t *image, settings_t *options){
+    static batch_t b; /* big */
+    static machine_t code, m; /* they're pointed into by their micro ops */
+    value_list_t *inputs, *outputs;
+    int count, first, lane, i, failed = 0;
+
+    if ( (count = read_inputs(options->batch, &inputs)) < 0 ) {
+        return 1;
+    }
+    if ( !(outputs = calloc((size_t) count + 1, sizeof(value_list_t))) ) {
+        fprintf(stderr, "Cannot allocate memory.\n");
+        free_value_lists(inputs, count);
+        return 1;
+    }
+
+    if ( !machine_init(&code, image, NULL, NULL) ) {
+        fprintf(stderr, "Runtime error at address %d: %s.\n", code.pc, code.error);
+        free_value_lists(inputs, count);
+        free_value_lists(outputs, count);
+        return 1;
+    }
+    machine_init(&m, image, NULL, NULL);
+    b.code = &code;
+
+    for ( first = 0; first < count; first += BATCH_WIDTH ) {
+        load_batch(&b, image, inputs + first, outputs + first, count - first < BATCH_WIDTH ? count - first : BATCH_WIDTH);
+        run_batch(&b, &m, options->max_steps);
+
+        for ( lane = 0; lane < b.lanes; lane++ ) {
+            printf("%d:", first + lane + 1);
+            for ( i = 0; i < outputs[first + lane].size; i++ ) {
+                printf(" %d", outputs[first + lane].values[i]);
+            }
+            if ( b.status[lane] == MACHINE_ERROR ) {
+                printf(" (runtime error at address %d: %s)", b.pc[lane], b.error[lane]);
+            } else if ( b.status[lane] == MACHINE_STEP_LIMIT ) {
+                printf(" (stopped after %ld steps at address %d)", b.steps[lane], b.pc[lane]);
+            }
+            putchar('\n');
+            failed |= b.status[lane] != MACHINE_HALTED;
+        }
+    }
+
+    machine_free(&code);
+    machine_free(&m);
+    free_value_lists(inputs, count);
+    free_value_lists(outputs, count);
+
+    return failed;
+}
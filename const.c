@@ -0,0 +1,513 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "header.h"
+
+/*
+ * Constants and compile time expressions.
+ *
+ *      .define SIZE = 4 * 2
+ *      .data SIZE, SIZE*2-1
+ *      mov #SIZE-1, r2
+ *
+ * An expression is made of numbers, constant names, + - * / % and parentheses. Inside an operand or a
+ * data list it can't have white spaces, since they separate the words of the line.
+ * A constant could be used before it's defined: a .define that uses an unknown constant is evaluated
+ * when the constant is needed, and a data word that uses an unknown constant is written as 0 and
+ * fixed at the end of the first scan (the fixup list). Immediate operands are encoded in the second scan,
+ * when all the constants are already known.
+ */
+
+enum {CONST_DEFINED = 0, CONST_PENDING, CONST_RESOLVING};
+
+/* the state of the expression parser */
+typedef struct{
+    constant_table_t *table; /* NULL to only check the syntax */
+    const char *p; /* the next char to parse */
+    int status; /* EXPR_OK, or the first error we found */
+    char name[LINE_MAX]; /* the constant that caused the error, if any */
+} expr_parser;
+
+static int parse_sum(expr_parser *parser);
+
+/**
+ * Initialize an empty constant table.
+ *
+ * @param constant_table_t*     table - The table to initialize.
+ */
+void constant_table_init(constant_table_t *table){
+    name_table_init(&table->names);
+    table->constants = NULL;
+    table->capacity = 0;
+}
+
+/**
+ * Free the memory of the constant table.
+ *
+ * @param constant_table_t*     table - The table to free.
+ */
+void constant_table_free(constant_table_t *table){
+    name_table_free(&table->names);
+    free(table->constants);
+    constant_table_init(table);
+}
+
+/**
+ * Skip white spaces inside an expression.
+ *
+ * @param expr_parser*  parser - The parser.
+ */
+static void skip_expression_spaces(expr_parser *parser){
+    while ( *parser->p == ' ' || *parser->p == '\t' ) {
+        parser->p++;
+    }
+}
+
+/**
+ * Record an error, only the first error of the expression is kept.
+ *
+ * @param expr_parser*  parser - The parser.
+ * @param int           status - The error, EXPR_*.
+ */
+static void expression_error(expr_parser *parser, int status){
+    if ( parser->status == EXPR_OK ) {
+        parser->status = status;
+    }
+}
+
+/**
+ * Get the value of a constant, its expression is evaluated if it wasn't evaluated yet.
+ *
+ * @param expr_parser*  parser - The parser, the error (if any) is recorded in it.
+ * @param char*         name - The constant name.
+ *
+ * @return int - The value of the constant, 0 on error.
+ */
+static int constant_value(expr_parser *parser, char *name){
+    constant_t *constant;
+    expr_parser inner;
+    int index;
+
+    if ( !parser->table ) { /* syntax check only */
+        return 0;
+    }
+
+    if ( (index = name_table_find(&parser->table->names, name)) == -1 ) {
+        expression_error(parser, EXPR_UNDEFINED);
+        strcpy(parser->name, name);
+        return 0;
+    }
+
+    constant = &parser->table->constants[index];
+    if ( constant->state == CONST_RESOLVING ) { /* the constant is defined by itself */
+        expression_error(parser, EXPR_CYCLE);
+        strcpy(parser->name, name);
+        return 0;
+    }
+
+    if ( constant->state == CONST_PENDING ) {
+        inner.table = parser->table;
+        inner.p = parser->table->names.text + constant->expression;
+        inner.status = EXPR_OK;
+        inner.name[0] = '\0';
+
+        constant->state = CONST_RESOLVING;
+        constant->value = parse_sum(&inner);
+        constant = &parser->table->constants[index];
+        constant->state = inner.status == EXPR_OK ? CONST_DEFINED : CONST_PENDING;
+
+        if ( inner.status != EXPR_OK ) {
+            expression_error(parser, inner.status);
+            strcpy(parser->name, inner.name);
+            return 0;
+        }
+    }
+
+    return constant->value;
+}
+
+/**
+ * factor: number | name | ( sum ) | + factor | - factor
+ *
+ * @param expr_parser*  parser - The parser.
+ *
+ * @return int - The value of the factor.
+ */
+static int parse_factor(expr_parser *parser){
+    char name[LINE_MAX];
+    int value = 0, length = 0;
+
+    skip_expression_spaces(parser);
+
+    if ( *parser->p == '+' || *parser->p == '-' ) {
+        char sign = *parser->p++;
+        value = parse_factor(parser);
+        return sign == '-' ? -value : value;
+    }
+
+    if ( *parser->p == '(' ) {
+        parser->p++;
+        value = parse_sum(parser);
+        skip_expression_spaces(parser);
+        if ( *parser->p != ')' ) {
+            expression_error(parser, EXPR_SYNTAX);
+            return 0;
+        }
+        parser->p++;
+        return value;
+    }
+
+    if ( isdigit((unsigned char) *parser->p) ) {
+        while ( isdigit((unsigned char) *parser->p) ) {
+            value = value * 10 + (*parser->p++ - '0');
+        }
+        return value;
+    }
+
+    if ( isalpha((unsigned char) *parser->p) ) {
+        while ( isalnum((unsigned char) *parser->p) && length < LABEL_MAX ) {
+            name[length++] = *parser->p++;
+        }
+        name[length] = '\0';
+        if ( isalnum((unsigned char) *parser->p) ) { /* too long to be a name */
+            expression_error(parser, EXPR_SYNTAX);
+            return 0;
+        }
+        return constant_value(parser, name);
+    }
+
+    expression_error(parser, EXPR_SYNTAX);
+    return 0;
+}
+
+/**
+ * term: factor { (* | / | %) factor }
+ *
+ * @param expr_parser*  parser - The parser.
+ *
+ * @return int - The value of the term.
+ */
+static int parse_term(expr_parser *parser){
+    int value = parse_factor(parser), right;
+    char operation;
+
+    skip_expression_spaces(parser);
+    while ( *parser->p == '*' || *parser->p == '/' || *parser->p == '%' ) {
+        operation = *parser->p++;
+        right = parse_factor(parser);
+
+        if ( operation == '*' ) {
+            value *= right;
+        } else if ( right == 0 ) {
+            if ( parser->table && parser->status == EXPR_OK ) { /* the value of a name is unknown in a syntax check */
+                expression_error(parser, EXPR_DIVISION_BY_ZERO);
+            }
+            value = 0;
+        } else {
+            value = operation == '/' ? value / right : value % right;
+        }
+        skip_expression_spaces(parser);
+    }
+
+    return value;
+}
+
+/**
+ * sum: term { (+ | -) term }
+ *
+ * @param expr_parser*  parser - The parser.
+ *
+ * @return int - The value of the sum.
+ */
+static int parse_sum(expr_parser *parser){
+    int value = parse_term(parser);
+    char operation;
+
+    skip_expression_spaces(parser);
+    while ( *parser->p == '+' || *parser->p == '-' ) {
+        operation = *parser->p++;
+        value = operation == '+' ? value + parse_term(parser) : value - parse_term(parser);
+        skip_expression_spaces(parser);
+    }
+
+    return value;
+}
+
+/**
+ * Evaluate an expression. The expression ends at the end of the string, a '\n' or a ';' (a comment).
+ *
+ * @param constant_table_t*     table - The constants the expression could use, NULL to only check the syntax.
+ * @param char*                 expression - The expression.
+ * @param int*                  value - Will hold the value at the end.
+ * @param char*                 name - If not NULL, will hold the name of the constant that caused the error (if any).
+ *
+ * @return int - EXPR_OK if everything went OK, otherwise the error: EXPR_SYNTAX, EXPR_UNDEFINED,
+ *               EXPR_DIVISION_BY_ZERO or EXPR_CYCLE.
+ */
+int eval_expression(constant_table_t *table, const char *expression, int *value, char *name){
+    expr_parser parser;
+
+    parser.table = table;
+    parser.p = expression;
+    parser.status = EXPR_OK;
+    parser.name[0] = '\0';
+
+    *value = parse_sum(&parser);
+
+    skip_expression_spaces(&parser);
+    if ( *parser.p != '\0' && *parser.p != '\n' && *parser.p != '\r' && *parser.p != ';' ) {
+        expression_error(&parser, EXPR_SYNTAX);
+    }
+
+    if ( name ) {
+        strcpy(name, parser.name);
+    }
+
+    return parser.status;
+}
+
+/**
+ * Check the syntax of an expression.
+ *
+ * @param char*     expression - The expression.
+ *
+ * @return int - 1 if the syntax is valid, 0 otherwise.
+ */
+int is_valid_expression(const char *expression){
+    int value;
+
+    return eval_expression(NULL, expression, &value, NULL) != EXPR_SYNTAX;
+}
+
+/**
+ * Report an expression error.
+ *
+ * @param assembler_t*  as - The assembler context.
+ * @param int           status - The error, EXPR_*.
+ * @param char*         expression - The expression.
+ * @param char*         name - The constant that caused the error.
+ * @param int           line - The line number.
+ * @param int           column - The column of the expression.
+ */
+static void report_expression_error(assembler_t *as, int status, char *expression, char *name, int line, int column){
+    switch ( status ) {
+        case EXPR_UNDEFINED:
+            diag_report(&as->diag, line, column, DIAG_UNDEFINED_CONSTANT, 1, "Undefined constant: %s", name);
+            break;
+        case EXPR_CYCLE:
+            diag_report(&as->diag, line, column, DIAG_INVALID_EXPRESSION, 1, "The constant %s is defined by itself", name);
+            break;
+        case EXPR_DIVISION_BY_ZERO:
+            diag_report(&as->diag, line, column, DIAG_INVALID_EXPRESSION, 1, "Division by zero: %s", expression);
+            break;
+        default:
+            diag_report(&as->diag, line, column, DIAG_INVALID_EXPRESSION, 1, "Invalid expression: %s", expression);
+    }
+}
+
+/**
+ * Handle a ".define NAME = expression" line.
+ *
+ * @param assembler_t*  as - The assembler context.
+ * @param char*         line - The line.
+ * @param int           pos - The position after the ".define".
+ * @param int           line_number - The line number.
+ *
+ * @return int - 1 if everything went OK, 0 otherwise (the error is reported).
+ */
+int parse_define(assembler_t *as, char *line, int pos, int line_number){
+    constant_table_t *table = &as->constants;
+    char name[LINE_MAX], undefined_name[LINE_MAX];
+    int length = 0, name_pos, expression_pos, index, status, value;
+
+    skip_white_space(line, &pos);
+    name_pos = pos;
+    while ( isalnum((unsigned char) line[pos]) && length < LINE_MAX - 1 ) {
+        name[length++] = line[pos++];
+    }
+    name[length] = '\0';
+
+    if ( !check_word(name, LABEL) ) {
+        diag_report(&as->diag, line_number, name_pos + 1, DIAG_INVALID_LABEL, 1, "invalid constant name: '%s'", name);
+        return 0;
+    }
+    if ( name_table_find(&table->names, name) != -1 ) {
+        diag_report(&as->diag, line_number, name_pos + 1, DIAG_DUPLICATE_SIGN, 1, "The constant %s defined more then once", name);
+        return 0;
+    }
+
+    skip_white_space(line, &pos);
+    if ( line[pos] != '=' ) {
+        diag_report(&as->diag, line_number, pos + 1, DIAG_INVALID_EXPRESSION, 1, ".define should be in the form: .define NAME = expression");
+        return 0;
+    }
+    pos++;
+    skip_white_space(line, &pos);
+    expression_pos = pos;
+    line[pos + strcspn(line + pos, "\r\n;")] = '\0';
+
+    if ( !is_valid_expression(line + expression_pos) || line[expression_pos] == '\0' ) {
+        report_expression_error(as, EXPR_SYNTAX, line + expression_pos, NULL, line_number, expression_pos + 1);
+        return 0;
+    }
+
+    if ( !ensure_capacity((void **) &table->constants, &table->capacity, table->names.size + 1, sizeof(constant_t))
+         || (index = name_table_insert(&table->names, name)) < 0
+         || (table->constants[index].expression = name_table_add_text(&table->names, line + expression_pos, (int) strlen(line + expression_pos))) < 0 ) {
+        diag_report(&as->diag, line_number, 0, DIAG_MEMORY, 1, "Cannot allocate memory for constant %s", name);
+        return 0;
+    }
+    table->constants[index].state = CONST_PENDING;
+    table->constants[index].line = line_number;
+    table->constants[index].column = expression_pos + 1;
+    table->constants[index].value = 0;
+
+    /* evaluate it now if we can, a constant that isn't defined yet is fine, we'll try again when it's needed */
+    status = eval_expression(table, name, &value, undefined_name);
+    if ( status != EXPR_OK && status != EXPR_UNDEFINED ) {
+        report_expression_error(as, status, line + expression_pos, undefined_name, line_number, expression_pos + 1);
+        table->constants[index].state = CONST_DEFINED; /* so it isn't reported again */
+        return 0;
+    }
+
+    return 1;
+}
+
+/**
+ * Get the value of a number in a data list (.data / .mat), which could be a literal number or an expression.
+ * If the expression uses a constant that isn't defined yet, the value is 0 and a fixup is added for
+ * the data word that is going to be inserted (at as->dc), so it's fixed at the end of the first scan.
+ *
+ * @param assembler_t*  as - The assembler context.
+ * @param char*         arg - The number or the expression.
+ * @param int           line - The line number.
+ * @param int           column - The column of the number.
+ * @param int*          num - Will hold the value at the end.
+ *
+ * @return int - 1 if everything went OK, 0 if the number is invalid (the error is reported).
+ */
+int fold_data_value(assembler_t *as, char *arg, int line, int column, int *num){
+    char name[LINE_MAX];
+    fixup_t *fixup;
+    int status;
+
+    if ( num_isvalid(arg) ) { /* the common case, a literal number */
+        *num = atoi(arg);
+        return 1;
+    }
+
+    if ( !is_valid_expression(arg) ) {
+        diag_report(&as->diag, line, column, DIAG_INVALID_NUMBER, 1, "Invalid number: %s", arg);
+        return 0;
+    }
+
+    status = eval_expression(&as->constants, arg, num, name);
+    if ( status == EXPR_OK ) {
+        return 1;
+    }
+    if ( status != EXPR_UNDEFINED ) {
+        report_expression_error(as, status, arg, name, line, column);
+        return 0;
+    }
+
+    /* the constant isn't defined yet */
+    if ( !ensure_capacity((void **) &as->fixups, &as->fixups_capacity, as->fixups_size + 1, sizeof(fixup_t)) ) {
+        diag_report(&as->diag, line, 0, DIAG_MEMORY, 1, "Cannot allocate memory for fixup");
+        return 0;
+    }
+    fixup = &as->fixups[as->fixups_size];
+    if ( (fixup->expression = name_table_add_text(&as->constants.names, arg, (int) strlen(arg))) < 0 ) {
+        diag_report(&as->diag, line, 0, DIAG_MEMORY, 1, "Cannot allocate memory for fixup");
+        return 0;
+    }
+    fixup->index = as->dc;
+    fixup->line = line;
+    fixup->column = column;
+    as->fixups_size++;
+
+    *num = 0;
+
+    return 1;
+}
+
+/**
+ * Fold an immediate operand ("#expression") to a literal number, so it could be encoded.
+ *
+ * @param assembler_t*  as - The assembler context.
+ * @param char*         arg - The operand, replaced by "#number" at the end.
+ * @param int           line - The line number.
+ * @param int           column - The column of the operand.
+ *
+ * @return int - 1 if everything went OK, 0 otherwise (the error is reported).
+ */
+int fold_immediate(assembler_t *as, char *arg, int line, int column){
+    char name[LINE_MAX];
+    int status, value;
+
+    if ( num_isvalid(arg + 1) ) { /* already a literal number, checked by the first scan */
+        return 1;
+    }
+
+    if ( (status = eval_expression(&as->constants, arg + 1, &value, name)) != EXPR_OK ) {
+        report_expression_error(as, status, arg + 1, name, line, column);
+        return 0;
+    }
+
+    if ( !is_immediate_in_range(value) ) {
+        diag_report(&as->diag, line, column, DIAG_NUMBER_TOO_BIG, 1, "The immediate value %d (%s) is out of range", value, arg + 1);
+        return 0;
+    }
+
+    sprintf(arg, "#%d", value);
+
+    return 1;
+}
+
+/**
+ * Fix the data words that used constants that weren't defined yet, and make sure every constant
+ * has a value. Called at the end of the first scan, when all the constants are known.
+ *
+ * @param assembler_t*  as - The assembler context.
+ *
+ * @return int - 0 if everything went OK, 1 otherwise (the errors are reported).
+ */
+int resolve_fixups(assembler_t *as){
+    constant_table_t *table = &as->constants;
+    char name[LINE_MAX], *expression;
+    int i, status, value, too_big, error = 0;
+    fixup_t *fixup;
+
+    for ( i = 0; i < as->fixups_size; i++ ) {
+        fixup = &as->fixups[i];
+        expression = table->names.text + fixup->expression;
+
+        if ( (status = eval_expression(table, expression, &value, name)) != EXPR_OK ) {
+            report_expression_error(as, status, expression, name, fixup->line, fixup->column);
+            error = 1;
+            continue;
+        }
+
+        too_big = 0;
+        as->data_seg[fixup->index] = trans_to_word(value, &too_big);
+        if ( too_big ) {
+            diag_report(&as->diag, fixup->line, fixup->column, DIAG_NUMBER_TOO_BIG, 1, "Number's size is bigger than the word size (%d bits).", WORD_MAX);
+            error = 1;
+        }
+    }
+
+    /* constants that were never used still need a value */
+    for ( i = 0; i < table->names.size; i++ ) {
+        if ( table->constants[i].state != CONST_PENDING ) {
+            continue;
+        }
+        expression = table->names.text + table->constants[i].expression;
+        if ( (status = eval_expression(table, name_table_name(&table->names, i), &value, name)) != EXPR_OK ) {
+            report_expression_error(as, status, expression, name, table->constants[i].line, table->constants[i].column);
+            table->constants[i].state = CONST_DEFINED;
+            error = 1;
+        }
+    }
+
+    return error;
+}
@@ -9,6 +9,7 @@
  *
  * @param table_of_signs**          signs_table - The signs table. Double pointer as we want to change it.
  * @param int*                      table_size - The size of the table.
+ * @param int*                      table_capacity - The capacity of the table.
  * @param char*                     sign_name - The sign to insert.
  * @param int                       address - The address of the sign
  * @param int                       external - Whether it is an external variable or not, 0 - false, 1 - true, 2 - unknown
@@ -16,31 +17,26 @@
  *
  * @return int - 1 if the sign entered successfully, -1 if the sign already exists in the table, -2 on memory error.
  */
-int insert_sign(table_of_signs **table, int *table_size, char *sign_name, int address, int external, int operation){
-	size_t new_table_size;
-
+int insert_sign(table_of_signs **table, int *table_size, int *table_capacity, char *sign_name, int address, int external, int operation){
     /* check if the sign already exists in the table */
     if ( sign_already_exists(*table, *table_size, sign_name) ) {
         return -1;
     }
 
-	(*table_size)++;	
-	new_table_size = (*table_size) * sizeof(table_of_signs);
-	*table = (table_of_signs *) realloc(*table, new_table_size); /* memory allocation for the table new cell */
-
-	(*table)[(*table_size)-1].label_name = (char *)malloc(strlen(sign_name)); /*memory allocation for the new sign name */
-
-	if ( !(*table) || !(*table)[(*table_size)-1].label_name ) { /* if there is a memory allocation problem */
+	/* memory allocation for the table new cell, and for the new sign name */
+	if ( !ensure_capacity((void **) table, table_capacity, *table_size + 1, sizeof(table_of_signs))
+	     || !((*table)[*table_size].label_name = (char *)malloc(strlen(sign_name) + 1)) ) {
 		fprintf(stderr, "cannot allocate memory for signs table");
-		(*table_size)--; /* the size hasn't changed */
 		return -2;
 	}
+	(*table_size)++;
 
 	/* else, add the new sign */
 	strcpy((*table)[(*table_size)-1].label_name, sign_name);
 	(*table)[(*table_size)-1].address = address;
 	(*table)[(*table_size)-1].external = external;
 	(*table)[(*table_size)-1].operation = operation;
+	(*table)[(*table_size)-1].alias = 0;
 
 	return 1;
 }
@@ -69,26 +65,23 @@ void signs_table_update(table_of_signs *table, int table_size, int inst_count) {
  *
  * @param data_table**      ent_table - Pointer to point the entry table.
  * @param int*              ent_size - Pointer to the size of the entry table.
+ * @param int*              ent_capacity - Pointer to the capacity of the entry table.
  * @param char*             ent_label - The label to insert.
  * @param table_of_signs*   table_signs - Pointer to the table of signs.
  * @param int               table_of_sings_size -The size of the table of signs as we want to loop over it.
  *
  * @return int - 1 if update went successfully, 0 otherwise.
  */
-int update_ent_table(data_table **ent_table, int *ent_size, char *ent_label, table_of_signs *table_signs, int table_of_sings_size) {
+int update_ent_table(data_table **ent_table, int *ent_size, int *ent_capacity, char *ent_label, table_of_signs *table_signs, int table_of_sings_size) {
 	int i;
-    size_t new_table_size;
 
-    (*ent_size)++;
-    new_table_size = (*ent_size) * sizeof(data_table);
-    *ent_table = realloc(*ent_table, new_table_size); /* memory allocation for the table new cell */
-    (*ent_table)[(*ent_size)-1].label_name = (char *)malloc(strlen(ent_label)); /*memory allocation for the new sign name */
-
-    if ( !(*ent_table) || !(*ent_table)[(*ent_size)-1].label_name ) { /* if there is a memory allocation problem */
+    /* memory allocation for the table new cell, and for the new sign name */
+    if ( !ensure_capacity((void **) ent_table, ent_capacity, *ent_size + 1, sizeof(data_table))
+         || !((*ent_table)[*ent_size].label_name = (char *)malloc(strlen(ent_label) + 1)) ) {
         printf("Failed to add %s to the entry table.\n", ent_label);
-        (*ent_size)--; /* the size hasn't changed */
         return 0;
     }
+    (*ent_size)++;
 
     for ( i = 0; i < table_of_sings_size; i++ ) { /*/ search the label on the signs_table*/
         if ( strcmp(table_signs[i].label_name, ent_label) == 0 && !table_signs[i].external ){ /* the label was found, and it's not define as external, update the entry table */
@@ -99,6 +92,7 @@ int update_ent_table(data_table **ent_table, int *ent_size, char *ent_label, tab
         }
     }
 
+    free((*ent_table)[(*ent_size)-1].label_name);
     (*ent_size)--; /* the size hasn't changed */
 
     return 0; /* failed to update the entry table */
@@ -109,24 +103,20 @@ int update_ent_table(data_table **ent_table, int *ent_size, char *ent_label, tab
  * 
  * @param data_table*   table - The table to update.
  * @param int*          table_size - The size of the table.
+ * @param int*          table_capacity - The capacity of the table.
  * @param char*         label - The label to insert.
  * @param int           address - The address to insert.
  *
  * @return int 1 if everything went OK, 0 otherwise.
  */
-int update_ext_table(data_table **table, int *table_size, char *label, int address){
-    size_t new_table_size;
-
-    (*table_size)++;
-    new_table_size = (*table_size) * sizeof(data_table);
-    *table = realloc(*table, new_table_size); /* memory allocation for the table new cell */
-    (*table)[(*table_size)-1].label_name = (char *)malloc(strlen(label)); /*memory allocation for the new sign name */
-
-    if ( !(*table) || !(*table)[(*table_size)-1].label_name ) { /* if there is a memory allocation problem */
+int update_ext_table(data_table **table, int *table_size, int *table_capacity, char *label, int address){
+    /* memory allocation for the table new cell, and for the new sign name */
+    if ( !ensure_capacity((void **) table, table_capacity, *table_size + 1, sizeof(data_table))
+         || !((*table)[*table_size].label_name = (char *)malloc(strlen(label) + 1)) ) {
         printf("Failed to add the label %s to te externa label.\n", label);
-        (*table_size)--; /* the size hasn't changed */
         return 0;
     }
+    (*table_size)++;
 
     strcpy((*table)[(*table_size)-1].label_name, label);
     (*table)[(*table_size)-1].address = (unsigned) address;
@@ -137,22 +127,28 @@ int update_ext_table(data_table **table, int *table_size, char *label, int addre
 /**
  * Add "new_word_code" (the binary code of the word) to data_code_image (data image or code image)
  *
+ * @param spilled The spilled segments of the context, the image is moved to a file when it's over their budget.
  * @param data_code_image The data code image to insert the code to.
  * @param size The size of the image.
+ * @param capacity The capacity of the image.
  * @param new_word_code The code to insert.
  *
  * @return 1 if everything went ok, 0 otherwise.
  */
-int code_insert(word_t **data_code_image, int *size, word_t new_word_code){
-	(*size)++;
-	*data_code_image=(word_t *) realloc((*data_code_image), (*size)*sizeof(word_t));
+int code_insert(spill_table_t *spilled, word_t **data_code_image, int *size, int *capacity, word_t new_word_code){
+    switch ( segment_spill_insert(spilled, data_code_image, size, new_word_code) ) { /* over the budget of --mem-limit */
+        case 1:
+            return 1;
+        case -1:
+            printf("Cannot allocate memory for segment\n");
+            return 0;
+    }
 
-	if ( !(*data_code_image) ) {
+	if ( !ensure_capacity((void **) data_code_image, capacity, *size + 1, sizeof(word_t)) ) {
 		printf("Cannot allocate memory for segment\n");
-		(*size)--; /* the size hasn't changed */
 		return 0;
 	}
-	(*data_code_image)[(*size)-1] = new_word_code;
+	(*data_code_image)[(*size)++] = new_word_code;
 
 	return 1;
 }
@@ -161,13 +157,14 @@ int code_insert(word_t **data_code_image, int *size, word_t new_word_code){
 /**
  * Print the code and data segments to the .ob file (first the code than the data).
  *
+ * @param spill_table_t* spilled - The spilled segments of the context, the pages that were printed are released.
  * @param word_t*       code_image - Pointer to the code image.
  * @param word_t*       data_image - Pointer to the data image.
  * @param int           inst_count - The size of the code segment.
  * @param int           data_count - The size of the data segment.
  * @param FILE*         obj_file - The .obj file that we want to print the data to.
  */
-void ob_print(word_t *code_image, word_t *data_image, int inst_count, int data_count, FILE *obj_file) {
+void ob_print(spill_table_t *spilled, word_t *code_image, word_t *data_image, int inst_count, int data_count, FILE *obj_file) {
 	int i, j;
 
     /* allocate memory for pointers that will hold the base 4 "mozar" strings */
@@ -202,6 +199,9 @@ void ob_print(word_t *code_image, word_t *data_image, int inst_count, int data_c
         /* reset the pointers for the next iteration */
         memset(address, '\0', 1);
         memset(machine_code, '\0', 1);
+        if ( (j + 1) % SEGMENT_STREAM_WORDS == 0 ) {
+            segment_release(spilled, code_image, j + 1);
+        }
 	}
 
     /* print the data segment */
@@ -215,6 +215,9 @@ void ob_print(word_t *code_image, word_t *data_image, int inst_count, int data_c
         /* reset the pointers for the next iteration */
         memset(address, '\0', 1);
         memset(machine_code, '\0', 1);
+        if ( (j + 1) % SEGMENT_STREAM_WORDS == 0 ) {
+            segment_release(spilled, data_image, j + 1);
+        }
 	}
 
     free(address);
@@ -239,4 +242,109 @@ void e_print(data_table *table, int table_size, FILE *file){
         fprintf(file, "%s\n", base_4_mozar_address);
 	}
     free(base_4_mozar_address);
+}
+
+
+/**
+ * Print the extern table in the compact format (--compact-ext): every symbol once, with the addresses of its uses
+ * sorted, the first of them and then the distance of every use from the one before it, in base 4 "mozar".
+ *
+ * Every use is a word of the code segment, so the uses are sorted by a table of the code addresses, and grouped
+ * by their symbol with a count of the uses of every symbol, in O(uses + code words). The symbols come in the order
+ * of their first use. When an address isn't a single word of the code segment, the table is printed as it is by
+ * e_print() (a plain line is a compact line of one use).
+ *
+ * @param data_table*   table - The extern table.
+ * @param int           table_size - Size of the table.
+ * @param int           inst_count - The IC counter.
+ * @param FILE*         file - The file to print to.
+ *
+ * @return int - 1 if everything went OK, 0 on memory error.
+ */
+int ext_print_compact(data_table *table, int table_size, int inst_count, FILE *file){
+    name_table_t symbols;
+    char *base_4_mozar_address;
+    int *use_at, *symbol_of, *first, *order = NULL, first_capacity = 0, i, j, symbol, previous, ok = 1;
+
+    use_at = malloc(((size_t) inst_count + 1) * sizeof(int));
+    symbol_of = malloc(((size_t) table_size + 1) * sizeof(int));
+    base_4_mozar_address = malloc(sizeof(char));
+    first = NULL;
+    name_table_init(&symbols);
+    if ( !use_at || !symbol_of || !base_4_mozar_address ) {
+        ok = 0;
+    }
+
+    /* the use at every code address */
+    for ( i = 0; ok && i < inst_count; i++ ) {
+        use_at[i] = -1;
+    }
+    for ( i = 0; ok && i < table_size; i++ ) {
+        j = table[i].address - INITIAL_IC;
+        if ( j < 0 || j >= inst_count || use_at[j] != -1 ) {
+            break;
+        }
+        use_at[j] = i;
+    }
+    if ( ok && i < table_size ) {
+        free(use_at);
+        free(symbol_of);
+        free(base_4_mozar_address);
+        e_print(table, table_size, file);
+        return 1;
+    }
+
+    /* the symbol of every use, and the number of uses of every symbol (in first), by the order of the addresses */
+    for ( i = 0; ok && i < inst_count; i++ ) {
+        if ( use_at[i] == -1 ) {
+            continue;
+        }
+        if ( (symbol = name_table_find(&symbols, table[use_at[i]].label_name)) == -1 ) {
+            if ( (symbol = name_table_insert(&symbols, table[use_at[i]].label_name)) < 0
+                 || !ensure_capacity((void **) &first, &first_capacity, symbol + 2, sizeof(int)) ) {
+                ok = 0;
+                break;
+            }
+            first[symbol + 1] = 0;
+        }
+        symbol_of[use_at[i]] = symbol;
+        first[symbol + 1]++;
+    }
+
+    /* the uses of every symbol, sorted, from first[symbol] to first[symbol + 1] */
+    if ( ok && symbols.size > 0 && (order = malloc((size_t) table_size * sizeof(int))) ) {
+        for ( first[0] = 0, symbol = 1; symbol <= symbols.size; symbol++ ) {
+            first[symbol] += first[symbol - 1];
+        }
+        for ( i = 0; i < inst_count; i++ ) {
+            if ( use_at[i] != -1 ) {
+                order[first[symbol_of[use_at[i]]]++] = use_at[i];
+            }
+        }
+        for ( symbol = symbols.size; symbol > 0; symbol-- ) { /* the placing moved every first to the next one */
+            first[symbol] = first[symbol - 1];
+        }
+        first[0] = 0;
+
+        for ( symbol = 0; symbol < symbols.size; symbol++ ) {
+            fprintf(file, "%-30s", name_table_name(&symbols, symbol));
+            for ( previous = 0, j = first[symbol]; j < first[symbol + 1]; j++ ) {
+                convert_num_to_base_four_mozar(table[order[j]].address - previous, &base_4_mozar_address);
+                fprintf(file, j == first[symbol] ? "%s" : " %s", base_4_mozar_address);
+                previous = table[order[j]].address;
+            }
+            fprintf(file, "\n");
+        }
+    } else if ( symbols.size > 0 ) {
+        ok = 0;
+    }
+
+    name_table_free(&symbols);
+    free(use_at);
+    free(symbol_of);
+    free(first);
+    free(order);
+    free(base_4_mozar_address);
+
+    return ok;
 }
\ No newline at end of file
@@ -0,0 +1,482 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "header.h"
+
+/*
+ * The debug information (-g). The second scan adds a row to the line table for every instruction it
+ * encodes, so the table needs no pass of its own and its rows are already sorted by address. With the
+ * symbols it's written to NAME.dbg, which the tools look up in place, without reading it into tables:
+ *
+ *      header          the magic "MZD1", the base address, the number of rows, of symbols and of files, the
+ *                      size of the strings and the size of the deltas, as 4 bytes little endian numbers
+ *      checkpoints     every DEBUG_CHECKPOINT rows, the full row (address, file, line) and the offset of the
+ *                      rows after it in the deltas, 4 numbers, so a lookup is a binary search over them
+ *      symbols         by address, the address, the kind (code, data or extern) and the offset of the name,
+ *                      3 numbers, an external symbol is at every word that uses it
+ *      files           the offset of the name of every source file
+ *      strings         the names, null terminated
+ *      deltas          every row that isn't a checkpoint, from the row before it: the address delta, and the
+ *                      line delta (zigzag) shifted left by 1 with 1 if the file changed, followed by the file,
+ *                      as base 128 numbers (7 bits in a byte, the high bit set if more bytes follow)
+ *
+ * An instruction takes 1 - 5 words and follows the line before it, so a row is 2 bytes in the deltas.
+ */
+
+#define DEBUG_MAGIC "MZD1"
+#define DEBUG_HEADER_SIZE 28
+#define DEBUG_CHECKPOINT 16 /* rows between two checkpoints */
+#define CHECKPOINT_SIZE 16
+#define SYMBOL_SIZE 12
+
+/**
+ * Initialize an empty line table.
+ *
+ * @param line_table_t*     table - The line table.
+ */
+void line_table_init(line_table_t *table){
+    table->rows = NULL;
+    table->rows_size = table->rows_capacity = 0;
+}
+
+/**
+ * Remove the rows of the line table, its memory is kept for the next source.
+ *
+ * @param line_table_t*     table - The line table.
+ */
+void line_table_clear(line_table_t *table){
+    table->rows_size = 0;
+}
+
+/**
+ * Free the memory of the line table.
+ *
+ * @param line_table_t*     table - The line table.
+ */
+void line_table_free(line_table_t *table){
+    free(table->rows);
+    line_table_init(table);
+}
+
+/**
+ * Add the row of an instruction, the instructions are added by their addresses.
+ *
+ * @param line_table_t*     table - The line table.
+ * @param int               address - The address of the first word of the instruction.
+ * @param int               line - The source line.
+ *
+ * @return int - 1 if everything went OK, 0 on memory error.
+ */
+int line_table_add(line_table_t *table, int address, int line){
+    if ( !ensure_capacity((void **) &table->rows, &table->rows_capacity, table->rows_size + 1, sizeof(line_row_t)) ) {
+        return 0;
+    }
+    table->rows[table->rows_size].address = address;
+    table->rows[table->rows_size].line = line;
+    table->rows_size++;
+
+    return 1;
+}
+
+/* the bytes of the deltas, while they're encoded */
+typedef struct{
+    unsigned char *bytes;
+    int size;
+    int capacity;
+} byte_buffer_t;
+
+/**
+ * Add a base 128 number to the deltas.
+ *
+ * @param byte_buffer_t*    buffer - The deltas.
+ * @param unsigned long     num - The number.
+ *
+ * @return int - 1 if everything went OK, 0 on memory error.
+ */
+static int put_varint(byte_buffer_t *buffer, unsigned long num){
+    do {
+        if ( !ensure_capacity((void **) &buffer->bytes, &buffer->capacity, buffer->size + 1, sizeof(unsigned char)) ) {
+            return 0;
+        }
+        buffer->bytes[buffer->size++] = (unsigned char) ((num & 0x7F) | (num > 0x7F ? 0x80 : 0));
+        num >>= 7;
+    } while ( num );
+
+    return 1;
+}
+
+/**
+ * Write a 4 bytes little endian number.
+ */
+static void put_le32(long num, FILE *fp){
+    fputc((int) (num & 0xFF), fp);
+    fputc((int) ((num >> 8) & 0xFF), fp);
+    fputc((int) ((num >> 16) & 0xFF), fp);
+    fputc((int) ((num >> 24) & 0xFF), fp);
+}
+
+/**
+ * Compare two symbols by their addresses, and then by their kinds, for qsort().
+ */
+static int compare_symbols(const void *a, const void *b){
+    const debug_symbol_t *first = (const debug_symbol_t *) a, *second = (const debug_symbol_t *) b;
+
+    if ( first->address != second->address ) {
+        return first->address < second->address ? -1 : 1;
+    }
+    if ( first->kind != second->kind ) {
+        return first->kind < second->kind ? -1 : 1;
+    }
+    return first->name < second->name ? -1 : first->name > second->name;
+}
+
+/**
+ * Add a symbol, and its name if it's new.
+ *
+ * @param debug_symbol_t**  symbols - The symbols.
+ * @param int*              size - The number of symbols.
+ * @param int*              capacity - The capacity of the symbols.
+ * @param name_table_t*     names - The names.
+ * @param char*             name - The name of the symbol.
+ * @param int               address - The address of the symbol.
+ * @param int               kind - SYMBOL_CODE, SYMBOL_DATA or SYMBOL_EXTERN.
+ *
+ * @return int - 1 if everything went OK, 0 on memory error.
+ */
+static int add_symbol(debug_symbol_t **symbols, int *size, int *capacity, name_table_t *names, char *name, int address, int kind){
+    int index;
+
+    if ( (index = name_table_find(names, name)) == -1 && (index = name_table_insert(names, name)) < 0 ) {
+        return 0;
+    }
+    if ( !ensure_capacity((void **) symbols, capacity, *size + 1, sizeof(debug_symbol_t)) ) {
+        return 0;
+    }
+    (*symbols)[*size].address = address;
+    (*symbols)[*size].kind = kind;
+    (*symbols)[*size].name = names->names[index];
+    (*size)++;
+
+    return 1;
+}
+
+/**
+ * Write the debug information of an assembled source.
+ *
+ * @param assembler_t*  as - The assembler context that holds the assembled source and its line table.
+ * @param char*         source_name - The name of the source file.
+ * @param FILE*         fp - The file to write to, opened in binary mode.
+ *
+ * @return int - 1 if everything went OK, 0 on memory error.
+ */
+int debug_write(assembler_t *as, char *source_name, FILE *fp){
+    line_table_t *table = &as->lines;
+    debug_symbol_t *symbols = NULL;
+    byte_buffer_t deltas;
+    name_table_t names;
+    long line_delta;
+    int i, size = 0, capacity = 0, file, ok;
+
+    name_table_init(&names);
+    deltas.bytes = NULL;
+    deltas.size = deltas.capacity = 0;
+
+    /* the names of the files come first, so the single source is file 0 */
+    ok = (file = name_table_insert(&names, source_name)) >= 0;
+
+    for ( i = 0; ok && i < as->table_signs_size; i++ ) {
+        if ( !as->table_signs[i].external ) {
+            ok = add_symbol(&symbols, &size, &capacity, &names, as->table_signs[i].label_name, as->table_signs[i].address,
+                            as->table_signs[i].operation ? SYMBOL_CODE : SYMBOL_DATA);
+        }
+    }
+    for ( i = 0; ok && i < as->ext_size; i++ ) {
+        ok = add_symbol(&symbols, &size, &capacity, &names, as->ext[i].label_name, as->ext[i].address, SYMBOL_EXTERN);
+    }
+    if ( size > 0 ) {
+        qsort(symbols, (size_t) size, sizeof(debug_symbol_t), compare_symbols);
+    }
+
+    for ( i = 0; ok && i < table->rows_size; i++ ) {
+        if ( i % DEBUG_CHECKPOINT != 0 ) {
+            line_delta = (long) table->rows[i].line - table->rows[i - 1].line;
+            ok = put_varint(&deltas, (unsigned long) (table->rows[i].address - table->rows[i - 1].address))
+                 && put_varint(&deltas, (line_delta >= 0 ? (unsigned long) line_delta << 1 : ((unsigned long) -line_delta << 1) - 1) << 1);
+        }
+    }
+
+    if ( ok ) {
+        fwrite(DEBUG_MAGIC, 1, 4, fp);
+        put_le32(INITIAL_IC, fp);
+        put_le32(table->rows_size, fp);
+        put_le32(size, fp);
+        put_le32(1, fp);
+        put_le32(names.text_size, fp);
+        put_le32(deltas.size, fp);
+
+        for ( i = 0, deltas.size = 0; i < table->rows_size; i++ ) {
+            if ( i % DEBUG_CHECKPOINT == 0 ) {
+                put_le32(table->rows[i].address, fp);
+                put_le32(file, fp);
+                put_le32(table->rows[i].line, fp);
+                put_le32(deltas.size, fp);
+            } else { /* find where the rows after the next checkpoint start, by skipping the numbers of this row */
+                while ( deltas.bytes[deltas.size++] & 0x80 );
+                while ( deltas.bytes[deltas.size++] & 0x80 );
+            }
+        }
+        for ( i = 0; i < size; i++ ) {
+            put_le32(symbols[i].address, fp);
+            put_le32(symbols[i].kind, fp);
+            put_le32(symbols[i].name, fp);
+        }
+        put_le32(names.names[file], fp);
+        fwrite(names.text, 1, (size_t) names.text_size, fp);
+        fwrite(deltas.bytes, 1, (size_t) deltas.size, fp);
+    }
+
+    free(symbols);
+    free(deltas.bytes);
+    name_table_free(&names);
+
+    return ok;
+}
+
+/**
+ * Read a 4 bytes little endian number.
+ */
+static long get_le32(const unsigned char *p){
+    return (long) p[0] | (long) p[1] << 8 | (long) p[2] << 16 | (long) p[3] << 24;
+}
+
+/**
+ * Read a base 128 number of the deltas.
+ *
+ * @param debug_map_t*  map - The debug information.
+ * @param long*         offset - The offset of the number in the deltas, moved past it.
+ *
+ * @return long - The number, -1 if it's cut by the end of the deltas.
+ */
+static long get_varint(debug_map_t *map, long *offset){
+    long num = 0;
+    int shift = 0;
+    unsigned char byte;
+
+    do {
+        if ( *offset >= map->deltas_size || shift > 28 ) {
+            return -1;
+        }
+        byte = map->deltas[(*offset)++];
+        num |= (long) (byte & 0x7F) << shift;
+        shift += 7;
+    } while ( byte & 0x80 );
+
+    return num;
+}
+
+/**
+ * Get a string of the debug information.
+ *
+ * @param debug_map_t*  map - The debug information.
+ * @param long          offset - The offset of the string.
+ *
+ * @return char* - The string, "?" if the offset is out of the strings.
+ */
+static const char *get_string(debug_map_t *map, long offset){
+    return offset >= 0 && offset < map->strings_size ? (const char *) map->strings + offset : "?";
+}
+
+/**
+ * Load the debug information of a program, NAME.dbg.
+ *
+ * @param debug_map_t*  map - Will hold the debug information at the end.
+ * @param char*         base_name - The file name without extension.
+ *
+ * @return int - 1 if everything went OK, 0 if there's no valid NAME.dbg.
+ */
+int debug_map_load(debug_map_t *map, char *base_name){
+    const unsigned char *p;
+    char *name;
+    long needed;
+
+    memset(map, 0, sizeof(debug_map_t));
+    if ( !(name = malloc(strlen(base_name) + 5)) ) {
+        return 0;
+    }
+    sprintf(name, "%s.dbg", base_name);
+    map->contents = (unsigned char *) read_whole_file(name, &map->length);
+    free(name);
+
+    if ( !map->contents || map->length < DEBUG_HEADER_SIZE || memcmp(map->contents, DEBUG_MAGIC, 4) != 0 ) {
+        debug_map_free(map);
+        return 0;
+    }
+
+    p = map->contents;
+    map->base = (int) get_le32(p + 4);
+    map->rows = get_le32(p + 8);
+    map->symbols = get_le32(p + 12);
+    map->files = get_le32(p + 16);
+    map->strings_size = get_le32(p + 20);
+    map->deltas_size = get_le32(p + 24);
+    map->checkpoints = (map->rows + DEBUG_CHECKPOINT - 1) / DEBUG_CHECKPOINT;
+
+    needed = DEBUG_HEADER_SIZE + map->checkpoints * CHECKPOINT_SIZE + map->symbols * SYMBOL_SIZE + map->files * 4
+             + map->strings_size + map->deltas_size;
+    if ( map->rows < 0 || map->symbols < 0 || map->files < 0 || map->strings_size < 0 || map->deltas_size < 0
+         || needed != map->length || (map->strings_size > 0 && p[needed - map->deltas_size - 1] != '\0') ) {
+        debug_map_free(map);
+        return 0;
+    }
+
+    map->checkpoint_table = p + DEBUG_HEADER_SIZE;
+    map->symbol_table = map->checkpoint_table + map->checkpoints * CHECKPOINT_SIZE;
+    map->file_table = map->symbol_table + map->symbols * SYMBOL_SIZE;
+    map->strings = map->file_table + map->files * 4;
+    map->deltas = map->strings + map->strings_size;
+
+    return 1;
+}
+
+/**
+ * Free the debug information.
+ *
+ * @param debug_map_t*  map - The debug information.
+ */
+void debug_map_free(debug_map_t *map){
+    free(map->contents);
+    memset(map, 0, sizeof(debug_map_t));
+}
+
+/**
+ * Find the source line of an address: the line of the instruction the address is in, or of the last instruction
+ * before it.
+ *
+ * @param debug_map_t*  map - The debug information.
+ * @param int           address - The address.
+ * @param char**        file - Will point to the name of the source file at the end.
+ * @param int*          line - Will hold the line at the end.
+ *
+ * @return int - 1 if the line was found, 0 if the address is before the first instruction.
+ */
+int debug_find_line(debug_map_t *map, int address, const char **file, int *line){
+    const unsigned char *checkpoint;
+    long low = 0, high = map->checkpoints, middle, offset, delta, rows, next_address, file_index;
+
+    /* the last checkpoint at the address or before it */
+    while ( low < high ) {
+        middle = (low + high) / 2;
+        if ( get_le32(map->checkpoint_table + middle * CHECKPOINT_SIZE) <= address ) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    if ( low == 0 ) {
+        return 0;
+    }
+
+    checkpoint = map->checkpoint_table + (low - 1) * CHECKPOINT_SIZE;
+    next_address = get_le32(checkpoint);
+    file_index = get_le32(checkpoint + 4);
+    *line = (int) get_le32(checkpoint + 8);
+    offset = get_le32(checkpoint + 12);
+
+    /* the rows after it, until the next checkpoint */
+    rows = map->rows - (low - 1) * DEBUG_CHECKPOINT - 1;
+    for ( rows = rows < DEBUG_CHECKPOINT - 1 ? rows : DEBUG_CHECKPOINT - 1; rows > 0; rows-- ) {
+        if ( (delta = get_varint(map, &offset)) < 0 || next_address + delta > address ) {
+            break;
+        }
+        next_address += delta;
+        if ( (delta = get_varint(map, &offset)) < 0 ) {
+            break;
+        }
+        *line += (int) (delta & 2 ? -((delta >> 2) + 1) : delta >> 2);
+        if ( delta & 1 ) {
+            file_index = get_varint(map, &offset);
+        }
+    }
+
+    *file = file_index >= 0 && file_index < map->files ? get_string(map, get_le32(map->file_table + file_index * 4)) : "?";
+
+    return 1;
+}
+
+/**
+ * Get a symbol of the debug information.
+ *
+ * @param debug_map_t*  map - The debug information.
+ * @param int           index - The index of the symbol, by address.
+ * @param int*          address - Will hold the address at the end.
+ * @param int*          kind - Will hold SYMBOL_CODE, SYMBOL_DATA or SYMBOL_EXTERN at the end.
+ *
+ * @return char* - The name of the symbol.
+ */
+const char *debug_symbol(debug_map_t *map, int index, int *address, int *kind){
+    const unsigned char *symbol = map->symbol_table + (long) index * SYMBOL_SIZE;
+
+    *address = (int) get_le32(symbol);
+    *kind = (int) get_le32(symbol + 4);
+
+    return get_string(map, get_le32(symbol + 8));
+}
+
+/**
+ * Find the label an address is in: the last code or data label at the address or before it.
+ *
+ * @param debug_map_t*  map - The debug information.
+ * @param int           address - The address.
+ * @param int*          label_address - Will hold the address of the label at the end.
+ *
+ * @return char* - The name of the label, NULL if there's no label before the address.
+ */
+const char *debug_find_label(debug_map_t *map, int address, int *label_address){
+    const char *name;
+    long low = 0, high = map->symbols, middle;
+    int kind;
+
+    while ( low < high ) {
+        middle = (low + high) / 2;
+        if ( get_le32(map->symbol_table + middle * SYMBOL_SIZE) <= address ) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    for ( ; low > 0; low-- ) { /* the external symbols are at the words that use them, not labels */
+        name = debug_symbol(map, (int) low - 1, label_address, &kind);
+        if ( kind != SYMBOL_EXTERN ) {
+            return name;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Format the source location of an address, i.e "LOOP+2 (prog.as line 12)".
+ *
+ * @param debug_map_t*  map - The debug information.
+ * @param int           address - The address.
+ * @param char*         out - Will hold the location at the end, LINE_MAX * 2 chars at least.
+ */
+void debug_format_location(debug_map_t *map, int address, char *out){
+    const char *label, *file;
+    int label_address, line;
+
+    out[0] = '\0';
+    if ( (label = debug_find_label(map, address, &label_address)) ) {
+        if ( label_address == address ) {
+            sprintf(out, "%.*s ", LABEL_MAX, label);
+        } else {
+            sprintf(out, "%.*s+%d ", LABEL_MAX, label, address - label_address);
+        }
+    }
+    if ( debug_find_line(map, address, &file, &line) ) {
+        sprintf(out + strlen(out), "(%.*s line %d)", LINE_MAX - 1, file, line);
+    } else if ( out[0] ) {
+        out[strlen(out) - 1] = '\0';
+    }
+}
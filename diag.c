@@ -0,0 +1,283 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include "header.h"
+
+#define DIAG_MESSAGE_MAX 256
+
+static char *diag_code_names[] = {	/* the names of the diagnostic codes, by code */
+    "invalid_label",
+    "invalid_operation",
+    "duplicate_sign",
+    "invalid_number",
+    "number_too_big",
+    "invalid_list",
+    "invalid_string",
+    "extra_operand",
+    "invalid_matrix_size",
+    "invalid_matrix_list",
+    "invalid_argument",
+    "too_many_operands",
+    "invalid_entry",
+    "undefined_label",
+    "invalid_addressing",
+    "memory",
+    "invalid_macro",
+    "invalid_expression",
+    "undefined_constant"
+};
+
+/**
+ * Initialize an empty diagnostics buffer.
+ *
+ * @param diagnostics_t*    diag - The buffer to initialize.
+ */
+void diag_init(diagnostics_t *diag){
+    diag->records = NULL;
+    diag->messages = NULL;
+    diag->size = diag->capacity = 0;
+    diag->messages_size = diag->messages_capacity = 0;
+    diag->errors = diag->max_errors = 0;
+}
+
+/**
+ * Drop all the records, but keep the memory for the next source.
+ *
+ * @param diagnostics_t*    diag - The buffer to clear.
+ */
+void diag_clear(diagnostics_t *diag){
+    diag->size = diag->messages_size = diag->errors = 0;
+}
+
+/**
+ * Free the memory of the diagnostics buffer.
+ *
+ * @param diagnostics_t*    diag - The buffer to free.
+ */
+void diag_free(diagnostics_t *diag){
+    int max_errors = diag->max_errors;
+
+    free(diag->records);
+    free(diag->messages);
+    diag_init(diag);
+    diag->max_errors = max_errors;
+}
+
+/**
+ * Make sure a buffer has room for "needed" more bytes, the capacity is doubled when it's full.
+ *
+ * @param char**    buffer - The buffer.
+ * @param int       size - The used size of the buffer.
+ * @param int*      capacity - The capacity of the buffer.
+ * @param int       needed - Number of bytes we are going to add.
+ *
+ * @return int - 1 if everything went OK, 0 on memory error.
+ */
+static int reserve(char **buffer, int size, int *capacity, int needed){
+    int new_capacity = *capacity ? *capacity : DIAG_MESSAGE_MAX;
+    char *temp;
+
+    while ( size + needed > new_capacity ) {
+        new_capacity *= 2;
+    }
+
+    if ( new_capacity != *capacity || !(*buffer) ) {
+        if ( !(temp = realloc(*buffer, (size_t) new_capacity)) ) {
+            return 0;
+        }
+        *buffer = temp;
+        *capacity = new_capacity;
+    }
+
+    return 1;
+}
+
+/**
+ * Add a diagnostic record to the buffer.
+ *
+ * @param diagnostics_t*    diag - The buffer.
+ * @param int               line - The line number, 0 if the diagnostic isn't about a specific line.
+ * @param int               column - The column (starts from 1), 0 if the diagnostic is about the whole line.
+ * @param int               code - The diagnostic code, DIAG_*.
+ * @param int               is_error - 1 for errors, 0 for warnings.
+ * @param char*             format - printf like format of the message, followed by its arguments.
+ */
+void diag_report(diagnostics_t *diag, int line, int column, int code, int is_error, const char *format, ...){
+    char message[DIAG_MESSAGE_MAX];
+    diagnostic *temp;
+    va_list args;
+    int length;
+
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+    length = (int) strlen(message) + 1;
+
+    if ( diag->size == diag->capacity ) {
+        diag->capacity = diag->capacity ? diag->capacity * 2 : 16;
+        if ( !(temp = realloc(diag->records, diag->capacity * sizeof(diagnostic))) ) {
+            fprintf(stderr, "line %d:\t%s\n", line, message); /* better late than never */
+            diag->capacity = diag->size;
+            return;
+        }
+        diag->records = temp;
+    }
+
+    if ( !reserve(&diag->messages, diag->messages_size, &diag->messages_capacity, length) ) {
+        fprintf(stderr, "line %d:\t%s\n", line, message);
+        return;
+    }
+
+    memcpy(diag->messages + diag->messages_size, message, (size_t) length);
+    diag->records[diag->size].line = line;
+    diag->records[diag->size].column = column;
+    diag->records[diag->size].code = code;
+    diag->records[diag->size].is_error = is_error;
+    diag->records[diag->size].message = diag->messages_size;
+    diag->messages_size += length;
+    diag->size++;
+
+    if ( is_error ) {
+        diag->errors++;
+    }
+}
+
+/**
+ * Check if we've got to the maximal number of errors, so the scanning should stop.
+ *
+ * @param diagnostics_t*    diag - The buffer.
+ *
+ * @return int - 1 if the scanning should stop, 0 otherwise.
+ */
+int diag_limit_reached(diagnostics_t *diag){
+    return diag->max_errors > 0 && diag->errors >= diag->max_errors;
+}
+
+/**
+ * Append a string to the output buffer, escaped as a JSON string (without the quotes).
+ *
+ * @param char**    out - The output buffer.
+ * @param int*      size - The used size of the output buffer.
+ * @param int*      capacity - The capacity of the output buffer.
+ * @param char*     str - The string to append.
+ *
+ * @return int - 1 if everything went OK, 0 on memory error.
+ */
+static int append_json_string(char **out, int *size, int *capacity, const char *str){
+    if ( !reserve(out, *size, capacity, (int) strlen(str) * 6 + 1) ) { /* the worst case is \u00XX for each char */
+        return 0;
+    }
+
+    for ( ; *str; str++ ) {
+        if ( *str == '"' || *str == '\\' ) {
+            (*out)[(*size)++] = '\\';
+            (*out)[(*size)++] = *str;
+        } else if ( (unsigned char) *str < 0x20 ) {
+            *size += sprintf(*out + *size, "\\u%04x", (unsigned char) *str);
+        } else {
+            (*out)[(*size)++] = *str;
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * Append a single record to the output buffer, as text or as a JSON line.
+ *
+ * @param char**    out - The output buffer.
+ * @param int*      size - The used size of the output buffer.
+ * @param int*      capacity - The capacity of the output buffer.
+ * @param char*     file_name - The name of the source file.
+ * @param int       format - DIAG_TEXT or DIAG_JSON.
+ * @param int       line - The line number.
+ * @param int       column - The column.
+ * @param char*     code - The code name.
+ * @param int       is_error - 1 for errors, 0 for warnings.
+ * @param char*     message - The message.
+ *
+ * @return int - 1 if everything went OK, 0 on memory error.
+ */
+static int append_record(char **out, int *size, int *capacity, char *file_name, int format,
+                         int line, int column, char *code, int is_error, char *message){
+    char prefix[DIAG_MESSAGE_MAX];
+
+    if ( format == DIAG_TEXT ) {
+        if ( line > 0 ) {
+            sprintf(prefix, "line %d:\t", line);
+        } else {
+            prefix[0] = '\0';
+        }
+        if ( !reserve(out, *size, capacity, (int) (strlen(prefix) + strlen(message)) + 2) ) {
+            return 0;
+        }
+        *size += sprintf(*out + *size, "%s%s\n", prefix, message);
+        return 1;
+    }
+
+    if ( !reserve(out, *size, capacity, 16) ) {
+        return 0;
+    }
+    *size += sprintf(*out + *size, "{\"file\":\"");
+    if ( !append_json_string(out, size, capacity, file_name) ) {
+        return 0;
+    }
+
+    sprintf(prefix, "\",\"line\":%d,\"column\":%d,\"code\":\"%s\",\"severity\":\"%s\",\"message\":\"",
+            line, column, code, is_error ? "error" : "warning");
+    if ( !reserve(out, *size, capacity, (int) strlen(prefix) + 1) ) {
+        return 0;
+    }
+    *size += sprintf(*out + *size, "%s", prefix);
+
+    if ( !append_json_string(out, size, capacity, message) || !reserve(out, *size, capacity, 4) ) {
+        return 0;
+    }
+    *size += sprintf(*out + *size, "\"}\n");
+
+    return 1;
+}
+
+/**
+ * Write all the records to "out" in a single batch, and clear the buffer.
+ *
+ * @param diagnostics_t*    diag - The buffer.
+ * @param char*             file_name - The name of the source file the diagnostics belong to.
+ * @param int               format - DIAG_TEXT or DIAG_JSON.
+ * @param FILE*             out - Where to write the diagnostics to, usually stderr.
+ */
+void diag_flush(diagnostics_t *diag, char *file_name, int format, FILE *out){
+    char *batch = NULL;
+    char message[DIAG_MESSAGE_MAX];
+    int size = 0, capacity = 0, i, ok = 1;
+    diagnostic *record;
+
+    if ( diag->size == 0 ) {
+        return;
+    }
+
+    for ( i = 0; ok && i < diag->size; i++ ) {
+        record = &diag->records[i];
+        ok = append_record(&batch, &size, &capacity, file_name, format, record->line, record->column,
+                           diag_code_names[record->code], record->is_error, diag->messages + record->message);
+    }
+
+    if ( ok && diag_limit_reached(diag) ) {
+        sprintf(message, "Too many errors, stopped after %d errors.", diag->errors);
+        ok = append_record(&batch, &size, &capacity, file_name, format, 0, 0, "too_many_errors", 1, message);
+    }
+
+    if ( ok ) {
+        fwrite(batch, 1, (size_t) size, out);
+    } else { /* no memory for the batch, write the records one by one */
+        for ( i = 0; i < diag->size; i++ ) {
+            fprintf(out, "line %d:\t%s\n", diag->records[i].line, diag->messages + diag->records[i].message);
+        }
+    }
+    fflush(out);
+
+    free(batch);
+    diag_clear(diag);
+}
@@ -0,0 +1,319 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "header.h"
+
+/*
+ * The disassembler (--disasm NAME). Reads NAME.bin, or NAME.ob if there is no binary image, and writes the
+ * program back as source lines. The names of the symbols are taken from NAME.ent and NAME.ext when they
+ * exist, and a relocatable address without a name gets a made up label ("L" and the address).
+ * The decoding is table driven: the operation is the upper 4 bits of the first word, and the number of
+ * operands of each operation is known, so every field is read with a shift and a mask.
+ */
+
+#define DATA_PER_LINE 10
+
+static const char *mnemonic_of[OPERATION_CODES]; /* the name of each operation, by the operation code, NULL for an invalid code */
+
+/* names of the symbols, by address */
+typedef struct{
+    image_t image;
+    char *text; /* the names, one after the other */
+    int text_size;
+    int text_capacity;
+    int *label_of; /* offset of the label of each word of the image, -1 for none */
+    int *extern_of; /* offset of the external symbol each word uses, -1 for none */
+    name_table_t entries; /* the names in the .ent file */
+    name_table_t externs; /* the names in the .ext file, each name once */
+} disassembly_t;
+
+/**
+ * Add a name to the text of the names.
+ *
+ * @param disassembly_t*    dis - The disassembly.
+ * @param char*             name - The name.
+ *
+ * @return int - The offset of the name, -1 on memory error.
+ */
+static int add_name(disassembly_t *dis, const char *name){
+    int length = (int) strlen(name), offset = dis->text_size;
+
+    if ( !ensure_capacity((void **) &dis->text, &dis->text_capacity, dis->text_size + length + 1, sizeof(char)) ) {
+        return -1;
+    }
+    memcpy(dis->text + offset, name, (size_t) length + 1);
+    dis->text_size += length + 1;
+
+    return offset;
+}
+
+/**
+ * Get the index of an address in the image.
+ *
+ * @param disassembly_t*    dis - The disassembly.
+ * @param int               address - The address.
+ *
+ * @return int - The index, -1 if the address is out of the image.
+ */
+static int index_of(disassembly_t *dis, int address){
+    int index = address - dis->image.base;
+
+    return index >= 0 && index < dis->image.code_size + dis->image.data_size ? index : -1;
+}
+
+/**
+ * Read the symbols of a .ent or a .ext file (plain or compact).
+ *
+ * @param disassembly_t*    dis - The disassembly.
+ * @param char*             file_name - The file name.
+ * @param int*              names - label_of or extern_of, the name is set at the address of every line.
+ * @param name_table_t*     declared - Will hold every name once, to declare them at the beginning.
+ *
+ * @return int - 1 if everything went OK (a missing file is OK), 0 on memory error.
+ */
+static int read_symbols(disassembly_t *dis, char *file_name, int *names, name_table_t *declared){
+    symbol_reader_t reader;
+    char *contents;
+    int offset, index;
+    long length;
+
+    if ( !(contents = read_whole_file(file_name, &length)) ) {
+        return 1;
+    }
+
+    for ( symbol_reader_init(&reader, contents, length); symbol_reader_next(&reader); ) {
+        if ( (index = index_of(dis, reader.address)) == -1 ) {
+            continue;
+        }
+        if ( (offset = add_name(dis, reader.name)) < 0
+             || (name_table_find(declared, reader.name) == -1 && name_table_insert(declared, reader.name) < 0) ) {
+            free(contents);
+            return 0;
+        }
+        names[index] = offset;
+    }
+    free(contents);
+
+    return 1;
+}
+
+/**
+ * Give a made up label to every relocatable address that has no name.
+ *
+ * @param disassembly_t*    dis - The disassembly.
+ *
+ * @return int - 1 if everything went OK, 0 on memory error.
+ */
+static int name_addresses(disassembly_t *dis){
+    image_t *image = &dis->image;
+    char name[LINE_MAX];
+    int i, index, word;
+
+    for ( i = 0; i < image->code_size; i++ ) {
+        word = image->words[i];
+        if ( (word & 3) != R ) {
+            continue;
+        }
+        if ( (index = index_of(dis, (word >> 2) & VALUE_MASK)) != -1 && dis->label_of[index] == -1 ) {
+            sprintf(name, "L%d", (word >> 2) & VALUE_MASK);
+            if ( (dis->label_of[index] = add_name(dis, name)) < 0 ) {
+                return 0;
+            }
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * Format an operand.
+ *
+ * @param disassembly_t*    dis - The disassembly.
+ * @param int               method - The addressing method.
+ * @param int               index - The index of the (first) operand word.
+ * @param int               reg_shift - The position of the register in the word, for a register operand.
+ * @param char*             out - Will hold the operand at the end.
+ */
+static void format_operand(disassembly_t *dis, int method, int index, int reg_shift, char *out){
+    int word = dis->image.words[index], value = (word >> 2) & VALUE_MASK, target;
+    const char *name = NULL;
+
+    if ( method == DIRECT_REGISTER ) {
+        sprintf(out, "r%d", (word >> reg_shift) & 15);
+        return;
+    }
+    if ( method == IMMEDIATE ) {
+        sprintf(out, "#%d", value >= 1 << (VALUE_BITS - 1) ? value - (1 << VALUE_BITS) : value);
+        return;
+    }
+
+    /* DIRECT or MATRIX_ACCESS */
+    if ( (word & 3) == E && dis->extern_of[index] != -1 ) {
+        name = dis->text + dis->extern_of[index];
+    } else if ( (word & 3) == R && (target = index_of(dis, value)) != -1 && dis->label_of[target] != -1 ) {
+        name = dis->text + dis->label_of[target];
+    }
+    if ( name ) {
+        strcpy(out, name);
+    } else {
+        sprintf(out, "%d", value);
+    }
+
+    if ( method == MATRIX_ACCESS ) {
+        word = dis->image.words[index + 1];
+        sprintf(out + strlen(out), "[r%d][r%d]", (word >> 6) & 15, (word >> 2) & 15);
+    }
+}
+
+/**
+ * Write the label of a word, or the indentation if it has no label.
+ *
+ * @param disassembly_t*    dis - The disassembly.
+ * @param int               index - The index of the word.
+ * @param FILE*             out - Where to write to.
+ */
+static void print_label(disassembly_t *dis, int index, FILE *out){
+    if ( dis->label_of[index] != -1 ) {
+        fprintf(out, "%s:", dis->text + dis->label_of[index]);
+    }
+    fputc(' ', out);
+}
+
+/**
+ * Write the code segment as instructions.
+ *
+ * @param disassembly_t*    dis - The disassembly.
+ * @param FILE*             out - Where to write to.
+ */
+static void print_code(disassembly_t *dis, FILE *out){
+    image_t *image = &dis->image;
+    char first[LINE_MAX], second[LINE_MAX];
+    int i, word, oper, src, dest, next;
+
+    for ( i = 0; i < image->code_size; i = next ) {
+        word = image->words[i];
+        oper = word >> 6;
+        src = (word >> 4) & 3;
+        dest = (word >> 2) & 3;
+        next = i + instruction_length(word);
+
+        print_label(dis, i, out);
+        if ( next > image->code_size || !mnemonic_of[oper] ) { /* a broken instruction at the end of the code, or an invalid code */
+            fprintf(out, ".data %d\n", word >= 1 << (WORD_MAX - 1) ? word - (1 << WORD_MAX) : word);
+            next = i + 1;
+            continue;
+        }
+
+        switch ( operands_count(oper) ) {
+            case 2:
+                format_operand(dis, src, i + 1, 6, first);
+                format_operand(dis, dest, src == DIRECT_REGISTER && dest == DIRECT_REGISTER ? i + 1 : next - (dest == MATRIX_ACCESS ? 2 : 1), 2, second);
+                fprintf(out, "%s %s, %s\n", mnemonic_of[oper], first, second);
+                break;
+            case 1:
+                format_operand(dis, dest, i + 1, 6, first); /* a single register operand is encoded like a source register */
+                fprintf(out, "%s %s\n", mnemonic_of[oper], first);
+                break;
+            default:
+                fprintf(out, "%s\n", mnemonic_of[oper]);
+        }
+    }
+}
+
+/**
+ * Write the data segment as .data lines.
+ *
+ * @param disassembly_t*    dis - The disassembly.
+ * @param FILE*             out - Where to write to.
+ */
+static void print_data(disassembly_t *dis, FILE *out){
+    image_t *image = &dis->image;
+    int i, word, in_line = 0;
+
+    for ( i = image->code_size; i < image->code_size + image->data_size; i++ ) {
+        word = image->words[i];
+        if ( in_line && (dis->label_of[i] != -1 || in_line == DATA_PER_LINE) ) {
+            fputc('\n', out);
+            in_line = 0;
+        }
+        if ( in_line == 0 ) {
+            print_label(dis, i, out);
+            fprintf(out, ".data %d", word >= 1 << (WORD_MAX - 1) ? word - (1 << WORD_MAX) : word);
+        } else {
+            fprintf(out, ", %d", word >= 1 << (WORD_MAX - 1) ? word - (1 << WORD_MAX) : word);
+        }
+        in_line++;
+    }
+    if ( in_line ) {
+        fputc('\n', out);
+    }
+}
+
+/**
+ * Disassemble an assembled program.
+ *
+ * @param char*     base_name - The file name without extension, NAME.bin or NAME.ob is read.
+ * @param FILE*     out - Where to write the source lines to.
+ *
+ * @return int - 0 if everything went OK, 1 if the program couldn't be read.
+ */
+int disassemble(char *base_name, FILE *out){
+    disassembly_t dis;
+    char *name;
+    int i, size, ok = 0;
+
+    if ( !(name = malloc(strlen(base_name) + 5)) ) {
+        fprintf(stderr, "Cannot allocate memory.\n");
+        return 1;
+    }
+
+    for ( i = 0; i < NUM_OF_OPERATIONS; i++ ) { /* reverse the operations table */
+        mnemonic_of[valid_operations[i].oper_num] = valid_operations[i].oper_name;
+    }
+
+    image_init(&dis.image);
+    dis.text = NULL;
+    dis.text_size = dis.text_capacity = 0;
+    dis.label_of = dis.extern_of = NULL;
+    name_table_init(&dis.entries);
+    name_table_init(&dis.externs);
+
+    if ( !image_load_program(&dis.image, base_name) ) {
+        free(name);
+        return 1;
+    }
+
+    size = dis.image.code_size + dis.image.data_size;
+    if ( (dis.label_of = malloc((size + 1) * sizeof(int))) && (dis.extern_of = malloc((size + 1) * sizeof(int))) ) {
+        for ( i = 0; i < size; i++ ) {
+            dis.label_of[i] = dis.extern_of[i] = -1;
+        }
+        sprintf(name, "%s.ent", base_name);
+        ok = read_symbols(&dis, name, dis.label_of, &dis.entries);
+        sprintf(name, "%s.ext", base_name);
+        ok = ok && read_symbols(&dis, name, dis.extern_of, &dis.externs) && name_addresses(&dis);
+    }
+
+    if ( ok ) {
+        for ( i = 0; i < dis.entries.size; i++ ) {
+            fprintf(out, ".entry %s\n", name_table_name(&dis.entries, i));
+        }
+        for ( i = 0; i < dis.externs.size; i++ ) {
+            fprintf(out, ".extern %s\n", name_table_name(&dis.externs, i));
+        }
+        print_code(&dis, out);
+        print_data(&dis, out);
+    } else {
+        fprintf(stderr, "Cannot allocate memory.\n");
+    }
+
+    image_free(&dis.image);
+    free(dis.text);
+    free(dis.label_of);
+    free(dis.extern_of);
+    name_table_free(&dis.entries);
+    name_table_free(&dis.externs);
+    free(name);
+
+    return !ok;
+}
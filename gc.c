@@ -0,0 +1,301 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "header.h"
+
+/*
+ * Garbage collection of unreachable code and data (--gc).
+ *
+ * The source is split into blocks: a code block starts at every labeled instruction (and at the first
+ * instruction), a data block starts at every labeled .data / .string / .mat. Another unit could only
+ * reach this one through its .entry labels, so the roots are the .entry labels and the first instruction,
+ * where the program starts. A reachable code block reaches:
+ *      - the blocks of the labels its instructions use (DIRECT and MATRIX_ACCESS operands, jmp/bne/jsr targets),
+ *      - the block after it, unless its last instruction is jmp, rts or stop.
+ * The instructions of the other code blocks are removed (as the peephole optimizer removes instructions),
+ * and the other data blocks are cut out of the data segment. The entry and the extern tables are made
+ * by the second scan, from what was left.
+ * A label of a pooled string (--pool-strings) points into the block of another string, so it doesn't start a block.
+ */
+
+/* the state of the reachability analysis */
+typedef struct{
+    assembler_t *as;
+    name_table_t labels; /* the labels, to find their signs fast */
+    int *sign_of_label; /* by the index of the label */
+    int *code_block; /* the block of each instruction */
+    int *block_first; /* the first instruction of each code block, and the instructions count at the end */
+    int code_blocks;
+    int *data_labels; /* the signs of the data labels, sorted by their addresses */
+    int data_blocks;
+    int *reachable; /* by block, code blocks first */
+    int *stack; /* blocks that were reached but not visited yet */
+    int stack_size;
+} gc_state;
+
+/* a data label, to sort the data labels by their addresses */
+typedef struct{
+    int address;
+    int sign;
+} data_label_t;
+
+/**
+ * Compare two data labels by their addresses (and by their signs, so the order doesn't depend on qsort()).
+ */
+static int compare_data_labels(const void *first, const void *second){
+    const data_label_t *a = first, *b = second;
+
+    return a->address != b->address ? a->address - b->address : a->sign - b->sign;
+}
+
+/**
+ * Mark a block as reachable, and push it to be visited.
+ *
+ * @param gc_state*     gc - The state.
+ * @param int           block - The block.
+ */
+static void reach(gc_state *gc, int block){
+    if ( block >= 0 && !gc->reachable[block] ) {
+        gc->reachable[block] = 1;
+        gc->stack[gc->stack_size++] = block;
+    }
+}
+
+/**
+ * Find the block a label belongs to.
+ *
+ * @param gc_state*     gc - The state.
+ * @param char*         label - The label.
+ *
+ * @return int - The block, -1 if it's not in a block of this unit.
+ */
+static int block_of_label(gc_state *gc, char *label){
+    table_of_signs *sign;
+    int index, low, high, middle;
+
+    if ( (index = name_table_find(&gc->labels, label)) == -1 ) {
+        return -1;
+    }
+    sign = &gc->as->table_signs[gc->sign_of_label[index]];
+
+    if ( sign->external ) {
+        return -1;
+    }
+    if ( sign->operation == 1 ) {
+        index = instruction_find(&gc->as->instructions, sign->address);
+        return index == -1 ? -1 : gc->code_block[index];
+    }
+
+    /* the last data label that isn't after the address, the data before the first label isn't in a block */
+    if ( gc->data_blocks == 0 || sign->address < gc->as->table_signs[gc->data_labels[0]].address ) {
+        return -1;
+    }
+    low = 0;
+    high = gc->data_blocks - 1;
+    while ( low < high ) {
+        middle = (low + high + 1) / 2;
+        if ( gc->as->table_signs[gc->data_labels[middle]].address <= sign->address ) {
+            low = middle;
+        } else {
+            high = middle - 1;
+        }
+    }
+
+    return gc->code_blocks + low;
+}
+
+/**
+ * Visit a reachable code block: reach the labels its instructions use, and the block after it.
+ *
+ * @param gc_state*     gc - The state.
+ * @param int           block - The code block.
+ */
+static void visit_code_block(gc_state *gc, int block){
+    instruction_list_t *list = &gc->as->instructions;
+    instruction_t *item = NULL;
+    char label[LINE_MAX], *arg;
+    int i, j;
+
+    for ( i = gc->block_first[block]; i < gc->block_first[block + 1]; i++ ) {
+        item = &list->items[i];
+        for ( j = FIRST_ARG; j <= SECOND_ARG; j++ ) {
+            if ( item->amethods[j] == DIRECT || item->amethods[j] == MATRIX_ACCESS ) {
+                arg = instruction_operand(list, item, j);
+                strncpy(label, arg, strcspn(arg, "["));
+                label[strcspn(arg, "[")] = '\0';
+                reach(gc, block_of_label(gc, label));
+            }
+        }
+    }
+
+    if ( item && item->oper != JMP && item->oper != RTS && item->oper != STOP && block + 1 < gc->code_blocks ) {
+        reach(gc, block + 1);
+    }
+}
+
+/**
+ * Cut the unreachable data blocks out of the data segment, and move the data labels.
+ *
+ * @param gc_state*     gc - The state.
+ *
+ * @return int - The number of words that were removed, -1 on memory error.
+ */
+static int compact_data(gc_state *gc){
+    assembler_t *as = gc->as;
+    int i, start, end, removed_words = 0, dc, block;
+    int *new_start = malloc((gc->data_blocks + 1) * sizeof(int)); /* where each block starts after the compaction */
+
+    if ( !new_start ) {
+        return -1;
+    }
+
+    dc = gc->data_blocks > 0 ? as->table_signs[gc->data_labels[0]].address : as->dc; /* the data before the first label stays */
+    for ( i = 0; i < gc->data_blocks; i++ ) {
+        start = as->table_signs[gc->data_labels[i]].address;
+        end = i + 1 < gc->data_blocks ? as->table_signs[gc->data_labels[i + 1]].address : as->dc;
+        new_start[i] = dc;
+
+        if ( gc->reachable[gc->code_blocks + i] ) {
+            memmove(as->data_seg + dc, as->data_seg + start, (end - start) * sizeof(word_t));
+            dc += end - start;
+        } else {
+            removed_words += end - start;
+        }
+    }
+
+    /* a pooled string moves with the block it points into */
+    for ( i = 0; i < as->table_signs_size; i++ ) {
+        if ( as->table_signs[i].alias && (block = block_of_label(gc, as->table_signs[i].label_name) - gc->code_blocks) >= 0 ) {
+            as->table_signs[i].address += new_start[block] - as->table_signs[gc->data_labels[block]].address;
+        }
+    }
+
+    /* the label of a removed block gets the address of the data after it */
+    for ( i = 0; i < gc->data_blocks; i++ ) {
+        as->table_signs[gc->data_labels[i]].address = new_start[i];
+    }
+
+    as->dc = dc;
+    free(new_start);
+
+    return removed_words;
+}
+
+/**
+ * Free the memory of the state.
+ *
+ * @param gc_state*     gc - The state.
+ */
+static void gc_free(gc_state *gc){
+    name_table_free(&gc->labels);
+    free(gc->sign_of_label);
+    free(gc->code_block);
+    free(gc->block_first);
+    free(gc->data_labels);
+    free(gc->reachable);
+    free(gc->stack);
+}
+
+/**
+ * Split the source to blocks, and find the sign of every label.
+ *
+ * @param gc_state*     gc - The state, its arrays are allocated.
+ *
+ * @return int - 1 if everything went OK, 0 on memory error.
+ */
+static int make_blocks(gc_state *gc){
+    assembler_t *as = gc->as;
+    instruction_list_t *list = &as->instructions;
+    data_label_t *data_labels;
+    int i, index;
+
+    if ( !(data_labels = malloc((as->table_signs_size + 1) * sizeof(data_label_t))) ) {
+        return 0;
+    }
+    for ( i = 0; i < as->table_signs_size; i++ ) {
+        if ( (index = name_table_insert(&gc->labels, as->table_signs[i].label_name)) < 0 ) {
+            free(data_labels);
+            return 0;
+        }
+        gc->sign_of_label[index] = i;
+        if ( as->table_signs[i].operation == 0 && !as->table_signs[i].external && !as->table_signs[i].alias ) {
+            data_labels[gc->data_blocks].address = as->table_signs[i].address;
+            data_labels[gc->data_blocks++].sign = i;
+        }
+    }
+    qsort(data_labels, (size_t) gc->data_blocks, sizeof(data_label_t), compare_data_labels);
+    for ( i = 0; i < gc->data_blocks; i++ ) {
+        gc->data_labels[i] = data_labels[i].sign;
+    }
+    free(data_labels);
+
+    for ( i = 0; i < list->size; i++ ) {
+        if ( i == 0 || list->items[i].has_label ) { /* a new code block */
+            gc->block_first[gc->code_blocks++] = i;
+        }
+        gc->code_block[i] = gc->code_blocks - 1;
+    }
+    gc->block_first[gc->code_blocks] = list->size;
+
+    return 1;
+}
+
+/**
+ * Remove the code and the data that can't be reached from the .entry labels or from the start of the program.
+ * Called at the end of the first scan, after all the labels are known and before the data is placed after the code.
+ * The number of removed words is kept in the context (gc_code_words, gc_data_words).
+ *
+ * @param assembler_t*  as - The assembler context.
+ *
+ * @return int - 1 if everything went OK, 0 on memory error.
+ */
+int collect_garbage(assembler_t *as){
+    instruction_list_t *list = &as->instructions;
+    gc_state gc;
+    int i, block;
+
+    gc.as = as;
+    gc.stack_size = gc.code_blocks = gc.data_blocks = 0;
+    name_table_init(&gc.labels);
+    gc.sign_of_label = malloc((as->table_signs_size + 1) * sizeof(int));
+    gc.data_labels = malloc((as->table_signs_size + 1) * sizeof(int));
+    gc.code_block = malloc((list->size + 1) * sizeof(int));
+    gc.block_first = malloc((list->size + 1) * sizeof(int));
+    gc.reachable = calloc((size_t) (list->size + as->table_signs_size + 1), sizeof(int)); /* enough for all the blocks */
+    gc.stack = malloc((list->size + as->table_signs_size + 1) * sizeof(int));
+    as->gc_code_words = as->gc_data_words = 0;
+
+    if ( !gc.sign_of_label || !gc.data_labels || !gc.code_block || !gc.block_first || !gc.reachable || !gc.stack
+         || !make_blocks(&gc) ) {
+        gc_free(&gc);
+        return 0;
+    }
+
+    /* the roots */
+    if ( gc.code_blocks > 0 ) {
+        reach(&gc, 0);
+    }
+    for ( i = 0; i < as->entries.size; i++ ) {
+        reach(&gc, block_of_label(&gc, name_table_name(&as->entries, i)));
+    }
+
+    while ( gc.stack_size > 0 ) {
+        block = gc.stack[--gc.stack_size];
+        if ( block < gc.code_blocks ) { /* a data block doesn't reach anything */
+            visit_code_block(&gc, block);
+        }
+    }
+
+    /* remove what wasn't reached */
+    for ( i = 0; i < list->size; i++ ) {
+        if ( !gc.reachable[gc.code_block[i]] ) {
+            list->items[i].removed = 1;
+            as->gc_code_words += instruction_size(list, i, as->ic);
+        }
+    }
+    as->gc_data_words = compact_data(&gc);
+
+    gc_free(&gc);
+
+    return as->gc_data_words >= 0;
+}
@@ -1,10 +1,34 @@
 #define LINE_MAX 81
-#define WORD_MAX 10
 #define LABEL_MAX 31
-#define NUM_OF_OPERATIONS 16
-#define INITIAL_IC 100
 #define NO_ARG 20
-#define BASE_4_WORD_SIZE 5
+
+/*
+ * The machine the programs are assembled for. Its word width and the address the code starts at are chosen
+ * when the assembler is built, so the sibling machines are built from the same source, i.e:
+ *
+ *      gcc -DWORD_MAX=12 -DINITIAL_IC=0 ...
+ *
+ * A word is, from its highest bit: the operation code (the rest of the bits), the addressing methods of the
+ * source and of the destination operands (2 bits each), and the memory type (2 bits). An operand word holds
+ * its value (a number or an address) above the memory type. Everything below is a constant of the build, so
+ * the encoders, the formatters and the simulator have no test of the width.
+ */
+#ifndef WORD_MAX
+#define WORD_MAX 10 /* 10, 12, 14 or 16 bits */
+#endif
+#ifndef INITIAL_IC
+#define INITIAL_IC 100
+#endif
+#if WORD_MAX < 10 || WORD_MAX > 16 || WORD_MAX % 2 != 0
+#error "WORD_MAX should be 10, 12, 14 or 16"
+#endif
+#define OPER_BITS (WORD_MAX - 6) /* the bits of the operation code */
+#define OPER_MASK ((1 << OPER_BITS) - 1)
+#define OPERATION_CODES (1 << OPER_BITS) /* the codes the operation field can hold, the codes from NUM_OF_OPERATIONS up are invalid */
+#define NUM_OF_OPERATIONS 16
+#define VALUE_BITS (WORD_MAX - 2) /* the bits of the value of an operand word */
+#define VALUE_MASK ((1 << VALUE_BITS) - 1)
+#define BASE_4_WORD_SIZE (WORD_MAX / 2) /* the base 4 digits of a word */
 
 /* Addressing methods */
 #define IMMEDIATE 0
@@ -15,8 +39,9 @@
 
 enum {A = 0, E, R}; /* memory type - A for absolute, E for external, and R for relocatable memory */
 enum {LABEL = 1, OPERATION, ARGUMENT};
-enum {DATA = 16, STRING, MAT, ENTRY, EXTERN};
+enum {DATA = 16, STRING, MAT, ENTRY, EXTERN, DEFINE};
 enum {FIRST_ARG, SECOND_ARG};
+enum {MOV = 0, CMP, ADD, SUB, NOT, CLR, LEA, INC, DEC, JMP, BNE, RED, PRN, JSR, RTS, STOP}; /* operation codes */
 
 /* struct that represents the signs table */
 typedef struct{
@@ -24,6 +49,7 @@ typedef struct{
     int address;
     int external : 2;
     int operation : 2;
+    int alias : 2; /* 1 if the label points into the words of another string (string pooling) */
 } table_of_signs;
 
 typedef struct{
@@ -32,20 +58,416 @@ typedef struct{
 } opers;
 
 
-/* type of word_type, represents a 10-bits "word" in the memory */
+/* type of word_type, represents a WORD_MAX bits "word" in the memory */
 typedef struct{
-    unsigned int oper : 4;	/* operation name */
+    unsigned int oper : OPER_BITS;	/* operation name */
     unsigned int amethod_src_operand : 2;	/* addressing method of the source operand */
     unsigned int amethod_dest_operand : 2;	/* addressing method of the destination operand */
     unsigned int memory : 2; /* memory type, absolute, external or relocatable */
 } word_t;
 
+/* a memory image of an assembled program, loaded from a .ob or a .bin file */
+typedef struct{
+    unsigned short *words; /* the code words and then the data words, as numbers */
+    int code_size;
+    int data_size;
+    int base; /* the address of the first word */
+} image_t;
+
+/* reads the symbols of a .ent or a .ext file one at a time, in the plain or in the compact format (--compact-ext) */
+typedef struct{
+    const char *p; /* the next char to read */
+    const char *end;
+    char name[LINE_MAX]; /* the symbol that was read */
+    int address; /* the address that was read */
+    int grouped; /* 1 while the rest of a line is the deltas of more uses of the symbol */
+} symbol_reader_t;
+
+/* the simulated machine */
+#define MEMORY_SIZE (1 << VALUE_BITS) /* an address is the value of an operand word, 8 bits on the 10 bits machine */
+#define SEGMENT_STREAM_WORDS 4096 /* the writers release the pages of a spilled segment every this many words */
+#define STACK_SIZE 256
+#define NUM_OF_REGISTERS 8
+#define WORD_MASK ((1 << WORD_MAX) - 1)
+
+enum {MACHINE_RUNNING = 0, MACHINE_HALTED, MACHINE_STEP_LIMIT, MACHINE_ERROR};
+
+/* a decoded operand */
+typedef struct{
+    int method; /* the addressing method, NO_ARG if there is no operand */
+    int value; /* the immediate value, the address, or the register */
+    int row; /* the registers of a matrix access */
+    int column;
+    int *cell; /* the register, the memory word or the immediate value, NULL for a matrix access */
+} operand_t;
+
+/* a predecoded instruction */
+typedef struct{
+    int oper;
+    int address;
+    int next; /* the address of the instruction after it */
+    operand_t src;
+    operand_t dest;
+} micro_op_t;
+
+/* a decoded basic block, by its first address */
+typedef struct{
+    int first; /* the index of its first micro op */
+    int count; /* the number of micro ops, 0 if the block isn't decoded */
+} block_t;
+
+/* a list of word values, the input or the output of a simulated program */
+typedef struct{
+    int *values;
+    int size;
+    int capacity;
+} value_list_t;
+
+/* a node of the call tree of the profiler, a routine and the calls that led to it */
+typedef struct{
+    int parent; /* -1 for the root */
+    int routine; /* the address the routine starts at */
+    int first_child;
+    int next_sibling;
+    long count; /* instructions run in this routine, when it was called by this path */
+} call_node_t;
+
+/* the counters of the profiler (--profile) */
+typedef struct{
+    long hits[MEMORY_SIZE]; /* runs of the instruction at each address */
+    long opcodes[NUM_OF_OPERATIONS]; /* runs of each operation */
+    long taken[MEMORY_SIZE]; /* bne that jumped, by address */
+    long not_taken[MEMORY_SIZE];
+    call_node_t *nodes; /* the call tree, the root is the start of the program */
+    int nodes_size;
+    int nodes_capacity;
+    int current; /* the node of the routine that runs now */
+} profile_t;
+
+typedef struct{
+    int memory[MEMORY_SIZE];
+    int registers[NUM_OF_REGISTERS];
+    int immediates[WORD_MASK + 1]; /* every word value, for the immediate operands to point to */
+    int pc;
+    int zero; /* the flag cmp sets */
+    int stack[STACK_SIZE]; /* the return addresses */
+    int sp;
+    long steps; /* the number of instructions that were run */
+    int status;
+    const char *error; /* the runtime error, when the status is MACHINE_ERROR */
+    micro_op_t *ops; /* the micro ops of all the decoded blocks */
+    int ops_size;
+    int ops_capacity;
+    block_t blocks[MEMORY_SIZE];
+    unsigned char is_code[MEMORY_SIZE]; /* 1 for the words of decoded instructions */
+    int code_written; /* 1 if a decoded instruction was written to */
+    int flushes; /* the number of times the decoded blocks were dropped */
+    FILE *in; /* where red reads from, when there is no input list */
+    FILE *out; /* where prn writes to, when there is no output list */
+    value_list_t *input; /* the numbers red reads, NULL to read from "in" */
+    int input_position;
+    value_list_t *output; /* the numbers prn writes, NULL to write to "out" */
+    profile_t *profile; /* the counters, NULL when not profiling */
+} machine_t;
+
 /* a general table */
 typedef struct{
 	char *label_name;
 	int address; /* address of the label that will be covert to basis 4 "mozar" as described in the maman booklet */
 } data_table;
 
+/* diagnostics formats */
+enum {DIAG_TEXT = 0, DIAG_JSON};
+
+/* diagnostic codes */
+enum {DIAG_INVALID_LABEL = 0, DIAG_INVALID_OPERATION, DIAG_DUPLICATE_SIGN, DIAG_INVALID_NUMBER, DIAG_NUMBER_TOO_BIG,
+      DIAG_INVALID_LIST, DIAG_INVALID_STRING, DIAG_EXTRA_OPERAND, DIAG_INVALID_MATRIX_SIZE, DIAG_INVALID_MATRIX_LIST,
+      DIAG_INVALID_ARGUMENT, DIAG_TOO_MANY_OPERANDS, DIAG_INVALID_ENTRY, DIAG_UNDEFINED_LABEL, DIAG_INVALID_ADDRESSING,
+      DIAG_MEMORY, DIAG_INVALID_MACRO, DIAG_INVALID_EXPRESSION, DIAG_UNDEFINED_CONSTANT};
+
+/* expression evaluation results */
+enum {EXPR_OK = 0, EXPR_SYNTAX, EXPR_UNDEFINED, EXPR_DIVISION_BY_ZERO, EXPR_CYCLE};
+
+/* a single diagnostic (error or warning) */
+typedef struct{
+    int line;
+    int column; /* starts from 1, 0 if the diagnostic is about the whole line */
+    int code;
+    int is_error; /* 1 for errors, 0 for warnings */
+    int message; /* offset of the message in the messages buffer */
+} diagnostic;
+
+/* the diagnostics of a single source, they are kept in memory and written in one batch */
+typedef struct{
+    diagnostic *records;
+    int size;
+    int capacity;
+    char *messages; /* the messages of all the records, one after the other */
+    int messages_size;
+    int messages_capacity;
+    int errors; /* number of errors, not including warnings */
+    int max_errors; /* stop scanning after this many errors, 0 for no limit */
+} diagnostics_t;
+
+/* a span of text in the text buffer of a names table */
+typedef struct{
+    int start; /* offset of the text in the buffer */
+    int length;
+    int line; /* the line number of the text in the source file */
+} text_span;
+
+/* names table, maps names to indexes through a hash table */
+typedef struct{
+    char *text; /* the names, and other texts that belong to them */
+    int text_size;
+    int text_capacity;
+    int *names; /* offset of each name in the text */
+    int *next; /* the next name in the same hash bucket, -1 for none */
+    int size;
+    int capacity;
+    int *buckets; /* index of the first name in each bucket, -1 for empty bucket */
+    int buckets_count; /* a power of two */
+} name_table_t;
+
+/* a macro, its body is the lines (spans) first_span ... first_span + span_count - 1 */
+typedef struct{
+    int first_span;
+    int span_count;
+} macro_t;
+
+/* the macro table, hashed by the macro name */
+typedef struct{
+    name_table_t names; /* the macros names, and the text of their bodies */
+    macro_t *macros; /* by the index of the name */
+    int capacity;
+    text_span *spans; /* the lines of all the macros bodies */
+    int spans_size;
+    int spans_capacity;
+} macro_table_t;
+
+/* the macro stage, expands the macros while the source is read */
+typedef struct{
+    macro_table_t table;
+    int expanding; /* the macro that is being expanded, -1 if none */
+    int next_span; /* the next line of the macro that is being expanded */
+    int defining; /* the macro that is being defined, -1 if none, -2 if its definition is skipped */
+    int definition_line; /* the line of the last "mcr" */
+    int line_counter; /* the number of lines read from the source file */
+    int frozen; /* 1 if the macros are already known (second scan), so their definitions are skipped */
+} preprocessor_t;
+
+/* a constant defined by .define, its expression is evaluated when it's first needed */
+typedef struct{
+    int value;
+    int state; /* defined, pending (not evaluated yet) or resolving (being evaluated, to find cycles) */
+    int expression; /* offset of the expression in the text of the names table */
+    int line; /* the line of the .define */
+    int column; /* the column of the expression */
+} constant_t;
+
+/* the constant table, hashed by the constant name */
+typedef struct{
+    name_table_t names; /* the constants names, and the text of their expressions */
+    constant_t *constants; /* by the index of the name */
+    int capacity;
+} constant_table_t;
+
+/* a data word that uses a constant that wasn't defined yet, fixed at the end of the first scan */
+typedef struct{
+    int index; /* the index of the word in the data segment */
+    int expression; /* offset of the expression in the text of the constant table */
+    int line;
+    int column;
+} fixup_t;
+
+/* an instruction the first scan counted, for the peephole optimizer */
+typedef struct{
+    int address; /* the address before the optimization */
+    int oper; /* operation code */
+    int has_label; /* 1 if there is a label on the instruction line */
+    int removed; /* 1 if the optimizer removed the instruction */
+    int args[2]; /* offset of each operand in the text of the list, -1 if there is no such operand */
+    int amethods[2]; /* addressing method of each operand, NO_ARG if there is no such operand */
+} instruction_t;
+
+/* the instructions of the source, in the order they were written */
+typedef struct{
+    instruction_t *items;
+    int size;
+    int capacity;
+    char *text; /* the operands of all the instructions */
+    int text_size;
+    int text_capacity;
+} instruction_list_t;
+
+/* the strings in the data segment, and all their suffixes, hashed by their contents */
+typedef struct{
+    name_table_t strings;
+    int *addresses; /* the data address of each string, by the index of the string */
+    int capacity;
+} string_pool_t;
+
+/* a row of the line table: an instruction and the source line it was encoded from */
+typedef struct{
+    int address; /* the address of the first word of the instruction */
+    int line;
+} line_row_t;
+
+/* the line table of an assembled source, for the debug information (-g) */
+typedef struct{
+    line_row_t *rows; /* by address, the order the second scan encodes the instructions in */
+    int rows_size;
+    int rows_capacity;
+} line_table_t;
+
+enum {SYMBOL_CODE = 0, SYMBOL_DATA, SYMBOL_EXTERN}; /* kinds of the symbols of the debug information */
+
+/* a symbol of the debug information, while it's written */
+typedef struct{
+    int address; /* the address of the label, or of the word that uses the external symbol */
+    int kind;
+    int name; /* offset of the name in the strings */
+} debug_symbol_t;
+
+/* the debug information of a program (NAME.dbg), looked up in the contents of the file */
+typedef struct{
+    unsigned char *contents;
+    long length;
+    int base;
+    long rows;
+    long checkpoints;
+    long symbols;
+    long files;
+    long strings_size;
+    long deltas_size;
+    const unsigned char *checkpoint_table; /* the parts of the file, point into the contents */
+    const unsigned char *symbol_table;
+    const unsigned char *file_table;
+    const unsigned char *strings;
+    const unsigned char *deltas;
+} debug_map_t;
+
+/* the files of an archive member */
+enum {MEMBER_OB, MEMBER_ENT, MEMBER_EXT, MEMBER_FILES};
+
+/* the totals of the files assembled by the driver */
+typedef struct{
+    int files;
+    int assembled;
+    int with_errors;
+    int not_opened;
+    long code_words;
+    long data_words;
+    int outputs_written; /* the output files that were written */
+    int outputs_unchanged; /* the output files that were left as they were, their contents didn't change */
+} batch_totals_t;
+
+/* the output files of the run that were written, and the ones that were left as they were (see close_output()) */
+typedef struct{
+    int written;
+    int unchanged;
+} output_counts_t;
+
+/* an object archive (see archive.c), looked up in the mapped file */
+typedef struct{
+    const unsigned char *contents;
+    long length;
+    long members;
+    long symbols;
+    long slots;
+    long strings_size;
+    const unsigned char *member_table; /* the parts of the file, point into the contents */
+    const unsigned char *index;
+    const unsigned char *strings;
+} archive_t;
+
+/* assembler settings, chosen by the command line options */
+typedef struct{
+    int diag_format; /* DIAG_TEXT or DIAG_JSON */
+    int max_errors; /* stop scanning after this many errors, 0 for no limit */
+    int optimize; /* 1 to run the peephole optimizer (-O) */
+    int gc; /* 1 to remove the unreachable code and data (--gc) */
+    int pool_strings; /* 1 to share the words of identical strings and suffixes (--pool-strings) */
+    int binary; /* 1 to write a binary image (.bin) too (--bin) */
+    long max_steps; /* stop the simulator after this many instructions (--max-steps=N), 0 for no limit */
+    int jit; /* 1 to run the hot blocks as native code (--jit) */
+    int profile; /* 1 to write an execution profile of the simulated program (--profile) */
+    char *batch; /* run the program once for every line of this file, in lockstep (--batch=FILE), NULL for a single run */
+    int debug_info; /* 1 to write the line table and the symbols (.dbg) too (-g) */
+    int relocations; /* 1 to write the relocation table (.rel) too (--reloc) */
+    int load_base; /* run the program at this address (--base=N), -1 to run it where it was assembled */
+    int threads; /* the number of threads of the link check (--threads=N), 0 for every CPU */
+    long mem_limit; /* the memory budget of the segments in bytes (--mem-limit=N), 0 for no limit */
+    int compact_ext; /* 1 to write every extern once, with the deltas of its uses (--compact-ext) */
+} settings_t;
+
+/* a segment that was moved to a temporary file (--mem-limit, see spill.c) */
+typedef struct{
+    word_t *words; /* the mapping */
+    int fd;
+    long capacity; /* the words the file holds */
+} spilled_segment_t;
+
+/* the segments of a context that were moved to temporary files */
+typedef struct{
+    spilled_segment_t *segments;
+    int size;
+    int capacity;
+    long budget; /* the memory budget of the segments in bytes, from the settings of the source, 0 for no limit */
+} spill_table_t;
+
+/* assembler context, holds everything that belongs to a single assembled source */
+typedef struct{
+    settings_t settings;
+    diagnostics_t diag;
+    preprocessor_t pp;
+
+    constant_table_t constants;
+    fixup_t *fixups; /* data words to fix at the end of the first scan */
+    int fixups_size;
+    int fixups_capacity;
+
+    instruction_list_t instructions; /* recorded only for the peephole optimizer and the garbage collection */
+    name_table_t entries; /* the .entry labels, the roots of the garbage collection */
+    int gc_code_words; /* the number of code words the garbage collection removed */
+    int gc_data_words; /* the number of data words the garbage collection removed */
+    string_pool_t pool; /* used only with --pool-strings */
+    line_table_t lines; /* recorded only with -g, or for the incremental assembly */
+    int incremental; /* 1 if the context is kept to patch the next version of the source (assemble_incremental()) */
+
+    table_of_signs *table_signs;
+    int table_signs_size;
+    int table_signs_capacity; /* the tables keep their capacities from source to source */
+
+    word_t *data_seg; /* data segment */
+    int dc; /* data counter */
+    int data_capacity;
+
+    word_t *code_seg; /* code segment */
+    int ic;  /* instruction counter */
+    int code_capacity;
+    spill_table_t spilled; /* the segments that were moved to temporary files */
+
+    data_table *ent; /* entry table */
+    int ent_size;  /* size of entry table */
+    int ent_capacity;
+
+    data_table *ext; /* extern table */
+    int ext_size;  /* size of extern table */
+    int ext_capacity;
+} assembler_t;
+
+/* read only view of the assembled segments, points into the assembler context */
+typedef struct{
+    const word_t *code;
+    int code_size;
+    const word_t *data;
+    int data_size;
+    int base; /* the address of the first code word */
+} segments_view;
+
+extern opers valid_operations[];
+
 /* validation functions */
 int check_word(char *, int);
 int num_isvalid(char *);
@@ -53,28 +475,213 @@ int is_valid_matrix_form(char *arg);
 int sign_already_exists(table_of_signs *table, int row_counter, char *sign_name);
 int is_address_valid(int, int, int);
 int is_label_defined(char *label, int addressing_method, table_of_signs *signs_table, int signs_table_size);
+int is_immediate_in_range(int num);
 
 /* utilities functions */
 void skip_white_space(const char line[LINE_MAX], int *i);
 int get_new_word(char line[LINE_MAX], char single_word[LINE_MAX], int *position);
 int get_entry_string(char line[LINE_MAX], char string[LINE_MAX], int *position);
 int find_reg_num(char reg[LINE_MAX]);
-word_t trans_to_word(int int_num, int line_count, int *error);
+word_t trans_to_word(int int_num, int *error);
 int calculate_matrix_size(char *arg);
 word_t trans_regs_to_word(int first_register_num, int second_register_num, int memory_type);
-void encode_argument(char *arg, int amethod, char *additional_arg, int arg_count, word_t **code_seg, int *seg_size, table_of_signs*, int table_signs_size, data_table **ext_table, int *ext_table_size);
+void encode_argument(char *arg, int amethod, char *additional_arg, int arg_count, spill_table_t *spilled, word_t **code_seg, int *seg_size, int *seg_capacity, table_of_signs*, int table_signs_size, data_table **ext_table, int *ext_table_size, int *ext_table_capacity);
 int find_label_address(char *label, table_of_signs*, int table_signs_size, int *is_external);
 void convert_word_to_base_four_mozar(word_t word, char **p);
 void convert_num_to_base_four_mozar(int num, char **p);
 void extract_mat_label(char *src_label, char **dest_label);
 int is_valid_register(char *reg);
 void free_signs_names(table_of_signs *table_signs, int table_size);
+void free_table_names(data_table *table, int table_size);
+unsigned int hash_string(const char *str);
+int ensure_capacity(void **array, int *capacity, int needed, size_t item_size);
 
 /* db functions */
-int insert_sign(table_of_signs **table, int *table_size, char *sign_name, int address, int external, int operation);
+int insert_sign(table_of_signs **table, int *table_size, int *table_capacity, char *sign_name, int address, int external, int operation);
 void signs_table_update(table_of_signs *table, int table_size, int inst_count);
-int update_ent_table(data_table **ent_table, int *ent_size, char *ent_label, table_of_signs *table_signs, int table_of_sings_size);
-int update_ext_table(data_table **table, int *table_size, char *label, int address);
-int code_insert(word_t **data_code_image,int *size, word_t new_word);
-void ob_print(word_t *code_image, word_t *data_image, int inst_count, int data_count, FILE *obj_file);
-void e_print(data_table *table, int table_size, FILE *file);
\ No newline at end of file
+int update_ent_table(data_table **ent_table, int *ent_size, int *ent_capacity, char *ent_label, table_of_signs *table_signs, int table_of_sings_size);
+int update_ext_table(data_table **table, int *table_size, int *table_capacity, char *label, int address);
+int code_insert(spill_table_t *spilled, word_t **data_code_image, int *size, int *capacity, word_t new_word);
+void ob_print(spill_table_t *spilled, word_t *code_image, word_t *data_image, int inst_count, int data_count, FILE *obj_file);
+void e_print(data_table *table, int table_size, FILE *file);
+int ext_print_compact(data_table *table, int table_size, int inst_count, FILE *file);
+
+enum {LINE_SKIPPED = 0, LINE_ENCODED, LINE_ERROR, LINE_FATAL}; /* results of encoding a line in the second scan */
+
+/* assembler functions */
+void assembler_init(assembler_t *as);
+void assembler_free(assembler_t *as);
+int first_scan(assembler_t *as, FILE *fp);
+int encode_line(assembler_t *as, char *line, int line_counter, int *instruction);
+int second_scan(assembler_t *as, FILE *fp);
+int assembler_run(assembler_t *as, FILE *fp);
+int assemble_buffer(assembler_t *as, const char *source, size_t length);
+void assembler_segments(assembler_t *as, segments_view *view);
+
+/* diagnostics functions */
+void diag_init(diagnostics_t *diag);
+void diag_clear(diagnostics_t *diag);
+void diag_free(diagnostics_t *diag);
+void diag_report(diagnostics_t *diag, int line, int column, int code, int is_error, const char *format, ...);
+int diag_limit_reached(diagnostics_t *diag);
+void diag_flush(diagnostics_t *diag, char *file_name, int format, FILE *out);
+
+/* names table functions */
+void name_table_init(name_table_t *table);
+void name_table_clear(name_table_t *table);
+void name_table_free(name_table_t *table);
+int name_table_find(name_table_t *table, const char *name);
+int name_table_add_text(name_table_t *table, const char *text, int length);
+int name_table_insert(name_table_t *table, const char *name);
+char *name_table_name(name_table_t *table, int index);
+
+/* macro functions */
+void preprocessor_init(preprocessor_t *pp);
+void preprocessor_reset(preprocessor_t *pp);
+void preprocessor_rewind(preprocessor_t *pp);
+void preprocessor_free(preprocessor_t *pp);
+int macro_find(macro_table_t *table, char *name);
+int read_line(assembler_t *as, FILE *fp, char line[LINE_MAX], int *line_number);
+
+/* constants functions */
+void constant_table_init(constant_table_t *table);
+void constant_table_free(constant_table_t *table);
+int eval_expression(constant_table_t *table, const char *expression, int *value, char *name);
+int is_valid_expression(const char *expression);
+int parse_define(assembler_t *as, char *line, int pos, int line_number);
+int fold_data_value(assembler_t *as, char *arg, int line, int column, int *num);
+int fold_immediate(assembler_t *as, char *arg, int line, int column);
+int resolve_fixups(assembler_t *as);
+
+/* peephole optimizer functions */
+void instruction_list_init(instruction_list_t *list);
+void instruction_list_clear(instruction_list_t *list);
+void instruction_list_free(instruction_list_t *list);
+int instruction_add(instruction_list_t *list, int address, int oper, int has_label);
+int instruction_set_operand(instruction_list_t *list, int arg_count, char *arg, int amethod);
+char *instruction_operand(instruction_list_t *list, instruction_t *item, int arg_count);
+int instruction_size(instruction_list_t *list, int index, int ic);
+int instruction_find(instruction_list_t *list, int address);
+void peephole_optimize(assembler_t *as);
+int remove_instructions(assembler_t *as);
+
+/* string pool functions */
+void string_pool_init(string_pool_t *pool);
+void string_pool_clear(string_pool_t *pool);
+void string_pool_free(string_pool_t *pool);
+int string_pool_find(string_pool_t *pool, char *str);
+int string_pool_add(string_pool_t *pool, char *str, int address);
+
+/* image functions */
+int word_to_int(word_t word);
+word_t int_to_word(int num);
+void image_init(image_t *image);
+void image_free(image_t *image);
+char *read_whole_file(const char *file_name, long *length);
+const char *map_file(const char *file_name, long *length);
+void unmap_file(const char *contents, long length);
+int file_has_contents(const char *file_name, const char *contents, long length);
+int image_load(image_t *image, const char *file_name);
+int image_load_program(image_t *image, char *base_name);
+int read_symbol_line(const char *line, char *name, int *address);
+void symbol_reader_init(symbol_reader_t *reader, const char *text, long length);
+int symbol_reader_next(symbol_reader_t *reader);
+int operands_count(int oper);
+int instruction_length(int word);
+void bin_print(spill_table_t *spilled, word_t *code_image, word_t *data_image, int inst_count, int data_count, FILE *bin_file);
+void rel_print(spill_table_t *spilled, word_t *code_image, int inst_count, FILE *rel_file);
+int image_relocate(image_t *image, char *base_name, int base);
+
+/* debug information functions */
+void line_table_init(line_table_t *table);
+void line_table_clear(line_table_t *table);
+void line_table_free(line_table_t *table);
+int line_table_add(line_table_t *table, int address, int line);
+int debug_write(assembler_t *as, char *source_name, FILE *fp);
+int debug_map_load(debug_map_t *map, char *base_name);
+void debug_map_free(debug_map_t *map);
+int debug_find_line(debug_map_t *map, int address, const char **file, int *line);
+const char *debug_symbol(debug_map_t *map, int index, int *address, int *kind);
+const char *debug_find_label(debug_map_t *map, int address, int *label_address);
+void debug_format_location(debug_map_t *map, int address, char *out);
+
+/* spilled segment functions */
+void spill_table_init(spill_table_t *spilled);
+void spill_table_free(spill_table_t *spilled);
+int segment_spill_insert(spill_table_t *spilled, word_t **image, int *size, word_t word);
+void segment_free(spill_table_t *spilled, word_t *words);
+void segment_will_stream(spill_table_t *spilled, word_t *words);
+void segment_release(spill_table_t *spilled, word_t *words, long count);
+long segment_spilled_bytes(spill_table_t *spilled, word_t *words);
+long peak_rss_kb(void);
+
+/* archive functions */
+unsigned long symbol_hash(const char *name);
+int archive_create(char *archive_name, int count, char *base_names[]);
+int archive_open(archive_t *ar, const char *archive_name);
+void archive_close(archive_t *ar);
+long archive_find(archive_t *ar, const char *symbol, int *address);
+const char *archive_member_name(archive_t *ar, long member);
+const char *archive_member_file(archive_t *ar, long member, int file, long *length);
+int archive_command(int argc, char *argv[]);
+
+/* link check functions */
+int link_units(int argc, char *argv[]);
+
+/* disassembler functions */
+int disassemble(char *base_name, FILE *out);
+
+/* simulator functions */
+int machine_init(machine_t *m, image_t *image, FILE *in, FILE *out);
+void machine_free(machine_t *m);
+int decode_block(machine_t *m, int start);
+void machine_flush(machine_t *m);
+void machine_run_block(machine_t *m, long max_steps);
+int machine_run(machine_t *m, long max_steps);
+int simulate(char *base_name, settings_t *options);
+int value_list_add(value_list_t *list, int value);
+
+/* batch simulator functions */
+int batch_simulate(image_t *image, settings_t *options);
+
+/* profiler functions */
+int profile_init(profile_t *profile, int start);
+void profile_free(profile_t *profile);
+void profile_count(profile_t *profile, micro_op_t *op, int pc);
+int profile_write(profile_t *profile, image_t *image, char *base_name);
+
+/* JIT functions */
+int jit_run(machine_t *m, long max_steps);
+
+/* garbage collection functions */
+int collect_garbage(assembler_t *as);
+
+/* driver functions */
+extern settings_t settings;
+extern output_counts_t output_counts;
+int parse_option(settings_t *options, char *option);
+FILE *open_output(char *base_name, char *extension, char **name);
+int close_output(FILE *fp, char *name, int complete);
+int write_outputs(assembler_t *as, char *base_name);
+int assemble(assembler_t *context, FILE *fp, char *base_name);
+int assemble_file(assembler_t *context, char *base_name);
+
+/* pipelined driver functions */
+FILE *pipeline_open_output(void);
+int pipeline_close_output(FILE *fp, char *name, int complete, int *ok, int *unchanged);
+int assemble_files(int count, char *base_names[], batch_totals_t *totals);
+int assemble_manifest(char *manifest_name);
+
+/* incremental assembly functions */
+int assemble_incremental(assembler_t *as, const char *old_source, size_t old_length, const char *source, size_t length, int *patched);
+
+/* stop signal functions */
+void catch_stop_signals(void);
+int stop_was_requested(void);
+
+/* watch mode functions */
+int watch(int count, char *base_names[]);
+
+/* server functions */
+int serve(char *socket_path);
+int client(char *socket_path, int argc, char *argv[]);
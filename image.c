@@ -0,0 +1,679 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "header.h"
+
+/*
+ * Memory images of assembled programs. An image is the code words followed by the data words, each
+ * word as a number (oper << 6 | src << 4 | dest << 2 | memory), loaded from:
+ *
+ *      .ob     the base 4 "mozar" text the assembler writes
+ *      .bin    a binary image (--bin): the magic "MZR1", the base address, the code size and the data size
+ *              as 4 bytes little endian numbers, and then every word as 2 bytes little endian
+ *
+ * The binary files are mapped to memory instead of read. With the relocation table (--reloc) an image can
+ * be loaded at another address without assembling it again:
+ *
+ *      .rel    the magic "MZL1", the base address it was assembled at and the number of relocatable words,
+ *              and then the index of every relocatable word in the image, ascending, all 4 bytes little endian
+ *
+ * A relocatable word is an operand word with R in its memory field, the address of a label of the program.
+ * Relocating is one pass over the table, that adds the distance between the bases to every word it lists.
+ */
+
+#define IMAGE_MAGIC "MZR1"
+#define IMAGE_HEADER_SIZE 16
+#define RELOCATION_MAGIC "MZL1"
+#define RELOCATION_HEADER_SIZE 12
+
+/* number of operands of each operation, by the operation code */
+static const int operands_of[OPERATION_CODES] = {2, 2, 2, 2, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 0, 0}; /* 0 for the invalid codes */
+
+static signed char mozar_digit[256]; /* the value of each base 4 "mozar" char, -1 for the other chars */
+static int mozar_ready = 0;
+
+/**
+ * Fill the reverse lookup table of the "mozar" digits.
+ */
+static void init_mozar_digits(void){
+    int i;
+
+    for ( i = 0; i < 256; i++ ) {
+        mozar_digit[i] = -1;
+    }
+    mozar_digit['a'] = 0;
+    mozar_digit['b'] = 1;
+    mozar_digit['c'] = 2;
+    mozar_digit['d'] = 3;
+    mozar_ready = 1;
+}
+
+/**
+ * Get the number of a word.
+ *
+ * @param word_t    word - The word.
+ *
+ * @return int - The number, between 0 and 2^WORD_MAX - 1.
+ */
+int word_to_int(word_t word){
+    return (int) (word.oper << 6 | word.amethod_src_operand << 4 | word.amethod_dest_operand << 2 | word.memory);
+}
+
+/**
+ * Get the word of a number, only the lower WORD_MAX bits are used.
+ *
+ * @param int   num - The number.
+ *
+ * @return word_t - The word.
+ */
+word_t int_to_word(int num){
+    word_t word;
+
+    word.memory = (unsigned) num & 3;
+    word.amethod_dest_operand = (unsigned) (num >> 2) & 3;
+    word.amethod_src_operand = (unsigned) (num >> 4) & 3;
+    word.oper = (unsigned) (num >> 6) & OPER_MASK;
+
+    return word;
+}
+
+/**
+ * Get the number of operands of an operation.
+ *
+ * @param int   oper - The operation code.
+ *
+ * @return int - 0, 1 or 2.
+ */
+int operands_count(int oper){
+    return operands_of[oper & OPER_MASK];
+}
+
+/**
+ * Get the number of words of an encoded instruction, by its first word.
+ * Two register operands share a word, and a matrix access takes two words.
+ *
+ * @param int   word - The first word of the instruction.
+ *
+ * @return int - The number of words, including the first word.
+ */
+int instruction_length(int word){
+    static const int method_words[4] = {1, 1, 2, 1}; /* IMMEDIATE, DIRECT, MATRIX_ACCESS, DIRECT_REGISTER */
+    int src = (word >> 4) & 3, dest = (word >> 2) & 3;
+
+    switch ( operands_of[(word >> 6) & OPER_MASK] ) {
+        case 2:
+            if ( src == DIRECT_REGISTER && dest == DIRECT_REGISTER ) {
+                return 2;
+            }
+            return 1 + method_words[src] + method_words[dest];
+        case 1:
+            return 1 + method_words[dest];
+        default:
+            return 1;
+    }
+}
+
+/**
+ * Initialize an empty image.
+ *
+ * @param image_t*  image - The image to initialize.
+ */
+void image_init(image_t *image){
+    image->words = NULL;
+    image->code_size = image->data_size = 0;
+    image->base = INITIAL_IC;
+}
+
+/**
+ * Free the memory of an image.
+ *
+ * @param image_t*  image - The image to free.
+ */
+void image_free(image_t *image){
+    free(image->words);
+    image_init(image);
+}
+
+/**
+ * Read a whole file to memory.
+ *
+ * @param char*     file_name - The file name.
+ * @param long*     length - Will hold the length of the file at the end.
+ *
+ * @return char* - The (allocated, null terminated) contents, NULL if the file couldn't be read.
+ */
+char *read_whole_file(const char *file_name, long *length){
+    FILE *fp;
+    char *contents;
+
+    if ( !(fp = fopen(file_name, "rb")) ) {
+        return NULL;
+    }
+    if ( fseek(fp, 0, SEEK_END) != 0 || (*length = ftell(fp)) < 0 || fseek(fp, 0, SEEK_SET) != 0
+         || !(contents = malloc((size_t) *length + 1)) ) {
+        fclose(fp);
+        return NULL;
+    }
+    if ( fread(contents, 1, (size_t) *length, fp) != (size_t) *length ) {
+        free(contents);
+        fclose(fp);
+        return NULL;
+    }
+    contents[*length] = '\0';
+    fclose(fp);
+
+    return contents;
+}
+
+/**
+ * Map a whole file to memory, read only.
+ *
+ * @param char*     file_name - The file name.
+ * @param long*     length - Will hold the length of the file at the end.
+ *
+ * @return char* - The contents, NULL if the file couldn't be mapped (or is empty).
+ */
+const char *map_file(const char *file_name, long *length){
+    struct stat info;
+    void *contents;
+    int fd;
+
+    if ( (fd = open(file_name, O_RDONLY)) < 0 ) {
+        return NULL;
+    }
+    if ( fstat(fd, &info) != 0 || info.st_size <= 0 ) {
+        close(fd);
+        return NULL;
+    }
+    *length = (long) info.st_size;
+    contents = mmap(NULL, (size_t) *length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); /* the mapping stays */
+
+    return contents == MAP_FAILED ? NULL : (const char *) contents;
+}
+
+/**
+ * Unmap a file that was mapped by map_file().
+ */
+void unmap_file(const char *contents, long length){
+    munmap((void *) contents, (size_t) length);
+}
+
+/**
+ * Check whether a file holds exactly the given contents. The sizes are compared first, and then the mapped
+ * file, up to the first difference.
+ *
+ * @param char*     file_name - The file name.
+ * @param char*     contents - The contents.
+ * @param long      length - The length of the contents.
+ *
+ * @return int - 1 if the file holds the contents, 0 otherwise (or if it can't be read).
+ */
+int file_has_contents(const char *file_name, const char *contents, long length){
+    struct stat info;
+    const char *existing;
+    long existing_length;
+    int same;
+
+    if ( stat(file_name, &info) != 0 || !S_ISREG(info.st_mode) || (long) info.st_size != length ) {
+        return 0;
+    }
+    if ( length == 0 ) {
+        return 1;
+    }
+    if ( !(existing = map_file(file_name, &existing_length)) ) {
+        return 0;
+    }
+    same = existing_length == length && memcmp(existing, contents, (size_t) length) == 0;
+    unmap_file(existing, existing_length);
+
+    return same;
+}
+
+/**
+ * Read a base 4 "mozar" number.
+ *
+ * @param char**    p - The position in the text, moved after the number at the end.
+ *
+ * @return int - The number, -1 if there is no number at the position.
+ */
+static int read_mozar(const char **p){
+    const unsigned char *s = (const unsigned char *) *p;
+    int num = 0, digits = 0;
+
+    while ( *s == ' ' || *s == '\t' || *s == '\r' ) {
+        s++;
+    }
+    while ( mozar_digit[*s] >= 0 ) {
+        num = num * 4 + mozar_digit[*s++];
+        digits++;
+    }
+    *p = (const char *) s;
+
+    return digits ? num : -1;
+}
+
+/**
+ * Skip to the beginning of the next line.
+ *
+ * @param char**    p - The position in the text.
+ */
+static void next_line(const char **p){
+    while ( **p && **p != '\n' ) {
+        (*p)++;
+    }
+    if ( **p ) {
+        (*p)++;
+    }
+}
+
+/**
+ * Parse the .ob text.
+ *
+ * @param image_t*  image - The image, its words are allocated.
+ * @param char*     text - The text.
+ *
+ * @return int - 1 if everything went OK, 0 if the text isn't a valid .ob file.
+ */
+static int parse_mozar_image(image_t *image, const char *text){
+    const char *p = text;
+    int code_size, data_size, i, address, word;
+
+    if ( !mozar_ready ) {
+        init_mozar_digits();
+    }
+
+    next_line(&p); /* the titles */
+    while ( *p == '\r' || *p == '\n' ) {
+        p++;
+    }
+
+    /* the sizes, an empty size is 0 */
+    if ( (code_size = read_mozar(&p)) < 0 ) {
+        return 0;
+    }
+    if ( (data_size = read_mozar(&p)) < 0 ) {
+        data_size = 0;
+    }
+    next_line(&p);
+
+    if ( !(image->words = malloc((code_size + data_size + 1) * sizeof(unsigned short))) ) {
+        return 0;
+    }
+    image->code_size = code_size;
+    image->data_size = data_size;
+
+    for ( i = 0; i < code_size + data_size; i++ ) {
+        while ( *p == '\r' || *p == '\n' ) {
+            p++;
+        }
+        address = read_mozar(&p);
+        word = read_mozar(&p);
+        if ( address < 0 || word < 0 ) {
+            return 0;
+        }
+        if ( i == 0 ) {
+            image->base = address;
+        }
+        image->words[i] = (unsigned short) word;
+        next_line(&p);
+    }
+
+    return 1;
+}
+
+/**
+ * Read a 4 bytes little endian number.
+ *
+ * @param unsigned char*    p - The bytes.
+ *
+ * @return long - The number.
+ */
+static long read_le32(const unsigned char *p){
+    return (long) p[0] | (long) p[1] << 8 | (long) p[2] << 16 | (long) p[3] << 24;
+}
+
+/**
+ * Parse a binary image.
+ *
+ * @param image_t*  image - The image, its words are allocated.
+ * @param char*     contents - The contents of the file.
+ * @param long      length - The length of the file.
+ *
+ * @return int - 1 if everything went OK, 0 if the file isn't a valid binary image.
+ */
+static int parse_binary_image(image_t *image, const char *contents, long length){
+    const unsigned char *p = (const unsigned char *) contents;
+    long code_size, data_size, i;
+
+    if ( length < IMAGE_HEADER_SIZE ) {
+        return 0;
+    }
+    code_size = read_le32(p + 8);
+    data_size = read_le32(p + 12);
+    if ( code_size < 0 || data_size < 0 || length != IMAGE_HEADER_SIZE + 2 * (code_size + data_size) ) {
+        return 0;
+    }
+
+    if ( !(image->words = malloc((code_size + data_size + 1) * sizeof(unsigned short))) ) {
+        return 0;
+    }
+    image->base = (int) read_le32(p + 4);
+    image->code_size = (int) code_size;
+    image->data_size = (int) data_size;
+
+    for ( i = 0, p += IMAGE_HEADER_SIZE; i < code_size + data_size; i++, p += 2 ) {
+        image->words[i] = (unsigned short) ((p[0] | p[1] << 8) & WORD_MASK);
+    }
+
+    return 1;
+}
+
+/**
+ * Load an image from a .ob or a .bin file, the format is found by the contents.
+ *
+ * @param image_t*  image - The image, should be initialized.
+ * @param char*     file_name - The file name.
+ *
+ * @return int - 1 if everything went OK, 0 if the file couldn't be read or isn't valid.
+ */
+int image_load(image_t *image, const char *file_name){
+    const char *mapped;
+    char *contents;
+    long length;
+    int ok;
+
+    image_free(image);
+
+    /* a binary image is parsed where it's mapped, the .ob text is read since it's parsed as a string */
+    if ( (mapped = map_file(file_name, &length)) ) {
+        if ( length >= 4 && memcmp(mapped, IMAGE_MAGIC, 4) == 0 ) {
+            ok = parse_binary_image(image, mapped, length);
+            unmap_file(mapped, length);
+            if ( !ok ) {
+                image_free(image);
+            }
+            return ok;
+        }
+        unmap_file(mapped, length);
+    }
+
+    if ( !(contents = read_whole_file(file_name, &length)) ) {
+        return 0;
+    }
+    ok = parse_mozar_image(image, contents);
+    free(contents);
+
+    if ( !ok ) {
+        image_free(image);
+    }
+
+    return ok;
+}
+
+/**
+ * Read a line of a .ent or a .ext file: a name and a base 4 "mozar" address.
+ *
+ * @param char*     line - The line, shorter than LINE_MAX.
+ * @param char*     name - Will hold the name at the end, LINE_MAX chars.
+ * @param int*      address - Will hold the address at the end.
+ *
+ * @return int - 1 if the line has a name and an address, 0 otherwise.
+ */
+int read_symbol_line(const char *line, char *name, int *address){
+    char digits[LINE_MAX];
+    int i;
+
+    if ( sscanf(line, "%80s %80s", name, digits) != 2 ) {
+        return 0;
+    }
+    for ( *address = 0, i = 0; digits[i] >= 'a' && digits[i] <= 'd'; i++ ) {
+        *address = *address * 4 + digits[i] - 'a';
+    }
+
+    return i > 0;
+}
+
+/**
+ * Start reading the symbols of a .ent or a .ext file.
+ *
+ * @param symbol_reader_t*  reader - The reader.
+ * @param char*             text - The file, NULL if there is none.
+ * @param long              length - The length of the file.
+ */
+void symbol_reader_init(symbol_reader_t *reader, const char *text, long length){
+    reader->p = text;
+    reader->end = text ? text + length : NULL;
+    reader->grouped = 0;
+}
+
+/**
+ * Read a base 4 "mozar" number.
+ *
+ * @param char**    p - The position, moved past the number at the end.
+ * @param char*     end - The end of the text.
+ * @param int*      num - Will hold the number at the end.
+ *
+ * @return int - 1 if there was a number, 0 otherwise.
+ */
+static int read_mozar_number(const char **p, const char *end, int *num){
+    const char *start = *p;
+
+    for ( *num = 0; *p < end && **p >= 'a' && **p <= 'd'; (*p)++ ) {
+        *num = *num * 4 + **p - 'a';
+    }
+
+    return *p > start;
+}
+
+/**
+ * Read the next symbol of a .ent or a .ext file. A line is a name and the address of its first use, and in the
+ * compact format the distances of the next uses from the one before them, so a line could be as long as the
+ * uses are many:
+ *
+ *      NAME                          FIRST DELTA DELTA ...
+ *
+ * A line that has no name and address is skipped, as read_symbol_line() does.
+ *
+ * @param symbol_reader_t*  reader - The reader, the name and the address are set at the end.
+ *
+ * @return int - 1 if a symbol was read, 0 at the end of the file.
+ */
+int symbol_reader_next(symbol_reader_t *reader){
+    const char *start;
+    int delta;
+
+    while ( reader->p && reader->p < reader->end ) {
+        for ( ; reader->p < reader->end && (*reader->p == ' ' || *reader->p == '\t' || *reader->p == '\r'); reader->p++ );
+        if ( reader->grouped && read_mozar_number(&reader->p, reader->end, &delta) ) {
+            reader->address += delta;
+            return 1;
+        }
+
+        /* a new line */
+        if ( reader->grouped ) {
+            for ( ; reader->p < reader->end && *reader->p != '\n'; reader->p++ );
+            reader->grouped = 0;
+        }
+        if ( reader->p < reader->end && *reader->p == '\n' ) {
+            reader->p++;
+            continue;
+        }
+        for ( start = reader->p; reader->p < reader->end && !isspace((unsigned char) *reader->p); reader->p++ );
+        if ( reader->p - start < LINE_MAX ) {
+            sprintf(reader->name, "%.*s", (int) (reader->p - start), start);
+            for ( ; reader->p < reader->end && (*reader->p == ' ' || *reader->p == '\t'); reader->p++ );
+            if ( read_mozar_number(&reader->p, reader->end, &reader->address) ) {
+                reader->grouped = 1;
+                return 1;
+            }
+        }
+        for ( ; reader->p < reader->end && *reader->p != '\n'; reader->p++ ); /* not a symbol */
+    }
+
+    return 0;
+}
+
+/**
+ * Load an assembled program: NAME.bin if there is one, NAME.ob otherwise. An error is printed if neither could be read.
+ *
+ * @param image_t*  image - The image, should be initialized.
+ * @param char*     base_name - The file name without extension.
+ *
+ * @return int - 1 if everything went OK, 0 otherwise.
+ */
+int image_load_program(image_t *image, char *base_name){
+    char *name;
+    int ok;
+
+    if ( !(name = malloc(strlen(base_name) + 5)) ) {
+        fprintf(stderr, "Cannot allocate memory.\n");
+        return 0;
+    }
+
+    sprintf(name, "%s.bin", base_name);
+    if ( !(ok = image_load(image, name)) ) {
+        sprintf(name, "%s.ob", base_name);
+        ok = image_load(image, name);
+    }
+    if ( !ok ) {
+        fprintf(stderr, "Cannot read the program: %s.bin or %s.ob\n", base_name, base_name);
+    }
+    free(name);
+
+    return ok;
+}
+
+/**
+ * Write a 4 bytes little endian number.
+ *
+ * @param long      num - The number.
+ * @param FILE*     fp - The file.
+ */
+static void write_le32(long num, FILE *fp){
+    fputc((int) (num & 0xFF), fp);
+    fputc((int) ((num >> 8) & 0xFF), fp);
+    fputc((int) ((num >> 16) & 0xFF), fp);
+    fputc((int) ((num >> 24) & 0xFF), fp);
+}
+
+/**
+ * Write the code and the data segments as a binary image.
+ *
+ * @param spill_table_t*    spilled - The spilled segments of the context (see segment_release()).
+ * @param word_t*   code_image - The code segment.
+ * @param word_t*   data_image - The data segment.
+ * @param int       inst_count - The size of the code segment.
+ * @param int       data_count - The size of the data segment.
+ * @param FILE*     bin_file - The file to write to, opened in binary mode.
+ */
+void bin_print(spill_table_t *spilled, word_t *code_image, word_t *data_image, int inst_count, int data_count, FILE *bin_file){
+    int i, word;
+
+    fwrite(IMAGE_MAGIC, 1, 4, bin_file);
+    write_le32(INITIAL_IC, bin_file);
+    write_le32(inst_count, bin_file);
+    write_le32(data_count, bin_file);
+
+    for ( i = 0; i < inst_count + data_count; i++ ) {
+        word = word_to_int(i < inst_count ? code_image[i] : data_image[i - inst_count]);
+        fputc(word & 0xFF, bin_file);
+        fputc(word >> 8, bin_file);
+        if ( (i + 1) % SEGMENT_STREAM_WORDS == 0 ) {
+            segment_release(spilled, code_image, i + 1 < inst_count ? i + 1 : inst_count);
+            segment_release(spilled, data_image, i + 1 < inst_count ? 0 : i + 1 - inst_count);
+        }
+    }
+}
+
+/**
+ * Write the relocation table of the code segment: the index of every word with R in its memory field.
+ *
+ * @param spill_table_t*    spilled - The spilled segments of the context (see segment_release()).
+ * @param word_t*   code_image - The code segment.
+ * @param int       inst_count - The size of the code segment.
+ * @param FILE*     rel_file - The file to write to, opened in binary mode.
+ */
+void rel_print(spill_table_t *spilled, word_t *code_image, int inst_count, FILE *rel_file){
+    int i, count = 0;
+
+    for ( i = 0; i < inst_count; i++ ) {
+        count += code_image[i].memory == R;
+        if ( (i + 1) % SEGMENT_STREAM_WORDS == 0 ) {
+            segment_release(spilled, code_image, i + 1);
+        }
+    }
+
+    fwrite(RELOCATION_MAGIC, 1, 4, rel_file);
+    write_le32(INITIAL_IC, rel_file);
+    write_le32(count, rel_file);
+
+    for ( i = 0; i < inst_count; i++ ) {
+        if ( code_image[i].memory == R ) {
+            write_le32(i, rel_file);
+        }
+        if ( (i + 1) % SEGMENT_STREAM_WORDS == 0 ) {
+            segment_release(spilled, code_image, i + 1);
+        }
+    }
+}
+
+/**
+ * Move a loaded program to another base address, by its relocation table (NAME.rel). An error is printed
+ * if the table is missing or doesn't fit the image.
+ *
+ * @param image_t*  image - The image, loaded from NAME.bin or NAME.ob.
+ * @param char*     base_name - The file name without extension.
+ * @param int       base - The address to load the program at.
+ *
+ * @return int - 1 if everything went OK, 0 otherwise (the image isn't changed then).
+ */
+int image_relocate(image_t *image, char *base_name, int base){
+    const unsigned char *table;
+    const char *contents = NULL;
+    char *name;
+    long length = 0, count = 0, i, index, previous = -1;
+    int delta = base - image->base, size = image->code_size + image->data_size, address, ok;
+
+    if ( !(name = malloc(strlen(base_name) + 5)) ) {
+        fprintf(stderr, "Cannot allocate memory.\n");
+        return 0;
+    }
+    sprintf(name, "%s.rel", base_name);
+
+    /* the whole table is checked first, so a bad table doesn't leave a half moved image */
+    ok = base >= 0 && base + size <= MEMORY_SIZE && (contents = map_file(name, &length)) && length >= RELOCATION_HEADER_SIZE
+         && memcmp(contents, RELOCATION_MAGIC, 4) == 0 && read_le32((const unsigned char *) contents + 4) == image->base
+         && (count = read_le32((const unsigned char *) contents + 8)) >= 0 && length == RELOCATION_HEADER_SIZE + 4 * count;
+    table = (const unsigned char *) contents + RELOCATION_HEADER_SIZE;
+    for ( i = 0; ok && i < count; i++, previous = index ) {
+        index = read_le32(table + 4 * i);
+        ok = index > previous && index < image->code_size && (image->words[index] & 3) == R;
+    }
+
+    if ( ok ) {
+        for ( i = 0; i < count; i++ ) {
+            index = read_le32(table + 4 * i);
+            address = ((image->words[index] >> 2) + delta) & (MEMORY_SIZE - 1);
+            image->words[index] = (unsigned short) (address << 2 | R);
+        }
+        image->base = base;
+    } else if ( base < 0 || base + size > MEMORY_SIZE ) {
+        fprintf(stderr, "The program (%d words) doesn't fit in the memory at address %d.\n", size, base);
+    } else {
+        fprintf(stderr, "Cannot relocate the program, %s is missing or doesn't fit %s.bin or %s.ob\n", name, base_name, base_name);
+    }
+
+    if ( contents ) {
+        unmap_file(contents, length);
+    }
+    free(name);
+
+    return ok;
+}
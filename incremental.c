@@ -0,0 +1,327 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "header.h"
+
+/*
+ * Incremental assembly, for the watch mode. The assembler context keeps everything the last assembly left
+ * in it: the symbol table, the constants, the macros, the segments, the entry and the extern tables, and the
+ * line table (the address of the instruction on every line). The new source is diffed with the old one line
+ * by line, and when every changed line is an instruction that was changed to another instruction (with the
+ * same label), only these lines are encoded again, by the second scan, and patched into the code segment:
+ *
+ *      the same size       the words of the instruction are replaced, nothing else moves
+ *      another size        the code after the instruction and the data move: one pass over the relocatable
+ *                          words (the label references) moves the addresses after the instruction, and so
+ *                          do the symbol, entry, extern and line tables
+ *
+ * Anything else (a label, a directive, a macro or a line that was added or removed) changes what the first
+ * scan found, and the source is assembled from the beginning. So is a source whose patch has a diagnostic,
+ * so the diagnostics are always the ones a full assembly gives.
+ */
+
+/* an instruction line to encode again */
+typedef struct{
+    int number; /* the line number */
+    const char *text; /* the new text of the line, in the new source */
+    int length;
+} patch_t;
+
+/**
+ * Get the length of the line that starts at a position, without its new line.
+ */
+static int line_length(const char *text, size_t size, size_t start){
+    size_t end = start;
+
+    while ( end < size && text[end] != '\n' ) {
+        end++;
+    }
+
+    return (int) (end - start);
+}
+
+/**
+ * Read the label and the operation of an instruction line.
+ *
+ * @param char*     text - The line.
+ * @param int       length - The length of the line.
+ * @param char*     label - Will hold the label at the end, an empty string if there is none.
+ * @param char*     line - Will hold the line, as read_line() gives it.
+ *
+ * @return int - 1 if the line is an instruction the first scan accepts (operation code 0 - 15, valid operands,
+ *               no more than two of them), 0 otherwise.
+ */
+static int read_instruction_line(const char *text, int length, char *label, char *line){
+    char word[LINE_MAX];
+    int pos = 0, args;
+
+    if ( length >= LINE_MAX - 1 ) { /* longer lines are split by fgets() */
+        return 0;
+    }
+    memcpy(line, text, (size_t) length);
+    line[length] = '\n';
+    line[length + 1] = '\0';
+
+    label[0] = '\0';
+    skip_white_space(line, &pos);
+    if ( get_new_word(line, word, &pos) == 0 ) {
+        return 0;
+    }
+    if ( word[strlen(word) - 1] == ':' ) {
+        strcpy(label, word);
+        skip_white_space(line, &pos);
+        get_new_word(line, word, &pos);
+    }
+
+    if ( check_word(word, OPERATION) < MOV || check_word(word, OPERATION) > STOP ) {
+        return 0;
+    }
+    for ( args = 0; args < 3; args++ ) {
+        skip_white_space(line, &pos);
+        if ( get_new_word(line, word, &pos) == 0 ) {
+            return 1;
+        }
+        if ( args == 2 || check_word(word, ARGUMENT) == -1 ) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * Find the instruction of a line in the line table.
+ *
+ * @param assembler_t*  as - The assembler context.
+ * @param int           number - The line number.
+ * @param int*          size - Will hold the number of words of the instruction at the end.
+ *
+ * @return int - The index of the row, -1 if the line isn't a single instruction (i.e it's in a macro).
+ */
+static int find_row(assembler_t *as, int number, int *size){
+    line_table_t *table = &as->lines;
+    int i, found = -1;
+
+    for ( i = 0; i < table->rows_size; i++ ) {
+        if ( table->rows[i].line == number ) {
+            if ( found != -1 ) {
+                return -1;
+            }
+            found = i;
+        }
+    }
+    if ( found != -1 ) {
+        *size = (found + 1 < table->rows_size ? table->rows[found + 1].address : INITIAL_IC + as->ic) - table->rows[found].address;
+    }
+
+    return found;
+}
+
+/**
+ * Check if a line is in the body of a macro.
+ */
+static int in_macro(assembler_t *as, int number){
+    int i;
+
+    for ( i = 0; i < as->pp.table.spans_size; i++ ) {
+        if ( as->pp.table.spans[i].line == number ) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Move an address that is after the patched instruction.
+ *
+ * @param int   address - The address, before the patch.
+ * @param int   end - The address after the patched instruction, before the patch.
+ * @param int   delta - The change in the size of the instruction.
+ *
+ * @return int - The address after the patch.
+ */
+static int moved(int address, int end, int delta){
+    return address >= end ? address + delta : address;
+}
+
+/**
+ * Move the address of a relocatable word.
+ */
+static void move_word(word_t *word, int end, int delta){
+    int num = word_to_int(*word);
+
+    if ( (num & 3) == R ) {
+        *word = int_to_word(moved(num >> 2, end, delta) << 2 | R);
+    }
+}
+
+/**
+ * Encode a changed instruction line again and patch it into the segments.
+ *
+ * @param assembler_t*  as - The assembler context.
+ * @param patch_t*      patch - The line.
+ *
+ * @return int - 1 if the line was patched, 0 if it can't be (the context is left half patched then).
+ */
+static int apply_patch(assembler_t *as, patch_t *patch){
+    char label[LINE_MAX], line[LINE_MAX];
+    word_t *code = as->code_seg, *words;
+    data_table *ext;
+    int ic = as->ic, capacity = as->code_capacity, ext_before = as->ext_size, row, size, address, end, delta, status, i, kept, instruction = 0;
+
+    if ( (row = find_row(as, patch->number, &size)) == -1 ) {
+        return 0;
+    }
+    address = as->lines.rows[row].address;
+    end = address + size;
+    read_instruction_line(patch->text, patch->length, label, line);
+
+    /* encode the line by itself, the extern uses it adds are moved to its address */
+    as->code_seg = NULL;
+    as->ic = as->code_capacity = 0;
+    status = encode_line(as, line, patch->number, &instruction);
+    words = as->code_seg;
+    delta = as->ic - size;
+    as->code_seg = code;
+    as->ic = ic;
+    as->code_capacity = capacity;
+    for ( i = ext_before; i < as->ext_size; i++ ) {
+        as->ext[i].address += address - INITIAL_IC;
+    }
+    if ( status != LINE_ENCODED || as->diag.size > 0
+         || !ensure_capacity((void **) &as->code_seg, &as->code_capacity, ic + delta, sizeof(word_t)) ) {
+        free(words);
+        return 0;
+    }
+
+    /* the words after the instruction move, and the labels after it */
+    memmove(as->code_seg + end - INITIAL_IC + delta, as->code_seg + end - INITIAL_IC, (size_t) (INITIAL_IC + ic - end) * sizeof(word_t));
+    memcpy(as->code_seg + address - INITIAL_IC, words, (size + delta) * sizeof(word_t));
+    as->ic += delta;
+    free(words);
+    if ( delta != 0 ) {
+        for ( i = 0; i < as->ic; i++ ) {
+            move_word(&as->code_seg[i], end, delta);
+        }
+        for ( i = 0; i < as->table_signs_size; i++ ) {
+            if ( !as->table_signs[i].external ) {
+                as->table_signs[i].address = moved(as->table_signs[i].address, end, delta);
+            }
+        }
+        for ( i = 0; i < as->ent_size; i++ ) {
+            as->ent[i].address = moved(as->ent[i].address, end, delta);
+        }
+        for ( i = row + 1; i < as->lines.rows_size; i++ ) {
+            as->lines.rows[i].address += delta;
+        }
+    }
+
+    /* the extern uses of the old instruction are replaced by the new ones, in the order of the addresses */
+    if ( !(ext = malloc((as->ext_size + 1) * sizeof(data_table))) ) {
+        return 0;
+    }
+    for ( kept = 0, i = 0; i < ext_before; i++ ) {
+        if ( as->ext[i].address < address ) {
+            ext[kept++] = as->ext[i];
+        }
+    }
+    for ( i = ext_before; i < as->ext_size; i++ ) {
+        ext[kept++] = as->ext[i];
+    }
+    for ( i = 0; i < ext_before; i++ ) {
+        if ( as->ext[i].address >= end ) {
+            ext[kept] = as->ext[i];
+            ext[kept++].address += delta;
+        } else if ( as->ext[i].address >= address ) {
+            free(as->ext[i].label_name);
+        }
+    }
+    free(as->ext);
+    as->ext = ext;
+    as->ext_capacity = as->ext_size + 1;
+    as->ext_size = kept;
+
+    return 1;
+}
+
+/**
+ * Assemble a source again after it was edited: patch the changed instructions into the last assembly when
+ * it can be done, or assemble the whole source otherwise.
+ *
+ * @param assembler_t*  as - The assembler context, it holds the assembly of the old source, with its line table
+ *                           (as->incremental is set).
+ * @param char*         old_source - The source of the last assembly, NULL if it can't be patched (i.e it had
+ *                                   diagnostics).
+ * @param size_t        old_length - The length of the old source.
+ * @param char*         source - The new source.
+ * @param size_t        length - The length of the new source.
+ * @param int*          patched - Will hold 1 at the end if the source was patched, 0 if it was assembled.
+ *
+ * @return int - 0 if everything went OK, 1 if the source has errors, 2 if the source couldn't be opened.
+ */
+int assemble_incremental(assembler_t *as, const char *old_source, size_t old_length, const char *source, size_t length, int *patched){
+    char label[LINE_MAX], old_label[LINE_MAX], line[LINE_MAX];
+    patch_t *patches = NULL;
+    size_t start, same_end, old_start, new_start, i;
+    int number = 1, old_lines = 0, new_lines = 0, count = 0, capacity = 0, old_size, new_size, ok = 1;
+
+    *patched = 0;
+    if ( !old_source || !as->incremental || as->settings.optimize || as->settings.gc || as->settings.pool_strings
+         || as->settings.mem_limit ) { /* a spilled segment can't be reallocated */
+        return assemble_buffer(as, source, length);
+    }
+
+    /* the lines before the first change and after the last one are the same */
+    for ( start = 0; start < old_length && start < length && old_source[start] == source[start]; start++ );
+    while ( start > 0 && source[start - 1] != '\n' ) {
+        start--;
+    }
+    for ( same_end = 0; same_end < old_length - start && same_end < length - start
+                        && old_source[old_length - same_end - 1] == source[length - same_end - 1]; same_end++ );
+    while ( same_end > 0 && length - same_end > start && source[length - same_end - 1] != '\n' ) {
+        same_end--;
+    }
+    for ( i = 0; i < start; i++ ) {
+        number += source[i] == '\n';
+    }
+    for ( i = start; i < old_length - same_end; i++ ) {
+        old_lines += old_source[i] == '\n' || i + 1 == old_length;
+    }
+    for ( i = start; i < length - same_end; i++ ) {
+        new_lines += source[i] == '\n' || i + 1 == length;
+    }
+
+    /* every changed line should be an instruction that is still an instruction, with the same label */
+    diag_clear(&as->diag);
+    ok = old_lines == new_lines;
+    for ( old_start = new_start = start; ok && new_start < length - same_end; number++ ) {
+        old_size = line_length(old_source, old_length, old_start);
+        new_size = line_length(source, length, new_start);
+        if ( old_size != new_size || memcmp(old_source + old_start, source + new_start, (size_t) old_size) != 0 ) {
+            ok = read_instruction_line(old_source + old_start, old_size, old_label, line)
+                 && read_instruction_line(source + new_start, new_size, label, line)
+                 && strcmp(label, old_label) == 0 && !in_macro(as, number)
+                 && ensure_capacity((void **) &patches, &capacity, count + 1, sizeof(patch_t));
+            if ( ok ) {
+                patches[count].number = number;
+                patches[count].text = source + new_start;
+                patches[count++].length = new_size;
+            }
+        }
+        old_start += old_size + 1;
+        new_start += new_size + 1;
+    }
+
+    for ( i = 0; ok && i < (size_t) count; i++ ) {
+        ok = apply_patch(as, &patches[i]);
+    }
+    free(patches);
+
+    if ( !ok ) { /* the first scan has to see the change, or the patch has diagnostics */
+        return assemble_buffer(as, source, length);
+    }
+    *patched = 1;
+
+    return 0;
+}
@@ -0,0 +1,649 @@
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include "header.h"
+
+/*
+ * The JIT of the simulator (--jit). A basic block that was run JIT_THRESHOLD times is translated from its
+ * micro ops to x86-64 code. The native code keeps the machine state in the host registers:
+ *
+ *      r0 - r7     ebx, ebp, r12d, r13d, r14d, r15d, r10d, r11d
+ *      rdi         the machine, the memory and the stack are read and written through it
+ *      rsi         the zero flag, 0 or 1
+ *      r8          the number of instructions left to the step limit
+ *      r9          the table of the native code of each address
+ *      eax ecx edx scratch
+ *
+ * Every value is masked to WORD_MAX bits after every operation, so the results are exactly the simulator's.
+ * A block ends with a jump through the table to the block at the next address. An address without native
+ * code points to the exit stub, which saves the registers and returns to the dispatcher. The dispatcher
+ * runs the blocks that weren't translated on the simulator: the cold blocks, red and prn (a block is
+ * translated up to the first of them), the blocks that don't have enough steps left, and the runtime
+ * errors (a native block that would fail exits before the instruction, so the simulator reports it).
+ * A write to a decoded instruction, from the native code or from the simulator, drops all the native code.
+ *
+ * Without an x86-64 Linux host the simulator runs everything.
+ */
+
+#define JIT_THRESHOLD 16 /* runs of a block before it's translated */
+#define JIT_CODE_SIZE (1 << 21)
+#define JIT_OP_MAX 192 /* the longest code of a single instruction, in bytes */
+#define NO_LIMIT ((long) ((unsigned long) -1 >> 1))
+
+#if defined(__x86_64__) && defined(__linux__)
+
+#include <sys/mman.h>
+
+/* x86-64 registers */
+enum {RAX = 0, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15};
+
+/* ALU operations, the opcode of "op r/m32, r32" and the extension of "op r/m32, imm32" */
+#define OP_ADD 0x01, 0
+#define OP_SUB 0x29, 5
+#define OP_AND 0x21, 4
+#define OP_CMP 0x39, 7
+
+static const int host_register[NUM_OF_REGISTERS] = {RBX, RBP, R12, R13, R14, R15, R10, R11};
+
+/* the native code entry: runs the code until it exits, returns the number of steps left */
+typedef long (*native_entry)(machine_t *m, unsigned char *code, long budget, unsigned char **table);
+
+/* the state of the JIT */
+typedef struct{
+    unsigned char *code; /* the code buffer, executable */
+    int size;
+    int exit_at; /* the position of the exit stub, the stubs are at the beginning of the buffer */
+    unsigned char *exit_stub;
+    unsigned char *table[MEMORY_SIZE + 1]; /* the native code of each address, the exit stub if there is none */
+    int hits[MEMORY_SIZE]; /* runs of the block at each address, -1 if it can't be translated */
+    int flushes; /* machine flushes the native code matches */
+    native_entry enter;
+} jit_t;
+
+/**
+ * Write a byte of code.
+ */
+static void emit_byte(jit_t *jit, int byte){
+    jit->code[jit->size++] = (unsigned char) byte;
+}
+
+/**
+ * Write a 4 bytes little endian number.
+ */
+static void emit_int(jit_t *jit, long num){
+    emit_byte(jit, (int) (num & 0xFF));
+    emit_byte(jit, (int) ((num >> 8) & 0xFF));
+    emit_byte(jit, (int) ((num >> 16) & 0xFF));
+    emit_byte(jit, (int) ((num >> 24) & 0xFF));
+}
+
+/**
+ * Write a REX prefix, if it's needed.
+ *
+ * @param jit_t*    jit - The JIT.
+ * @param int       w - 1 for a 64 bits operation.
+ * @param int       reg - The register of the ModRM reg field.
+ * @param int       rm - The register of the ModRM rm field.
+ */
+static void emit_rex(jit_t *jit, int w, int reg, int rm){
+    if ( w || reg >= R8 || rm >= R8 ) {
+        emit_byte(jit, 0x40 | w << 3 | (reg >= R8) << 2 | (rm >= R8));
+    }
+}
+
+/**
+ * Write "op dst, src" on 32 bits registers.
+ */
+static void emit_reg_reg(jit_t *jit, int opcode, int extension, int dst, int src){
+    emit_rex(jit, 0, src, dst);
+    emit_byte(jit, opcode);
+    emit_byte(jit, 0xC0 | (src & 7) << 3 | (dst & 7));
+    (void) extension;
+}
+
+/**
+ * Write "op dst, imm32" on a 32 bits register.
+ */
+static void emit_reg_imm(jit_t *jit, int opcode, int extension, int dst, long imm){
+    emit_rex(jit, 0, 0, dst);
+    emit_byte(jit, 0x81);
+    emit_byte(jit, 0xC0 | extension << 3 | (dst & 7));
+    emit_int(jit, imm);
+    (void) opcode;
+}
+
+/**
+ * Write "mov dst, src" on 32 bits registers.
+ */
+static void emit_mov_reg(jit_t *jit, int dst, int src){
+    if ( dst != src ) {
+        emit_rex(jit, 0, src, dst);
+        emit_byte(jit, 0x89);
+        emit_byte(jit, 0xC0 | (src & 7) << 3 | (dst & 7));
+    }
+}
+
+/**
+ * Write "mov dst, imm32".
+ */
+static void emit_mov_imm(jit_t *jit, int dst, long imm){
+    emit_rex(jit, 0, 0, dst);
+    emit_byte(jit, 0xB8 | (dst & 7));
+    emit_int(jit, imm);
+}
+
+/**
+ * Write an instruction with a [rdi + disp32] or a [rdi + index * scale + disp32] memory operand.
+ *
+ * @param jit_t*    jit - The JIT.
+ * @param int       opcode - The opcode.
+ * @param int       reg - The ModRM reg field, a register or an opcode extension.
+ * @param int       index - The index register (below R8), -1 for none.
+ * @param int       scale - log2 of the scale of the index.
+ * @param long      disp - The displacement from rdi.
+ */
+static void emit_mem(jit_t *jit, int opcode, int reg, int index, int scale, long disp){
+    emit_rex(jit, 0, reg, RDI);
+    emit_byte(jit, opcode);
+    if ( index < 0 ) {
+        emit_byte(jit, 0x80 | (reg & 7) << 3 | RDI);
+    } else {
+        emit_byte(jit, 0x84 | (reg & 7) << 3);
+        emit_byte(jit, scale << 6 | index << 3 | RDI);
+    }
+    emit_int(jit, disp);
+}
+
+/**
+ * Write "mov dword [rdi + disp32], imm32".
+ */
+static void emit_store_imm(jit_t *jit, long disp, long imm){
+    emit_mem(jit, 0xC7, 0, -1, 0, disp);
+    emit_int(jit, imm);
+}
+
+/**
+ * Write "add r8, imm32" (the steps left), nothing for 0.
+ */
+static void emit_add_budget(jit_t *jit, long imm){
+    if ( imm ) {
+        emit_byte(jit, 0x49);
+        emit_byte(jit, 0x81);
+        emit_byte(jit, 0xC0);
+        emit_int(jit, imm);
+    }
+}
+
+/**
+ * Write a jump with a 32 bits displacement that is filled later by patch_jump().
+ *
+ * @param jit_t*    jit - The JIT.
+ * @param int       condition - The condition code (0x84 je, 0x85 jne, 0x8D jge), 0 for jmp.
+ *
+ * @return int - The position of the displacement.
+ */
+static int emit_jump(jit_t *jit, int condition){
+    if ( condition ) {
+        emit_byte(jit, 0x0F);
+        emit_byte(jit, condition);
+    } else {
+        emit_byte(jit, 0xE9);
+    }
+    emit_int(jit, 0);
+
+    return jit->size - 4;
+}
+
+/**
+ * Make a jump that emit_jump() wrote go to a position.
+ */
+static void patch_jump(jit_t *jit, int at, int target){
+    long disp = (long) target - (at + 4);
+
+    jit->code[at] = (unsigned char) (disp & 0xFF);
+    jit->code[at + 1] = (unsigned char) ((disp >> 8) & 0xFF);
+    jit->code[at + 2] = (unsigned char) ((disp >> 16) & 0xFF);
+    jit->code[at + 3] = (unsigned char) ((disp >> 24) & 0xFF);
+}
+
+/**
+ * Leave the native code at an address: set the program counter, give back the steps that weren't run
+ * and jump to the exit stub.
+ *
+ * @param jit_t*    jit - The JIT.
+ * @param int       pc - The address the dispatcher continues from.
+ * @param int       steps_back - The steps that were counted but not run.
+ */
+static void emit_exit(jit_t *jit, int pc, int steps_back){
+    emit_store_imm(jit, offsetof(machine_t, pc), pc);
+    emit_add_budget(jit, steps_back);
+    patch_jump(jit, emit_jump(jit, 0), jit->exit_at);
+}
+
+/**
+ * Go on to the native code of a constant address.
+ */
+static void emit_goto(jit_t *jit, int pc){
+    emit_store_imm(jit, offsetof(machine_t, pc), pc);
+    emit_byte(jit, 0x41); /* jmp [r9 + disp32] */
+    emit_byte(jit, 0xFF);
+    emit_byte(jit, 0xA1);
+    emit_int(jit, (long) pc * 8);
+}
+
+/**
+ * Go on to the native code of the address in eax (0 to MEMORY_SIZE).
+ */
+static void emit_goto_eax(jit_t *jit){
+    emit_mem(jit, 0x89, RAX, -1, 0, offsetof(machine_t, pc));
+    emit_byte(jit, 0x41); /* jmp [r9 + rax * 8] */
+    emit_byte(jit, 0xFF);
+    emit_byte(jit, 0x24);
+    emit_byte(jit, 0xC1);
+}
+
+/**
+ * Compute the address of a matrix access to a scratch register.
+ */
+static void emit_matrix_address(jit_t *jit, operand_t *operand, int reg){
+    emit_mov_imm(jit, reg, operand->value);
+    emit_reg_reg(jit, OP_ADD, reg, host_register[operand->row]);
+    emit_reg_reg(jit, OP_ADD, reg, host_register[operand->column]);
+    emit_reg_imm(jit, OP_AND, reg, MEMORY_SIZE - 1);
+}
+
+/**
+ * Load the value of an operand to a scratch register. The address of a matrix access should be in "index".
+ */
+static void emit_load(jit_t *jit, operand_t *operand, int reg, int index){
+    switch ( operand->method ) {
+        case IMMEDIATE:
+            emit_mov_imm(jit, reg, operand->value & WORD_MASK);
+            break;
+        case DIRECT:
+            emit_mem(jit, 0x8B, reg, -1, 0, offsetof(machine_t, memory) + 4L * operand->value);
+            break;
+        case MATRIX_ACCESS:
+            emit_mem(jit, 0x8B, reg, index, 2, offsetof(machine_t, memory));
+            break;
+        default: /* DIRECT_REGISTER */
+            emit_mov_reg(jit, reg, host_register[operand->value]);
+    }
+}
+
+/**
+ * Store eax to the destination operand, masked to WORD_MAX bits. The address of a matrix access should be in ecx.
+ * A store to a decoded instruction leaves the native code right after the instruction.
+ *
+ * @param jit_t*        jit - The JIT.
+ * @param micro_op_t*   op - The instruction.
+ * @param int           steps_back - The instructions of the block after this one.
+ */
+static void emit_store(jit_t *jit, micro_op_t *op, int steps_back){
+    int skip;
+
+    emit_reg_imm(jit, OP_AND, RAX, WORD_MASK);
+    switch ( op->dest.method ) {
+        case DIRECT_REGISTER:
+            emit_mov_reg(jit, host_register[op->dest.value], RAX);
+            return;
+        case DIRECT:
+            emit_mem(jit, 0x89, RAX, -1, 0, offsetof(machine_t, memory) + 4L * op->dest.value);
+            emit_mem(jit, 0x80, 7, -1, 0, offsetof(machine_t, is_code) + op->dest.value); /* cmp byte [...], 0 */
+            break;
+        default: /* MATRIX_ACCESS */
+            emit_mem(jit, 0x89, RAX, RCX, 2, offsetof(machine_t, memory));
+            emit_mem(jit, 0x80, 7, RCX, 0, offsetof(machine_t, is_code));
+    }
+    emit_byte(jit, 0);
+    skip = emit_jump(jit, 0x84);
+    emit_store_imm(jit, offsetof(machine_t, code_written), 1);
+    emit_exit(jit, op->next, steps_back);
+    patch_jump(jit, skip, jit->size);
+}
+
+/**
+ * Translate a single instruction that doesn't end the block.
+ */
+static void emit_instruction(jit_t *jit, micro_op_t *op, int steps_back){
+    int dest = op->dest.method == DIRECT_REGISTER ? host_register[op->dest.value] : -1;
+
+    /* register destinations with a register or an immediate source work on the host register itself */
+    if ( dest >= 0 && (op->oper == ADD || op->oper == SUB || op->oper == MOV)
+         && (op->src.method == DIRECT_REGISTER || op->src.method == IMMEDIATE) ) {
+        if ( op->src.method == IMMEDIATE ) {
+            if ( op->oper == MOV ) {
+                emit_mov_imm(jit, dest, op->src.value & WORD_MASK);
+                return;
+            }
+            emit_reg_imm(jit, op->oper == ADD ? 0x01 : 0x29, op->oper == ADD ? 0 : 5, dest, op->src.value & WORD_MASK);
+        } else if ( op->oper == MOV ) {
+            emit_mov_reg(jit, dest, host_register[op->src.value]);
+            return;
+        } else {
+            emit_reg_reg(jit, op->oper == ADD ? 0x01 : 0x29, 0, dest, host_register[op->src.value]);
+        }
+        emit_reg_imm(jit, OP_AND, dest, WORD_MASK);
+        return;
+    }
+
+    if ( op->dest.method == MATRIX_ACCESS ) {
+        emit_matrix_address(jit, &op->dest, RCX);
+    }
+    if ( op->src.method == MATRIX_ACCESS ) {
+        emit_matrix_address(jit, &op->src, RDX);
+    }
+
+    switch ( op->oper ) {
+        case MOV:
+            emit_load(jit, &op->src, RAX, RDX);
+            break;
+        case CMP: /* esi = (src == dest) */
+            emit_load(jit, &op->src, RDX, RDX);
+            emit_load(jit, &op->dest, RAX, RCX);
+            emit_reg_reg(jit, OP_CMP, RDX, RAX);
+            emit_byte(jit, 0x0F); /* sete cl */
+            emit_byte(jit, 0x94);
+            emit_byte(jit, 0xC1);
+            emit_byte(jit, 0x0F); /* movzx esi, cl */
+            emit_byte(jit, 0xB6);
+            emit_byte(jit, 0xF1);
+            return;
+        case ADD:
+        case SUB:
+            emit_load(jit, &op->src, RDX, RDX);
+            emit_load(jit, &op->dest, RAX, RCX);
+            if ( op->oper == ADD ) {
+                emit_reg_reg(jit, OP_ADD, RAX, RDX);
+            } else {
+                emit_reg_reg(jit, OP_SUB, RAX, RDX);
+            }
+            break;
+        case NOT:
+            emit_load(jit, &op->dest, RAX, RCX);
+            emit_byte(jit, 0xF7); /* not eax */
+            emit_byte(jit, 0xD0);
+            break;
+        case CLR:
+            emit_mov_imm(jit, RAX, 0);
+            break;
+        case LEA:
+            if ( op->src.method == MATRIX_ACCESS ) {
+                emit_mov_reg(jit, RAX, RDX);
+            } else {
+                emit_mov_imm(jit, RAX, op->src.value);
+            }
+            break;
+        case INC:
+        case DEC:
+            emit_load(jit, &op->dest, RAX, RCX);
+            emit_reg_imm(jit, OP_ADD, RAX, op->oper == INC ? 1 : -1);
+            break;
+    }
+
+    emit_store(jit, op, steps_back);
+}
+
+/**
+ * Load the address a jmp, bne or jsr goes to to eax.
+ */
+static void emit_jump_target(jit_t *jit, operand_t *operand){
+    if ( operand->method == DIRECT_REGISTER ) {
+        emit_mov_reg(jit, RAX, host_register[operand->value]);
+        emit_reg_imm(jit, OP_AND, RAX, MEMORY_SIZE - 1);
+    } else {
+        emit_matrix_address(jit, operand, RAX); /* only for a matrix access, a direct target is a constant */
+    }
+}
+
+/**
+ * Go on to the target of a jmp, bne or jsr.
+ */
+static void emit_goto_target(jit_t *jit, operand_t *operand){
+    if ( operand->method == DIRECT ) {
+        emit_goto(jit, operand->value);
+    } else {
+        emit_jump_target(jit, operand);
+        emit_goto_eax(jit);
+    }
+}
+
+/**
+ * Translate the instruction that ends the block: go on to the next block or leave the native code.
+ */
+static void emit_block_end(jit_t *jit, micro_op_t *op){
+    int skip;
+
+    switch ( op->oper ) {
+        case BNE:
+            emit_byte(jit, 0x85); /* test esi, esi */
+            emit_byte(jit, 0xF6);
+            skip = emit_jump(jit, 0x84);
+            emit_goto(jit, op->next);
+            patch_jump(jit, skip, jit->size); /* bne jumps if the flag is clear */
+            emit_goto_target(jit, &op->dest);
+            break;
+        case JMP:
+            emit_goto_target(jit, &op->dest);
+            break;
+        case JSR:
+            emit_mem(jit, 0x8B, RAX, -1, 0, offsetof(machine_t, sp));
+            emit_reg_imm(jit, OP_CMP, RAX, STACK_SIZE);
+            skip = emit_jump(jit, 0x85);
+            emit_exit(jit, op->address, 1); /* a stack overflow, the simulator reports it */
+            patch_jump(jit, skip, jit->size);
+            emit_mem(jit, 0xC7, 0, RAX, 2, offsetof(machine_t, stack));
+            emit_int(jit, op->next);
+            emit_reg_imm(jit, OP_ADD, RAX, 1);
+            emit_mem(jit, 0x89, RAX, -1, 0, offsetof(machine_t, sp));
+            emit_goto_target(jit, &op->dest);
+            break;
+        case RTS:
+            emit_mem(jit, 0x8B, RAX, -1, 0, offsetof(machine_t, sp));
+            emit_byte(jit, 0x85); /* test eax, eax */
+            emit_byte(jit, 0xC0);
+            skip = emit_jump(jit, 0x85);
+            emit_exit(jit, op->address, 1); /* an empty stack, the simulator reports it */
+            patch_jump(jit, skip, jit->size);
+            emit_reg_imm(jit, OP_SUB, RAX, 1);
+            emit_mem(jit, 0x89, RAX, -1, 0, offsetof(machine_t, sp));
+            emit_mem(jit, 0x8B, RAX, RAX, 2, offsetof(machine_t, stack));
+            emit_goto_eax(jit);
+            break;
+        default: /* STOP */
+            emit_store_imm(jit, offsetof(machine_t, status), MACHINE_HALTED);
+            emit_exit(jit, op->address, 0);
+    }
+}
+
+/**
+ * Write the entry and the exit stubs at the beginning of the code buffer.
+ *
+ * @param jit_t*    jit - The JIT.
+ */
+static void emit_stubs(jit_t *jit){
+    static const int saved[6] = {RBX, RBP, R12, R13, R14, R15};
+    unsigned char *entry;
+    int i;
+
+    jit->size = 0;
+
+    /* entry: rdi = the machine, rsi = the code, rdx = the budget, rcx = the table */
+    for ( i = 0; i < 6; i++ ) {
+        emit_rex(jit, 0, 0, saved[i]);
+        emit_byte(jit, 0x50 | (saved[i] & 7)); /* push */
+    }
+    emit_byte(jit, 0x49); /* mov r8, rdx */
+    emit_byte(jit, 0x89);
+    emit_byte(jit, 0xD0);
+    emit_byte(jit, 0x49); /* mov r9, rcx */
+    emit_byte(jit, 0x89);
+    emit_byte(jit, 0xC9);
+    emit_byte(jit, 0x48); /* mov rax, rsi */
+    emit_byte(jit, 0x89);
+    emit_byte(jit, 0xF0);
+    for ( i = 0; i < NUM_OF_REGISTERS; i++ ) {
+        emit_mem(jit, 0x8B, host_register[i], -1, 0, offsetof(machine_t, registers) + 4L * i);
+    }
+    emit_mem(jit, 0x8B, RSI, -1, 0, offsetof(machine_t, zero));
+    emit_byte(jit, 0xFF); /* jmp rax */
+    emit_byte(jit, 0xE0);
+
+    /* exit: save the machine registers and return the budget */
+    jit->exit_at = jit->size;
+    jit->exit_stub = jit->code + jit->size;
+    for ( i = 0; i < NUM_OF_REGISTERS; i++ ) {
+        emit_mem(jit, 0x89, host_register[i], -1, 0, offsetof(machine_t, registers) + 4L * i);
+    }
+    emit_mem(jit, 0x89, RSI, -1, 0, offsetof(machine_t, zero));
+    emit_byte(jit, 0x4C); /* mov rax, r8 */
+    emit_byte(jit, 0x89);
+    emit_byte(jit, 0xC0);
+    for ( i = 5; i >= 0; i-- ) {
+        emit_rex(jit, 0, 0, saved[i]);
+        emit_byte(jit, 0x58 | (saved[i] & 7)); /* pop */
+    }
+    emit_byte(jit, 0xC3); /* ret */
+
+    entry = jit->code;
+    memcpy(&jit->enter, &entry, sizeof(jit->enter)); /* ISO C has no object to function pointer cast */
+}
+
+/**
+ * Drop all the native code.
+ *
+ * @param jit_t*    jit - The JIT.
+ */
+static void jit_flush(jit_t *jit){
+    int i;
+
+    emit_stubs(jit);
+    for ( i = 0; i <= MEMORY_SIZE; i++ ) {
+        jit->table[i] = jit->exit_stub;
+    }
+    memset(jit->hits, 0, sizeof(jit->hits));
+}
+
+/**
+ * Translate the block at an address.
+ *
+ * @param jit_t*        jit - The JIT.
+ * @param machine_t*    m - The machine, the block is decoded already.
+ * @param int           start - The address of the block.
+ *
+ * @return int - 1 if the block was translated, 0 if it can't be (it starts with red or prn).
+ */
+static int translate_block(jit_t *jit, machine_t *m, int start){
+    micro_op_t *ops = m->ops + m->blocks[start].first;
+    int count = m->blocks[start].count, i, enough;
+
+    for ( i = 0; i < count && ops[i].oper != RED && ops[i].oper != PRN; i++ )
+        ;
+    if ( (count = i) == 0 ) {
+        return 0;
+    }
+
+    if ( JIT_CODE_SIZE - jit->size < (count + 1) * JIT_OP_MAX ) {
+        jit_flush(jit);
+    }
+    jit->table[start] = jit->code + jit->size;
+
+    /* take the steps of the whole block, or let the simulator run it if there aren't enough */
+    emit_byte(jit, 0x49); /* sub r8, count */
+    emit_byte(jit, 0x81);
+    emit_byte(jit, 0xE8);
+    emit_int(jit, count);
+    enough = emit_jump(jit, 0x8D);
+    emit_exit(jit, start, count);
+    patch_jump(jit, enough, jit->size);
+
+    for ( i = 0; i < count && ops[i].oper < JMP; i++ ) {
+        emit_instruction(jit, &ops[i], count - i - 1);
+    }
+    if ( i < count ) { /* jmp, bne, jsr, rts or stop */
+        emit_block_end(jit, &ops[i]);
+    } else { /* the block was cut, by its length or before red / prn */
+        emit_goto(jit, ops[count - 1].next);
+    }
+
+    return 1;
+}
+
+/**
+ * Run the machine until it stops, the hot blocks as native code.
+ *
+ * @param machine_t*    m - The machine.
+ * @param long          max_steps - Stop after this many instructions, 0 for no limit.
+ *
+ * @return int - The status at the end: MACHINE_HALTED, MACHINE_STEP_LIMIT or MACHINE_ERROR.
+ */
+int jit_run(machine_t *m, long max_steps){
+    static jit_t jit; /* its table is pointed to by the native code */
+    long budget, left;
+    int pc;
+
+    jit.code = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if ( jit.code == MAP_FAILED ) {
+        return machine_run(m, max_steps);
+    }
+    jit_flush(&jit);
+    jit.flushes = m->flushes;
+
+    while ( m->status == MACHINE_RUNNING ) {
+        if ( jit.flushes != m->flushes ) { /* the simulator wrote to a decoded instruction */
+            jit_flush(&jit);
+            jit.flushes = m->flushes;
+        }
+
+        pc = m->pc;
+        if ( jit.table[pc] == jit.exit_stub && jit.hits[pc] >= 0 && ++jit.hits[pc] > JIT_THRESHOLD ) {
+            if ( m->blocks[pc].count == 0 && !decode_block(m, pc) ) {
+                break;
+            }
+            if ( !translate_block(&jit, m, pc) ) {
+                jit.hits[pc] = -1;
+            }
+        }
+
+        left = 0;
+        if ( jit.table[pc] != jit.exit_stub ) {
+            budget = max_steps ? max_steps - m->steps : NO_LIMIT;
+            left = jit.enter(m, jit.table[pc], budget, jit.table);
+            m->steps += budget - left;
+            left = budget - left;
+            if ( m->code_written ) {
+                machine_flush(m);
+            }
+        }
+
+        if ( left == 0 && m->status == MACHINE_RUNNING ) { /* nothing was run natively */
+            machine_run_block(m, max_steps);
+        } else if ( m->status == MACHINE_RUNNING && m->pc >= MEMORY_SIZE ) {
+            m->status = MACHINE_ERROR;
+            m->error = "the program counter is out of the memory";
+        }
+    }
+
+    munmap(jit.code, JIT_CODE_SIZE);
+
+    return m->status;
+}
+
+#else
+
+/**
+ * Run the machine until it stops, there is no JIT for this host.
+ *
+ * @param machine_t*    m - The machine.
+ * @param long          max_steps - Stop after this many instructions, 0 for no limit.
+ *
+ * @return int - The status at the end: MACHINE_HALTED, MACHINE_STEP_LIMIT or MACHINE_ERROR.
+ */
+int jit_run(machine_t *m, long max_steps){
+    return machine_run(m, max_steps);
+}
+
+#endif
@@ -0,0 +1,523 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "header.h"
+
+/*
+ * The link check (--link unit1 unit2 ... [LIB.lib ...]). The entries (.ent) of every unit are merged into
+ * one global symbol table, and every extern use (.ext) is checked against it. The work is done by a pool of
+ * threads (--threads=N, every CPU by default), in phases:
+ *
+ *      load        a unit's .ent and .ext files are read, and its entries are published to the table
+ *      resolve     every extern use of a unit is looked up in the table
+ *
+ * The table is split to LINK_SHARDS shards by the hash of the name, each with its own lock, so units that
+ * publish at the same time seldom wait for each other. Nothing writes to the table after the load phase, so
+ * the lookups of the resolve phase take no lock at all. An extern that no unit defines is looked up in the
+ * archives, and the members that define one are loaded in the next round, until nothing more is pulled in.
+ *
+ * The errors don't depend on the order the threads ran in: a symbol that is an entry of two units belongs to
+ * the first of them on the command line (the table keeps the lowest unit), and the errors are printed at the
+ * end, unit by unit.
+ */
+
+#define LINK_SHARDS 64 /* a power of 2 */
+
+/* an entry or an extern use of a unit */
+typedef struct{
+    char name[LINE_MAX];
+    int address;
+    long owner; /* the unit that defines the symbol, -1 if none, after the resolve phase */
+} link_symbol_t;
+
+/* a unit of the link, an assembled source or an archive member */
+typedef struct{
+    char *name; /* the base name, or "ARCHIVE(member)" */
+    archive_t *archive; /* the archive of a member, NULL for a source */
+    long member;
+    link_symbol_t *entries;
+    int entries_size;
+    int entries_capacity;
+    link_symbol_t *externs;
+    int externs_size;
+    int externs_capacity;
+    int failed; /* 1 if the unit couldn't be loaded, 2 on memory error */
+} link_unit_t;
+
+/* a slot of a shard */
+typedef struct{
+    const char *name; /* points into the entries of the unit, NULL for an empty slot */
+    unsigned long hash;
+    long unit;
+} link_slot_t;
+
+/* a shard of the global symbol table */
+typedef struct{
+    pthread_mutex_t lock;
+    link_slot_t *slots;
+    long capacity; /* a power of 2 */
+    long size;
+} link_shard_t;
+
+/* the state of a link */
+typedef struct{
+    link_unit_t *units;
+    int units_size;
+    int units_capacity;
+    archive_t *archives;
+    char **archive_names;
+    int archives_size;
+    link_shard_t shards[LINK_SHARDS];
+    pthread_mutex_t next_lock; /* the work of a phase is handed out a unit at a time */
+    int next;
+    int end;
+    int phase;
+} link_t;
+
+enum {PHASE_LOAD, PHASE_RESOLVE};
+
+/**
+ * Read the symbols of a .ent or a .ext file of a unit.
+ *
+ * @param char*             text - The file, NULL if there is none.
+ * @param long              length - The length of the file.
+ * @param link_symbol_t**   symbols - The symbols of the unit.
+ * @param int*              size - The number of symbols.
+ * @param int*              capacity - The capacity of the symbols.
+ *
+ * @return int - 1 if everything went OK, 0 on memory error.
+ */
+static int read_link_symbols(const char *text, long length, link_symbol_t **symbols, int *size, int *capacity){
+    symbol_reader_t reader;
+
+    for ( symbol_reader_init(&reader, text, length); symbol_reader_next(&reader); ) {
+        if ( !ensure_capacity((void **) symbols, capacity, *size + 1, sizeof(link_symbol_t)) ) {
+            return 0;
+        }
+        strcpy((*symbols)[*size].name, reader.name);
+        (*symbols)[*size].address = reader.address;
+        (*symbols)[(*size)++].owner = -1;
+    }
+
+    return 1;
+}
+
+/**
+ * Publish an entry to the global symbol table. When the name is there already, the lower unit keeps it.
+ *
+ * @param link_t*   link - The link.
+ * @param char*     name - The name, it should live as long as the link.
+ * @param long      unit - The unit that defines it.
+ *
+ * @return int - 1 if everything went OK, 0 on memory error.
+ */
+static int publish(link_t *link, const char *name, long unit){
+    unsigned long hash = symbol_hash(name);
+    link_shard_t *shard = &link->shards[hash & (LINK_SHARDS - 1)];
+    link_slot_t *slots, *slot;
+    long i, j;
+
+    pthread_mutex_lock(&shard->lock);
+    if ( 2 * (shard->size + 1) > shard->capacity ) { /* keep it half empty, so the probes stay short */
+        if ( !(slots = calloc((size_t) (shard->capacity ? 2 * shard->capacity : 16), sizeof(link_slot_t))) ) {
+            pthread_mutex_unlock(&shard->lock);
+            return 0;
+        }
+        for ( i = 0; i < shard->capacity; i++ ) {
+            if ( shard->slots[i].name ) {
+                for ( j = (long) (shard->slots[i].hash >> 6); slots[j & (2 * shard->capacity - 1)].name; j++ );
+                slots[j & (2 * shard->capacity - 1)] = shard->slots[i];
+            }
+        }
+        free(shard->slots);
+        shard->slots = slots;
+        shard->capacity = shard->capacity ? 2 * shard->capacity : 16;
+    }
+
+    for ( i = (long) (hash >> 6); ; i++ ) {
+        slot = &shard->slots[i & (shard->capacity - 1)];
+        if ( !slot->name ) {
+            slot->name = name;
+            slot->hash = hash;
+            slot->unit = unit;
+            shard->size++;
+            break;
+        }
+        if ( slot->hash == hash && strcmp(slot->name, name) == 0 ) {
+            if ( unit < slot->unit ) {
+                slot->name = name;
+                slot->unit = unit;
+            }
+            break;
+        }
+    }
+    pthread_mutex_unlock(&shard->lock);
+
+    return 1;
+}
+
+/**
+ * Look up a symbol in the global symbol table. Takes no lock, the table should not change while it's called.
+ *
+ * @param link_t*   link - The link.
+ * @param char*     name - The name.
+ *
+ * @return long - The unit that defines the symbol, -1 if none.
+ */
+static long lookup(link_t *link, const char *name){
+    unsigned long hash = symbol_hash(name);
+    link_shard_t *shard = &link->shards[hash & (LINK_SHARDS - 1)];
+    link_slot_t *slot;
+    long i;
+
+    for ( i = (long) (hash >> 6); shard->capacity > 0; i++ ) {
+        slot = &shard->slots[i & (shard->capacity - 1)];
+        if ( !slot->name ) {
+            break;
+        }
+        if ( slot->hash == hash && strcmp(slot->name, name) == 0 ) {
+            return slot->unit;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * Load a unit: read its symbols (from its files or from its archive) and publish its entries.
+ *
+ * @param link_t*   link - The link.
+ * @param long      index - The unit.
+ */
+static void load_unit(link_t *link, long index){
+    link_unit_t *unit = &link->units[index];
+    char *file_name, *texts[MEMBER_FILES] = {NULL, NULL, NULL};
+    const char *ent, *ext;
+    long ent_length = 0, ext_length = 0;
+    int i;
+
+    if ( unit->archive ) {
+        ent = archive_member_file(unit->archive, unit->member, MEMBER_ENT, &ent_length);
+        ext = archive_member_file(unit->archive, unit->member, MEMBER_EXT, &ext_length);
+    } else {
+        if ( !(file_name = malloc(strlen(unit->name) + 5)) ) {
+            unit->failed = 2;
+            return;
+        }
+        sprintf(file_name, "%s.ob", unit->name);
+        if ( access(file_name, R_OK) != 0 ) {
+            unit->failed = 1;
+            free(file_name);
+            return;
+        }
+        sprintf(file_name, "%s.ent", unit->name);
+        texts[MEMBER_ENT] = read_whole_file(file_name, &ent_length);
+        sprintf(file_name, "%s.ext", unit->name);
+        texts[MEMBER_EXT] = read_whole_file(file_name, &ext_length);
+        free(file_name);
+        ent = texts[MEMBER_ENT];
+        ext = texts[MEMBER_EXT];
+    }
+
+    if ( !read_link_symbols(ent, ent_length, &unit->entries, &unit->entries_size, &unit->entries_capacity)
+         || !read_link_symbols(ext, ext_length, &unit->externs, &unit->externs_size, &unit->externs_capacity) ) {
+        unit->failed = 2;
+    }
+    for ( i = 0; !unit->failed && i < unit->entries_size; i++ ) {
+        if ( !publish(link, unit->entries[i].name, index) ) {
+            unit->failed = 2;
+        }
+    }
+    free(texts[MEMBER_ENT]);
+    free(texts[MEMBER_EXT]);
+}
+
+/**
+ * Resolve the extern uses of a unit, and find which of its entries another unit defines too. The uses of a
+ * symbol follow each other in a .ext file of the compact format (--compact-ext), so they're looked up once.
+ *
+ * @param link_t*   link - The link.
+ * @param long      index - The unit.
+ */
+static void resolve_unit(link_t *link, long index){
+    link_unit_t *unit = &link->units[index];
+    int i;
+
+    for ( i = 0; i < unit->entries_size; i++ ) {
+        unit->entries[i].owner = lookup(link, unit->entries[i].name);
+    }
+    for ( i = 0; i < unit->externs_size; i++ ) {
+        if ( i > 0 && strcmp(unit->externs[i].name, unit->externs[i - 1].name) == 0 ) {
+            unit->externs[i].owner = unit->externs[i - 1].owner;
+        } else {
+            unit->externs[i].owner = lookup(link, unit->externs[i].name);
+        }
+    }
+}
+
+/**
+ * A thread of the pool: takes the next unit of the phase until there are none left.
+ *
+ * @param void*     arg - The link.
+ *
+ * @return void* - NULL.
+ */
+static void *link_worker(void *arg){
+    link_t *link = arg;
+    int index;
+
+    for ( ; ; ) {
+        pthread_mutex_lock(&link->next_lock);
+        index = link->next < link->end ? link->next++ : -1;
+        pthread_mutex_unlock(&link->next_lock);
+        if ( index == -1 ) {
+            return NULL;
+        }
+        if ( link->phase == PHASE_LOAD ) {
+            load_unit(link, index);
+        } else {
+            resolve_unit(link, index);
+        }
+    }
+}
+
+/**
+ * Run a phase on units, on the threads of the pool, and wait for it to end.
+ *
+ * @param link_t*   link - The link.
+ * @param int       phase - PHASE_LOAD or PHASE_RESOLVE.
+ * @param int       start - The first unit.
+ * @param int       end - The unit after the last one.
+ * @param int       threads - The number of threads.
+ */
+static void run_phase(link_t *link, int phase, int start, int end, int threads){
+    pthread_t *pool;
+    int i, started;
+
+    link->phase = phase;
+    link->next = start;
+    link->end = end;
+    if ( threads > end - start ) {
+        threads = end - start;
+    }
+
+    /* a thread that can't be started leaves its work to the others, or to this thread */
+    pool = malloc((size_t) (threads > 0 ? threads : 1) * sizeof(pthread_t));
+    for ( started = 0, i = 0; pool && i < threads; i++ ) {
+        if ( pthread_create(&pool[started], NULL, link_worker, link) == 0 ) {
+            started++;
+        }
+    }
+    link_worker(link);
+    for ( i = 0; i < started; i++ ) {
+        pthread_join(pool[i], NULL);
+    }
+    free(pool);
+}
+
+/**
+ * Add a unit to the link.
+ *
+ * @param link_t*       link - The link.
+ * @param char*         name - The name of the unit, it's copied.
+ * @param archive_t*    archive - The archive of a member, NULL for a source.
+ * @param long          member - The index of the member.
+ *
+ * @return int - 1 if everything went OK, 0 on memory error.
+ */
+static int add_unit(link_t *link, const char *name, archive_t *archive, long member){
+    link_unit_t *unit;
+
+    if ( !ensure_capacity((void **) &link->units, &link->units_capacity, link->units_size + 1, sizeof(link_unit_t)) ) {
+        return 0;
+    }
+    unit = &link->units[link->units_size];
+    memset(unit, 0, sizeof(link_unit_t));
+    if ( !(unit->name = malloc(strlen(name) + 1)) ) {
+        return 0;
+    }
+    strcpy(unit->name, name);
+    unit->archive = archive;
+    unit->member = member;
+    link->units_size++;
+
+    return 1;
+}
+
+/**
+ * Pull in the archive members that define the externs no unit defines.
+ *
+ * @param link_t*   link - The link.
+ * @param long**    pulled - The unit of every member of every archive, -1 if it wasn't pulled in.
+ *
+ * @return int - The number of members pulled in, -1 on memory error.
+ */
+static int pull_members(link_t *link, long **pulled){
+    char name[2 * LINE_MAX + 2];
+    link_symbol_t *use;
+    long member;
+    int i, j, k, address, count = 0, units = link->units_size;
+
+    for ( i = 0; i < units; i++ ) {
+        for ( j = 0; j < link->units[i].externs_size; j++ ) {
+            use = &link->units[i].externs[j];
+            for ( k = 0; use->owner == -1 && k < link->archives_size; k++ ) {
+                if ( (member = archive_find(&link->archives[k], use->name, &address)) == -1 ) {
+                    continue;
+                }
+                if ( pulled[k][member] == -1 ) {
+                    pulled[k][member] = link->units_size;
+                    sprintf(name, "%.*s(%.*s)", LINE_MAX - 1, link->archive_names[k], LINE_MAX - 1,
+                            archive_member_name(&link->archives[k], member));
+                    if ( !add_unit(link, name, &link->archives[k], member) ) {
+                        return -1;
+                    }
+                    count++;
+                }
+                use->owner = pulled[k][member]; /* until it's resolved again */
+            }
+        }
+    }
+
+    return count;
+}
+
+/**
+ * Print the errors of the link, unit by unit: the entries that an earlier unit defines too, and the extern
+ * uses that no unit defines.
+ *
+ * @param link_t*   link - The link.
+ *
+ * @return int - The number of errors.
+ */
+static int print_link_errors(link_t *link){
+    link_unit_t *unit;
+    int i, j, errors = 0;
+
+    for ( i = 0; i < link->units_size; i++ ) {
+        unit = &link->units[i];
+        if ( unit->failed ) {
+            fprintf(stderr, unit->failed == 1 ? "Cannot open file: %s.ob\n" : "Cannot allocate memory for %s\n", unit->name);
+            errors++;
+            continue;
+        }
+        for ( j = 0; j < unit->entries_size; j++ ) {
+            if ( unit->entries[j].owner != i ) {
+                fprintf(stderr, "Symbol %s of %s is already an entry of %s\n", unit->entries[j].name, unit->name,
+                        link->units[unit->entries[j].owner].name);
+                errors++;
+            }
+        }
+        for ( j = 0; j < unit->externs_size; j++ ) {
+            if ( unit->externs[j].owner == -1 ) {
+                fprintf(stderr, "Undefined symbol: %s (used by %s at %d)\n", unit->externs[j].name, unit->name,
+                        unit->externs[j].address);
+                errors++;
+            }
+        }
+    }
+
+    return errors;
+}
+
+/**
+ * Check that the units link (--link): merge their entries, resolve their extern uses, and pull in the archive
+ * members that define the externs the units don't.
+ *
+ * @param int       argc - The number of arguments after --link.
+ * @param char**    argv - The units (file names without extension) and the archives (names that end with .lib).
+ *
+ * @return int - 0 if the units link, 1 otherwise.
+ */
+int link_units(int argc, char *argv[]){
+    link_t link;
+    long **pulled;
+    int threads = settings.threads > 0 ? settings.threads : (int) sysconf(_SC_NPROCESSORS_ONLN);
+    int i, j, start, end, uses = 0, entries = 0, members = 0, errors = 0;
+    size_t length;
+
+    if ( argc == 0 ) {
+        fprintf(stderr, "Missing file names after --link\n");
+        return 1;
+    }
+    memset(&link, 0, sizeof(link_t));
+    pthread_mutex_init(&link.next_lock, NULL);
+    for ( i = 0; i < LINK_SHARDS; i++ ) {
+        pthread_mutex_init(&link.shards[i].lock, NULL);
+    }
+    link.archives = calloc((size_t) argc, sizeof(archive_t));
+    link.archive_names = calloc((size_t) argc, sizeof(char *));
+    pulled = calloc((size_t) argc, sizeof(long *));
+    if ( !link.archives || !link.archive_names || !pulled ) {
+        fprintf(stderr, "Cannot allocate memory.\n");
+        errors++;
+    }
+
+    /* the units come in the order of the command line, the archive members after them */
+    for ( i = 0; !errors && i < argc; i++ ) {
+        length = strlen(argv[i]);
+        if ( length > 4 && strcmp(argv[i] + length - 4, ".lib") == 0 ) {
+            if ( !archive_open(&link.archives[link.archives_size], argv[i]) ) {
+                errors++;
+            } else if ( !(pulled[link.archives_size] = malloc(((size_t) link.archives[link.archives_size].members + 1) * sizeof(long))) ) {
+                archive_close(&link.archives[link.archives_size]);
+                fprintf(stderr, "Cannot allocate memory.\n");
+                errors++;
+            } else {
+                for ( j = 0; j < link.archives[link.archives_size].members; j++ ) {
+                    pulled[link.archives_size][j] = -1;
+                }
+                link.archive_names[link.archives_size++] = argv[i];
+            }
+        } else if ( !add_unit(&link, argv[i], NULL, 0) ) {
+            fprintf(stderr, "Cannot allocate memory.\n");
+            errors++;
+        }
+    }
+
+    /* a round loads the new units and resolves every unit, the archives may add units for the next round */
+    for ( start = 0; !errors && start < link.units_size; start = end ) {
+        end = link.units_size;
+        run_phase(&link, PHASE_LOAD, start, end, threads);
+        run_phase(&link, PHASE_RESOLVE, 0, end, threads);
+        if ( pull_members(&link, pulled) < 0 ) {
+            fprintf(stderr, "Cannot allocate memory.\n");
+            errors++;
+        }
+    }
+
+    if ( !errors ) {
+        errors = print_link_errors(&link);
+        for ( i = 0; i < link.units_size; i++ ) {
+            entries += link.units[i].entries_size;
+            uses += link.units[i].externs_size;
+            members += link.units[i].archive != NULL;
+        }
+        printf("INFO: %d units (%d archive members), %d entries, %d extern uses, %d errors (threads: %d).\n",
+               link.units_size, members, entries, uses, errors, threads);
+    }
+
+    for ( i = 0; i < link.units_size; i++ ) {
+        free(link.units[i].name);
+        free(link.units[i].entries);
+        free(link.units[i].externs);
+    }
+    for ( i = 0; i < link.archives_size; i++ ) {
+        archive_close(&link.archives[i]);
+        free(pulled[i]);
+    }
+    for ( i = 0; i < LINK_SHARDS; i++ ) {
+        free(link.shards[i].slots);
+        pthread_mutex_destroy(&link.shards[i].lock);
+    }
+    pthread_mutex_destroy(&link.next_lock);
+    free(link.units);
+    free(link.archives);
+    free(link.archive_names);
+    free(pulled);
+
+    return errors > 0;
+}
@@ -0,0 +1,265 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "header.h"
+
+/*
+ * The macro stage. Macros are defined in the source itself:
+ *
+ *      mcr NAME
+ *          ...
+ *      endmcr
+ *
+ * and a line that has only the name of a macro is replaced by the body of the macro.
+ * The stage sits between the source file and the scans: read_line() gives the scans the expanded
+ * lines one by one, so no intermediate file is written. Each line keeps the number it has in the
+ * source file (for a line of a macro body, the line inside the definition), so the diagnostics
+ * point at the original lines.
+ */
+
+#define NOT_DEFINING -1
+#define SKIPPING_DEFINITION -2
+
+/**
+ * Initialize the macro stage, before it's used for the first time.
+ *
+ * @param preprocessor_t*   pp - The macro stage.
+ */
+void preprocessor_init(preprocessor_t *pp){
+    name_table_init(&pp->table.names);
+    pp->table.macros = NULL;
+    pp->table.spans = NULL;
+    pp->table.capacity = pp->table.spans_size = pp->table.spans_capacity = 0;
+    pp->expanding = pp->defining = NOT_DEFINING;
+    pp->next_span = pp->definition_line = pp->line_counter = 0;
+    pp->frozen = 0;
+}
+
+/**
+ * Drop all the macros before a new source is assembled, but keep the memory.
+ *
+ * @param preprocessor_t*   pp - The macro stage.
+ */
+void preprocessor_reset(preprocessor_t *pp){
+    name_table_clear(&pp->table.names);
+    pp->table.spans_size = 0;
+    preprocessor_rewind(pp);
+    pp->frozen = 0;
+}
+
+/**
+ * Get ready to read the source from its beginning again. After the first scan the macros are already
+ * known, so their definitions are skipped.
+ *
+ * @param preprocessor_t*   pp - The macro stage.
+ */
+void preprocessor_rewind(preprocessor_t *pp){
+    pp->frozen = 1;
+    pp->expanding = pp->defining = NOT_DEFINING;
+    pp->next_span = pp->definition_line = pp->line_counter = 0;
+}
+
+/**
+ * Free the memory of the macro stage.
+ *
+ * @param preprocessor_t*   pp - The macro stage.
+ */
+void preprocessor_free(preprocessor_t *pp){
+    name_table_free(&pp->table.names);
+    free(pp->table.macros);
+    free(pp->table.spans);
+    preprocessor_init(pp);
+}
+
+/**
+ * Find a macro by its name.
+ *
+ * @param macro_table_t*    table - The macro table.
+ * @param char*             name - The name of the macro.
+ *
+ * @return int - The index of the macro in the table, -1 if there is no such macro.
+ */
+int macro_find(macro_table_t *table, char *name){
+    return name_table_find(&table->names, name);
+}
+
+/**
+ * Add a new (empty) macro to the table.
+ *
+ * @param macro_table_t*    table - The macro table.
+ * @param char*             name - The name of the macro, assumed not to be in the table already.
+ *
+ * @return int - The index of the new macro, -1 on memory error.
+ */
+static int macro_insert(macro_table_t *table, char *name){
+    int index;
+
+    if ( !ensure_capacity((void **) &table->macros, &table->capacity, table->names.size + 1, sizeof(macro_t))
+         || (index = name_table_insert(&table->names, name)) < 0 ) {
+        return -1;
+    }
+
+    table->macros[index].first_span = table->spans_size;
+    table->macros[index].span_count = 0;
+
+    return index;
+}
+
+/**
+ * Add a line to the body of the last macro in the table.
+ *
+ * @param macro_table_t*    table - The macro table.
+ * @param char*             line - The line, without the '\n'.
+ * @param int               line_number - The line number in the source.
+ *
+ * @return int - 1 if everything went OK, 0 on memory error.
+ */
+static int macro_add_line(macro_table_t *table, char *line, int line_number){
+    text_span *span;
+    int start;
+
+    if ( !ensure_capacity((void **) &table->spans, &table->spans_capacity, table->spans_size + 1, sizeof(text_span))
+         || (start = name_table_add_text(&table->names, line, (int) strcspn(line, "\n"))) < 0 ) {
+        return 0;
+    }
+
+    span = &table->spans[table->spans_size++];
+    span->start = start;
+    span->length = (int) strcspn(line, "\n");
+    span->line = line_number;
+    table->macros[table->names.size - 1].span_count++;
+
+    return 1;
+}
+
+/**
+ * Handle a "mcr NAME" line, start the definition of the macro.
+ *
+ * @param assembler_t*  as - The assembler context.
+ * @param char*         line - The line.
+ * @param int           pos - The position after the "mcr".
+ * @param int           line_number - The line number.
+ */
+static void start_definition(assembler_t *as, char *line, int pos, int line_number){
+    preprocessor_t *pp = &as->pp;
+    char name[LINE_MAX], extra[LINE_MAX];
+    int name_pos;
+
+    pp->definition_line = line_number;
+    pp->defining = SKIPPING_DEFINITION;
+
+    if ( pp->frozen ) { /* we already know this macro from the first scan */
+        return;
+    }
+
+    skip_white_space(line, &pos);
+    name_pos = pos;
+    get_new_word(line, name, &pos);
+    skip_white_space(line, &pos);
+
+    if ( strlen(name) == 0 || !check_word(name, LABEL) || strcmp(name, "mcr") == 0 || strcmp(name, "endmcr") == 0 ) {
+        diag_report(&as->diag, line_number, name_pos + 1, DIAG_INVALID_MACRO, 1, "invalid macro name: '%s'", name);
+        return;
+    }
+    if ( get_new_word(line, extra, &pos) > 0 ) {
+        diag_report(&as->diag, line_number, pos + 1, DIAG_EXTRA_OPERAND, 1, "mcr should have one argument");
+        return;
+    }
+    if ( macro_find(&pp->table, name) != -1 ) {
+        diag_report(&as->diag, line_number, name_pos + 1, DIAG_INVALID_MACRO, 1, "The macro %s defined more then once", name);
+        return;
+    }
+
+    if ( (pp->defining = macro_insert(&pp->table, name)) < 0 ) {
+        diag_report(&as->diag, line_number, 0, DIAG_MEMORY, 1, "Cannot allocate memory for macro %s", name);
+        pp->defining = SKIPPING_DEFINITION;
+    }
+}
+
+/**
+ * Read the next line of the source, after the macros were expanded.
+ * This is the only way the scans read the source.
+ *
+ * @param assembler_t*  as - The assembler context.
+ * @param FILE*         fp - The source.
+ * @param char[]        line - Will hold the line at the end.
+ * @param int*          line_number - Will hold the line number in the source file at the end.
+ *
+ * @return int - 1 if a line was read, 0 at the end of the source.
+ */
+int read_line(assembler_t *as, FILE *fp, char line[LINE_MAX], int *line_number){
+    preprocessor_t *pp = &as->pp;
+    char word[LINE_MAX];
+    text_span *span;
+    macro_t *macro;
+    int pos, length, macro_index;
+
+    while ( 1 ) {
+        /* ------------ MACRO EXPANSION --------------- */
+        if ( pp->expanding >= 0 ) {
+            macro = &pp->table.macros[pp->expanding];
+            if ( pp->next_span < macro->first_span + macro->span_count ) {
+                span = &pp->table.spans[pp->next_span++];
+                length = span->length < LINE_MAX - 2 ? span->length : LINE_MAX - 2;
+                memcpy(line, pp->table.names.text + span->start, (size_t) length);
+                line[length] = '\n';
+                line[length + 1] = '\0';
+                *line_number = span->line;
+                return 1;
+            }
+            pp->expanding = NOT_DEFINING;
+        }
+
+        if ( !fgets(line, LINE_MAX, fp) ) {
+            if ( pp->defining != NOT_DEFINING && !pp->frozen ) {
+                diag_report(&as->diag, pp->definition_line, 0, DIAG_INVALID_MACRO, 1, "mcr without endmcr");
+            }
+            pp->defining = NOT_DEFINING;
+            return 0;
+        }
+        *line_number = ++pp->line_counter;
+
+        pos = 0;
+        skip_white_space(line, &pos);
+        length = get_new_word(line, word, &pos);
+
+        /* ------------ MACRO DEFINITION --------------- */
+        if ( pp->defining != NOT_DEFINING ) {
+            if ( strcmp(word, "endmcr") == 0 ) {
+                skip_white_space(line, &pos);
+                if ( line[pos] != '\n' && line[pos] != '\0' && !pp->frozen ) {
+                    diag_report(&as->diag, *line_number, pos + 1, DIAG_EXTRA_OPERAND, 1, "endmcr should have no arguments");
+                }
+                pp->defining = NOT_DEFINING;
+            } else if ( strcmp(word, "mcr") == 0 && !pp->frozen ) {
+                diag_report(&as->diag, *line_number, 0, DIAG_INVALID_MACRO, 1, "macro definitions can't be nested");
+            } else if ( pp->defining >= 0 && !macro_add_line(&pp->table, line, *line_number) ) {
+                diag_report(&as->diag, *line_number, 0, DIAG_MEMORY, 1, "Cannot allocate memory for macro body");
+            }
+            continue;
+        }
+
+        if ( strcmp(word, "mcr") == 0 ) {
+            start_definition(as, line, pos, *line_number);
+            continue;
+        }
+        if ( strcmp(word, "endmcr") == 0 ) {
+            if ( !pp->frozen ) {
+                diag_report(&as->diag, *line_number, 0, DIAG_INVALID_MACRO, 1, "endmcr without mcr");
+            }
+            continue;
+        }
+
+        /* ------------ MACRO CALL --------------- */
+        if ( length > 0 && (macro_index = macro_find(&pp->table, word)) != -1 ) {
+            skip_white_space(line, &pos);
+            if ( line[pos] == '\n' || line[pos] == '\0' || line[pos] == ';' ) { /* only the name on this line */
+                pp->expanding = macro_index;
+                pp->next_span = pp->table.macros[macro_index].first_span;
+                continue;
+            }
+        }
+
+        return 1;
+    }
+}
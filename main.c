@@ -3,600 +3,474 @@
 #include <string.h>
 #include "header.h"
 
+settings_t settings = {DIAG_TEXT, 0, 0, 0, 0, 0, 0, 0, 0, NULL, 0, 0, -1, 0, 0, 0}; /* the settings every source is assembled with */
+output_counts_t output_counts = {0, 0}; /* the output files of the whole run */
 
-/*
- * Using global variables most of the time consider as bad practice,
- * but if it's done right, they can be very efficient.
+/**
+ * Parse a single command line option, i.e "--max-errors=20".
+ *
+ * @param settings_t*   options - The settings to update.
+ * @param char*         option - The option.
+ *
+ * @return int - 1 if the option is valid, 0 otherwise.
  */
-table_of_signs *table_signs;
-int table_signs_size;
-
-word_t *data_seg; /* data segment */
-int dc; /* data counter */
-
-word_t *code_seg; /* code segment */
-int ic;  /* instruction counter */
-
-data_table *ent; /* entry table */
-int ent_size;  /* size of entry table */
+int parse_option(settings_t *options, char *option){
+    if ( strcmp(option, "--diag=text") == 0 ) {
+        options->diag_format = DIAG_TEXT;
+    } else if ( strcmp(option, "--diag=json") == 0 ) {
+        options->diag_format = DIAG_JSON;
+    } else if ( strncmp(option, "--max-errors=", 13) == 0 && num_isvalid(option + 13) && atoi(option + 13) >= 0 ) {
+        options->max_errors = atoi(option + 13);
+    } else if ( strcmp(option, "-O") == 0 ) {
+        options->optimize = 1;
+    } else if ( strcmp(option, "--gc") == 0 ) {
+        options->gc = 1;
+    } else if ( strcmp(option, "--pool-strings") == 0 ) {
+        options->pool_strings = 1;
+    } else if ( strcmp(option, "--bin") == 0 ) {
+        options->binary = 1;
+    } else if ( strcmp(option, "-g") == 0 ) {
+        options->debug_info = 1;
+    } else if ( strcmp(option, "--reloc") == 0 ) {
+        options->relocations = 1;
+    } else if ( strncmp(option, "--base=", 7) == 0 && num_isvalid(option + 7) && atoi(option + 7) >= 0 ) {
+        options->load_base = atoi(option + 7);
+    } else if ( strncmp(option, "--max-steps=", 12) == 0 && num_isvalid(option + 12) && atol(option + 12) >= 0 ) {
+        options->max_steps = atol(option + 12);
+    } else if ( strcmp(option, "--jit") == 0 ) {
+        options->jit = 1;
+    } else if ( strcmp(option, "--profile") == 0 ) {
+        options->profile = 1;
+    } else if ( strncmp(option, "--batch=", 8) == 0 && option[8] ) {
+        options->batch = option + 8;
+    } else if ( strncmp(option, "--threads=", 10) == 0 && num_isvalid(option + 10) && atoi(option + 10) > 0 ) {
+        options->threads = atoi(option + 10);
+    } else if ( strncmp(option, "--mem-limit=", 12) == 0 && num_isvalid(option + 12) && atol(option + 12) > 0 ) {
+        options->mem_limit = atol(option + 12) * 1024;
+    } else if ( strcmp(option, "--compact-ext") == 0 ) {
+        options->compact_ext = 1;
+    } else {
+        return 0;
+    }
 
-data_table *ext; /* extern table */
-int ext_size;  /* size of extern table */
+    return 1;
+}
 
 /**
- * First assembler scan.
+ * Open an output file named "base_name" + "extension" for writing. The file is written under a temporary
+ * name, and takes its own name only when it's closed by close_output(), so a reader (or --watch) never sees
+ * a half written file.
  *
- * @param FILE* fp - The file to scan from.
+ * @param char*     base_name - The file name without extension.
+ * @param char*     extension - The extension to add, i.e ".ob".
+ * @param char**    name - Will point to the full (allocated) file name at the end.
  *
- * @return int 0 if everything went OK, 1 otherwise.
+ * @return FILE* - The opened file, NULL if it couldn't be opened.
  */
-int first_scan(FILE *fp){
-    int matrix_size, i, local_error;
-    int line_counter = 0; /* line number */
-	int error = 0; /* 1 if we found an error */
-	char line[LINE_MAX], temp[LINE_MAX], label[LINE_MAX], oper[LINE_MAX], arg1[LINE_MAX], arg2[LINE_MAX];
-	int length; /* length of current word */
-	int valid; /* save the result of the isvalid */
-	int pos; /* the position on the current line*/
-	int is_label; /* 1 if we have label on the current line */
-    int register_arg_flag; /* indicates the first argument was a register */
-    int insert_status; /* whether a sign insert to the table successfully */
-	ic = 100; dc = 0;
-
-	while ( fgets(line, LINE_MAX, fp) ) { /* get line */
-		pos = local_error = 0;
-        register_arg_flag = 0; /* not register yet */
-		is_label = 0; /* not label yet */
-		line_counter++; /* line counter is increased */
-
-		skip_white_space(line, &pos); /* skip to the first word */
-		length = get_new_word(line, temp, &pos); /* get the first word */
-
-		if ( length == 0 ) /* if it's mark or empty line */
-            continue;
-
-		/* ------------ LABEL HANDLING --------------- */
-		if ( temp[length-1] == ':' ){	/* if we read label */
-			temp[length-1] = '\0'; /* "delete" the : by putting \0 there */
-			strcpy(label,temp);
-			if ( ! check_word(label, LABEL) ) { /* check if it's valid label */
-				fprintf(stderr, "line %d:\tinvalid label: '%s'\n", line_counter,label);
-				error = 1;
-				continue;
-			}
-			is_label = 1; /* mark there is a label */
-			skip_white_space(line, &pos); /* skip to the next word */
-			get_new_word(line, oper, &pos); /* read the operation */
-		}
-		else {    /* we read the operation immediately */
-            strcpy(oper, temp);
-        }
-
-		/* ------------ CHECK OPERATION --------------- */
-		if ( ( valid = check_word(oper, OPERATION)) == -1 ){ /* check if the word is invalid */
-			fprintf(stderr, "line %d:\tinvalid operation: %s\n", line_counter, oper);
-			error = 1;
-			continue;
-		}
-
-        /* ------------ ENTRY HANDLING --------------- */
-        if ( valid == ENTRY ) {
-            /*
-             * If the word was .entry, we don't have anything to do right now,
-             * we will handle this case in the second scan.
-             */
-            continue;
-        }
-
-		/* ------------ DATA HANDLING --------------- */
-		if ( valid == DATA ) { /* the operation we read was .data */
-
-			if ( is_label == 1 ) { /* we have a label on this line, insert it to our table of signs */
-                if ( (insert_status = insert_sign(&table_signs, &table_signs_size, label, dc, 0, 0)) != 1 ) {
-                    if ( insert_status == -1 ) {
-                        fprintf(stderr, "line %d:\tThe sign %s declared more then once\n", line_counter, label);
-                    }
-                    error = 1;
-                    continue;
-                }
-            }
-
-			skip_white_space(line, &pos);
-			length = get_new_word(line, arg1, &pos); /* get the next word (of data) */
-			while ( length > 0 ) { /* while we read a word */
-				int num;
-				word_t op_num;
-				if ( !num_isvalid(arg1) ) { /* if it's invalid number */
-					fprintf(stderr, "line %d:\tInvalid number: %s\n", line_counter, arg1);
-					error = 1;
-                    local_error = 1;
-					break;
-				}
-				num = atoi(arg1); /* transform the number */
-				op_num = trans_to_word(num, line_counter, &error); /* change it to word_type */
-				if ( !code_insert(&data_seg, &dc, op_num) ) { /* add the data word to the data table */
-					error = 1;
-                    local_error = 1;
-					break;
-				}
-				skip_white_space(line, &pos);
-				length = get_new_word(line, arg1, &pos); /* get the next word (of data) */
-			}
-
-            if ( local_error ) continue;
-
-			skip_white_space(line, &pos);
-			if ( line[pos] != '\n' && line[pos] != '\0' ) { /* if the last char wasn't \n and wasn't \0 */
-				fprintf(stderr, "line %d:\tInvalid list number\n", line_counter);
-				error = 1;
-			}
-			continue;
-		}
-
-		/* ------------ STRING HANDLING --------------- */
-		if ( valid == STRING ) { /* the word was .string */
-			if ( is_label ) { /* we have a label on this line, insert it to our table of signs */
-                if ( (insert_status = insert_sign(&table_signs, &table_signs_size, label, dc, 0, 0)) != 1 ) {
-                    if (insert_status == -1) {
-                        fprintf(stderr, "line %d:\tThe sign %s declared more then once\n", line_counter, label);
-                    }
-                    error = 1;
-                    break;
-                }
-            }
-			skip_white_space(line, &pos);
-			length = get_entry_string(line, arg1, &pos);	/* get the string */
-			if ( length < 0 ) {
-				fprintf(stderr, "line %d:\tString should start and end with \"\n", line_counter);
-				error = 1;
-                continue;
-			}
-			for ( i = 0; i < length; i++ ) { /* for each char on the string (include \0) */
-				int num = arg1[i];
-                word_t op_num;
-
-				op_num = trans_to_word(num, line_counter, &error); /* change it to word_type */
-
-				if ( !code_insert(&data_seg, &dc, op_num) ) { /* add this sign to data table */
-					error = 1;
-                    continue;
-				}
-			}
-			skip_white_space(line, &pos);
-			length = get_new_word(line, arg1, &pos);
-			if ( length > 0 ) { /* if there was another word after the string */
-				fprintf(stderr, "line %d:\t.string should have one argument\n", line_counter);
-				error = 1;
-			}
-			continue;
-		}
-
-        /* ------------ MATRIX HANDLING --------------- */
-        if ( valid == MAT ) { /* the word was .mat */
-
-            if ( is_label == 1 ) { /* we have a label on this line, insert it to our table of signs */
-                if ( (insert_status = insert_sign(&table_signs, &table_signs_size, label, dc, 0, 0)) != 1 ) {
-                    if ( insert_status == -1 ) {
-                        fprintf(stderr, "line %d:\tThe sign %s declared more then once\n", line_counter, label);
-                    }
-                    error = 1;
-                    continue;
-                }
-            }
-
-            skip_white_space(line, &pos);
-            get_new_word(line, arg1, &pos); /* get matrix rows/columns count */
-            matrix_size = calculate_matrix_size(arg1);
-            if ( matrix_size < 1 ) {
-                fprintf(stderr, "line %d:\tMatrix rows and columns must be natural numbers.\n", line_counter);
-                error = 1;
-                continue;
-            }
-
-            skip_white_space(line, &pos);
-            length = get_new_word(line, arg2, &pos);
-            i = 0; /* this will tell us how many numbers there are at the end */
-            while ( length > 0 ) { /* while we read a word */
-                int num;
-                word_t op_num;
-                if ( !num_isvalid(arg2) ) { /* if it's invalid number */
-                    fprintf(stderr, "line %d:\tInvalid number: %s\n", line_counter, arg2);
-                    error = 1;
-                    local_error = 1;
-                    break;
-                }
-                num = atoi(arg2); /* translate the number */
-                op_num = trans_to_word(num, line_counter, &error); /* change it to word_type */
-                if ( !code_insert(&data_seg, &dc, op_num) ) { /* add the data number to the data table */
-                    error = 1;
-                    local_error = 1;
-                    break;
-                }
-                skip_white_space(line, &pos);
-                length = get_new_word(line, arg2, &pos); /* get the next number */
-                i++;
-            }
+FILE *open_output(char *base_name, char *extension, char **name){
+    FILE *fp;
 
-            if ( local_error ) continue;
+    *name = malloc(strlen(base_name) + strlen(extension) + 5); /* room for the temporary name */
+    if ( !(*name) ) {
+        fprintf(stderr, "Cannot allocate memory.\n");
+        return NULL;
+    }
+    sprintf(*name, "%s%s.tmp", base_name, extension);
 
-            skip_white_space(line, &pos);
-            if ( (line[pos] != '\n' &&  line[pos] != '\0') || i > matrix_size ) { /* if the last char wasn't \n or \0, or if there are more number than matrix size */
-                fprintf(stderr, "line %d:\tError trying to assign list number to the matrix, the list is invalid.\n", line_counter);
-                error = 1;
-            }
-            continue;
-        }
+    if ( !(fp = pipeline_open_output()) && !(fp = fopen(*name, "w")) ) { /* the pipeline writes it later */
+        fprintf(stderr, "Cannot open file: %s\n", *name);
+    }
+    (*name)[strlen(*name) - 4] = '\0';
 
-		/* ------------ EXTERN HANDLING --------------- */
-		if ( valid == EXTERN ) { /*the word was .extern */
-			skip_white_space(line, &pos);
-            get_new_word(line, arg1, &pos);
-			if ( (insert_status = insert_sign(&table_signs, &table_signs_size, arg1, 0, 1, 2)) != 1 ){  /* add the label to the signs table */
-				if ( insert_status == -1 ) {
-                    fprintf(stderr, "line %d:\tThe sign %s declared more then once\n", line_counter, arg1);
-                }
-                error = 1;
-                continue;
-			}
-			skip_white_space(line, &pos);
-			length = get_new_word(line, arg1, &pos);
-			if ( length > 0 ){ /* if there was another word after the extern */
-				fprintf(stderr, "line %d:\t.extern should have one argument\n",line_counter);
-				error = 1;
-			}
-			continue;
-		}
-		/* ------------ OPERATION HANDLING --------------- */
-        /* the word was an operation */
-        if ( is_label == 1 ) { /* we have a label on this line */
-            if ( (insert_status = insert_sign(&table_signs, &table_signs_size, label, ic, 0, 1)) != 1 ) {
-                if ( insert_status == -1 ) {
-                    fprintf(stderr, "line %d:\tThe sign %s declared more then once\n", line_counter, label);
-                }
-                error = 1;
-                continue;
-            }
-        }
-        ic++; /* we surely have a new word for the operation */
-        skip_white_space(line, &pos);
+    return fp;
+}
 
-		/* ------------ ARG1 HANDLING --------------- */
-		get_new_word(line, arg1, &pos);
-        if ( strlen(arg1) == 0 ) { /*if we don't have arguments */
-            continue;
+/**
+ * Close an output file that was opened by open_output(), and give it its name. When the file that has the name
+ * holds the same contents already, it's left as it is (so its modification time doesn't change, and the steps
+ * of a build that depend on it don't run again), and the temporary file is removed.
+ *
+ * @param FILE*     fp - The file.
+ * @param char*     name - The name of the file, from open_output().
+ * @param int       complete - 1 if the file was fully written, 0 to throw it away.
+ * @param int*      unchanged - Will hold 1 at the end if the file was left as it was, 0 otherwise.
+ *
+ * @return int - 1 if the file has its name (or had those contents already), 0 otherwise.
+ */
+static int finish_output(FILE *fp, char *name, int complete, int *unchanged){
+    char *temp_name;
+    const char *contents;
+    long length;
+    int ok;
+
+    *unchanged = 0;
+    if ( !pipeline_close_output(fp, name, complete, &ok, unchanged) ) {
+        ok = fclose(fp) == 0 && complete;
+        if ( !(temp_name = malloc(strlen(name) + 5)) ) {
+            fprintf(stderr, "Cannot allocate memory.\n");
+            return 0;
         }
+        sprintf(temp_name, "%s.tmp", name);
 
-		if ( (valid = check_word(arg1, ARGUMENT)) == -1 ) { /* if the argument1 is invalid*/
-			fprintf(stderr, "line %d:\tinvalid argument: '%s'\n", line_counter, arg1);
-			error = 1;
-			continue;
-		}
-        switch ( valid ) {
-            case DIRECT: case IMMEDIATE:
-                ic++; /* we should have new word for the label's address (or specified number) */
-                break;
-            case MATRIX_ACCESS:
-                ic += 2; /* we need two more spaces - one for the address of the matrix, and second for the relevant row/column */
-                break;
-            default: /* DIRECT_REGISTER */
-                ic++;
-                register_arg_flag = 1;
+        if ( ok && (contents = map_file(temp_name, &length)) ) {
+            *unchanged = file_has_contents(name, contents, length);
+            unmap_file(contents, length);
         }
-		skip_white_space(line, &pos);
-
-		/* ------------ ARG2 HANDLING --------------- */
-		get_new_word(line, arg2, &pos);
-        if ( strlen(arg2) == 0 ) { /* if we have only one argument */
-            continue;
+        if ( ok && !*unchanged && rename(temp_name, name) != 0 ) {
+            fprintf(stderr, "Cannot write file: %s\n", name);
+            ok = 0;
         }
-
-		if ( (valid = check_word(arg2, ARGUMENT)) == -1 ) { /*/if the argument2 is invalid*/
-			fprintf(stderr, "line %d:\tinvalid argument: '%s'\n", line_counter, arg2);
-			error=1;
-			continue;
-		}
-        switch ( valid ) {
-            case DIRECT: case IMMEDIATE:
-                ic++; /* we should have new word for the label's address (or specified number) */
-                break;
-            case MATRIX_ACCESS:
-                ic += 2; /* we need two more spaces - one for the address of the matrix, and second for the relevant row/column */
-                break;
-            default : /* DIRECT_REGISTER */
-                if ( !register_arg_flag ) { /* if arg1 was a register, we don't need to increase ic as they share a common word */
-                    ic++;
-                }
+        if ( !ok || *unchanged ) {
+            remove(temp_name);
         }
+        free(temp_name);
+    }
+    if ( ok ) {
+        output_counts.written += !*unchanged;
+        output_counts.unchanged += *unchanged;
+    }
 
-		/* ------------ EXCEPTION ARGS  --------------- */
-		skip_white_space(line, &pos);
-		if ( (line[pos] != '\n') && (line[pos] != '\0') ){ /*if after the 2 arguments we have more */
-			fprintf(stderr, "line %d:\ttoo much parameters\n", line_counter);
-			error = 1;
-            continue;
-		}
-	}
+    return ok;
+}
 
-	/* update the table of signs so the data will be placed after to code segment */
-	signs_table_update(table_signs, table_signs_size, ic);
+/**
+ * Close an output file that was opened by open_output(), and give it its name (see finish_output()).
+ *
+ * @param FILE*     fp - The file.
+ * @param char*     name - The name of the file, from open_output().
+ * @param int       complete - 1 if the file was fully written, 0 to throw it away.
+ *
+ * @return int - 1 if the file has its name (or had those contents already), 0 otherwise.
+ */
+int close_output(FILE *fp, char *name, int complete){
+    int unchanged;
 
-	return error;
+    return finish_output(fp, name, complete, &unchanged);
 }
 
-
 /**
- * Second assembler scan.
+ * Close an output file of a source, like close_output() does, and print whether it was created or left as it was.
  *
- * @param FILE* fp - The file to scan from.
+ * @param FILE*     fp - The file.
+ * @param char*     name - The name of the file, from open_output().
+ * @param int       complete - 1 if the file was fully written, 0 to throw it away.
  *
- * @return int 0 if everything went OK, 1 otherwise.
+ * @return int - 1 if the file has its name (or had those contents already), 0 otherwise.
  */
-int second_scan(FILE *fp){
-    int line_counter = 0; /* line number */
-    int error = 0; /* errors indicator */
-    char line[LINE_MAX], temp[LINE_MAX];	/* the line, and temp array to save each word */
-    char oper[LINE_MAX], arg1[LINE_MAX], arg2[LINE_MAX];
-    int length; /* length of current word *//*table_format_type *table_signs;*/
-    int pos; /* the position on the current line */
-    int arg1_exists;
-    int arg2_exists;
-    int address;
-    int arg1_amethod;
-    int arg2_amethod;
-    int src_operand_amethod;
-    int dest_operand_amethod;
-
-    word_t current_code; /* current code */
-
-    rewind(fp);
-    ic = 0;
-
-
-    while ( fgets(line, LINE_MAX, fp) ) { /* get line */
-
-        pos = arg1_exists = arg2_exists =  arg1_amethod = arg2_amethod = 0;
-        current_code.oper = current_code.amethod_src_operand = current_code.amethod_dest_operand = current_code.memory = 0;
-        line_counter++; /* line counter is increased */
-
-        /* reset the arguments */
-        arg1[0] = '\0';
-        arg2[0] = '\0';
-
-        skip_white_space(line, &pos); /* skip to the first word */
-        length = get_new_word(line, temp, &pos); /* get the first word */
-
-        if ( length == 0 ) {/* if it's mark or empty line */
-            continue;
-        }
+static int close_source_output(FILE *fp, char *name, int complete){
+    int unchanged;
 
-        /* ------------ LABEL HANDLING --------------- */
-        if (temp[length-1]==':'){	/* we read label */
-            skip_white_space(line, &pos);
-            get_new_word(line, oper, &pos); /* read the operation */
-        } else {    /* we read the operation immediately */
-            strcpy(oper, temp);
-        }
+    if ( !finish_output(fp, name, complete, &unchanged) ) {
+        return 0;
+    }
+    printf("INFO: %s %s.\n", name, unchanged ? "is unchanged" : "was created");
 
-        /* ------------ CHECK OPERATION --------------- */
-        address = check_word(oper, OPERATION);
+    return 1;
+}
 
-        /* do nothing in these cases */
-        if ( address == DATA || address == STRING || address == MAT || address == EXTERN ) {
-            continue;
+/**
+ * Create the .ob, .ent and .ext files of an assembled source (and the .bin, .rel and .dbg files when they were asked for).
+ *
+ * @param assembler_t*  as - The assembler context that holds the assembled source.
+ * @param char*         base_name - The file name without extension, used to name the output files.
+ *
+ * @return int - 0 if everything went OK, 2 if one of the files couldn't be created.
+ */
+int write_outputs(assembler_t *as, char *base_name){
+    FILE *obj_file;  /*the object file*/
+    FILE *entry_file;  /*the ENTRY file*/
+    FILE *extern_file;  /*the EXTERN file*/
+    FILE *bin_file;  /*the binary image*/
+    FILE *rel_file;  /*the relocation table*/
+    FILE *debug_file;  /*the debug information*/
+    char *name, *source_name;
+    int written;
+
+    segment_will_stream(&as->spilled, as->code_seg);
+    segment_will_stream(&as->spilled, as->data_seg);
+    if ( as->ic + as->dc > 0 ) {  /* if the length of the OB file is >0 */
+        if ( !(obj_file = open_output(base_name, ".ob", &name)) ) {
+            free(name);
+            return 2;
         }
-
-
-        /* ------------ ENTRY HANDLING --------------- */
-        if ( address == ENTRY ) {
-            skip_white_space(line, &pos);
-            get_new_word(line, arg1, &pos);
-            if ( ! update_ent_table(&ent, &ent_size, arg1, table_signs, table_signs_size) ) { /* update the ent table */
-                fprintf(stderr, "line %d:\tError trying to add value %s to the entry table.\n", line_counter, arg1);
-                error = 1;
-                continue;
-            }
-            length = get_new_word(line, arg2, &pos);
-            if ( length > 0 ) { /* if there was another word after the entry */
-                fprintf(stderr, "line %d:\t.entry should have one argument\n", line_counter);
-                error = 1;
-            }
-            continue;
+        ob_print(&as->spilled, as->code_seg, as->data_seg, as->ic, as->dc, obj_file);  /* print to OB */
+        written = close_source_output(obj_file, name, 1);
+        free(name);
+        if ( !written ) {
+            return 2;
         }
+    }
 
-        /* ------------ OPERATION HANDLING --------------- */
-        address = check_word(oper, OPERATION);
-
-        current_code.oper = (unsigned) address;
-        current_code.memory = 0;
-
-        /* get arg1 */
-        skip_white_space(line, &pos);
-        get_new_word(line, arg1, &pos);
-
-        /* get arg2 */
-        skip_white_space(line, &pos);
-        get_new_word(line, arg2, &pos);
-
-        /* check what we have */
-        if ( strlen(arg1) > 0 ) {
-            arg1_exists = 1;
-            arg1_amethod = (unsigned) check_word(arg1, ARGUMENT);
-
-            if ( strlen(arg2) > 0 ) { /* check for arg2 either */
-                arg2_exists = 1;
-                arg2_amethod = (unsigned) check_word(arg2, ARGUMENT);
-            }
+    if ( as->settings.binary ) {
+        if ( !(bin_file = open_output(base_name, ".bin", &name)) ) {
+            free(name);
+            return 2;
         }
+        bin_print(&as->spilled, as->code_seg, as->data_seg, as->ic, as->dc, bin_file);
+        written = close_source_output(bin_file, name, 1);
+        free(name);
+        if ( !written ) {
+            return 2;
+        }
+    }
 
-        if ( arg1_exists && !is_label_defined(arg1, arg1_amethod, table_signs, table_signs_size) ) {
-            fprintf(stderr, "line %d:\tUndefined label: %s\n", line_counter, arg1);
+    if ( as->settings.relocations ) {
+        if ( !(rel_file = open_output(base_name, ".rel", &name)) ) {
+            free(name);
+            return 2;
         }
-        if ( arg2_exists && !is_label_defined(arg2, arg2_amethod, table_signs, table_signs_size) ) {
-            fprintf(stderr, "line %d:\tUndefined label: %s\n", line_counter, arg2);
+        rel_print(&as->spilled, as->code_seg, as->ic, rel_file);
+        written = close_source_output(rel_file, name, 1);
+        free(name);
+        if ( !written ) {
+            return 2;
         }
+    }
 
-        /* if we have two arguments, the first one is going to be the source operand */
-        if ( arg1_exists && arg2_exists ) {
-            current_code.amethod_src_operand = (unsigned) arg1_amethod;
-            current_code.amethod_dest_operand = (unsigned) arg2_amethod;
-            src_operand_amethod = arg1_amethod;
-            dest_operand_amethod = arg2_amethod;
+    if ( as->settings.debug_info ) {
+        if ( !(debug_file = open_output(base_name, ".dbg", &name)) ) {
+            free(name);
+            return 2;
         }
-        /* if we have one argument, he is going to be destination operand */
-        else if ( arg1_exists &&  !arg2_exists ) {
-            current_code.amethod_dest_operand = (unsigned) arg1_amethod;
-            src_operand_amethod = NO_ARG;
-            dest_operand_amethod = arg1_amethod;
+        source_name = malloc(strlen(base_name) + 4);
+        if ( source_name ) {
+            sprintf(source_name, "%s.as", base_name);
         }
-        else { /* both not exists */
-            src_operand_amethod = dest_operand_amethod = NO_ARG;
+        written = source_name && debug_write(as, source_name, debug_file);
+        free(source_name);
+        if ( !written ) {
+            fprintf(stderr, "Cannot allocate memory.\n");
         }
-
-        /* check if the addressing method fits the operation */
-        if ( ! is_address_valid(address, src_operand_amethod, dest_operand_amethod) ) {
-            fprintf(stderr, "line %d:\tinvalid address\n", line_counter);
-            error = 1;
-            continue;
+        if ( !close_source_output(debug_file, name, written) ) {
+            free(name);
+            return 2;
         }
+        free(name);
+    }
 
-        /* encode the operation */
-        if ( ! code_insert(&code_seg, &ic, current_code) ) {
-            fprintf(stderr, "line %d:\tFailed to insert code.\n", line_counter);
-            error = 1;
-            continue;
+    if ( as->ent_size > 0 ){  /* if the length of the ENTRY file is > 0 */
+        if ( !(entry_file = open_output(base_name, ".ent", &name)) ) {
+            free(name);
+            return 2;
         }
-
-        /* encode the arguments */
-        if ( arg1_exists ) {
-            encode_argument(arg1, arg1_amethod, arg2, FIRST_ARG, &code_seg, &ic, table_signs, table_signs_size, &ext, &ext_size);
-        } else { /* if the destination operand is't exists, it must be the last word in the line, we can go to the next iteration */
-            continue;
+        e_print(as->ent, as->ent_size, entry_file);  /* print to ENTRY */
+        written = close_source_output(entry_file, name, 1);
+        free(name);
+        if ( !written ) {
+            return 2;
         }
+    }
 
-        if ( arg2_exists ) {
-            encode_argument(arg2, arg2_amethod, arg1, SECOND_ARG, &code_seg, &ic, table_signs, table_signs_size, &ext, &ext_size);
+    if ( as->ext_size > 0 ) {  /* if the length of the EXTERN file is >0 */
+        if ( !(extern_file = open_output(base_name, ".ext", &name)) ) {
+            free(name);
+            return 2;
+        }
+        if ( as->settings.compact_ext ) {
+            if ( !(written = ext_print_compact(as->ext, as->ext_size, as->ic, extern_file)) ) {
+                fprintf(stderr, "Cannot allocate memory.\n");
+            }
         } else {
-            continue; /* no need to check for exception args if arg2 isn't exists */
+            e_print(as->ext, as->ext_size, extern_file);   /*print to EXTERN*/
+            written = 1;
+        }
+        if ( !close_source_output(extern_file, name, written) ) {
+            free(name);
+            return 2;
         }
+        free(name);
+    }
 
+    if ( as->settings.gc ) {
+        printf("INFO: %s: %d unreachable words removed (%d code, %d data).\n", base_name,
+               as->gc_code_words + as->gc_data_words, as->gc_code_words, as->gc_data_words);
+    }
+    if ( as->settings.mem_limit ) {
+        printf("INFO: %s: %ld kB of segments spilled, peak RSS %ld kB.\n", base_name,
+               (segment_spilled_bytes(&as->spilled, as->code_seg) + segment_spilled_bytes(&as->spilled, as->data_seg)) / 1024, peak_rss_kb());
+    }
 
-        /* ------------ EXCEPTION ARGS  --------------- */
-        skip_white_space(line, &pos);
-        if ( line[pos] != '\n' && line[pos] != '\0' ) { /*if after the 2 arguments we have more */
-            fprintf(stderr, "line %d:\tToo much parameters\n",line_counter);
-            error = 1;
-            break;
-        }
+    return 0;
+}
+
+/**
+ * Assemble a source and create the .ob, .ent and .ext files.
+ *
+ * @param assembler_t*  context - The context to assemble with (it's emptied first, and keeps the capacities of its
+ *                                tables), NULL to assemble with a new one.
+ * @param FILE*         fp - The source to assemble, could be a file or an in-memory stream.
+ * @param char*         base_name - The file name without extension, used to name the output files.
+ *
+ * @return int - 0 if everything went OK, 1 if the source has errors, 2 on a fatal error (memory / output files).
+ */
+int assemble(assembler_t *context, FILE *fp, char *base_name){
+    assembler_t own, *as = context ? context : &own;
+    char *source_name;
+    int status;
+
+    if ( !(source_name = malloc(strlen(base_name) + 4)) ) {
+        fprintf(stderr, "Cannot allocate memory.\n");
+        return 2;
+    }
+    strcpy(source_name, base_name);
+    strcat(source_name, ".as");
+
+    if ( !context ) {
+        assembler_init(as);
     }
+    as->settings = settings;
 
-    return error;
+    status = assembler_run(as, fp);
+    diag_flush(&as->diag, source_name, as->settings.diag_format, stderr);
+    if ( status == 0 ) {
+        status = write_outputs(as, base_name);
+    }
+
+    if ( !context ) {
+        assembler_free(as);
+    }
+    free(source_name);
+
+    return status;
+}
+
+/**
+ * Assemble the file "base_name".as.
+ *
+ * @param assembler_t*  context - The context to assemble with, NULL to assemble with a new one (see assemble()).
+ * @param char*         base_name - The file name without the .as extension.
+ *
+ * @return int - -1 if the file couldn't be opened, otherwise the result of assemble().
+ */
+int assemble_file(assembler_t *context, char *base_name){
+    FILE *fp;  /*the source file*/
+    char *name;
+    int status;
+
+    name = malloc(strlen(base_name) + 4); /*file name*/
+    if ( !name ) {
+        fprintf(stderr, "Cannot allocate memory.\n");
+        return 2;
+    }
+    strcpy(name, base_name);  /*copy the file name*/
+    strcat(name, ".as");  /*add .as*/
+    if ( !(fp = fopen(name, "r")) ) {  /*open .as for read*/
+        fprintf(stderr, "Cannot open file: %s\n", name);
+        free(name);
+        return -1;
+    }
+
+    status = assemble(context, fp, base_name);
+
+    fclose(fp);
+    free(name);
+
+    return status;
 }
 
 /**
  * Handling user interactive. get files, processing and generating error & info.
  *
+ * Usage:
+ *      assembler [options] file1 file2 ...             assemble file1.as, file2.as ...
+ *      assembler [options] --serve SOCKET              run as an assembler server listening on SOCKET
+ *      assembler [options] --watch file1 file2 ...     assemble the files, and assemble a file again whenever it's saved
+ *      assembler [options] --manifest FILE             assemble the files listed in FILE (one on every line), print the totals
+ *      assembler --client SOCKET [options] file1 ...   assemble the files with the server that listens on SOCKET
+ *      assembler --client SOCKET --stdin NAME          assemble the source read from stdin as NAME with the server
+ *      assembler --disasm NAME                         write NAME.bin (or NAME.ob) back as source lines
+ *      assembler [--max-steps=N] [--jit] --run NAME    run NAME.bin (or NAME.ob) on the simulator
+ *      assembler --profile --run NAME                  run NAME and write NAME.prof and NAME.folded
+ *      assembler --batch=FILE --run NAME               run NAME once for every line of numbers in FILE (the input of red)
+ *      assembler --archive create LIB file1 file2 ...  bundle the .ob, .ent and .ext files of the sources in LIB
+ *      assembler --archive list|extract LIB [member]   print the members of LIB and their entries / write their files
+ *      assembler --archive resolve LIB NAME            print the members of LIB that the externs of NAME need
+ *      assembler [--threads=N] --link file1 ... [LIB]  check that the files (and the members of LIB they need) link
+ *
+ * Options:
+ *      --diag=text|json        write the diagnostics as text lines (default) or as JSON lines
+ *      --max-errors=N          stop scanning a file after N errors
+ *      -O                      remove instructions that have no effect (peephole optimizer)
+ *      --gc                    remove the code and data that can't be reached from the .entry labels
+ *      --pool-strings          labeled strings that were already written (or are suffixes of one) share its words
+ *      --bin                   write a binary image (.bin) too
+ *      --reloc                 write the relocation table (.rel) too, so the program can run at another address
+ *      -g                      write the source line of every instruction and the symbols (.dbg) too
+ *      --base=N                run the program at address N, it's moved there by NAME.rel
+ *      --max-steps=N           stop the simulator after N instructions
+ *      --jit                   run the hot blocks of the simulated program as native x86-64 code
+ *      --profile               count the instructions the simulated program runs (not with --jit)
+ *      --batch=FILE            run many instances of the program, a line of FILE is the input of an instance
+ *      --threads=N             check the link on N threads (every CPU by default)
+ *      --mem-limit=N           keep the segments in N kB of memory, the rest of them goes to temporary files
+ *      --compact-ext           write every extern once in the .ext file, with the sorted addresses of its uses as deltas
+ *
  * @param int       argc - Number of argument.
  * @param char**    argv - Array of arguments.
  *
  * @return 0 if everything went OK, 1 otherwise.
  */
 int main(int argc, char *argv[]){
-	FILE *fp;  /*the source file*/
-	FILE *obj_file;  /*the object file*/
-	FILE *entry_file;  /*the ENTRY file*/
-	FILE *extern_file;  /*the EXTERN file*/
 	int i;
+    batch_totals_t totals;
 
-	for ( i = 1; i < argc; i++ ) {  /*for each file*/
-		char *name;
-
-        /* allocate memory for the tables that will hold the data */
-		table_signs = (table_of_signs *) malloc(sizeof(table_of_signs));
-		code_seg = (word_t *) malloc(sizeof(word_t)); /* code segment in OB file */
-		data_seg = (word_t *) malloc(sizeof(word_t));  /* data segment in OB file */
-		ent = (data_table *) malloc(sizeof(data_table));  /* table on ENTRY file */
-		ext = (data_table *) malloc(sizeof(data_table));  /* table on EXTERN file */
-
-		if ( !code_seg || !data_seg || !table_signs || !ent || !ext ) {
-			fprintf(stderr, "Cannot allocate memory.\n");
+    for ( i = 1; i < argc && argv[i][0] == '-'; i++ ) {  /* options come before the files */
+        if ( strcmp(argv[i], "--disasm") == 0 ) {
+            if ( i + 1 >= argc ) {
+                fprintf(stderr, "Missing file name after %s\n", argv[i]);
+                return 1;
+            }
+            return disassemble(argv[i + 1], stdout);
+        }
+        if ( strcmp(argv[i], "--run") == 0 ) {
+            if ( i + 1 >= argc ) {
+                fprintf(stderr, "Missing file name after %s\n", argv[i]);
+                return 1;
+            }
+            return simulate(argv[i + 1], &settings);
+        }
+        if ( strcmp(argv[i], "--watch") == 0 ) {
+            return watch(argc - i - 1, argv + i + 1);
+        }
+        if ( strcmp(argv[i], "--archive") == 0 ) {
+            return archive_command(argc - i - 1, argv + i + 1);
+        }
+        if ( strcmp(argv[i], "--manifest") == 0 ) {
+            if ( i + 1 >= argc ) {
+                fprintf(stderr, "Missing file name after %s\n", argv[i]);
+                return 1;
+            }
+            if ( assemble_manifest(argv[i + 1]) ) {
+                return 1;
+            }
+            printf("===========\n");
+            return 0;
+        }
+        if ( strcmp(argv[i], "--link") == 0 ) {
+            return link_units(argc - i - 1, argv + i + 1);
+        }
+        if ( strcmp(argv[i], "--serve") == 0 || strcmp(argv[i], "--client") == 0 ) {
+            if ( i + 1 >= argc ) {
+                fprintf(stderr, "Missing socket path after %s\n", argv[i]);
+                return 1;
+            }
+            if ( strcmp(argv[i], "--serve") == 0 ) {
+                return serve(argv[i + 1]);
+            }
+            return client(argv[i + 1], argc - i - 2, argv + i + 2);
+        }
+        if ( !parse_option(&settings, argv[i]) ) {
+            fprintf(stderr, "Invalid option: %s\n", argv[i]);
             return 1;
-		}
-
-		table_signs_size = ent_size = ext_size = 0;  /*the lines of ENTRY and EXTERN file*/
-
-		name = malloc(strlen(argv[i])+3); /*file name*/
-		strcpy(name, argv[i]);  /*copy the file name*/
-		name = strcat(name,".as");  /*add .as*/
-		if (!(fp = fopen(name,"r") )) {  /*oper .as for read*/
-			fprintf(stderr, "Cannot open file: %s\n", name);
-			continue;
-		}
-
-		if ( first_scan(fp) == 1 ) {  /* if there was a problem on first scan */
-			fclose(fp);
-			free(code_seg);
-			free(data_seg);
-			free(table_signs);
-            putchar('\n');
-			continue;
-		}
-		if ( second_scan(fp) == 1 ) {  /* if there was a problem on second scan */
-			fclose(fp);
-			free(code_seg);
-			free(data_seg);
-			free(table_signs);
-            putchar('\n');
-			continue;
-		}
-
-		/*  ------------ So Far So Good --------------- */
-
-		if ( ic + dc > 0 ) {  /* if the length of the OB file is >0 */
-			strcpy(name, argv[i]);
-			name = strcat(name, ".ob");  /* add .ob */
-			if ( !(obj_file = fopen(name,"w") ) ) { /*  open the file for write */
-				fprintf(stderr, "Cannot open file: %s\n", name);
-				return 1;
-			}
-			ob_print(code_seg, data_seg, ic, dc, obj_file);  /* print to OB */
-			printf("INFO: %s was created.\n",name);
-			fclose(obj_file);
-		}
-
-		if ( ent_size > 0 ){  /* if the length of the ENTRY file is > 0 */
-			name = malloc(strlen(argv[i])+4);
-			strcpy(name, argv[i]);
-			name = strcat(name, ".ent");  /* add .ent */
-			if ( !(entry_file = fopen(name,"w")) ) {
-				fprintf(stderr, "Cannot open file: %s\n", name);
-				return 1;
-			}
-			e_print(ent, ent_size, entry_file);  /* print to ENTRY */
-			printf("INFO: %s was created.\n",name);
-			fclose(entry_file);
-		}
-
-        if ( ext_size > 0 ) {  /* if the length of the EXTERN file is >0 */
-			strcpy(name, argv[i]); 
-			name=strcat(name,".ext");  /* add .ext */
-			if ( !(extern_file = fopen(name,"w")) ) {
-				fprintf(stderr, "Cannot open file: %s\n", name);
-				return 0;
-			}
-			e_print(ext, ext_size, extern_file);   /*print to EXTERN*/
-			printf("INFO: %s was created.\n", name);
-			fclose(extern_file);
-		}
-		 /*------------ Free Allocation & Close Files ---------------*/
-		free(code_seg);
-		free(data_seg);
-        free_signs_names(table_signs, table_signs_size);
-		free(table_signs);
-		fclose(fp);
-
-        putchar('\n');
-
-	}
+        }
+    }
+
+    if ( assemble_files(argc - i, argv + i, &totals) ) { /* a fatal error stopped the files */
+        return 1;
+    }
+    if ( totals.outputs_unchanged > 0 ) { /* the per file lines tell it too, but they're easy to miss */
+        printf("INFO: %d output files written, %d unchanged.\n", totals.outputs_written, totals.outputs_unchanged);
+    }
 
     printf("===========\n");
 
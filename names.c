@@ -0,0 +1,171 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "header.h"
+
+/*
+ * A name table maps names to indexes (0, 1, 2 ... in the order the names were inserted), through a hash table.
+ * The names are kept in one text buffer, which could also hold other texts that belong to the names,
+ * so the tables that use it (macros, constants ...) keep their own data in arrays by the same index.
+ */
+
+#define NAME_BUCKETS_MIN 16
+
+/**
+ * Initialize an empty name table.
+ *
+ * @param name_table_t*     table - The table to initialize.
+ */
+void name_table_init(name_table_t *table){
+    table->text = NULL;
+    table->names = table->next = table->buckets = NULL;
+    table->text_size = table->text_capacity = 0;
+    table->size = table->capacity = table->buckets_count = 0;
+}
+
+/**
+ * Drop all the names, but keep the memory.
+ *
+ * @param name_table_t*     table - The table to clear.
+ */
+void name_table_clear(name_table_t *table){
+    int i;
+
+    for ( i = 0; i < table->buckets_count; i++ ) {
+        table->buckets[i] = -1;
+    }
+    table->size = table->text_size = 0;
+}
+
+/**
+ * Free the memory of the name table.
+ *
+ * @param name_table_t*     table - The table to free.
+ */
+void name_table_free(name_table_t *table){
+    free(table->text);
+    free(table->names);
+    free(table->next);
+    free(table->buckets);
+    name_table_init(table);
+}
+
+/**
+ * Find a name in the table.
+ *
+ * @param name_table_t*     table - The table.
+ * @param char*             name - The name to find.
+ *
+ * @return int - The index of the name, -1 if it's not in the table.
+ */
+int name_table_find(name_table_t *table, const char *name){
+    int i;
+
+    if ( table->size == 0 ) {
+        return -1;
+    }
+
+    for ( i = table->buckets[hash_string(name) & (table->buckets_count - 1)]; i != -1; i = table->next[i] ) {
+        if ( strcmp(table->text + table->names[i], name) == 0 ) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * Copy a text to the end of the text buffer of the table.
+ *
+ * @param name_table_t*     table - The table.
+ * @param char*             text - The text to copy.
+ * @param int               length - The length of the text, a '\0' is added after it.
+ *
+ * @return int - The offset of the text in the buffer, -1 on memory error.
+ */
+int name_table_add_text(name_table_t *table, const char *text, int length){
+    int offset = table->text_size;
+
+    if ( !ensure_capacity((void **) &table->text, &table->text_capacity, table->text_size + length + 1, sizeof(char)) ) {
+        return -1;
+    }
+
+    memcpy(table->text + offset, text, (size_t) length);
+    table->text[offset + length] = '\0';
+    table->text_size += length + 1;
+
+    return offset;
+}
+
+/**
+ * Double the number of hash buckets, and spread the names over them again.
+ *
+ * @param name_table_t*     table - The table.
+ *
+ * @return int - 1 if everything went OK, 0 on memory error.
+ */
+static int grow_buckets(name_table_t *table){
+    int count = table->buckets_count ? table->buckets_count * 2 : NAME_BUCKETS_MIN;
+    int *buckets = malloc(count * sizeof(int));
+    int i, bucket;
+
+    if ( !buckets ) {
+        return 0;
+    }
+
+    for ( i = 0; i < count; i++ ) {
+        buckets[i] = -1;
+    }
+    for ( i = 0; i < table->size; i++ ) {
+        bucket = (int) (hash_string(table->text + table->names[i]) & (count - 1));
+        table->next[i] = buckets[bucket];
+        buckets[bucket] = i;
+    }
+
+    free(table->buckets);
+    table->buckets = buckets;
+    table->buckets_count = count;
+
+    return 1;
+}
+
+/**
+ * Insert a name to the table, the caller should check it's not in the table already.
+ *
+ * @param name_table_t*     table - The table.
+ * @param char*             name - The name to insert.
+ *
+ * @return int - The index of the new name, -1 on memory error.
+ */
+int name_table_insert(name_table_t *table, const char *name){
+    int bucket, capacity = table->capacity, offset;
+
+    if ( table->size >= table->buckets_count && !grow_buckets(table) ) { /* keep the chains short */
+        return -1;
+    }
+
+    if ( !ensure_capacity((void **) &table->names, &capacity, table->size + 1, sizeof(int))
+         || !ensure_capacity((void **) &table->next, &table->capacity, table->size + 1, sizeof(int))
+         || (offset = name_table_add_text(table, name, (int) strlen(name))) < 0 ) {
+        return -1;
+    }
+
+    bucket = (int) (hash_string(name) & (table->buckets_count - 1));
+    table->names[table->size] = offset;
+    table->next[table->size] = table->buckets[bucket];
+    table->buckets[bucket] = table->size;
+
+    return table->size++;
+}
+
+/**
+ * Get a name by its index.
+ *
+ * @param name_table_t*     table - The table.
+ * @param int               index - The index of the name.
+ *
+ * @return char* - The name.
+ */
+char *name_table_name(name_table_t *table, int index){
+    return table->text + table->names[index];
+}
@@ -0,0 +1,310 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "header.h"
+
+/*
+ * The peephole optimizer (-O). The first scan records every instruction it counts, with its address and
+ * its operands. At the end of the first scan, before the data labels are placed after the code, the
+ * optimizer removes instructions that have no effect:
+ *
+ *      jmp NEXT            a jump to the next instruction
+ *      mov X, r1           the second mov copies back the value the first one just copied
+ *      mov r1, X
+ *      add #0, X           (and sub #0, X)
+ *      clr X               a clr right after the same clr
+ *      clr X
+ *
+ * The code labels are moved to the new addresses and the IC shrinks. The second scan encodes the
+ * instructions that were left, in the same order, so the addresses it gives them match.
+ */
+
+/**
+ * Initialize an empty instruction list.
+ *
+ * @param instruction_list_t*   list - The list to initialize.
+ */
+void instruction_list_init(instruction_list_t *list){
+    list->items = NULL;
+    list->text = NULL;
+    list->size = list->capacity = 0;
+    list->text_size = list->text_capacity = 0;
+}
+
+/**
+ * Drop all the instructions, but keep the memory.
+ *
+ * @param instruction_list_t*   list - The list to clear.
+ */
+void instruction_list_clear(instruction_list_t *list){
+    list->size = list->text_size = 0;
+}
+
+/**
+ * Free the memory of the instruction list.
+ *
+ * @param instruction_list_t*   list - The list to free.
+ */
+void instruction_list_free(instruction_list_t *list){
+    free(list->items);
+    free(list->text);
+    instruction_list_init(list);
+}
+
+/**
+ * Add an instruction to the end of the list, without operands.
+ *
+ * @param instruction_list_t*   list - The list.
+ * @param int                   address - The address of the instruction (the IC before it).
+ * @param int                   oper - The operation code.
+ * @param int                   has_label - 1 if there is a label on the instruction line.
+ *
+ * @return int - 1 if everything went OK, 0 on memory error.
+ */
+int instruction_add(instruction_list_t *list, int address, int oper, int has_label){
+    instruction_t *item;
+
+    if ( !ensure_capacity((void **) &list->items, &list->capacity, list->size + 1, sizeof(instruction_t)) ) {
+        return 0;
+    }
+
+    item = &list->items[list->size++];
+    item->address = address;
+    item->oper = oper;
+    item->has_label = has_label;
+    item->removed = 0;
+    item->args[FIRST_ARG] = item->args[SECOND_ARG] = -1;
+    item->amethods[FIRST_ARG] = item->amethods[SECOND_ARG] = NO_ARG;
+
+    return 1;
+}
+
+/**
+ * Set an operand of the last instruction in the list.
+ *
+ * @param instruction_list_t*   list - The list.
+ * @param int                   arg_count - FIRST_ARG or SECOND_ARG.
+ * @param char*                 arg - The operand as it was written.
+ * @param int                   amethod - The addressing method of the operand.
+ *
+ * @return int - 1 if everything went OK, 0 on memory error.
+ */
+int instruction_set_operand(instruction_list_t *list, int arg_count, char *arg, int amethod){
+    int length = (int) strlen(arg);
+    instruction_t *item = &list->items[list->size - 1];
+
+    if ( !ensure_capacity((void **) &list->text, &list->text_capacity, list->text_size + length + 1, sizeof(char)) ) {
+        return 0;
+    }
+
+    memcpy(list->text + list->text_size, arg, (size_t) length + 1);
+    item->args[arg_count] = list->text_size;
+    item->amethods[arg_count] = amethod;
+    list->text_size += length + 1;
+
+    return 1;
+}
+
+/**
+ * Get an operand of an instruction.
+ *
+ * @param instruction_list_t*   list - The list.
+ * @param instruction_t*        item - The instruction.
+ * @param int                   arg_count - FIRST_ARG or SECOND_ARG.
+ *
+ * @return char* - The operand, an empty string if the instruction doesn't have it.
+ */
+char *instruction_operand(instruction_list_t *list, instruction_t *item, int arg_count){
+    return item->args[arg_count] == -1 ? "" : list->text + item->args[arg_count];
+}
+
+/**
+ * Get the number of words of an instruction, by the address of the instruction after it.
+ *
+ * @param instruction_list_t*   list - The list.
+ * @param int                   index - The index of the instruction.
+ * @param int                   ic - The IC at the end of the first scan (before any instruction was removed).
+ *
+ * @return int - The number of words.
+ */
+int instruction_size(instruction_list_t *list, int index, int ic){
+    return (index + 1 < list->size ? list->items[index + 1].address : ic) - list->items[index].address;
+}
+
+/**
+ * Get the source and the destination addressing methods of an instruction, as is_address_valid() expects them.
+ *
+ * @param instruction_t*    item - The instruction.
+ * @param int*              src - Will hold the source addressing method (NO_ARG if none).
+ * @param int*              dest - Will hold the destination addressing method (NO_ARG if none).
+ */
+static void operand_methods(instruction_t *item, int *src, int *dest){
+    if ( item->amethods[SECOND_ARG] != NO_ARG ) {
+        *src = item->amethods[FIRST_ARG];
+        *dest = item->amethods[SECOND_ARG];
+    } else {
+        *src = NO_ARG;
+        *dest = item->amethods[FIRST_ARG];
+    }
+}
+
+/**
+ * Check if "item" is a mov that copies back what "previous" (a mov too) just copied:
+ * "mov X, r1" followed by "mov r1, X", or "mov r1, X" followed by "mov X, r1".
+ *
+ * @param instruction_list_t*   list - The list.
+ * @param instruction_t*        previous - The previous instruction.
+ * @param instruction_t*        item - The instruction to check.
+ *
+ * @return int - 1 if "item" has no effect, 0 otherwise.
+ */
+static int is_reverse_mov(instruction_list_t *list, instruction_t *previous, instruction_t *item){
+    int i;
+
+    if ( previous->oper != MOV || item->oper != MOV ) {
+        return 0;
+    }
+
+    /* a matrix access that uses the register would point to another cell after the first mov */
+    for ( i = FIRST_ARG; i <= SECOND_ARG; i++ ) {
+        if ( previous->amethods[i] != DIRECT && previous->amethods[i] != DIRECT_REGISTER ) {
+            return 0;
+        }
+    }
+
+    return strcmp(instruction_operand(list, previous, FIRST_ARG), instruction_operand(list, item, SECOND_ARG)) == 0
+           && strcmp(instruction_operand(list, previous, SECOND_ARG), instruction_operand(list, item, FIRST_ARG)) == 0;
+}
+
+/**
+ * Check if an instruction has no effect by itself, wherever it's reached from.
+ *
+ * @param assembler_t*      as - The assembler context.
+ * @param instruction_t*    item - The instruction.
+ * @param int               size - The number of words of the instruction.
+ *
+ * @return int - 1 if the instruction could be removed, 0 otherwise.
+ */
+static int has_no_effect(assembler_t *as, instruction_t *item, int size){
+    instruction_list_t *list = &as->instructions;
+    int value, i;
+
+    if ( (item->oper == ADD || item->oper == SUB) && item->amethods[FIRST_ARG] == IMMEDIATE ) { /* add #0, X */
+        return eval_expression(&as->constants, instruction_operand(list, item, FIRST_ARG) + 1, &value, NULL) == EXPR_OK && value == 0;
+    }
+
+    if ( item->oper == JMP && item->amethods[FIRST_ARG] == DIRECT && item->amethods[SECOND_ARG] == NO_ARG ) { /* jmp NEXT */
+        for ( i = 0; i < as->table_signs_size; i++ ) {
+            if ( strcmp(as->table_signs[i].label_name, instruction_operand(list, item, FIRST_ARG)) == 0 ) {
+                return as->table_signs[i].operation == 1 && as->table_signs[i].address == item->address + size;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Find the instruction at an address, by a binary search (the instructions are sorted by their addresses).
+ *
+ * @param instruction_list_t*   list - The list.
+ * @param int                   address - The address.
+ *
+ * @return int - The index of the instruction, -1 if there is no instruction at this address.
+ */
+int instruction_find(instruction_list_t *list, int address){
+    int low = 0, high = list->size - 1, middle;
+
+    while ( low <= high ) {
+        middle = (low + high) / 2;
+        if ( list->items[middle].address == address ) {
+            return middle;
+        }
+        if ( list->items[middle].address < address ) {
+            low = middle + 1;
+        } else {
+            high = middle - 1;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * Run the peephole optimizer over the instructions of the first scan, and mark the instructions that
+ * have no effect as removed. Instructions with an invalid addressing method are left as they are,
+ * so the second scan reports them.
+ *
+ * @param assembler_t*  as - The assembler context.
+ */
+void peephole_optimize(assembler_t *as){
+    instruction_list_t *list = &as->instructions;
+    instruction_t *item, *previous = NULL;
+    int i, src, dest, label_between = 0;
+
+    for ( i = 0; i < list->size; i++ ) {
+        item = &list->items[i];
+        if ( item->removed ) { /* already removed as unreachable, the next reachable instruction has a label */
+            continue;
+        }
+        operand_methods(item, &src, &dest);
+
+        if ( is_address_valid(item->oper, src, dest) ) {
+            if ( has_no_effect(as, item, instruction_size(list, i, as->ic)) ) {
+                item->removed = 1;
+            } else if ( previous && !item->has_label && !label_between ) { /* nothing could jump between the two */
+                item->removed = is_reverse_mov(list, previous, item)
+                                || (item->oper == CLR && previous->oper == CLR
+                                    && strcmp(instruction_operand(list, previous, FIRST_ARG), instruction_operand(list, item, FIRST_ARG)) == 0);
+            }
+        }
+
+        if ( item->removed ) {
+            label_between |= item->has_label;
+        } else {
+            previous = item;
+            label_between = 0;
+        }
+    }
+}
+
+/**
+ * Drop the instructions that were marked as removed: move the code labels to their new addresses and update the IC.
+ * A label of a removed instruction moves to the instruction after it.
+ *
+ * @param assembler_t*  as - The assembler context.
+ *
+ * @return int - The number of words that were removed, -1 on memory error.
+ */
+int remove_instructions(assembler_t *as){
+    instruction_list_t *list = &as->instructions;
+    int i, removed_words = 0, index;
+    int *new_address;
+
+    if ( list->size == 0 ) {
+        return 0;
+    }
+    if ( !(new_address = malloc(list->size * sizeof(int))) ) {
+        return -1;
+    }
+
+    for ( i = 0; i < list->size; i++ ) {
+        new_address[i] = list->items[i].address - removed_words;
+        if ( list->items[i].removed ) {
+            removed_words += instruction_size(list, i, as->ic);
+        }
+    }
+
+    for ( i = 0; i < as->table_signs_size; i++ ) {
+        if ( as->table_signs[i].operation == 1 && !as->table_signs[i].external ) {
+            if ( (index = instruction_find(list, as->table_signs[i].address)) != -1 ) {
+                as->table_signs[i].address = new_address[index];
+            }
+        }
+    }
+
+    as->ic -= removed_words;
+    free(new_address);
+
+    return removed_words;
+}
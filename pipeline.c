@@ -0,0 +1,442 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "header.h"
+
+/*
+ * The driver of the files on the command line, as a pipeline of three stages that run at the same time:
+ *
+ *      reader      a thread that reads the next sources to memory, up to PREFETCH_FILES files ahead
+ *      assembler   the main thread, it assembles a source from memory, prints its diagnostics and "writes" its
+ *                  outputs to memory buffers (open_output() and close_output() hand them to the writer)
+ *      writer      a thread that writes the buffers to the output files, under their temporary names, and
+ *                  renames them, up to OUTPUT_QUEUE buffers behind the assembler. A buffer that is the same as
+ *                  the file that has its name already isn't queued at all, the assembler compares them itself
+ *                  (see pipeline_close_output()), so it can tell which of the files were left as they were
+ *
+ * So the disk is read and written while the CPU assembles, even on one core. The main thread prints everything
+ * it did before, in the same order, so the output is the same as when the files are done one by one. A file
+ * that can't be written stops the files after it (the error is printed by the writer, a little later than
+ * it would be otherwise).
+ *
+ * With --mem-limit the outputs are written by the main thread, a buffer of a whole output file would break
+ * the budget.
+ *
+ * The files could also come from a manifest (--manifest FILE), a file name on every line, so there's no limit
+ * on their number. One assembler context assembles all of them, its tables keep the capacities they grew to
+ * (see clear_tables()), so once they're big enough for the biggest source nothing is allocated for them.
+ */
+
+#define PREFETCH_FILES 4 /* the sources that are read ahead of the one that is assembled */
+#define OUTPUT_QUEUE 8 /* the output files that could wait for the writer */
+
+/* an output file that waits for the writer */
+typedef struct{
+    char *name; /* the name of the file, allocated */
+    char *buffer; /* the contents, from open_memstream() */
+    size_t size;
+} output_t;
+
+/* the state of the pipeline, everything is guarded by the lock */
+typedef struct{
+    char **base_names;
+    int count;
+    char **sources; /* the contents of every source that was read and not assembled yet, NULL if it can't be read */
+    long *lengths;
+    int read; /* the number of sources the reader is done with */
+    int taken; /* the number of sources the assembler took */
+    FILE *open_file; /* the output file the assembler writes, to a buffer */
+    char *open_buffer;
+    size_t open_size;
+    output_t queue[OUTPUT_QUEUE]; /* a ring of the output files that wait for the writer */
+    int queue_start;
+    int queue_size;
+    int failed; /* 1 once an output file couldn't be written, the files after it aren't assembled */
+    int done; /* 1 when there are no more files */
+    pthread_mutex_t lock;
+    pthread_cond_t changed; /* signaled whenever one of the stages changed the state */
+} pipeline_t;
+
+static pipeline_t *active = NULL; /* the pipeline of the main thread, NULL when the outputs are written directly */
+
+/**
+ * Read a source of the pipeline to memory.
+ *
+ * @param pipeline_t*   pipeline - The pipeline.
+ * @param int           file - The file.
+ */
+static void read_source_file(pipeline_t *pipeline, int file){
+    char *name, *source = NULL;
+    long length = 0;
+
+    if ( (name = malloc(strlen(pipeline->base_names[file]) + 4)) ) {
+        sprintf(name, "%s.as", pipeline->base_names[file]);
+        source = read_whole_file(name, &length);
+        free(name);
+    }
+
+    pthread_mutex_lock(&pipeline->lock);
+    pipeline->sources[file] = source;
+    pipeline->lengths[file] = length;
+    pipeline->read = file + 1;
+    pthread_cond_broadcast(&pipeline->changed);
+    pthread_mutex_unlock(&pipeline->lock);
+}
+
+/**
+ * The reader stage: read the sources to memory, in order, without getting too far ahead.
+ *
+ * @param void*     arg - The pipeline.
+ *
+ * @return void* - NULL.
+ */
+static void *reader_stage(void *arg){
+    pipeline_t *pipeline = arg;
+    int i, stop;
+
+    for ( i = 0; i < pipeline->count; i++ ) {
+        pthread_mutex_lock(&pipeline->lock);
+        while ( i - pipeline->taken >= PREFETCH_FILES && !pipeline->done ) {
+            pthread_cond_wait(&pipeline->changed, &pipeline->lock);
+        }
+        stop = pipeline->done;
+        pthread_mutex_unlock(&pipeline->lock);
+        if ( stop ) {
+            break;
+        }
+        read_source_file(pipeline, i);
+    }
+
+    return NULL;
+}
+
+/**
+ * Write an output file under its temporary name, and give it its name.
+ *
+ * @param output_t*     output - The file.
+ *
+ * @return int - 1 if everything went OK, 0 otherwise (an error is printed).
+ */
+static int write_output_file(output_t *output){
+    char *temp_name;
+    FILE *fp;
+    int ok;
+
+    if ( !(temp_name = malloc(strlen(output->name) + 5)) ) {
+        fprintf(stderr, "Cannot allocate memory.\n");
+        return 0;
+    }
+    sprintf(temp_name, "%s.tmp", output->name);
+
+    if ( !(fp = fopen(temp_name, "w")) ) {
+        fprintf(stderr, "Cannot open file: %s\n", temp_name);
+        free(temp_name);
+        return 0;
+    }
+    ok = fwrite(output->buffer, 1, output->size, fp) == output->size;
+    ok = fclose(fp) == 0 && ok;
+    if ( !ok || rename(temp_name, output->name) != 0 ) {
+        fprintf(stderr, "Cannot write file: %s\n", output->name);
+        remove(temp_name);
+        ok = 0;
+    }
+    free(temp_name);
+
+    return ok;
+}
+
+/**
+ * The writer stage: write the output files the assembler queued, in order.
+ *
+ * @param void*     arg - The pipeline.
+ *
+ * @return void* - NULL.
+ */
+static void *writer_stage(void *arg){
+    pipeline_t *pipeline = arg;
+    output_t output;
+    int ok;
+
+    pthread_mutex_lock(&pipeline->lock);
+    for ( ; ; ) {
+        while ( pipeline->queue_size == 0 && !pipeline->done ) {
+            pthread_cond_wait(&pipeline->changed, &pipeline->lock);
+        }
+        if ( pipeline->queue_size == 0 ) {
+            break;
+        }
+        output = pipeline->queue[pipeline->queue_start];
+        pthread_mutex_unlock(&pipeline->lock);
+
+        ok = write_output_file(&output);
+
+        pthread_mutex_lock(&pipeline->lock);
+        pipeline->failed |= !ok;
+        pipeline->queue_start = (pipeline->queue_start + 1) % OUTPUT_QUEUE;
+        pipeline->queue_size--;
+        pthread_cond_broadcast(&pipeline->changed);
+        free(output.name); /* it's in the queue until here, the assembler looks it up (see pipeline_close_output()) */
+        free(output.buffer);
+    }
+    pthread_mutex_unlock(&pipeline->lock);
+
+    return NULL;
+}
+
+/**
+ * Open an output file of the pipeline, it's written to a memory buffer. Called by open_output().
+ *
+ * @return FILE* - The buffer, NULL if the file should be opened as usual (no pipeline, or a file of the
+ *                 pipeline is open already).
+ */
+FILE *pipeline_open_output(void){
+    if ( !active || active->open_file ) {
+        return NULL;
+    }
+    active->open_buffer = NULL;
+    active->open_size = 0;
+
+    return active->open_file = open_memstream(&active->open_buffer, &active->open_size);
+}
+
+/**
+ * Close an output file of the pipeline, and queue it for the writer, unless the file that has its name holds the
+ * same contents already (then it's left as it is). Called by close_output().
+ *
+ * @param FILE*     fp - The file.
+ * @param char*     name - The name of the file.
+ * @param int       complete - 1 if the file was fully written, 0 to throw it away.
+ * @param int*      ok - Will hold 1 at the end if the file was queued (or left as it was), 0 otherwise.
+ * @param int*      unchanged - Will hold 1 at the end if the file was left as it was, 0 otherwise.
+ *
+ * @return int - 1 if the file is a file of the pipeline, 0 if it should be closed as usual.
+ */
+int pipeline_close_output(FILE *fp, char *name, int complete, int *ok, int *unchanged){
+    output_t *output;
+    int i, pending = 0;
+
+    if ( !active || active->open_file != fp ) {
+        return 0;
+    }
+    active->open_file = NULL;
+    *ok = fclose(fp) == 0 && complete;
+    *unchanged = 0;
+
+    /* a file that waits for the writer doesn't hold its new contents yet, so it can't be compared */
+    pthread_mutex_lock(&active->lock);
+    for ( i = 0; *ok && i < active->queue_size; i++ ) {
+        pending |= strcmp(active->queue[(active->queue_start + i) % OUTPUT_QUEUE].name, name) == 0;
+    }
+    pthread_mutex_unlock(&active->lock);
+    if ( *ok && !pending ) {
+        *unchanged = file_has_contents(name, active->open_buffer, (long) active->open_size);
+    }
+
+    pthread_mutex_lock(&active->lock);
+    while ( *ok && !*unchanged && active->queue_size == OUTPUT_QUEUE ) {
+        pthread_cond_wait(&active->changed, &active->lock);
+    }
+    if ( *ok && !*unchanged && (*ok = !active->failed) ) {
+        output = &active->queue[(active->queue_start + active->queue_size) % OUTPUT_QUEUE];
+        if ( (output->name = malloc(strlen(name) + 1)) ) {
+            strcpy(output->name, name);
+            output->buffer = active->open_buffer;
+            output->size = active->open_size;
+            active->open_buffer = NULL;
+            active->queue_size++;
+            pthread_cond_broadcast(&active->changed);
+        } else {
+            fprintf(stderr, "Cannot allocate memory.\n");
+            *ok = 0;
+        }
+    }
+    pthread_mutex_unlock(&active->lock);
+    free(active->open_buffer);
+    active->open_buffer = NULL;
+
+    return 1;
+}
+
+/**
+ * Assemble the files, and write the outputs of every one of them, on the pipeline.
+ *
+ * @param int               count - The number of files.
+ * @param char**            base_names - The file names without the .as extension.
+ * @param batch_totals_t*   totals - Will hold the totals of the files at the end, could be NULL.
+ *
+ * @return int - 0 if everything went OK (files with errors or files that couldn't be opened included), 1 if
+ *               the files were stopped by a fatal error (memory / output files).
+ */
+int assemble_files(int count, char *base_names[], batch_totals_t *totals){
+    pipeline_t pipeline;
+    pthread_t reader, writer;
+    assembler_t as;
+    output_counts_t before = output_counts;
+    batch_totals_t ignored;
+    char *source_name;
+    int i, status = 0, has_reader, has_writer, failed;
+
+    if ( !totals ) {
+        totals = &ignored;
+    }
+    memset(totals, 0, sizeof(batch_totals_t));
+    memset(&pipeline, 0, sizeof(pipeline_t));
+    pipeline.base_names = base_names;
+    pipeline.count = count;
+    pipeline.sources = calloc((size_t) count + 1, sizeof(char *));
+    pipeline.lengths = calloc((size_t) count + 1, sizeof(long));
+    if ( !pipeline.sources || !pipeline.lengths ) {
+        fprintf(stderr, "Cannot allocate memory.\n");
+        free(pipeline.sources);
+        free(pipeline.lengths);
+        return 1;
+    }
+    pthread_mutex_init(&pipeline.lock, NULL);
+    pthread_cond_init(&pipeline.changed, NULL);
+    assembler_init(&as);
+    as.settings = settings;
+
+    /* a stage that can't be started is done by the main thread */
+    has_reader = pthread_create(&reader, NULL, reader_stage, &pipeline) == 0;
+    has_writer = !as.settings.mem_limit && pthread_create(&writer, NULL, writer_stage, &pipeline) == 0;
+    active = has_writer ? &pipeline : NULL;
+
+    for ( i = 0; i < count && status != 2; i++ ) {
+        if ( !has_reader ) {
+            read_source_file(&pipeline, i);
+        }
+        pthread_mutex_lock(&pipeline.lock);
+        while ( pipeline.read <= i ) {
+            pthread_cond_wait(&pipeline.changed, &pipeline.lock);
+        }
+        pipeline.taken = i + 1;
+        pthread_cond_broadcast(&pipeline.changed);
+        failed = pipeline.failed;
+        pthread_mutex_unlock(&pipeline.lock);
+        if ( failed ) {
+            status = 2;
+            break;
+        }
+
+        totals->files++;
+        if ( !pipeline.sources[i] ) {
+            fprintf(stderr, "Cannot open file: %s.as\n", base_names[i]);
+            totals->not_opened++;
+            continue;
+        }
+        if ( !(source_name = malloc(strlen(base_names[i]) + 4)) ) {
+            fprintf(stderr, "Cannot allocate memory.\n");
+            status = 2;
+            break;
+        }
+        sprintf(source_name, "%s.as", base_names[i]);
+
+        /* the same as assemble(), from memory and with the context of the last file */
+        as.settings = settings;
+        status = assemble_buffer(&as, pipeline.sources[i], (size_t) pipeline.lengths[i]);
+        free(pipeline.sources[i]);
+        pipeline.sources[i] = NULL;
+        diag_flush(&as.diag, source_name, as.settings.diag_format, stderr);
+        if ( status == 0 ) {
+            totals->assembled++;
+            totals->code_words += as.ic;
+            totals->data_words += as.dc;
+            status = write_outputs(&as, base_names[i]);
+        } else {
+            totals->with_errors++;
+        }
+        if ( status != 2 ) {
+            putchar('\n');
+        }
+        free(source_name);
+    }
+
+    /* stop the stages, the writer writes the files that wait first */
+    active = NULL;
+    pthread_mutex_lock(&pipeline.lock);
+    pipeline.done = 1;
+    pthread_cond_broadcast(&pipeline.changed);
+    pthread_mutex_unlock(&pipeline.lock);
+    if ( has_writer ) {
+        pthread_join(writer, NULL);
+    }
+    if ( has_reader ) {
+        pthread_join(reader, NULL);
+    }
+
+    for ( i = 0; i < count; i++ ) {
+        free(pipeline.sources[i]);
+    }
+    assembler_free(&as);
+    pthread_cond_destroy(&pipeline.changed);
+    pthread_mutex_destroy(&pipeline.lock);
+    free(pipeline.sources);
+    free(pipeline.lengths);
+
+    totals->outputs_written = output_counts.written - before.written;
+    totals->outputs_unchanged = output_counts.unchanged - before.unchanged;
+
+    return status == 2 || pipeline.failed;
+}
+
+/**
+ * Assemble the files listed in a manifest (--manifest FILE), on the pipeline, and print the totals. Every line
+ * of the manifest is a file name, with or without the .as extension. Empty lines and lines that start with ';'
+ * are skipped.
+ *
+ * @param char*     manifest_name - The name of the manifest.
+ *
+ * @return int - 0 if everything went OK (files with errors included), 1 otherwise.
+ */
+int assemble_manifest(char *manifest_name){
+    struct timespec start, end;
+    batch_totals_t totals;
+    char *contents, *line, *next, **names = NULL;
+    int count = 0, capacity = 0, status;
+    long length;
+    size_t size;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if ( !(contents = read_whole_file(manifest_name, &length)) ) {
+        fprintf(stderr, "Cannot open file: %s\n", manifest_name);
+        return 1;
+    }
+
+    /* the names point into the contents, every line is cut at its end */
+    for ( line = contents; *line; line = next ) {
+        next = line + strcspn(line, "\n");
+        if ( *next ) {
+            *next++ = '\0';
+        }
+        for ( size = strlen(line); size > 0 && (line[size - 1] == '\r' || line[size - 1] == ' ' || line[size - 1] == '\t'); size-- );
+        line[size] = '\0';
+        if ( size > 3 && strcmp(line + size - 3, ".as") == 0 ) {
+            line[size - 3] = '\0';
+        }
+        if ( *line == '\0' || *line == ';' ) {
+            continue;
+        }
+        if ( !ensure_capacity((void **) &names, &capacity, count + 1, sizeof(char *)) ) {
+            fprintf(stderr, "Cannot allocate memory.\n");
+            free(names);
+            free(contents);
+            return 1;
+        }
+        names[count++] = line;
+    }
+
+    status = assemble_files(count, names, &totals);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("INFO: %d files: %d assembled, %d with errors, %d couldn't be opened, %ld code words and %ld data words, "
+           "%d output files written and %d unchanged in %.2f ms.\n",
+           totals.files, totals.assembled, totals.with_errors, totals.not_opened, totals.code_words, totals.data_words,
+           totals.outputs_written, totals.outputs_unchanged, (end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_nsec - start.tv_nsec) / 1000000.0);
+
+    free(names);
+    free(contents);
+
+    return status;
+}
@@ -0,0 +1,82 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "header.h"
+
+/*
+ * The string pool (--pool-strings). Every string that is written to the data segment is added to the pool
+ * with all its suffixes, each with its address: "hello" adds "hello", "ello", "llo", "lo", "o" and "" (the
+ * terminator alone). A labeled .string whose body is already in the pool doesn't write anything, its label
+ * points at the shared words instead. The pool is hashed by the contents of the strings.
+ */
+
+/**
+ * Initialize an empty string pool.
+ *
+ * @param string_pool_t*    pool - The pool to initialize.
+ */
+void string_pool_init(string_pool_t *pool){
+    name_table_init(&pool->strings);
+    pool->addresses = NULL;
+    pool->capacity = 0;
+}
+
+/**
+ * Drop all the strings, but keep the memory.
+ *
+ * @param string_pool_t*    pool - The pool to clear.
+ */
+void string_pool_clear(string_pool_t *pool){
+    name_table_clear(&pool->strings);
+}
+
+/**
+ * Free the memory of the string pool.
+ *
+ * @param string_pool_t*    pool - The pool to free.
+ */
+void string_pool_free(string_pool_t *pool){
+    name_table_free(&pool->strings);
+    free(pool->addresses);
+    string_pool_init(pool);
+}
+
+/**
+ * Find a string in the pool.
+ *
+ * @param string_pool_t*    pool - The pool.
+ * @param char*             str - The string.
+ *
+ * @return int - The data address of the string, -1 if it's not in the pool.
+ */
+int string_pool_find(string_pool_t *pool, char *str){
+    int index = name_table_find(&pool->strings, str);
+
+    return index == -1 ? -1 : pool->addresses[index];
+}
+
+/**
+ * Add a string that was written to the data segment, and all its suffixes, to the pool.
+ *
+ * @param string_pool_t*    pool - The pool.
+ * @param char*             str - The string.
+ * @param int               address - The data address of the string.
+ *
+ * @return int - 1 if everything went OK, 0 on memory error.
+ */
+int string_pool_add(string_pool_t *pool, char *str, int address){
+    int i, index, length = (int) strlen(str);
+
+    for ( i = 0; i <= length; i++ ) {
+        if ( name_table_find(&pool->strings, str + i) != -1 ) { /* the rest of the suffixes are in the pool too */
+            break;
+        }
+        if ( !ensure_capacity((void **) &pool->addresses, &pool->capacity, pool->strings.size + 1, sizeof(int))
+             || (index = name_table_insert(&pool->strings, str + i)) < 0 ) {
+            return 0;
+        }
+        pool->addresses[index] = address + i;
+    }
+
+    return 1;
+}
@@ -0,0 +1,405 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "header.h"
+
+/*
+ * The profiler of the simulator (--profile). While the program runs, every instruction adds 1 to the
+ * counter of its address, of its operation and of the routine that runs it, and every bne to its taken
+ * or not taken counter. The routines are found by the calls: jsr enters the routine at its target, under
+ * the routine that called it, and rts goes back to the caller. So every path of calls has its own counter
+ * (a node of the call tree), which is what a flame graph needs.
+ *
+ * At the end two files are written:
+ *
+ *      NAME.prof       the flat profile: by routine, by address, by operation, and the bne branches
+ *      NAME.folded     the folded stacks, a line "start;ROUTINE;ROUTINE COUNT" for every path of calls
+ *
+ * The addresses are named by the labels of NAME.dbg (-g), or by the labels of NAME.ent if there is no debug
+ * information. A routine without a label is named by its address (i.e L112), and the program starts in "start"
+ * if its first instruction has no label. An address is shown by the routine or label before it and the offset
+ * from it, i.e "LOOP+3", and by its source line when NAME.dbg has it.
+ */
+
+/* the names of the addresses */
+typedef struct{
+    name_table_t names;
+    int name_of[MEMORY_SIZE]; /* the index of the name of each address, -1 for none */
+} profile_names_t;
+
+/**
+ * Initialize the counters of the profiler.
+ *
+ * @param profile_t*    profile - The profile.
+ * @param int           start - The address the program starts at.
+ *
+ * @return int - 1 if everything went OK, 0 on memory error.
+ */
+int profile_init(profile_t *profile, int start){
+    memset(profile, 0, sizeof(profile_t));
+    profile->nodes = NULL;
+
+    if ( !ensure_capacity((void **) &profile->nodes, &profile->nodes_capacity, 1, sizeof(call_node_t)) ) {
+        return 0;
+    }
+    profile->nodes[0].parent = profile->nodes[0].first_child = profile->nodes[0].next_sibling = -1;
+    profile->nodes[0].routine = start;
+    profile->nodes[0].count = 0;
+    profile->nodes_size = 1;
+    profile->current = 0;
+
+    return 1;
+}
+
+/**
+ * Free the memory of the profiler.
+ *
+ * @param profile_t*    profile - The profile.
+ */
+void profile_free(profile_t *profile){
+    free(profile->nodes);
+    profile->nodes = NULL;
+    profile->nodes_size = profile->nodes_capacity = 0;
+}
+
+/**
+ * Enter a routine from the current one: go to its node in the call tree, add the node if it's the first call by this path.
+ *
+ * @param profile_t*    profile - The profile.
+ * @param int           routine - The address of the routine.
+ */
+static void enter_routine(profile_t *profile, int routine){
+    call_node_t *node;
+    int child;
+
+    for ( child = profile->nodes[profile->current].first_child; child != -1; child = profile->nodes[child].next_sibling ) {
+        if ( profile->nodes[child].routine == routine ) {
+            profile->current = child;
+            return;
+        }
+    }
+
+    if ( !ensure_capacity((void **) &profile->nodes, &profile->nodes_capacity, profile->nodes_size + 1, sizeof(call_node_t)) ) {
+        return; /* out of memory, the calls are counted for the caller */
+    }
+    child = profile->nodes_size++;
+    node = &profile->nodes[child];
+    node->parent = profile->current;
+    node->routine = routine;
+    node->first_child = -1;
+    node->next_sibling = profile->nodes[profile->current].first_child;
+    node->count = 0;
+    profile->nodes[profile->current].first_child = child;
+    profile->current = child;
+}
+
+/**
+ * Count an instruction that was run.
+ *
+ * @param profile_t*    profile - The profile.
+ * @param micro_op_t*   op - The instruction.
+ * @param int           pc - The address it jumped to, -1 if it didn't jump.
+ */
+void profile_count(profile_t *profile, micro_op_t *op, int pc){
+    profile->hits[op->address]++;
+    profile->opcodes[op->oper]++;
+    profile->nodes[profile->current].count++;
+
+    switch ( op->oper ) {
+        case BNE:
+            if ( pc >= 0 ) {
+                profile->taken[op->address]++;
+            } else {
+                profile->not_taken[op->address]++;
+            }
+            break;
+        case JSR:
+            enter_routine(profile, pc);
+            break;
+        case RTS:
+            if ( profile->nodes[profile->current].parent != -1 ) {
+                profile->current = profile->nodes[profile->current].parent;
+            }
+            break;
+    }
+}
+
+/**
+ * Give a name to an address, unless it has one.
+ *
+ * @param profile_names_t*  names - The names.
+ * @param int               address - The address.
+ * @param char*             name - The name.
+ *
+ * @return int - 1 if everything went OK, 0 on memory error.
+ */
+static int name_address(profile_names_t *names, int address, char *name){
+    int index;
+
+    if ( address < 0 || address >= MEMORY_SIZE || names->name_of[address] != -1 ) {
+        return 1;
+    }
+    if ( (index = name_table_find(&names->names, name)) == -1 && (index = name_table_insert(&names->names, name)) < 0 ) {
+        return 0;
+    }
+    names->name_of[address] = index;
+
+    return 1;
+}
+
+/**
+ * Name the addresses: the code labels of the debug information (or the labels of NAME.ent), the start of the
+ * program and the routines.
+ *
+ * @param profile_t*        profile - The profile.
+ * @param profile_names_t*  names - The names, initialized.
+ * @param char*             base_name - The file name without extension.
+ * @param debug_map_t*      map - The debug information, NULL if there is none.
+ * @param int               moved - The distance the program was moved from where it was assembled (--base=N).
+ *
+ * @return int - 1 if everything went OK, 0 on memory error.
+ */
+static int read_names(profile_t *profile, profile_names_t *names, char *base_name, debug_map_t *map, int moved){
+    char *file_name, *contents = NULL, *line, *end, name[LINE_MAX];
+    long length;
+    int i, address, kind, ok = 1;
+
+    if ( map ) {
+        for ( i = 0; ok && i < map->symbols; i++ ) {
+            strncpy(name, debug_symbol(map, i, &address, &kind), LINE_MAX - 1);
+            name[LINE_MAX - 1] = '\0';
+            if ( kind == SYMBOL_CODE ) {
+                ok = name_address(names, address + moved, name);
+            }
+        }
+    } else {
+        if ( !(file_name = malloc(strlen(base_name) + 5)) ) {
+            return 0;
+        }
+        sprintf(file_name, "%s.ent", base_name);
+        contents = read_whole_file(file_name, &length);
+        free(file_name);
+    }
+
+    for ( line = contents; ok && line && *line; line = *end ? end + 1 : end ) {
+        end = line + strcspn(line, "\n");
+        if ( end - line < LINE_MAX && read_symbol_line(line, name, &address) ) {
+            ok = name_address(names, address + moved, name);
+        }
+    }
+    free(contents);
+
+    ok = ok && name_address(names, profile->nodes[0].routine, "start");
+    for ( i = 1; ok && i < profile->nodes_size; i++ ) {
+        sprintf(name, "L%d", profile->nodes[i].routine);
+        ok = name_address(names, profile->nodes[i].routine, name);
+    }
+
+    return ok;
+}
+
+/**
+ * Format an address as the name before it and the offset from it.
+ *
+ * @param profile_names_t*  names - The names.
+ * @param int               address - The address.
+ * @param char*             out - Will hold the location at the end.
+ */
+static void format_location(profile_names_t *names, int address, char *out){
+    int named = address;
+
+    while ( named >= 0 && names->name_of[named] == -1 ) {
+        named--;
+    }
+    if ( named < 0 ) {
+        sprintf(out, "%d", address);
+    } else if ( named == address ) {
+        strcpy(out, name_table_name(&names->names, names->name_of[named]));
+    } else {
+        sprintf(out, "%s+%d", name_table_name(&names->names, names->name_of[named]), address - named);
+    }
+}
+
+/**
+ * Get a percent of the instructions that were run.
+ */
+static double percent(long count, long total){
+    return total ? 100.0 * count / total : 0.0;
+}
+
+/**
+ * Find the addresses that have a count, the highest count first.
+ *
+ * @param long*     counts - The count of each address.
+ * @param int*      order - Will hold the addresses at the end, MEMORY_SIZE items.
+ *
+ * @return int - The number of addresses.
+ */
+static int sort_by_count(const long *counts, int *order){
+    int i, j, size = 0, top, swap;
+
+    for ( i = 0; i < MEMORY_SIZE; i++ ) {
+        if ( counts[i] ) {
+            order[size++] = i;
+        }
+    }
+    for ( i = 0; i < size; i++ ) { /* a selection sort, there are MEMORY_SIZE addresses at most */
+        for ( top = i, j = i + 1; j < size; j++ ) {
+            if ( counts[order[j]] > counts[order[top]] ) {
+                top = j;
+            }
+        }
+        swap = order[i];
+        order[i] = order[top];
+        order[top] = swap;
+    }
+
+    return size;
+}
+
+/**
+ * Write the flat profile.
+ *
+ * @param profile_t*        profile - The profile.
+ * @param image_t*          image - The program.
+ * @param profile_names_t*  names - The names.
+ * @param debug_map_t*      map - The debug information, NULL if there is none.
+ * @param FILE*             out - Where to write to.
+ */
+static void write_flat(profile_t *profile, image_t *image, profile_names_t *names, debug_map_t *map, FILE *out){
+    static const char *mnemonic_of[OPERATION_CODES]; /* NULL for an invalid code */
+    long total = 0, by_routine[MEMORY_SIZE];
+    char location[LINE_MAX * 2], source[LINE_MAX * 2];
+    const char *file;
+    int i, index, order[MEMORY_SIZE], size, line;
+
+    for ( i = 0; i < NUM_OF_OPERATIONS; i++ ) {
+        mnemonic_of[valid_operations[i].oper_num] = valid_operations[i].oper_name;
+        total += profile->opcodes[i];
+    }
+
+    fprintf(out, "Flat profile, %ld instructions\n", total);
+
+    /* by routine, the instructions of the routine itself (not of the routines it calls) */
+    memset(by_routine, 0, sizeof(by_routine));
+    for ( i = 0; i < profile->nodes_size; i++ ) {
+        by_routine[profile->nodes[i].routine] += profile->nodes[i].count;
+    }
+    fprintf(out, "\nBy routine:\n%12s %8s  %s\n", "count", "percent", "routine");
+    size = sort_by_count(by_routine, order);
+    for ( i = 0; i < size; i++ ) {
+        format_location(names, order[i], location);
+        fprintf(out, "%12ld %7.2f%%  %s\n", by_routine[order[i]], percent(by_routine[order[i]], total), location);
+    }
+
+    /* by address */
+    fprintf(out, "\nBy address:\n%12s %8s %8s  %-20s %-9s %s\n", "count", "percent", "address", "location", "operation", "source");
+    size = sort_by_count(profile->hits, order);
+    for ( i = 0; i < size; i++ ) {
+        format_location(names, order[i], location);
+        index = order[i] - image->base; /* the operation as it was loaded, self modifying code could have changed it */
+        if ( map && index >= 0 && index < image->code_size && debug_find_line(map, order[i] - image->base + map->base, &file, &line) ) {
+            sprintf(source, "%.*s:%d", LINE_MAX - 1, file, line);
+        } else {
+            strcpy(source, "-");
+        }
+        fprintf(out, "%12ld %7.2f%% %8d  %-20s %-9s %s\n", profile->hits[order[i]], percent(profile->hits[order[i]], total), order[i],
+                location, index >= 0 && index < image->code_size && mnemonic_of[image->words[index] >> 6] ? mnemonic_of[image->words[index] >> 6] : "?", source);
+    }
+
+    /* by operation */
+    fprintf(out, "\nBy operation:\n%12s %8s  %s\n", "count", "percent", "operation");
+    for ( i = 0; i < NUM_OF_OPERATIONS; i++ ) {
+        if ( profile->opcodes[i] ) {
+            fprintf(out, "%12ld %7.2f%%  %s\n", profile->opcodes[i], percent(profile->opcodes[i], total), mnemonic_of[i]);
+        }
+    }
+
+    /* the branches */
+    fprintf(out, "\nBranches (bne):\n%8s  %-20s %12s %12s\n", "address", "location", "taken", "not taken");
+    for ( i = 0; i < MEMORY_SIZE; i++ ) {
+        if ( profile->taken[i] || profile->not_taken[i] ) {
+            format_location(names, i, location);
+            fprintf(out, "%8d  %-20s %12ld %12ld\n", i, location, profile->taken[i], profile->not_taken[i]);
+        }
+    }
+}
+
+/**
+ * Write the path of calls to a node of the call tree, the root first.
+ */
+static void write_stack(profile_t *profile, profile_names_t *names, int node, FILE *out){
+    char location[LINE_MAX * 2];
+
+    if ( profile->nodes[node].parent != -1 ) {
+        write_stack(profile, names, profile->nodes[node].parent, out);
+        fputc(';', out);
+    }
+    format_location(names, profile->nodes[node].routine, location);
+    fputs(location, out);
+}
+
+/**
+ * Write the folded stacks.
+ *
+ * @param profile_t*        profile - The profile.
+ * @param profile_names_t*  names - The names.
+ * @param FILE*             out - Where to write to.
+ */
+static void write_folded(profile_t *profile, profile_names_t *names, FILE *out){
+    int i;
+
+    for ( i = 0; i < profile->nodes_size; i++ ) {
+        if ( profile->nodes[i].count ) {
+            write_stack(profile, names, i, out);
+            fprintf(out, " %ld\n", profile->nodes[i].count);
+        }
+    }
+}
+
+/**
+ * Write NAME.prof and NAME.folded.
+ *
+ * @param profile_t*    profile - The profile, after the run.
+ * @param image_t*      image - The program that was run.
+ * @param char*         base_name - The file name without extension.
+ *
+ * @return int - 1 if everything went OK, 0 if the files couldn't be written.
+ */
+int profile_write(profile_t *profile, image_t *image, char *base_name){
+    profile_names_t names;
+    debug_map_t map;
+    FILE *fp;
+    char *name = NULL;
+    int i, ok, has_map;
+
+    name_table_init(&names.names);
+    for ( i = 0; i < MEMORY_SIZE; i++ ) {
+        names.name_of[i] = -1;
+    }
+    has_map = debug_map_load(&map, base_name);
+    if ( !(ok = read_names(profile, &names, base_name, has_map ? &map : NULL, image->base - (has_map ? map.base : INITIAL_IC))) ) {
+        fprintf(stderr, "Cannot allocate memory.\n");
+    }
+
+    if ( ok && (ok = (fp = open_output(base_name, ".prof", &name)) != NULL) ) {
+        write_flat(profile, image, &names, has_map ? &map : NULL, fp);
+        if ( (ok = close_output(fp, name, 1)) ) {
+            fprintf(stderr, "INFO: %s was created.\n", name); /* the output of the program is on stdout */
+        }
+    }
+    if ( ok ) {
+        free(name);
+        if ( (ok = (fp = open_output(base_name, ".folded", &name)) != NULL) ) {
+            write_folded(profile, &names, fp);
+            if ( (ok = close_output(fp, name, 1)) ) {
+                fprintf(stderr, "INFO: %s was created.\n", name);
+            }
+        }
+    }
+    free(name);
+    name_table_free(&names.names);
+    debug_map_free(&map);
+
+    return ok;
+}
@@ -0,0 +1,493 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "header.h"
+
+/*
+ * The assembler server keeps running between requests, so the process startup is paid only once. One assembler
+ * context assembles every source of every request, and it keeps the capacities its tables and buffers grew to
+ * (see clear_tables()), as does the buffer inline sources are read to, so a request allocates next to nothing.
+ * A request is a list of text lines sent by the client over a local (unix) socket:
+ *
+ *      CWD <directory>             the directory relative file names are resolved from
+ *      OPTION <option>             a command line option for this request, i.e "--diag=json"
+ *      FILE <name>                 assemble <name>.as (could appear more than once)
+ *      SOURCE <length> <name>      assemble the <length> bytes that follow as the source of <name>
+ *      END                         end of request
+ *
+ * The server answers with everything the assembler printed, and the exit status the assembler would have returned:
+ *
+ *      OUT <length>\n<bytes>       the standard output
+ *      ERR <length>\n<bytes>       the diagnostics
+ *      STATUS <n>\n
+ */
+
+#define REQUEST_LINE_MAX 4096
+#define TRANSFER_BUFFER_SIZE 8192
+
+/* what the server keeps between the requests */
+typedef struct{
+    assembler_t as;
+    char *source; /* the last inline source */
+    int source_capacity;
+    FILE *out_capture; /* the standard output of a request */
+    FILE *err_capture; /* the diagnostics of a request */
+} server_t;
+
+/**
+ * Write all "size" bytes of "buffer" to the file descriptor "fd".
+ *
+ * @param int       fd - The file descriptor.
+ * @param char*     buffer - The bytes to write.
+ * @param size_t    size - Number of bytes to write.
+ *
+ * @return int - 1 if everything was written, 0 otherwise.
+ */
+static int write_all(int fd, const char *buffer, size_t size){
+    ssize_t written;
+
+    while ( size > 0 ) {
+        if ( (written = write(fd, buffer, size)) < 0 ) {
+            if ( errno == EINTR ) {
+                continue;
+            }
+            return 0;
+        }
+        buffer += written;
+        size -= (size_t) written;
+    }
+
+    return 1;
+}
+
+/**
+ * Copy exactly "size" bytes from the stream "src" to the stream "dest".
+ *
+ * @param FILE*     src - The stream to read from.
+ * @param FILE*     dest - The stream to write to.
+ * @param long      size - Number of bytes to copy.
+ *
+ * @return int - 1 if everything was copied, 0 otherwise.
+ */
+static int copy_stream(FILE *src, FILE *dest, long size){
+    char buffer[TRANSFER_BUFFER_SIZE];
+    size_t chunk;
+
+    while ( size > 0 ) {
+        chunk = size > TRANSFER_BUFFER_SIZE ? TRANSFER_BUFFER_SIZE : (size_t) size;
+        if ( fread(buffer, 1, chunk, src) != chunk || fwrite(buffer, 1, chunk, dest) != chunk ) {
+            return 0;
+        }
+        size -= (long) chunk;
+    }
+
+    return 1;
+}
+
+/**
+ * Send the content of a temporary capture file to the client, and truncate it for the next request.
+ *
+ * @param int       conn - The client connection.
+ * @param char*     tag - The section name, "OUT" or "ERR".
+ * @param FILE*     capture - The capture file.
+ *
+ * @return int - 1 if everything was sent, 0 otherwise.
+ */
+static int send_capture(int conn, char *tag, FILE *capture){
+    char header[REQUEST_LINE_MAX];
+    char buffer[TRANSFER_BUFFER_SIZE];
+    long size;
+    size_t chunk;
+    int status = 1;
+
+    fflush(capture);
+    size = ftell(capture);
+    rewind(capture);
+
+    sprintf(header, "%s %ld\n", tag, size);
+    if ( !write_all(conn, header, strlen(header)) ) {
+        status = 0;
+    }
+
+    while ( status && size > 0 && (chunk = fread(buffer, 1, sizeof(buffer), capture)) > 0 ) {
+        status = write_all(conn, buffer, chunk);
+        size -= (long) chunk;
+    }
+
+    rewind(capture);
+    if ( ftruncate(fileno(capture), 0) != 0 ) {
+        status = 0;
+    }
+
+    return status;
+}
+
+/**
+ * Assemble a source that was sent inline by the client.
+ *
+ * @param server_t*     server - The server, its context and its source buffer are used.
+ * @param FILE*         in - The client connection, positioned at the first byte of the source.
+ * @param long          length - The length of the source.
+ * @param char*         base_name - The name of the source, used to name the output files.
+ *
+ * @return int - 0 if everything went OK, 1 if the source has errors, 2 on a fatal error.
+ */
+static int assemble_inline_source(server_t *server, FILE *in, long length, char *base_name){
+    char *source_name;
+    int status;
+
+    if ( length < 0 || (long) (int) (length + 1) != length + 1
+         || !ensure_capacity((void **) &server->source, &server->source_capacity, (int) length + 1, sizeof(char)) ) {
+        fprintf(stderr, "Cannot allocate memory.\n");
+        return 2;
+    }
+
+    if ( fread(server->source, 1, (size_t) length, in) != (size_t) length ) {
+        fprintf(stderr, "Cannot read the source of %s\n", base_name);
+        return 2;
+    }
+
+    if ( !(source_name = malloc(strlen(base_name) + 4)) ) {
+        fprintf(stderr, "Cannot allocate memory.\n");
+        return 2;
+    }
+    sprintf(source_name, "%s.as", base_name);
+
+    server->as.settings = settings;
+    status = assemble_buffer(&server->as, server->source, (size_t) length);
+    diag_flush(&server->as.diag, source_name, server->as.settings.diag_format, stderr);
+    if ( status == 0 ) {
+        status = write_outputs(&server->as, base_name);
+    }
+    free(source_name);
+
+    return status;
+}
+
+/**
+ * Handle a single client request. The standard output and the diagnostics are redirected
+ * to the capture files while the request is assembled.
+ *
+ * @param server_t*     server - The server.
+ * @param int           conn - The client connection.
+ */
+static void handle_request(server_t *server, int conn){
+    FILE *out_capture = server->out_capture, *err_capture = server->err_capture;
+    char line[REQUEST_LINE_MAX];
+    char status_line[REQUEST_LINE_MAX];
+    int saved_out, saved_err;
+    int fatal = 0;
+    int status;
+    long length;
+    int name_pos;
+    settings_t saved_settings = settings;
+    output_counts_t before = output_counts;
+    FILE *in;
+
+    if ( !(in = fdopen(dup(conn), "r")) ) {
+        return;
+    }
+
+    fflush(stdout);
+    fflush(stderr);
+    saved_out = dup(STDOUT_FILENO);
+    saved_err = dup(STDERR_FILENO);
+    dup2(fileno(out_capture), STDOUT_FILENO);
+    dup2(fileno(err_capture), STDERR_FILENO);
+
+    while ( fgets(line, REQUEST_LINE_MAX, in) ) {
+        line[strcspn(line, "\n")] = '\0';
+
+        if ( strcmp(line, "END") == 0 ) {
+            break;
+        }
+
+        status = 0;
+        if ( strncmp(line, "CWD ", 4) == 0 ) {
+            if ( chdir(line + 4) != 0 ) {
+                fprintf(stderr, "Cannot change directory to: %s\n", line + 4);
+                fatal = 1;
+            }
+            continue;
+        } else if ( strncmp(line, "OPTION ", 7) == 0 ) {
+            /* --batch=FILE would point into the line, which the next one overwrites (and the server runs nothing) */
+            if ( strncmp(line + 7, "--batch=", 8) == 0 ) {
+                fprintf(stderr, "Not a server option: %s\n", line + 7);
+                fatal = 1;
+            } else if ( !parse_option(&settings, line + 7) ) {
+                fprintf(stderr, "Invalid option: %s\n", line + 7);
+                fatal = 1;
+            }
+            continue;
+        } else if ( strncmp(line, "FILE ", 5) == 0 ) {
+            if ( !fatal ) {
+                status = assemble_file(&server->as, line + 5);
+            }
+        } else if ( sscanf(line, "SOURCE %ld %n", &length, &name_pos) == 1 ) {
+            if ( fatal ) { /* we still have to consume the source */
+                while ( length-- > 0 && fgetc(in) != EOF );
+                continue;
+            }
+            status = assemble_inline_source(server, in, length, line + name_pos);
+        } else {
+            fprintf(stderr, "Invalid request: %s\n", line);
+            fatal = 1;
+            continue;
+        }
+
+        if ( fatal ) {
+            continue;
+        }
+
+        /* the same output the assembler prints when it's invoked directly */
+        switch ( status ) {
+            case -1:
+                break;
+            case 2:
+                fatal = 1;
+                break;
+            default:
+                putchar('\n');
+        }
+    }
+
+    if ( !fatal ) {
+        if ( output_counts.unchanged > before.unchanged ) { /* as main() prints it */
+            printf("INFO: %d output files written, %d unchanged.\n", output_counts.written - before.written,
+                   output_counts.unchanged - before.unchanged);
+        }
+        printf("===========\n");
+    }
+
+    fflush(stdout);
+    fflush(stderr);
+    dup2(saved_out, STDOUT_FILENO);
+    dup2(saved_err, STDERR_FILENO);
+    close(saved_out);
+    close(saved_err);
+
+    settings = saved_settings; /* the options were only for this request */
+
+    sprintf(status_line, "STATUS %d\n", fatal);
+    if ( send_capture(conn, "OUT", out_capture) && send_capture(conn, "ERR", err_capture) ) {
+        write_all(conn, status_line, strlen(status_line));
+    }
+
+    fclose(in);
+}
+
+/**
+ * Open a unix socket client connection to "socket_path".
+ *
+ * @param char*     socket_path - The socket path.
+ * @param struct sockaddr_un*   address - Will hold the socket address.
+ *
+ * @return int - The socket, -1 on error.
+ */
+static int open_socket(char *socket_path, struct sockaddr_un *address){
+    int fd;
+
+    if ( strlen(socket_path) >= sizeof(address->sun_path) ) {
+        fprintf(stderr, "Socket path is too long: %s\n", socket_path);
+        return -1;
+    }
+
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+    strcpy(address->sun_path, socket_path);
+
+    if ( (fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 ) {
+        fprintf(stderr, "Cannot create socket: %s\n", strerror(errno));
+    }
+
+    return fd;
+}
+
+/**
+ * Run the assembler as a server, listening on the unix socket "socket_path" until SIGINT or SIGTERM.
+ *
+ * @param char*     socket_path - The socket path.
+ *
+ * @return int - 0 if the server stopped normally, 1 otherwise.
+ */
+int serve(char *socket_path){
+    struct sockaddr_un address;
+    server_t server;
+    int fd, conn;
+
+    if ( (fd = open_socket(socket_path, &address)) < 0 ) {
+        return 1;
+    }
+
+    unlink(socket_path); /* remove a socket left behind by a previous server */
+    if ( bind(fd, (struct sockaddr *) &address, sizeof(address)) != 0 || listen(fd, SOMAXCONN) != 0 ) {
+        fprintf(stderr, "Cannot listen on %s: %s\n", socket_path, strerror(errno));
+        close(fd);
+        return 1;
+    }
+
+    /* the capture files are kept between the requests, and truncated after each one */
+    if ( !(server.out_capture = tmpfile()) || !(server.err_capture = tmpfile()) ) {
+        fprintf(stderr, "Cannot create capture files.\n");
+        close(fd);
+        unlink(socket_path);
+        return 1;
+    }
+    assembler_init(&server.as);
+    server.source = NULL;
+    server.source_capacity = 0;
+
+    catch_stop_signals(); /* accept() returns when we should stop */
+    signal(SIGPIPE, SIG_IGN); /* a client that went away shouldn't kill the server */
+
+    printf("INFO: listening on %s\n", socket_path);
+    fflush(stdout);
+
+    while ( !stop_was_requested() ) {
+        if ( (conn = accept(fd, NULL, NULL)) < 0 ) {
+            if ( errno == EINTR ) {
+                continue;
+            }
+            fprintf(stderr, "Cannot accept connection: %s\n", strerror(errno));
+            break;
+        }
+        handle_request(&server, conn);
+        close(conn);
+    }
+
+    assembler_free(&server.as);
+    free(server.source);
+    fclose(server.out_capture);
+    fclose(server.err_capture);
+    close(fd);
+    unlink(socket_path);
+
+    return 0;
+}
+
+/**
+ * Read the whole standard input into memory.
+ *
+ * @param long*     length - Will hold the length of the input.
+ *
+ * @return char* - The input, NULL on error.
+ */
+static char *read_standard_input(long *length){
+    char *buffer = NULL, *temp;
+    size_t capacity = 0, size = 0, chunk;
+
+    do {
+        if ( size == capacity ) {
+            capacity = capacity ? capacity * 2 : TRANSFER_BUFFER_SIZE;
+            if ( !(temp = realloc(buffer, capacity)) ) {
+                free(buffer);
+                return NULL;
+            }
+            buffer = temp;
+        }
+        chunk = fread(buffer + size, 1, capacity - size, stdin);
+        size += chunk;
+    } while ( chunk > 0 );
+
+    *length = (long) size;
+
+    return buffer;
+}
+
+/**
+ * Read a response section header ("OUT <length>" / "ERR <length>") and copy the section to "dest".
+ *
+ * @param FILE*     in - The server connection.
+ * @param char*     tag - The expected section name.
+ * @param FILE*     dest - Where to copy the section to.
+ *
+ * @return int - 1 if everything went OK, 0 otherwise.
+ */
+static int receive_section(FILE *in, char *tag, FILE *dest){
+    char line[REQUEST_LINE_MAX];
+    char format[REQUEST_LINE_MAX];
+    long length;
+
+    sprintf(format, "%s %%ld", tag);
+    if ( !fgets(line, REQUEST_LINE_MAX, in) || sscanf(line, format, &length) != 1 ) {
+        return 0;
+    }
+
+    return copy_stream(in, dest, length);
+}
+
+/**
+ * Assemble files with an assembler server, instead of running the assembler directly.
+ * The output, the diagnostics and the exit status are the same as direct invocation.
+ *
+ * @param char*     socket_path - The socket path the server listens on.
+ * @param int       argc - Number of file names.
+ * @param char**    argv - The files names and options, "--stdin NAME" sends the standard input as the source of NAME.
+ *
+ * @return int - The status the server returned, 1 if it couldn't be reached.
+ */
+int client(char *socket_path, int argc, char *argv[]){
+    struct sockaddr_un address;
+    char cwd[REQUEST_LINE_MAX];
+    char line[REQUEST_LINE_MAX];
+    char *source;
+    long length;
+    int fd, i, status;
+    FILE *out, *in;
+
+    if ( (fd = open_socket(socket_path, &address)) < 0 ) {
+        return 1;
+    }
+
+    if ( connect(fd, (struct sockaddr *) &address, sizeof(address)) != 0 ) {
+        fprintf(stderr, "Cannot connect to %s: %s\n", socket_path, strerror(errno));
+        close(fd);
+        return 1;
+    }
+
+    if ( !(out = fdopen(dup(fd), "w")) || !(in = fdopen(fd, "r")) ) {
+        fprintf(stderr, "Cannot open connection streams.\n");
+        close(fd);
+        return 1;
+    }
+
+    if ( getcwd(cwd, sizeof(cwd)) ) {
+        fprintf(out, "CWD %s\n", cwd);
+    }
+
+    for ( i = 0; i < argc; i++ ) {
+        if ( strcmp(argv[i], "--stdin") == 0 && i + 1 < argc ) {
+            if ( !(source = read_standard_input(&length)) ) {
+                fprintf(stderr, "Cannot read the standard input.\n");
+                return 1;
+            }
+            fprintf(out, "SOURCE %ld %s\n", length, argv[++i]);
+            fwrite(source, 1, (size_t) length, out);
+            free(source);
+        } else if ( argv[i][0] == '-' ) {
+            fprintf(out, "OPTION %s\n", argv[i]);
+        } else {
+            fprintf(out, "FILE %s\n", argv[i]);
+        }
+    }
+    fprintf(out, "END\n");
+    fclose(out);
+
+    if ( !receive_section(in, "OUT", stdout) || !receive_section(in, "ERR", stderr)
+         || !fgets(line, REQUEST_LINE_MAX, in) || sscanf(line, "STATUS %d", &status) != 1 ) {
+        fprintf(stderr, "Invalid response from %s\n", socket_path);
+        fclose(in);
+        return 1;
+    }
+
+    fclose(in);
+
+    return status;
+}
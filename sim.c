@@ -0,0 +1,524 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "header.h"
+
+/*
+ * The simulator (--run NAME). Runs NAME.bin, or NAME.ob if there is no binary image, on the WORD_MAX bits machine:
+ *
+ *      memory      MEMORY_SIZE words (an address is VALUE_BITS bits), the program is loaded at its base address
+ *                  and runs from its first instruction
+ *      registers   r0 - r7, every value is a WORD_MAX bits word and the arithmetic wraps around
+ *      cmp         sets the zero flag if the operands are equal, bne jumps if it's clear
+ *      jsr, rts    the return addresses are kept on a stack of STACK_SIZE addresses
+ *      red, prn    read a decimal number from the input, write the (signed) value to the output
+ *      X[ri][rj]   the word at X + ri + rj (the dimensions of the matrix aren't in the image)
+ *
+ * An external address (E) is 0, since nothing links the program to its external symbols.
+ *
+ * The words aren't decoded on every step. A basic block (the instructions from an address to the first
+ * jmp / bne / jsr / rts / stop) is decoded once, when it's reached first, to micro ops with the operands
+ * already resolved: a pointer to the register, the memory word or the immediate value. Two register
+ * operands that share a word become two register pointers of the same micro op. The decoded blocks are
+ * kept by their first address. A write to a word that belongs to a decoded instruction drops all the
+ * decoded blocks, so the code is decoded again from what was written.
+ */
+
+#define BLOCK_MAX 64 /* a longer straight line of code is split to a few blocks */
+
+/**
+ * Drop all the decoded blocks, after a decoded instruction was written to.
+ *
+ * @param machine_t*    m - The machine.
+ */
+void machine_flush(machine_t *m){
+    memset(m->blocks, 0, sizeof(m->blocks));
+    memset(m->is_code, 0, sizeof(m->is_code));
+    m->ops_size = 0;
+    m->code_written = 0;
+    m->flushes++;
+}
+
+/**
+ * Stop the machine with a runtime error.
+ *
+ * @param machine_t*    m - The machine.
+ * @param int           address - The address of the instruction.
+ * @param char*         error - The error message.
+ */
+static void machine_error(machine_t *m, int address, const char *error){
+    m->status = MACHINE_ERROR;
+    m->error = error;
+    m->pc = address;
+}
+
+/**
+ * Decode a single operand.
+ *
+ * @param machine_t*    m - The machine.
+ * @param int           method - The addressing method.
+ * @param int           address - The address of the (first) operand word.
+ * @param int           reg_shift - The position of the register in the word, for a register operand.
+ * @param operand_t*    operand - Will hold the decoded operand at the end.
+ *
+ * @return int - 1 if the operand is valid, 0 otherwise.
+ */
+static int decode_operand(machine_t *m, int method, int address, int reg_shift, operand_t *operand){
+    int word = m->memory[address], value = (word >> 2) & VALUE_MASK;
+
+    operand->method = method;
+    operand->cell = NULL;
+    switch ( method ) {
+        case IMMEDIATE:
+            operand->value = value >= 1 << (VALUE_BITS - 1) ? value - (1 << VALUE_BITS) : value;
+            operand->cell = &m->immediates[operand->value & WORD_MASK];
+            break;
+        case DIRECT:
+            operand->value = value;
+            operand->cell = &m->memory[value];
+            break;
+        case MATRIX_ACCESS:
+            operand->value = value;
+            word = m->memory[address + 1];
+            operand->row = (word >> 6) & 15;
+            operand->column = (word >> 2) & 15;
+            return operand->row < NUM_OF_REGISTERS && operand->column < NUM_OF_REGISTERS;
+        case DIRECT_REGISTER:
+            operand->value = (word >> reg_shift) & 15;
+            if ( operand->value >= NUM_OF_REGISTERS ) {
+                return 0;
+            }
+            operand->cell = &m->registers[operand->value];
+            break;
+        default: /* NO_ARG */
+            break;
+    }
+
+    return 1;
+}
+
+/**
+ * Decode the instruction at an address.
+ *
+ * @param machine_t*    m - The machine.
+ * @param int           address - The address.
+ * @param micro_op_t*   op - Will hold the decoded instruction at the end.
+ *
+ * @return int - 1 if the instruction is valid, 0 otherwise.
+ */
+static int decode_instruction(machine_t *m, int address, micro_op_t *op){
+    int word = m->memory[address], src = (word >> 4) & 3, dest = (word >> 2) & 3;
+
+    op->oper = word >> 6;
+    op->address = address;
+    op->next = address + instruction_length(word);
+    if ( op->next > MEMORY_SIZE ) {
+        return 0;
+    }
+
+    switch ( operands_count(op->oper) ) {
+        case 2:
+            return is_address_valid(op->oper, src, dest)
+                   && decode_operand(m, src, address + 1, 6, &op->src)
+                   && decode_operand(m, dest, src == DIRECT_REGISTER && dest == DIRECT_REGISTER ? address + 1 : op->next - (dest == MATRIX_ACCESS ? 2 : 1), 2, &op->dest);
+        case 1:
+            op->src.method = NO_ARG;
+            return is_address_valid(op->oper, NO_ARG, dest) && decode_operand(m, dest, address + 1, 6, &op->dest); /* a single register is encoded like a source register */
+        default:
+            op->src.method = op->dest.method = NO_ARG;
+            return is_address_valid(op->oper, NO_ARG, NO_ARG);
+    }
+}
+
+/**
+ * Decode the basic block that starts at an address.
+ *
+ * @param machine_t*    m - The machine.
+ * @param int           start - The address.
+ *
+ * @return int - 1 if everything went OK, 0 if the machine stopped (an invalid instruction or a memory error).
+ */
+int decode_block(machine_t *m, int start){
+    micro_op_t op;
+    int address = start, count = 0, i;
+
+    while ( address < MEMORY_SIZE && count < BLOCK_MAX && decode_instruction(m, address, &op) ) {
+        if ( !ensure_capacity((void **) &m->ops, &m->ops_capacity, m->ops_size + count + 1, sizeof(micro_op_t)) ) {
+            machine_error(m, start, "cannot allocate memory");
+            return 0;
+        }
+        m->ops[m->ops_size + count++] = op;
+        for ( i = address; i < op.next; i++ ) {
+            m->is_code[i] = 1;
+        }
+        address = op.next;
+        if ( op.oper == JMP || op.oper == BNE || op.oper == JSR || op.oper == RTS || op.oper == STOP ) {
+            break;
+        }
+    }
+
+    if ( count == 0 ) { /* an invalid instruction further in the block stops the machine only when it's reached */
+        machine_error(m, start, address < MEMORY_SIZE ? "invalid instruction" : "the program counter is out of the memory");
+        return 0;
+    }
+    m->blocks[start].first = m->ops_size;
+    m->blocks[start].count = count;
+    m->ops_size += count;
+
+    return 1;
+}
+
+/**
+ * Get the address a memory operand points to.
+ *
+ * @param machine_t*    m - The machine.
+ * @param operand_t*    operand - A DIRECT or a MATRIX_ACCESS operand.
+ *
+ * @return int - The address.
+ */
+static int effective_address(machine_t *m, operand_t *operand){
+    if ( operand->method == MATRIX_ACCESS ) {
+        return (operand->value + m->registers[operand->row] + m->registers[operand->column]) & (MEMORY_SIZE - 1);
+    }
+
+    return operand->value;
+}
+
+/**
+ * Read the value of an operand.
+ *
+ * @param machine_t*    m - The machine.
+ * @param operand_t*    operand - The operand.
+ *
+ * @return int - The value, a WORD_MAX bits word.
+ */
+static int read_operand(machine_t *m, operand_t *operand){
+    return operand->cell ? *operand->cell : m->memory[effective_address(m, operand)];
+}
+
+/**
+ * Write a value to an operand, only the lower WORD_MAX bits are written.
+ *
+ * @param machine_t*    m - The machine.
+ * @param operand_t*    operand - The operand, a register or a memory word.
+ * @param int           value - The value.
+ */
+static void write_operand(machine_t *m, operand_t *operand, int value){
+    int address;
+
+    if ( operand->method == DIRECT_REGISTER ) {
+        *operand->cell = value & WORD_MASK;
+        return;
+    }
+
+    address = effective_address(m, operand);
+    m->memory[address] = value & WORD_MASK;
+    if ( m->is_code[address] ) {
+        m->code_written = 1;
+    }
+}
+
+/**
+ * Get the address a jump goes to.
+ *
+ * @param machine_t*    m - The machine.
+ * @param operand_t*    operand - The destination operand of jmp, bne or jsr.
+ *
+ * @return int - The address.
+ */
+static int jump_target(machine_t *m, operand_t *operand){
+    return operand->method == DIRECT_REGISTER ? *operand->cell & (MEMORY_SIZE - 1) : effective_address(m, operand);
+}
+
+/**
+ * Add a value to the end of a list.
+ *
+ * @param value_list_t*     list - The list.
+ * @param int               value - The value.
+ *
+ * @return int - 1 if everything went OK, 0 on memory error.
+ */
+int value_list_add(value_list_t *list, int value){
+    if ( !ensure_capacity((void **) &list->values, &list->capacity, list->size + 1, sizeof(int)) ) {
+        return 0;
+    }
+    list->values[list->size++] = value;
+
+    return 1;
+}
+
+/**
+ * Read the next number of the input, for red.
+ *
+ * @param machine_t*    m - The machine.
+ * @param int*          value - Will hold the number at the end.
+ *
+ * @return int - 1 if a number was read, 0 at the end of the input.
+ */
+static int read_input(machine_t *m, int *value){
+    if ( m->input ) {
+        if ( m->input_position == m->input->size ) {
+            return 0;
+        }
+        *value = m->input->values[m->input_position++];
+        return 1;
+    }
+
+    return fscanf(m->in, "%d", value) == 1;
+}
+
+/**
+ * Initialize a machine and load a program to its memory.
+ *
+ * @param machine_t*    m - The machine.
+ * @param image_t*      image - The program.
+ * @param FILE*         in - Where red reads from (an input list could be set after).
+ * @param FILE*         out - Where prn writes to (an output list could be set after).
+ *
+ * @return int - 1 if everything went OK, 0 if the program doesn't fit in the memory.
+ */
+int machine_init(machine_t *m, image_t *image, FILE *in, FILE *out){
+    int i, size = image->code_size + image->data_size;
+
+    memset(m, 0, sizeof(machine_t));
+    m->ops = NULL;
+    m->input = m->output = NULL;
+    m->profile = NULL;
+    m->in = in;
+    m->out = out;
+    m->pc = image->base;
+    m->status = MACHINE_RUNNING;
+    for ( i = 0; i <= WORD_MASK; i++ ) {
+        m->immediates[i] = i;
+    }
+
+    if ( image->base < 0 || image->base + size > MEMORY_SIZE ) {
+        machine_error(m, image->base, "the program doesn't fit in the memory");
+        return 0;
+    }
+    for ( i = 0; i < size; i++ ) {
+        m->memory[image->base + i] = image->words[i] & WORD_MASK;
+    }
+
+    return 1;
+}
+
+/**
+ * Free the memory of a machine.
+ *
+ * @param machine_t*    m - The machine.
+ */
+void machine_free(machine_t *m){
+    free(m->ops);
+    m->ops = NULL;
+    m->ops_size = m->ops_capacity = 0;
+}
+
+/**
+ * Run a single basic block, the one at the program counter.
+ *
+ * @param machine_t*    m - The machine, running.
+ * @param long          max_steps - Stop after this many instructions (in total), 0 for no limit.
+ */
+void machine_run_block(machine_t *m, long max_steps){
+    micro_op_t *first, *op, *end;
+    int pc, value;
+
+    if ( max_steps && m->steps >= max_steps ) {
+        m->status = MACHINE_STEP_LIMIT;
+        return;
+    }
+    if ( m->blocks[m->pc].count == 0 && !decode_block(m, m->pc) ) {
+        return;
+    }
+
+    first = op = m->ops + m->blocks[m->pc].first;
+    end = first + m->blocks[m->pc].count;
+    if ( max_steps && max_steps - m->steps < end - first ) {
+        end = first + (max_steps - m->steps);
+    }
+
+    for ( pc = -1; op < end && pc < 0; op++ ) {
+        switch ( op->oper ) {
+            case MOV:
+                write_operand(m, &op->dest, read_operand(m, &op->src));
+                break;
+            case CMP:
+                m->zero = read_operand(m, &op->src) == read_operand(m, &op->dest);
+                break;
+            case ADD:
+                write_operand(m, &op->dest, read_operand(m, &op->dest) + read_operand(m, &op->src));
+                break;
+            case SUB:
+                write_operand(m, &op->dest, read_operand(m, &op->dest) - read_operand(m, &op->src));
+                break;
+            case NOT:
+                write_operand(m, &op->dest, ~read_operand(m, &op->dest));
+                break;
+            case CLR:
+                write_operand(m, &op->dest, 0);
+                break;
+            case LEA:
+                write_operand(m, &op->dest, effective_address(m, &op->src));
+                break;
+            case INC:
+                write_operand(m, &op->dest, read_operand(m, &op->dest) + 1);
+                break;
+            case DEC:
+                write_operand(m, &op->dest, read_operand(m, &op->dest) - 1);
+                break;
+            case JMP:
+                pc = jump_target(m, &op->dest);
+                break;
+            case BNE:
+                if ( !m->zero ) {
+                    pc = jump_target(m, &op->dest);
+                }
+                break;
+            case RED:
+                if ( !read_input(m, &value) ) {
+                    machine_error(m, op->address, "no more input for red");
+                    pc = op->address;
+                    break;
+                }
+                write_operand(m, &op->dest, value);
+                break;
+            case PRN:
+                value = read_operand(m, &op->dest);
+                value = value >= 1 << (WORD_MAX - 1) ? value - (1 << WORD_MAX) : value;
+                if ( m->output ) {
+                    value_list_add(m->output, value);
+                } else {
+                    fprintf(m->out, "%d\n", value);
+                }
+                break;
+            case JSR:
+                if ( m->sp == STACK_SIZE ) {
+                    machine_error(m, op->address, "stack overflow");
+                    pc = op->address;
+                    break;
+                }
+                m->stack[m->sp++] = op->next;
+                pc = jump_target(m, &op->dest);
+                break;
+            case RTS:
+                if ( m->sp == 0 ) {
+                    machine_error(m, op->address, "rts with an empty stack");
+                    pc = op->address;
+                    break;
+                }
+                pc = m->stack[--m->sp];
+                break;
+            default: /* STOP */
+                m->status = MACHINE_HALTED;
+                pc = op->address;
+        }
+
+        if ( m->profile && m->status != MACHINE_ERROR ) {
+            profile_count(m->profile, op, pc);
+        }
+
+        if ( m->code_written && pc < 0 ) { /* the rest of the block may have changed */
+            pc = op->next;
+        }
+    }
+
+    m->steps += op - first;
+    m->pc = pc >= 0 ? pc : (op - 1)->next;
+    if ( m->code_written ) {
+        machine_flush(m);
+    }
+    if ( m->status == MACHINE_RUNNING && m->pc >= MEMORY_SIZE ) {
+        machine_error(m, m->pc, "the program counter is out of the memory");
+    }
+}
+
+/**
+ * Run the machine until it stops.
+ *
+ * @param machine_t*    m - The machine.
+ * @param long          max_steps - Stop after this many instructions, 0 for no limit.
+ *
+ * @return int - The status at the end: MACHINE_HALTED, MACHINE_STEP_LIMIT or MACHINE_ERROR.
+ */
+int machine_run(machine_t *m, long max_steps){
+    while ( m->status == MACHINE_RUNNING ) {
+        machine_run_block(m, max_steps);
+    }
+
+    return m->status;
+}
+
+/**
+ * Run an assembled program.
+ *
+ * @param char*         base_name - The file name without extension, NAME.bin or NAME.ob is run.
+ * @param settings_t*   options - The settings (max_steps, jit, profile, batch, load_base).
+ *
+ * @return int - 0 if the program stopped with stop, 1 otherwise.
+ */
+int simulate(char *base_name, settings_t *options){
+    static machine_t m; /* big, and it's pointed into by its micro ops */
+    static profile_t profile;
+    image_t image;
+    debug_map_t map;
+    char location[LINE_MAX * 2];
+    int status, failed = 0;
+
+    image_init(&image);
+    if ( !image_load_program(&image, base_name) ) {
+        return 1;
+    }
+    if ( options->load_base >= 0 && !image_relocate(&image, base_name, options->load_base) ) {
+        image_free(&image);
+        return 1;
+    }
+
+    if ( options->batch ) {
+        status = batch_simulate(&image, options);
+        image_free(&image);
+        return status;
+    }
+
+    if ( machine_init(&m, &image, stdin, stdout) ) {
+        if ( options->profile ) {
+            if ( !profile_init(&profile, image.base) ) {
+                fprintf(stderr, "Cannot allocate memory.\n");
+                image_free(&image);
+                return 1;
+            }
+            m.profile = &profile;
+            machine_run(&m, options->max_steps); /* the native code doesn't count */
+        } else if ( options->jit ) {
+            jit_run(&m, options->max_steps);
+        } else {
+            machine_run(&m, options->max_steps);
+        }
+    }
+    fflush(stdout);
+
+    status = m.status;
+    if ( status == MACHINE_ERROR ) {
+        location[0] = '\0';
+        if ( debug_map_load(&map, base_name) ) { /* the source line of the error */
+            debug_format_location(&map, m.pc - image.base + map.base, location); /* the program could have been moved */
+            debug_map_free(&map);
+        }
+        if ( location[0] ) {
+            fprintf(stderr, "Runtime error at address %d %s: %s.\n", m.pc, location, m.error);
+        } else {
+            fprintf(stderr, "Runtime error at address %d: %s.\n", m.pc, m.error);
+        }
+    } else if ( status == MACHINE_STEP_LIMIT ) {
+        fprintf(stderr, "Stopped after %ld steps at address %d.\n", m.steps, m.pc);
+    }
+
+    if ( m.profile ) {
+        failed = !profile_write(&profile, &image, base_name);
+        profile_free(&profile);
+    }
+    machine_free(&m);
+    image_free(&image);
+
+    return status != MACHINE_HALTED || failed;
+}
@@ -0,0 +1,264 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include "header.h"
+
+/*
+ * Memory budgeted segments (--mem-limit=N). A segment (code or data) grows on the heap, one word at a time,
+ * until it takes more than half of the budget. Then it's moved to a temporary file that is mapped to memory,
+ * and grows by chunks of half of the budget: the file is made longer and mapped again. Unmapping writes the
+ * words that were filled back to the file and takes their pages off the process, so only the chunk that is
+ * being filled (and the pages that are read or patched again) stay resident, however big the segment gets.
+ *
+ * The mapped segment is still one array of words, so the scans, the passes that patch it and the writers of
+ * the output files use it as they use a heap segment. The writers read it from the beginning to the end, which
+ * the kernel is told so it reads the file ahead, and every SEGMENT_STREAM_WORDS words they take the pages they
+ * read off the process (see segment_release()).
+ *
+ * The file is unlinked as soon as it's created, it's gone when it's closed (or when the process ends).
+ *
+ * The spilled segments are held by the context that owns them (spill_table_t), with the budget of its source, so
+ * contexts that assemble at the same time don't share anything.
+ */
+
+/**
+ * Initialize the spilled segments of a context.
+ *
+ * @param spill_table_t*    spilled - The spilled segments.
+ */
+void spill_table_init(spill_table_t *spilled){
+    spilled->segments = NULL;
+    spilled->size = spilled->capacity = 0;
+    spilled->budget = 0;
+}
+
+/**
+ * Free the spilled segments table, the segments themselves are freed by segment_free().
+ *
+ * @param spill_table_t*    spilled - The spilled segments.
+ */
+void spill_table_free(spill_table_t *spilled){
+    free(spilled->segments);
+    spill_table_init(spilled);
+}
+
+/**
+ * Find a segment in the spilled segments.
+ *
+ * @param spill_table_t*    spilled - The spilled segments.
+ * @param word_t*           words - The segment.
+ *
+ * @return int - The index of the segment, -1 if it's on the heap.
+ */
+static int find_spilled(spill_table_t *spilled, word_t *words){
+    int i;
+
+    for ( i = 0; words && i < spilled->size; i++ ) {
+        if ( spilled->segments[i].words == words ) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * Map the file of a spilled segment again, with its new capacity.
+ *
+ * @param spilled_segment_t*    segment - The segment, its words are unmapped (when mapped) and mapped again.
+ * @param long                  capacity - The new capacity, in words.
+ *
+ * @return int - 1 if everything went OK, 0 otherwise (the segment is left as it was).
+ */
+static int map_segment(spilled_segment_t *segment, long capacity){
+    void *words;
+
+    if ( ftruncate(segment->fd, (off_t) (capacity * (long) sizeof(word_t))) != 0 ) {
+        return 0;
+    }
+    words = mmap(NULL, (size_t) capacity * sizeof(word_t), PROT_READ | PROT_WRITE, MAP_SHARED, segment->fd, 0);
+    if ( words == MAP_FAILED ) {
+        return 0;
+    }
+    if ( segment->words ) {
+        munmap(segment->words, (size_t) segment->capacity * sizeof(word_t));
+    }
+    segment->words = words;
+    segment->capacity = capacity;
+
+    return 1;
+}
+
+/**
+ * Get the number of words a spilled segment grows by.
+ *
+ * @param spill_table_t*    spilled - The spilled segments, their budget is used.
+ */
+static long chunk_words(spill_table_t *spilled){
+    long words = spilled->budget / 2 / (long) sizeof(word_t);
+
+    return words > 0 ? words : 1;
+}
+
+/**
+ * Move a heap segment to a temporary file.
+ *
+ * @param spill_table_t*    spilled - The spilled segments, the segment is added to them.
+ * @param word_t**          image - The segment, points to the mapping at the end.
+ * @param int               size - The number of words in the segment.
+ *
+ * @return int - 1 if everything went OK, 0 otherwise (the segment stays on the heap).
+ */
+static int spill_segment(spill_table_t *spilled, word_t **image, int size){
+    char name[] = "/tmp/mozar-spill-XXXXXX";
+    const char *directory = getenv("TMPDIR");
+    spilled_segment_t segment;
+    char *path;
+
+    if ( !ensure_capacity((void **) &spilled->segments, &spilled->capacity, spilled->size + 1, sizeof(spilled_segment_t))
+         || !(path = malloc((directory ? strlen(directory) : 0) + sizeof(name))) ) {
+        return 0;
+    }
+    if ( directory && *directory ) {
+        sprintf(path, "%s/%s", directory, name + 5);
+    } else {
+        strcpy(path, name);
+    }
+    segment.fd = mkstemp(path);
+    if ( segment.fd >= 0 ) {
+        unlink(path);
+    }
+    free(path);
+
+    segment.words = NULL;
+    segment.capacity = 0;
+    if ( segment.fd < 0 || !map_segment(&segment, size + chunk_words(spilled)) ) {
+        if ( segment.fd >= 0 ) {
+            close(segment.fd);
+        }
+        return 0;
+    }
+    memcpy(segment.words, *image, (size_t) size * sizeof(word_t));
+    free(*image);
+    *image = segment.words;
+    spilled->segments[spilled->size++] = segment;
+
+    return 1;
+}
+
+/**
+ * Add a word to a segment when it's over the budget (--mem-limit), moving it to a temporary file when it's
+ * on the heap.
+ *
+ * @param spill_table_t*    spilled - The spilled segments of the context of the segment, and its budget.
+ * @param word_t**          image - The segment, could be moved.
+ * @param int*              size - The number of words in the segment, grows by one.
+ * @param word_t            word - The word to add.
+ *
+ * @return int - 1 if the word was added, 0 if the segment is within the budget (so nothing was done), -1 if
+ *               the segment couldn't grow.
+ */
+int segment_spill_insert(spill_table_t *spilled, word_t **image, int *size, word_t word){
+    int index = find_spilled(spilled, *image);
+    spilled_segment_t *segment;
+
+    if ( index == -1 ) {
+        if ( spilled->budget <= 0 || (long) (*size + 1) * (long) sizeof(word_t) <= spilled->budget / 2 ) {
+            return 0;
+        }
+        if ( !spill_segment(spilled, image, *size) ) {
+            return -1;
+        }
+        index = spilled->size - 1;
+    }
+
+    segment = &spilled->segments[index];
+    if ( *size + 1 > segment->capacity ) {
+        if ( !map_segment(segment, segment->capacity + chunk_words(spilled)) ) {
+            return -1;
+        }
+        *image = segment->words;
+    }
+    (*image)[(*size)++] = word;
+
+    return 1;
+}
+
+/**
+ * Free a segment, on the heap or in a temporary file.
+ *
+ * @param spill_table_t*    spilled - The spilled segments of the context of the segment.
+ * @param word_t*           words - The segment, could be NULL.
+ */
+void segment_free(spill_table_t *spilled, word_t *words){
+    int index = find_spilled(spilled, words);
+
+    if ( index == -1 ) {
+        free(words);
+        return;
+    }
+    munmap(spilled->segments[index].words, (size_t) spilled->segments[index].capacity * sizeof(word_t));
+    close(spilled->segments[index].fd);
+    spilled->segments[index] = spilled->segments[--spilled->size];
+}
+
+/**
+ * Tell the kernel that a segment is about to be read from the beginning to the end (by the writers of the
+ * output files), nothing is done for a segment on the heap.
+ *
+ * @param spill_table_t*    spilled - The spilled segments of the context of the segment.
+ * @param word_t*           words - The segment.
+ */
+void segment_will_stream(spill_table_t *spilled, word_t *words){
+    int index = find_spilled(spilled, words);
+
+    if ( index != -1 ) {
+        posix_madvise(words, (size_t) spilled->segments[index].capacity * sizeof(word_t), POSIX_MADV_SEQUENTIAL);
+    }
+}
+
+/**
+ * Take the pages of the words a writer of the output files has read off the process. The words are mapped again
+ * from the file, so the pointer (and the words) stay the same. Nothing is done for a segment on the heap.
+ *
+ * @param spill_table_t*    spilled - The spilled segments of the context of the segment.
+ * @param word_t*           words - The segment.
+ * @param long              count - The number of words from the beginning of the segment that were read.
+ */
+void segment_release(spill_table_t *spilled, word_t *words, long count){
+    long page = sysconf(_SC_PAGESIZE), bytes = count * (long) sizeof(word_t);
+    int index = find_spilled(spilled, words);
+
+    if ( index != -1 && page > 0 && (bytes -= bytes % page) > 0 ) {
+        mmap(words, (size_t) bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, spilled->segments[index].fd, 0);
+    }
+}
+
+/**
+ * Get the size of the temporary file of a segment.
+ *
+ * @param spill_table_t*    spilled - The spilled segments of the context of the segment.
+ * @param word_t*           words - The segment.
+ *
+ * @return long - The size in bytes, 0 for a segment on the heap.
+ */
+long segment_spilled_bytes(spill_table_t *spilled, word_t *words){
+    int index = find_spilled(spilled, words);
+
+    return index == -1 ? 0 : spilled->segments[index].capacity * (long) sizeof(word_t);
+}
+
+/**
+ * Get the peak resident memory of the process.
+ *
+ * @return long - The peak, in kB.
+ */
+long peak_rss_kb(void){
+    struct rusage usage;
+
+    return getrusage(RUSAGE_SELF, &usage) == 0 ? usage.ru_maxrss : 0;
+}
@@ -0,0 +1,45 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <signal.h>
+#include <string.h>
+#include "header.h"
+
+/*
+ * The stop signals of the modes that keep running (--watch and --serve). SIGINT and SIGTERM only ask the mode to
+ * stop, it stops between its builds / requests. The handler is installed without SA_RESTART, so a call the mode
+ * waits in (read(), accept()) returns when the signal comes.
+ */
+
+static volatile sig_atomic_t stop_requested = 0;
+
+/**
+ * Signal handler that asks the running mode to stop.
+ *
+ * @param int   sig - The signal number.
+ */
+static void handle_stop_signal(int sig){
+    (void) sig;
+    stop_requested = 1;
+}
+
+/**
+ * Install the handler of SIGINT and SIGTERM.
+ */
+void catch_stop_signals(void){
+    struct sigaction action;
+
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = handle_stop_signal; /* no SA_RESTART */
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+}
+
+/**
+ * Check if SIGINT or SIGTERM came since catch_stop_signals().
+ *
+ * @return int - 1 if the running mode should stop, 0 otherwise.
+ */
+int stop_was_requested(void){
+    return stop_requested;
+}
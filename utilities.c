@@ -1,7 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <math.h>
 #include "header.h"
 
 /**
@@ -163,21 +162,21 @@ int calculate_matrix_size(char *arg){
 
 /**
  * Convert integer to word_type.
- * If the number is bigger than the size of a word (10 bits) the value that will be returned is 0.
+ * If the number is bigger than the size of a word (WORD_MAX bits) the value that will be returned is 0.
  * This function is used mainly to append data to the data segment.
  *
  * @param int       int_num - The number to transform.
- * @param int*      error - Function set this to 1 if error occurs.
+ * @param int*      error - Function set this to 1 if the number is bigger than the size of a word.
  *
  * @return word_t - The transformed word.
  */
-word_t trans_to_word(int int_num, int line_count, int *error) {
+word_t trans_to_word(int int_num, int *error) {
     word_t opcode_num; /* this will be the number after being opcoded */
     opcode_num.oper = opcode_num.amethod_src_operand = opcode_num.amethod_dest_operand = opcode_num.memory = 0; /* init opcode num to be 0 */
 
-    if ( int_num < pow(2, WORD_MAX) && int_num > -pow(2, WORD_MAX) ) { /* if num is in the word size boundaries (10 bits) */
+    if ( int_num < 1L << WORD_MAX && int_num > -(1L << WORD_MAX) ) { /* if num is in the word size boundaries (WORD_MAX bits) */
         int mask = 3; /* mask for the ints that should have only one bits */
-        int mask2 = 15; /* mask for the "oper" member, which should have four bits */
+        int mask2 = OPER_MASK; /* mask for the "oper" member, which should have OPER_BITS bits */
 
         /* Start shifting from right to left, set each value to the relevant member */
         opcode_num.memory = (unsigned) int_num & mask;
@@ -192,7 +191,6 @@ word_t trans_to_word(int int_num, int line_count, int *error) {
         opcode_num.oper = (unsigned) int_num & mask2;
 
     } else {
-        fprintf(stderr, "line %d:\tNumber's size is bigger than the word size (10 bits).\n", line_count);
         (*error) = 1;
     }
 
@@ -211,9 +209,9 @@ word_t trans_arg_to_word(int num, int memory_type){
     word_t opcode_num;
     opcode_num.oper = opcode_num.amethod_src_operand = opcode_num.amethod_dest_operand = opcode_num.memory = 0; /* init opcode num to be 0 */
 
-    if ( num < pow(2, WORD_MAX) && num > -pow(2, WORD_MAX) ) { /* if num is in the word size boundaries (10 bits) */
+    if ( num < 1L << WORD_MAX && num > -(1L << WORD_MAX) ) { /* if num is in the word size boundaries (WORD_MAX bits) */
         int mask = 3; /* mask for the ints that should have only one bits */
-        int mask2 = 15; /* mask for the "oper" member, which should have four bits */
+        int mask2 = OPER_MASK; /* mask for the "oper" member, which should have OPER_BITS bits */
 
         opcode_num.memory = (unsigned) memory_type;
 
@@ -226,7 +224,7 @@ word_t trans_arg_to_word(int num, int memory_type){
         opcode_num.oper = (unsigned) num & mask2;
 
     } else {
-        fprintf(stderr, "Number's size is bigger than the word size (10 bits). The opcode value returned is 0.\n");
+        fprintf(stderr, "Number's size is bigger than the word size (%d bits). The opcode value returned is 0.\n", WORD_MAX);
     }
 
     return opcode_num;
@@ -245,7 +243,7 @@ word_t trans_regs_to_word(int first_register_num, int second_register_num, int m
     word_t opcode_num;
     opcode_num.oper = opcode_num.amethod_src_operand = opcode_num.amethod_dest_operand = opcode_num.memory = 0;
 
-    if ( (first_register_num < pow(2, WORD_MAX) && first_register_num > -pow(2, WORD_MAX)) ||  (second_register_num < pow(2, WORD_MAX) && second_register_num > -pow(2, WORD_MAX)) ) {
+    if ( (first_register_num < 1L << WORD_MAX && first_register_num > -(1L << WORD_MAX)) ||  (second_register_num < 1L << WORD_MAX && second_register_num > -(1L << WORD_MAX)) ) {
         int mask = 3; /* mask the last two bits */
 
         opcode_num.memory = (unsigned) memory_type;
@@ -259,7 +257,7 @@ word_t trans_regs_to_word(int first_register_num, int second_register_num, int m
 
 
     } else {
-        fprintf(stderr, "Number's size is bigger than the word size (10 bits). The opcode value returned is 0.\n");
+        fprintf(stderr, "Number's size is bigger than the word size (%d bits). The opcode value returned is 0.\n", WORD_MAX);
     }
 
     return opcode_num;
@@ -347,10 +345,12 @@ int is_register(char *str){
  *
  * @param char*     arg - The argument to encode
  * @param int       amethod - The addressing method.
+ * @param spill_table_t* spilled - The spilled segments of the context (see code_insert()).
  * @param word_t**  code_seg - The code segment to place the argument in.
  * @param int*      seg_size - The size of the code segment.
+ * @param int*      seg_capacity - The capacity of the code segment.
  */
-void encode_argument(char *arg, int amethod, char *additional_arg, int arg_count, word_t **code_seg, int *seg_size, table_of_signs *table_signs, int table_signs_size, data_table **ext_table, int *ext_table_size){
+void encode_argument(char *arg, int amethod, char *additional_arg, int arg_count, spill_table_t *spilled, word_t **code_seg, int *seg_size, int *seg_capacity, table_of_signs *table_signs, int table_signs_size, data_table **ext_table, int *ext_table_size, int *ext_table_capacity){
     word_t word_to_append;
     word_t sec_word_to_append; /* if need to encode another word, for matrices for example */
     int address, reg1_num, reg2_num, has_second_word = 0;
@@ -376,7 +376,7 @@ void encode_argument(char *arg, int amethod, char *additional_arg, int arg_count
                 word_to_append = trans_arg_to_word(address, E);
 
                 /* add the external label to the ext_table with the new address (which is the original IC) */
-                if ( ! update_ext_table(ext_table, ext_table_size, arg, ((*seg_size)+INITIAL_IC)) ) {
+                if ( ! update_ext_table(ext_table, ext_table_size, ext_table_capacity, arg, ((*seg_size)+INITIAL_IC)) ) {
                     return;
                 }
 
@@ -386,8 +386,8 @@ void encode_argument(char *arg, int amethod, char *additional_arg, int arg_count
             break;
         case MATRIX_ACCESS:
             mat_label = malloc((strlen(arg) * sizeof(char)) + 1);
-            reg1 = malloc(sizeof(char) * 3);
-            reg2 = malloc(sizeof(char) * 3);
+            reg1 = malloc(sizeof(char) * 4);
+            reg2 = malloc(sizeof(char) * 4);
             if ( !mat_label || !reg1 || !reg2 ) {
                 fprintf(stderr, "Error allocating memory\n");
                 return;
@@ -443,9 +443,9 @@ void encode_argument(char *arg, int amethod, char *additional_arg, int arg_count
 
     }
 
-    code_insert(code_seg, seg_size, word_to_append);
+    code_insert(spilled, code_seg, seg_size, seg_capacity, word_to_append);
     if ( has_second_word ) {
-        code_insert(code_seg, seg_size, sec_word_to_append);
+        code_insert(spilled, code_seg, seg_size, seg_capacity, sec_word_to_append);
     }
 
 }
@@ -473,7 +473,7 @@ int convert_to_base_four(int number){
 char *reverse_string(char *str){
     size_t i;
     int j;
-    char *temp = malloc(strlen(str) * sizeof(char));
+    char *temp = malloc((strlen(str) + 1) * sizeof(char));
 
     for ( i = strlen((str))-1, j = 0; i != -1; i--, j++ ) {
         temp[j] = str[i];
@@ -527,7 +527,7 @@ void convert_num_to_base_four_mozar(int num, char **p){
         i++;
     }
 
-    (*p) = realloc((*p), (sizeof(char) + 1));
+    (*p) = realloc((*p), (sizeof(char) * (i + 1)));
     (*p)[i] = '\0';
     temp = (*p);
     (*p) = reverse_string(*p);
@@ -535,44 +535,19 @@ void convert_num_to_base_four_mozar(int num, char **p){
 }
 
 /**
- * Convert a word (word type) to base 4 "mozar".
+ * Convert a word (word type) to base 4 "mozar", BASE_4_WORD_SIZE digits.
  *
  * @param word_t    word - The word to convert.
- * @param char**    p - Pointer that will point to the converted word at the end.
+ * @param char**    p - Pointer to the converted word, it should hold BASE_4_WORD_SIZE + 1 chars.
  */
 void convert_word_to_base_four_mozar(word_t word, char **p){
-    int mask = 3; /* mask the last two bits */
-    int num_to_convert; /* will hold the number that we gonna convert each time */
-    char *p1, *p2, *p3, *p4, *p5; /* these pointers point on each individual base 4 mozar char */
-
-    p1 = malloc(sizeof(char));
-    p2 = malloc(sizeof(char));
-    p3 = malloc(sizeof(char));
-    p4 = malloc(sizeof(char));
-    p5 = malloc(sizeof(char));
-
-    num_to_convert = word.oper & mask;
-    convert_num_to_base_four_mozar(num_to_convert, &p2);
-    word.oper >>= 2;
-
-    num_to_convert = word.oper & mask;
-    convert_num_to_base_four_mozar(num_to_convert, &p1);
-
-    convert_num_to_base_four_mozar(word.amethod_src_operand, &p3);
-    convert_num_to_base_four_mozar(word.amethod_dest_operand, &p4);
-    convert_num_to_base_four_mozar(word.memory, &p5);
-
-    strcat((*p), p1);
-    strcat((*p), p2);
-    strcat((*p), p3);
-    strcat((*p), p4);
-    strcat((*p), p5);
-
-    free(p1);
-    free(p2);
-    free(p3);
-    free(p4);
-    free(p5);
+    static const char mozar_digits[] = "abcd";
+    int num = word_to_int(word), i;
+
+    for ( i = BASE_4_WORD_SIZE - 1; i >= 0; i--, num >>= 2 ) { /* from the least significant digit */
+        (*p)[i] = mozar_digits[num & 3];
+    }
+    (*p)[BASE_4_WORD_SIZE] = '\0';
 }
 
 /**
@@ -587,4 +562,66 @@ void free_signs_names(table_of_signs *table_signs, int table_size){
     for ( i = 0; i < table_size; i++ ) {
         free(table_signs[i].label_name);
     }
-}
\ No newline at end of file
+}
+
+/**
+ * Free all names strings in an entry/extern table.
+ *
+ * @param data_table*   table - The table.
+ * @param int           table_size - The size of the table.
+ */
+void free_table_names(data_table *table, int table_size){
+    int i;
+
+    for ( i = 0; i < table_size; i++ ) {
+        free(table[i].label_name);
+    }
+}
+
+/**
+ * Hash a string (djb2).
+ *
+ * @param char*     str - The string to hash.
+ *
+ * @return unsigned int - The hash value.
+ */
+unsigned int hash_string(const char *str){
+    unsigned int hash = 5381;
+
+    while ( *str ) {
+        hash = hash * 33 + (unsigned char) *str++;
+    }
+
+    return hash;
+}
+
+/**
+ * Make sure an array has room for at least "needed" items, its capacity is doubled when it's full.
+ *
+ * @param void**    array - Pointer to the array, could point to NULL.
+ * @param int*      capacity - The number of items the array has room for.
+ * @param int       needed - The number of items we need room for.
+ * @param size_t    item_size - The size of a single item.
+ *
+ * @return int - 1 if everything went OK, 0 on memory error (the array is left as is).
+ */
+int ensure_capacity(void **array, int *capacity, int needed, size_t item_size){
+    int new_capacity = *capacity > 0 ? *capacity : 8;
+    void *temp;
+
+    if ( needed <= *capacity && *array ) {
+        return 1;
+    }
+
+    while ( new_capacity < needed ) {
+        new_capacity *= 2;
+    }
+
+    if ( !(temp = realloc(*array, new_capacity * item_size)) ) {
+        return 0;
+    }
+    *array = temp;
+    *capacity = new_capacity;
+
+    return 1;
+}
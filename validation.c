@@ -1,7 +1,6 @@
 #include <stdio.h>
 #include <ctype.h>
 #include <string.h>
-#include <math.h>
 #include <stdlib.h>
 #include "header.h"
 
@@ -78,6 +77,8 @@ static int check_operation(char op[LINE_MAX]) {
 		return ENTRY;
 	if ( strcmp(op, ".extern") == 0 ) /* if the operation is: ".extern" */
 		return EXTERN;
+	if ( strcmp(op, ".define") == 0 ) /* if the operation is: ".define" */
+		return DEFINE;
 
 	for ( i = 0; i < NUM_OF_OPERATIONS; i++ ) { /* check if word is a command operation */
         if ( strcmp(op, valid_operations[i].oper_name ) == 0) { /* the operation was found */
@@ -100,7 +101,7 @@ int is_valid_matrix_access_form(char *arg){
     int first_par_flag = 0; /* this will tell us if we are after the first parenthesis checks */
     int open_pars_counter = 0; /* count the number of parenthesis */
     size_t arg_len = strlen(arg);
-    char *extracted_label = malloc(sizeof(char) * arg_len), *first_reg, *second_reg;
+    char *extracted_label = malloc(sizeof(char) * (arg_len + 1)), *first_reg, *second_reg;
 
     extract_mat_label(arg, &extracted_label);
     if ( !strlen(extracted_label) || !check_word(extracted_label, LABEL) ) { /* check for label validity */
@@ -109,8 +110,8 @@ int is_valid_matrix_access_form(char *arg){
     }
 
     free(extracted_label);
-    first_reg = malloc(sizeof(char) * 3);
-    second_reg = malloc(sizeof(char) * 3);
+    first_reg = malloc(sizeof(char) * 4);
+    second_reg = malloc(sizeof(char) * 4);
 
     for ( i = 0; i < arg_len; i++ ) {
         if ( arg[i] == '[' && !first_par_flag ) {
@@ -162,10 +163,10 @@ int is_valid_matrix_access_form(char *arg){
  */
 static int check_argument(char arg[LINE_MAX]){
     if ( arg[0] == '#' ) {
-        if ( !num_isvalid(arg+1) ) { /* if the rest of the number isn't valid - error*/
-            return -1;
+        if ( !num_isvalid(arg+1) ) { /* not a number, it could be a constant expression (folded in the second scan) */
+            return is_valid_expression(arg+1) ? IMMEDIATE : -1;
         }
-        if ( atoi(arg+1) > pow(2, 8) || atoi(arg+1) < -pow(2, 8)){ /* if the immediate number exceed the bunderies of 8 bits */
+        if ( !is_immediate_in_range(atoi(arg+1)) ){ /* if the immediate number exceed the bunderies of 8 bits */
             return -1;
         }
 
@@ -204,6 +205,16 @@ int check_word(char word[LINE_MAX], int type){
 
 }
 
+/**
+ * Check if an immediate number fits in its operand word.
+ *
+ * @param int   num - The number.
+ * @return int - 1 if it's in range, 0 otherwise.
+ */
+int is_immediate_in_range(int num){
+    return num <= 1 << VALUE_BITS && num >= -(1 << VALUE_BITS);
+}
+
 /**
  * Check if the argument is valid number.
  *
@@ -223,7 +234,6 @@ int num_isvalid(char *arg){
 
     for ( i = 1; i < strlen(arg); i++ ) { /* the other string must be digits */
         if ( !isdigit(arg[i]) ) { /* if there is a character that is not a digit */
-            printf("**%i", arg[i]);
             return 0;
         }
     }
@@ -359,8 +369,8 @@ int is_address_valid(int oper, int src_operand, int dest_operand){
                 return 0; /* arg1 present || arg2 present */
             break;
 
-        default:
-            break;
+        default: /* a code of a wider operation field that no operation has */
+            return 0;
     }
 
     return 1;
@@ -405,4 +415,4 @@ int is_label_defined(char *label, int addressing_method, table_of_signs *signs_t
         default:
             return 1;
     }
-}
\ No newline at end of file
+}
\ No newline at end of file
@@ -0,0 +1,258 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+#include "header.h"
+
+/*
+ * The watch mode (--watch file1 file2 ...). Assembles the files once, and then waits for inotify to tell
+ * that one of them was saved, and assembles only that file again, until SIGINT or SIGTERM. The process
+ * stays up between the builds: every file keeps its own assembler context (so the tables and the buffers
+ * it grew are reused) and the buffer its source is read to. The last good version of the source is kept too,
+ * so a file whose edit only changed instructions is patched instead of assembled (see incremental.c). The
+ * output files are written under temporary names and renamed when they're complete (see open_output()), so
+ * a tool that reads them never sees half a file. A build that has errors leaves the outputs of the last good
+ * build as they are.
+ *
+ * The directories of the files are watched rather than the files, since an editor that saves by writing
+ * a new file and renaming it over the old one would end a watch on the file itself.
+ */
+
+#define EVENTS_BUFFER_SIZE 4096
+
+/* a watched source */
+typedef struct{
+    char *base_name; /* the file name without extension, as it was given */
+    char *source_name; /* base_name + ".as" */
+    const char *entry_name; /* the name of the source in its directory, points into source_name */
+    int directory; /* the watch of the directory of the source */
+    int changed; /* 1 if it was saved since the last build */
+    assembler_t as;
+    char *source; /* the text of the source, kept between the builds */
+    int source_capacity;
+    char *previous; /* the text of the last build, when it had no diagnostics, so it can be patched */
+    int previous_capacity;
+    long previous_length;
+    int patchable; /* 1 if the assembler context holds the assembly of "previous" */
+} watched_file_t;
+
+/**
+ * Read the whole source of a watched file to its buffer.
+ *
+ * @param watched_file_t*   file - The file.
+ * @param long*             length - Will hold the length of the source at the end.
+ *
+ * @return int - 1 if everything went OK, 0 if the file couldn't be read.
+ */
+static int read_source(watched_file_t *file, long *length){
+    FILE *fp;
+    size_t chunk;
+
+    if ( !(fp = fopen(file->source_name, "r")) ) {
+        fprintf(stderr, "Cannot open file: %s\n", file->source_name);
+        return 0;
+    }
+
+    *length = 0;
+    do {
+        if ( !ensure_capacity((void **) &file->source, &file->source_capacity, (int) *length + EVENTS_BUFFER_SIZE, sizeof(char)) ) {
+            fprintf(stderr, "Cannot allocate memory.\n");
+            fclose(fp);
+            return 0;
+        }
+        chunk = fread(file->source + *length, 1, (size_t) (file->source_capacity - *length), fp);
+        *length += (long) chunk;
+    } while ( chunk > 0 );
+    fclose(fp);
+
+    return 1;
+}
+
+/**
+ * Assemble a watched file and write its outputs, the same way assemble() does.
+ *
+ * @param watched_file_t*   file - The file.
+ *
+ * @return int - 0 if everything went OK, 1 if the source has errors, 2 on a fatal error (memory / output files).
+ */
+static int build(watched_file_t *file){
+    struct timespec start, end;
+    output_counts_t before = output_counts;
+    char *swap;
+    long length;
+    int status, patched, clean, capacity;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    if ( !read_source(file, &length) ) {
+        return 2;
+    }
+    file->as.settings = settings;
+    status = assemble_incremental(&file->as, file->patchable ? file->previous : NULL, (size_t) file->previous_length,
+                                  file->source, (size_t) length, &patched);
+    clean = file->as.diag.size == 0;
+    diag_flush(&file->as.diag, file->source_name, file->as.settings.diag_format, stderr);
+    if ( status == 0 ) {
+        status = write_outputs(&file->as, file->base_name);
+    }
+
+    /* the source of a clean build is the base of the next patch */
+    if ( (file->patchable = status == 0 && clean) ) {
+        swap = file->previous;
+        file->previous = file->source;
+        file->source = swap;
+        capacity = file->previous_capacity;
+        file->previous_capacity = file->source_capacity;
+        file->source_capacity = capacity;
+        file->previous_length = length;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("INFO: %s was %s in %.2f ms%s, %d output files written, %d unchanged.\n", file->source_name,
+           patched ? "patched" : "assembled", (end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_nsec - start.tv_nsec) / 1000000.0,
+           status ? " with errors" : "", output_counts.written - before.written, output_counts.unchanged - before.unchanged);
+    fflush(stdout);
+    fflush(stderr);
+
+    return status;
+}
+
+#ifdef __linux__
+/**
+ * Watch the directory of a source.
+ *
+ * @param int               fd - The inotify instance.
+ * @param watched_file_t*   file - The file, its names are set.
+ *
+ * @return int - 1 if everything went OK, 0 if the directory can't be watched.
+ */
+static int watch_directory(int fd, watched_file_t *file){
+    const char *slash = strrchr(file->source_name, '/');
+    char *directory;
+
+    file->entry_name = slash ? slash + 1 : file->source_name;
+    if ( !(directory = malloc(strlen(file->source_name) + 2)) ) {
+        fprintf(stderr, "Cannot allocate memory.\n");
+        return 0;
+    }
+    if ( slash ) {
+        sprintf(directory, "%.*s", (int) (slash - file->source_name) + 1, file->source_name); /* keeps "/" for the root */
+    } else {
+        strcpy(directory, ".");
+    }
+
+    /* a directory that is watched already gets the same watch back */
+    if ( (file->directory = inotify_add_watch(fd, directory, IN_CLOSE_WRITE | IN_MOVED_TO)) < 0 ) {
+        fprintf(stderr, "Cannot watch %s: %s\n", directory, strerror(errno));
+    }
+    free(directory);
+
+    return file->directory >= 0;
+}
+#endif
+
+/**
+ * Assemble the files, and assemble every file again when it's saved, until SIGINT or SIGTERM.
+ *
+ * @param int       count - The number of files.
+ * @param char**    base_names - The file names without the .as extension.
+ *
+ * @return int - 0 if the watch stopped normally, 1 otherwise.
+ */
+int watch(int count, char *base_names[]){
+#ifdef __linux__
+    struct inotify_event *event;
+    long buffer[EVENTS_BUFFER_SIZE / sizeof(long)]; /* aligned for the events */
+    watched_file_t *files;
+    char *p;
+    ssize_t length;
+    int fd, i, built, ok = 1;
+
+    if ( count == 0 ) {
+        fprintf(stderr, "Missing file names after --watch\n");
+        return 1;
+    }
+    if ( (fd = inotify_init()) < 0 ) {
+        fprintf(stderr, "Cannot start inotify: %s\n", strerror(errno));
+        return 1;
+    }
+    if ( !(files = calloc((size_t) count, sizeof(watched_file_t))) ) {
+        fprintf(stderr, "Cannot allocate memory.\n");
+        close(fd);
+        return 1;
+    }
+
+    for ( i = 0; i < count; i++ ) {
+        assembler_init(&files[i].as);
+        files[i].as.incremental = 1;
+    }
+    for ( i = 0; ok && i < count; i++ ) {
+        files[i].base_name = base_names[i];
+        if ( !(files[i].source_name = malloc(strlen(base_names[i]) + 4)) ) {
+            fprintf(stderr, "Cannot allocate memory.\n");
+            ok = 0;
+            break;
+        }
+        sprintf(files[i].source_name, "%s.as", base_names[i]);
+        ok = watch_directory(fd, &files[i]);
+    }
+
+    catch_stop_signals(); /* read() returns when we should stop */
+
+    for ( i = 0; ok && i < count; i++ ) {
+        files[i].changed = 1;
+    }
+
+    while ( ok && !stop_was_requested() ) {
+        for ( built = 0, i = 0; i < count; i++ ) {
+            if ( files[i].changed ) {
+                files[i].changed = 0;
+                build(&files[i]);
+                built++;
+            }
+        }
+        if ( built ) { /* the events of the outputs (and of the other files in the directories) build nothing */
+            printf("INFO: watching %d files.\n", count);
+            fflush(stdout);
+        }
+
+        if ( (length = read(fd, buffer, sizeof(buffer))) < 0 ) {
+            if ( errno != EINTR ) {
+                fprintf(stderr, "Cannot read the inotify events: %s\n", strerror(errno));
+                ok = 0;
+            }
+            continue;
+        }
+
+        /* a save could come as more than one event, every file that was saved is built once */
+        for ( p = (char *) buffer; p < (char *) buffer + length; p += sizeof(struct inotify_event) + event->len ) {
+            event = (struct inotify_event *) p;
+            for ( i = 0; event->len && i < count; i++ ) {
+                if ( event->wd == files[i].directory && strcmp(event->name, files[i].entry_name) == 0 ) {
+                    files[i].changed = 1;
+                }
+            }
+        }
+    }
+
+    for ( i = 0; i < count; i++ ) {
+        assembler_free(&files[i].as);
+        free(files[i].source_name);
+        free(files[i].source);
+        free(files[i].previous);
+    }
+    free(files);
+    close(fd);
+
+    return !ok;
+#else
+    fprintf(stderr, "--watch needs inotify, it's available on Linux only.\n");
+    return 1;
+#endif
+}